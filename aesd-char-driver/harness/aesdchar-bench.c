@@ -0,0 +1,156 @@
+/**
+ * @file aesdchar-bench.c
+ * @brief Multi-threaded throughput of the aesdchar read/write paths
+ * @usage ./aesdchar-bench [-t threads] [-s seconds] [-l line_bytes] [-r read_percent]
+ *                         [-p parts]
+ *        Each thread repeatedly either writes one line of line_bytes
+ *        (default 64) in parts write() calls (default 1), or reads the whole
+ *        device from offset 0, choosing a read read_percent (default 50) of
+ *        the time.  Prints operations/s and MB/s per direction.  Run under
+ *        perf record, or build with -DAESDCHAR_SANITIZE=thread/address.
+ * @author Jake Michael
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "aesdchar-harness.h"
+#include "aesd-circular-buffer.h"
+
+struct bench_thread {
+  pthread_t thread;
+  unsigned int seed;
+  unsigned long reads;
+  unsigned long writes;
+  unsigned long long read_bytes;
+  unsigned long long write_bytes;
+  int errors;
+};
+
+static size_t line_bytes = 64;
+static unsigned int parts = 1;
+static unsigned int read_percent = 50;
+static volatile int stop_flag;
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *bench_thread(void *arg)
+{
+  struct bench_thread *t = (struct bench_thread *) arg;
+  size_t bufsize = line_bytes * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * 2;
+  char *line = malloc(line_bytes);
+  char *buf = malloc(bufsize);
+  struct file filp;
+  size_t part;
+  size_t off;
+  ssize_t n;
+
+  if (line == NULL || buf == NULL || aesd_harness_open(&filp) != 0) {
+    t->errors++;
+    goto handle_errors;
+  }
+  memset(line, 'a' + (t->seed % 26), line_bytes - 1);
+  line[line_bytes - 1] = '\n';
+  part = (line_bytes + parts - 1) / parts;
+
+  while (!__atomic_load_n(&stop_flag, __ATOMIC_RELAXED)) {
+    if ((unsigned int) (rand_r(&t->seed) % 100) < read_percent) {
+      filp.f_pos = 0;
+      while ((n = aesd_harness_read(&filp, buf, bufsize)) > 0) {
+        t->read_bytes += n;
+      }
+      if (n < 0)
+        t->errors++;
+      t->reads++;
+    } else {
+      for (off = 0; off < line_bytes; off += part) {
+        n = aesd_harness_write(&filp, line + off, off + part < line_bytes ? part : line_bytes - off);
+        if (n < 0)
+          t->errors++;
+        else
+          t->write_bytes += n;
+      }
+      t->writes++;
+    }
+  }
+  aesd_harness_release(&filp);
+
+handle_errors:
+  free(line);
+  free(buf);
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned int nthreads = 4;
+  double seconds = 2.0;
+  struct bench_thread *threads;
+  struct bench_thread total = { 0 };
+  double start;
+  double elapsed;
+  unsigned int i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:s:l:r:p:")) != -1) {
+    switch (opt) {
+      case 't': nthreads = (unsigned int) strtoul(optarg, NULL, 0); break;
+      case 's': seconds = atof(optarg); break;
+      case 'l': line_bytes = strtoul(optarg, NULL, 0); break;
+      case 'r': read_percent = (unsigned int) strtoul(optarg, NULL, 0); break;
+      case 'p': parts = (unsigned int) strtoul(optarg, NULL, 0); break;
+      default:
+        printf("Usage: %s [-t threads] [-s seconds] [-l line_bytes] [-r read_percent] "
+               "[-p parts]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (nthreads == 0 || line_bytes < 2 || parts == 0 || parts > line_bytes) {
+    printf("aesdchar-bench: invalid arguments\n");
+    return 1;
+  }
+
+  threads = calloc(nthreads, sizeof(struct bench_thread));
+  if (threads == NULL || aesd_harness_load() != 0) {
+    printf("aesdchar-bench: cannot load the device\n");
+    return 1;
+  }
+
+  start = now_seconds();
+  for (i = 0; i < nthreads; i++) {
+    threads[i].seed = i + 1;
+    pthread_create(&threads[i].thread, NULL, bench_thread, &threads[i]);
+  }
+  usleep((useconds_t) (seconds * 1e6));
+  __atomic_store_n(&stop_flag, 1, __ATOMIC_RELAXED);
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(threads[i].thread, NULL);
+    total.reads += threads[i].reads;
+    total.writes += threads[i].writes;
+    total.read_bytes += threads[i].read_bytes;
+    total.write_bytes += threads[i].write_bytes;
+    total.errors += threads[i].errors;
+  }
+  elapsed = now_seconds() - start;
+  aesd_harness_unload();
+
+  printf("%u threads, %zu byte lines in %u parts, %u%% reads, %.2f s\n", nthreads,
+         line_bytes, parts, read_percent, elapsed);
+  printf("writes: %10.0f lines/s %8.2f MB/s\n", total.writes / elapsed,
+         total.write_bytes / elapsed / 1e6);
+  printf("reads:  %10.0f scans/s %8.2f MB/s\n", total.reads / elapsed,
+         total.read_bytes / elapsed / 1e6);
+  free(threads);
+  if (total.errors) {
+    printf("aesdchar-bench: %d errors\n", total.errors);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,360 @@
+/**
+ * @file aesdchar-cuse.c
+ * @brief /dev/aesdchar served from userspace through CUSE
+ * @usage ./aesdchar-cuse [-n devname] [-t threads] [-M major] [-m minor]
+ *        Creates /dev/<devname> (default aesdchar, major/minor allocated
+ *        unless given) backed by the driver's own aesd_read/aesd_write,
+ *        built through the harness, so aesdsocket with USE_AESD_CHAR_DEVICE
+ *        runs end to end without loading the module.  Requests are handled
+ *        by threads (default 1) reading /dev/cuse concurrently.  Runs in the
+ *        foreground until SIGINT or SIGTERM; the device goes away with the
+ *        process.  Needs /dev/cuse (the cuse module) and the right to open it,
+ *        usually root.
+ *
+ *        The CUSE protocol is spoken directly over /dev/cuse, no libfuse.
+ *        CUSE opens files as non-seekable and never passes a file position,
+ *        so each open keeps its own position here, advanced by reads as the
+ *        driver's f_pos is.  The driver has no llseek either, so both return
+ *        ESPIPE on lseek() and rereading means reopening, as aesdsocket does.
+ *
+ * @author Jake Michael
+ * @resources
+ * (+)  include/uapi/linux/fuse.h and fs/fuse/cuse.c of the kernel
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <linux/fuse.h>
+#include "aesdchar-harness.h"
+
+#define CUSE_DEVICE "/dev/cuse"
+// largest read or write passed in one request
+#define MAX_IO (128 * 1024)
+// a request is its headers followed by at most MAX_IO bytes of data
+#define REQUEST_BUF_SIZE (MAX_IO + 4096)
+
+// state of one open() of the device, its address is the fuse file handle
+struct cuse_open {
+  struct file filp;
+  pthread_mutex_t lock;       // serializes requests on the same handle
+};
+
+static int cuse_fd = -1;
+static volatile sig_atomic_t abort_flag = 0;
+
+static void signal_handler(int signo)
+{
+  abort_flag = 1;
+}
+
+/*
+ * @brief  sends the reply to request unique, error is 0 or a negative errno
+ * @return 0 on success, -1 on error
+ */
+static int send_reply(uint64_t unique, int error, const void *data, size_t len)
+{
+  struct fuse_out_header out;
+  struct iovec iov[2];
+  ssize_t written;
+
+  out.len = sizeof(out) + len;
+  out.error = error;
+  out.unique = unique;
+  iov[0].iov_base = &out;
+  iov[0].iov_len = sizeof(out);
+  iov[1].iov_base = (void *) data;
+  iov[1].iov_len = len;
+
+  // the reply must be a single write
+  written = writev(cuse_fd, iov, len ? 2 : 1);
+  if (written == -1) {
+    // ENOENT: the request was interrupted and is gone, not an error
+    if (errno != ENOENT) {
+      perror("writev /dev/cuse");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void do_init(const struct fuse_in_header *in, const struct cuse_init_in *arg,
+                    const char *devname, uint32_t dev_major, uint32_t dev_minor)
+{
+  char reply[sizeof(struct cuse_init_out) + 128];
+  struct cuse_init_out *out = (struct cuse_init_out *) reply;
+  int infolen;
+
+  if (arg->major != FUSE_KERNEL_VERSION) {
+    fprintf(stderr, "aesdchar-cuse: kernel protocol %u.%u, need %u.x\n", arg->major,
+            arg->minor, FUSE_KERNEL_VERSION);
+    send_reply(in->unique, -EPROTO, NULL, 0);
+    return;
+  }
+  memset(out, 0, sizeof(*out));
+  out->major = FUSE_KERNEL_VERSION;
+  out->minor = FUSE_KERNEL_MINOR_VERSION;
+  out->max_read = MAX_IO;
+  out->max_write = MAX_IO;
+  out->dev_major = dev_major;
+  out->dev_minor = dev_minor;
+  // device info follows as NUL separated KEY=value strings
+  infolen = snprintf(reply + sizeof(*out), sizeof(reply) - sizeof(*out), "DEVNAME=%s",
+                     devname);
+  send_reply(in->unique, 0, reply, sizeof(*out) + infolen + 1);
+}
+
+static void do_open(const struct fuse_in_header *in)
+{
+  struct fuse_open_out out;
+  struct cuse_open *o = malloc(sizeof(*o));
+  int rc;
+
+  if (o == NULL) {
+    send_reply(in->unique, -ENOMEM, NULL, 0);
+    return;
+  }
+  rc = aesd_harness_open(&o->filp);
+  if (rc != 0) {
+    free(o);
+    send_reply(in->unique, rc, NULL, 0);
+    return;
+  }
+  pthread_mutex_init(&o->lock, NULL);
+  memset(&out, 0, sizeof(out));
+  out.fh = (uint64_t) (uintptr_t) o;
+  out.open_flags = FOPEN_DIRECT_IO;
+  send_reply(in->unique, 0, &out, sizeof(out));
+}
+
+static void do_read(const struct fuse_in_header *in, const struct fuse_read_in *arg,
+                    char *buf)
+{
+  struct cuse_open *o = (struct cuse_open *) (uintptr_t) arg->fh;
+  size_t size = arg->size < MAX_IO ? arg->size : MAX_IO;
+  ssize_t n;
+
+  pthread_mutex_lock(&o->lock);
+  n = aesd_harness_read(&o->filp, buf, size);
+  pthread_mutex_unlock(&o->lock);
+  if (n < 0) {
+    send_reply(in->unique, (int) n, NULL, 0);
+  } else {
+    send_reply(in->unique, 0, buf, n);
+  }
+}
+
+static void do_write(const struct fuse_in_header *in, const struct fuse_write_in *arg)
+{
+  struct cuse_open *o = (struct cuse_open *) (uintptr_t) arg->fh;
+  struct fuse_write_out out;
+  ssize_t n;
+
+  if (in->len < sizeof(*in) + sizeof(*arg) + arg->size) {
+    send_reply(in->unique, -EINVAL, NULL, 0);
+    return;
+  }
+  pthread_mutex_lock(&o->lock);
+  n = aesd_harness_write(&o->filp, (const char *) (arg + 1), arg->size);
+  pthread_mutex_unlock(&o->lock);
+  if (n < 0) {
+    send_reply(in->unique, (int) n, NULL, 0);
+    return;
+  }
+  memset(&out, 0, sizeof(out));
+  out.size = (uint32_t) n;
+  send_reply(in->unique, 0, &out, sizeof(out));
+}
+
+static void do_release(const struct fuse_in_header *in, const struct fuse_release_in *arg)
+{
+  struct cuse_open *o = (struct cuse_open *) (uintptr_t) arg->fh;
+
+  aesd_harness_release(&o->filp);
+  pthread_mutex_destroy(&o->lock);
+  free(o);
+  send_reply(in->unique, 0, NULL, 0);
+}
+
+/*
+ * @brief  handles one request read from /dev/cuse
+ */
+static void handle_request(char *req, size_t len, char *buf)
+{
+  const struct fuse_in_header *in = (const struct fuse_in_header *) req;
+  const void *arg = req + sizeof(*in);
+
+  if (len < sizeof(*in) || in->len != len) {
+    fprintf(stderr, "aesdchar-cuse: short request\n");
+    return;
+  }
+
+  switch (in->opcode) {
+    case FUSE_OPEN:
+      do_open(in);
+      break;
+    case FUSE_READ:
+      do_read(in, (const struct fuse_read_in *) arg, buf);
+      break;
+    case FUSE_WRITE:
+      do_write(in, (const struct fuse_write_in *) arg);
+      break;
+    case FUSE_RELEASE:
+      do_release(in, (const struct fuse_release_in *) arg);
+      break;
+    case FUSE_FLUSH:
+    case FUSE_FSYNC:
+      send_reply(in->unique, 0, NULL, 0);
+      break;
+    case FUSE_INTERRUPT:
+      // requests complete without blocking, nothing to interrupt and no reply
+      break;
+    case FUSE_IOCTL:
+      send_reply(in->unique, -ENOTTY, NULL, 0);
+      break;
+    default:
+      send_reply(in->unique, -ENOSYS, NULL, 0);
+      break;
+  }
+}
+
+/*
+ * @brief  reads and handles requests until the device goes away or a
+ *         signal asks us to stop
+ */
+static void *serve_thread(void *arg)
+{
+  char *req = malloc(REQUEST_BUF_SIZE);
+  char *buf = malloc(MAX_IO);
+  ssize_t len;
+
+  if (req == NULL || buf == NULL) {
+    fprintf(stderr, "aesdchar-cuse: malloc fail\n");
+    goto handle_errors;
+  }
+  while (!abort_flag) {
+    len = read(cuse_fd, req, REQUEST_BUF_SIZE);
+    if (len == -1) {
+      // ENOENT: an interrupted request was dropped before we read it
+      if (errno == EINTR || errno == EAGAIN || errno == ENOENT)
+        continue;
+      if (errno != ENODEV)
+        perror("read /dev/cuse");
+      break;
+    }
+    handle_request(req, len, buf);
+  }
+
+handle_errors:
+  free(req);
+  free(buf);
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  const char *devname = "aesdchar";
+  unsigned int nthreads = 1;
+  uint32_t dev_major = 0;
+  uint32_t dev_minor = 0;
+  char *req = NULL;
+  pthread_t *threads = NULL;
+  const struct fuse_in_header *in;
+  struct sigaction sa;
+  ssize_t len;
+  unsigned int i;
+  int opt;
+  int rc = 1;
+
+  while ((opt = getopt(argc, argv, "n:t:M:m:")) != -1) {
+    switch (opt) {
+      case 'n': devname = optarg; break;
+      case 't': nthreads = (unsigned int) strtoul(optarg, NULL, 0); break;
+      case 'M': dev_major = (uint32_t) strtoul(optarg, NULL, 0); break;
+      case 'm': dev_minor = (uint32_t) strtoul(optarg, NULL, 0); break;
+      default:
+        printf("Usage: %s [-n devname] [-t threads] [-M major] [-m minor]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (nthreads == 0) {
+    nthreads = 1;
+  }
+
+  // no SA_RESTART, so a signal interrupts the blocking read of /dev/cuse
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = signal_handler;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  if (aesd_harness_load() != 0) {
+    fprintf(stderr, "aesdchar-cuse: cannot initialize the device\n");
+    return 1;
+  }
+
+  cuse_fd = open(CUSE_DEVICE, O_RDWR | O_CLOEXEC);
+  if (cuse_fd == -1) {
+    fprintf(stderr, "aesdchar-cuse: %s: %s (is the cuse module loaded?)\n", CUSE_DEVICE,
+            strerror(errno));
+    goto handle_errors;
+  }
+
+  // the first request is always CUSE_INIT, the device exists once it is answered
+  req = malloc(REQUEST_BUF_SIZE);
+  if (req == NULL) {
+    goto handle_errors;
+  }
+  do {
+    len = read(cuse_fd, req, REQUEST_BUF_SIZE);
+  } while (len == -1 && errno == EINTR && !abort_flag);
+  in = (const struct fuse_in_header *) req;
+  if (len < (ssize_t) (sizeof(*in) + sizeof(struct cuse_init_in)) || in->opcode != CUSE_INIT) {
+    fprintf(stderr, "aesdchar-cuse: expected CUSE_INIT from %s\n", CUSE_DEVICE);
+    goto handle_errors;
+  }
+  do_init(in, (const struct cuse_init_in *) (req + sizeof(*in)), devname, dev_major,
+          dev_minor);
+  fprintf(stderr, "aesdchar-cuse: serving /dev/%s with %u threads\n", devname, nthreads);
+
+  // signals go to the main thread only, which then takes the process down
+  threads = calloc(nthreads, sizeof(pthread_t));
+  if (threads == NULL) {
+    goto handle_errors;
+  }
+  for (i = 1; i < nthreads; i++) {
+    sigset_t set;
+    int err;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    err = pthread_create(&threads[i], NULL, serve_thread, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    // rather than serve with fewer threads than asked for, exiting takes
+    // the ones started down with the device
+    if (err != 0) {
+      fprintf(stderr, "aesdchar-cuse: cannot start thread %u of %u: %s\n", i + 1,
+              nthreads, strerror(err));
+      goto handle_errors;
+    }
+  }
+  serve_thread(NULL);
+  rc = 0;
+
+  // the other threads may be blocked in read(), exiting ends them with the
+  // device, so neither they nor the driver state are torn down one by one
+
+handle_errors:
+  free(req);
+  free(threads);
+  if (cuse_fd != -1)
+    close(cuse_fd);
+  return rc;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file aesdchar-harness.c
+ * @brief Drives the aesdchar driver's file operations from userspace
+ * @author Jake Michael
+ */
+
+#include "aesdchar-harness.h"
+#include "aesdchar.h"
+
+// defined by main.c
+extern struct aesd_dev aesd_device;
+int aesd_init_module(void);
+void aesd_cleanup_module(void);
+
+// what the VFS would find for /dev/aesdchar
+static struct inode aesd_inode = { .i_cdev = &aesd_device.cdev };
+
+int aesd_harness_load(void)
+{
+  return aesd_init_module();
+}
+
+void aesd_harness_unload(void)
+{
+  aesd_cleanup_module();
+}
+
+int aesd_harness_open(struct file *filp)
+{
+  memset(filp, 0, sizeof(*filp));
+  filp->f_inode = &aesd_inode;
+  return aesd_device.cdev.ops->open(&aesd_inode, filp);
+}
+
+int aesd_harness_release(struct file *filp)
+{
+  return aesd_device.cdev.ops->release(filp->f_inode, filp);
+}
+
+ssize_t aesd_harness_read(struct file *filp, void *buf, size_t count)
+{
+  return aesd_device.cdev.ops->read(filp, buf, count, &filp->f_pos);
+}
+
+ssize_t aesd_harness_write(struct file *filp, const void *buf, size_t count)
+{
+  return aesd_device.cdev.ops->write(filp, buf, count, &filp->f_pos);
+}
@@ -0,0 +1,51 @@
+/**
+ * @file aesdchar-harness.h
+ * @brief Drives the aesdchar driver's file operations from userspace
+ *
+ * The driver sources are linked in unmodified against the kernel shim in
+ * shim/, and these calls stand in for the VFS: each aesd_harness_open()
+ * is one open file with its own file position, and read/write pass
+ * &filp->f_pos to the driver as vfs_read()/vfs_write() do.  Any number of
+ * threads may use the device at once, each with its own struct file, the
+ * same as processes sharing /dev/aesdchar.
+ *
+ * @author Jake Michael
+ */
+
+#ifndef AESDCHAR_HARNESS_H
+#define AESDCHAR_HARNESS_H
+
+#include <linux/fs.h>
+
+/**
+ * Runs the driver's module init.
+ * @return 0 on success, else the negative errno of aesd_init_module()
+ */
+int aesd_harness_load(void);
+
+/**
+ * Runs the driver's module exit, freeing everything the device holds.
+ */
+void aesd_harness_unload(void);
+
+/**
+ * Opens the device into @param filp.
+ * @return 0 on success, else a negative errno
+ */
+int aesd_harness_open(struct file *filp);
+
+int aesd_harness_release(struct file *filp);
+
+/**
+ * read(2) on @param filp.
+ * @return bytes read, 0 at the end of the data, or a negative errno
+ */
+ssize_t aesd_harness_read(struct file *filp, void *buf, size_t count);
+
+/**
+ * write(2) on @param filp.
+ * @return bytes written or a negative errno
+ */
+ssize_t aesd_harness_write(struct file *filp, const void *buf, size_t count);
+
+#endif /* AESDCHAR_HARNESS_H */
@@ -0,0 +1,211 @@
+/**
+ * @file aesdchar-test.c
+ * @brief Tests of the aesdchar read/write semantics through the harness
+ *
+ * Each test loads a fresh device.  The concurrent test has writer threads
+ * appending whole lines while reader threads read the device end to end;
+ * every read must see only complete lines, and the device must end up
+ * holding the last AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED of them.  Build
+ * with -DAESDCHAR_SANITIZE=thread or address to check the driver's locking
+ * and memory handling as well.
+ *
+ * @author Jake Michael
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include "aesdchar-harness.h"
+#include "aesd-circular-buffer.h"
+
+#define WRITERS (4)
+#define READERS (2)
+#define LINES_PER_WRITER (2000)
+#define LINE_LEN (16)
+#define DEVICE_MAX (AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * 64)
+
+static int failures;
+
+#define CHECK(cond) do {                                              \
+    if (!(cond)) {                                                    \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);              \
+    }                                                                 \
+  } while (0)
+
+/*
+ * @brief  reads filp from its position to the end of the data
+ * @return the number of bytes read into buf, or -1 on error
+ */
+static ssize_t read_all(struct file *filp, char *buf, size_t size, size_t chunk)
+{
+  size_t total = 0;
+  ssize_t n;
+
+  while (total < size) {
+    n = aesd_harness_read(filp, buf + total, chunk < size - total ? chunk : size - total);
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      break;
+    total += n;
+  }
+  return total;
+}
+
+static void test_partial_write(void)
+{
+  struct file filp;
+  char buf[64];
+
+  CHECK(aesd_harness_load() == 0);
+  CHECK(aesd_harness_open(&filp) == 0);
+
+  // nothing is readable until the newline completes the command
+  CHECK(aesd_harness_write(&filp, "abc", 3) == 3);
+  CHECK(read_all(&filp, buf, sizeof(buf), sizeof(buf)) == 0);
+  CHECK(aesd_harness_write(&filp, "def\n", 4) == 4);
+  filp.f_pos = 0;
+  CHECK(read_all(&filp, buf, sizeof(buf), sizeof(buf)) == 7);
+  CHECK(memcmp(buf, "abcdef\n", 7) == 0);
+
+  CHECK(aesd_harness_release(&filp) == 0);
+  aesd_harness_unload();
+}
+
+static void test_overwrite_oldest(void)
+{
+  struct file filp;
+  char expected[256] = "";
+  char line[32];
+  char buf[256];
+  int i;
+
+  CHECK(aesd_harness_load() == 0);
+  CHECK(aesd_harness_open(&filp) == 0);
+
+  for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 2; i++) {
+    snprintf(line, sizeof(line), "write%d\n", i);
+    CHECK(aesd_harness_write(&filp, line, strlen(line)) == (ssize_t) strlen(line));
+    if (i >= 2)
+      strcat(expected, line);
+  }
+
+  // reads stop at entry boundaries, so try whole and byte at a time
+  filp.f_pos = 0;
+  CHECK(read_all(&filp, buf, sizeof(buf), sizeof(buf)) == (ssize_t) strlen(expected));
+  CHECK(memcmp(buf, expected, strlen(expected)) == 0);
+  filp.f_pos = 0;
+  CHECK(read_all(&filp, buf, sizeof(buf), 1) == (ssize_t) strlen(expected));
+  CHECK(memcmp(buf, expected, strlen(expected)) == 0);
+
+  CHECK(aesd_harness_release(&filp) == 0);
+  aesd_harness_unload();
+}
+
+static void test_bad_args(void)
+{
+  struct file filp;
+  char buf[8];
+
+  CHECK(aesd_harness_load() == 0);
+  CHECK(aesd_harness_open(&filp) == 0);
+  CHECK(aesd_harness_write(&filp, NULL, 4) == -EFAULT);
+  CHECK(aesd_harness_read(&filp, NULL, 4) == -EFAULT);
+  CHECK(aesd_harness_write(&filp, buf, 0) == 0);
+  CHECK(aesd_harness_read(&filp, buf, 0) == 0);
+  CHECK(aesd_harness_release(&filp) == 0);
+  aesd_harness_unload();
+}
+
+static void *writer_thread(void *arg)
+{
+  long id = (long) arg;
+  struct file filp;
+  char line[LINE_LEN + 1];
+  int i;
+
+  aesd_harness_open(&filp);
+  for (i = 0; i < LINES_PER_WRITER; i++) {
+    // fixed width so any whole line can be recognized
+    snprintf(line, sizeof(line), "w%ld-%012d\n", id, i);
+    CHECK(aesd_harness_write(&filp, line, LINE_LEN) == LINE_LEN);
+  }
+  aesd_harness_release(&filp);
+  return NULL;
+}
+
+static bool valid_lines(const char *buf, size_t len)
+{
+  size_t i;
+
+  if (len % LINE_LEN != 0)
+    return false;
+  for (i = 0; i < len; i += LINE_LEN) {
+    if (buf[i] != 'w' || buf[i + 2] != '-' || buf[i + LINE_LEN - 1] != '\n')
+      return false;
+  }
+  return true;
+}
+
+static volatile int writers_done;
+
+static void *reader_thread(void *arg)
+{
+  struct file filp;
+  char buf[DEVICE_MAX];
+  ssize_t len;
+
+  aesd_harness_open(&filp);
+  while (!__atomic_load_n(&writers_done, __ATOMIC_ACQUIRE)) {
+    // one entry per read, so entries come from consistent snapshots
+    filp.f_pos = 0;
+    len = read_all(&filp, buf, sizeof(buf), LINE_LEN);
+    CHECK(len >= 0 && valid_lines(buf, len));
+  }
+  aesd_harness_release(&filp);
+  return NULL;
+}
+
+static void test_concurrent(void)
+{
+  pthread_t writers[WRITERS];
+  pthread_t readers[READERS];
+  struct file filp;
+  char buf[DEVICE_MAX];
+  ssize_t len;
+  long i;
+
+  CHECK(aesd_harness_load() == 0);
+  writers_done = 0;
+  for (i = 0; i < READERS; i++)
+    pthread_create(&readers[i], NULL, reader_thread, NULL);
+  for (i = 0; i < WRITERS; i++)
+    pthread_create(&writers[i], NULL, writer_thread, (void *) i);
+  for (i = 0; i < WRITERS; i++)
+    pthread_join(writers[i], NULL);
+  __atomic_store_n(&writers_done, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < READERS; i++)
+    pthread_join(readers[i], NULL);
+
+  CHECK(aesd_harness_open(&filp) == 0);
+  len = read_all(&filp, buf, sizeof(buf), sizeof(buf));
+  CHECK(len == AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * LINE_LEN);
+  CHECK(len > 0 && valid_lines(buf, len));
+  CHECK(aesd_harness_release(&filp) == 0);
+  aesd_harness_unload();
+}
+
+int main(int argc, char **argv)
+{
+  test_partial_write();
+  test_overwrite_oldest();
+  test_bad_args();
+  test_concurrent();
+
+  if (failures) {
+    printf("aesdchar-test: %d checks failed\n", failures);
+    return 1;
+  }
+  printf("aesdchar-test: all checks passed\n");
+  return 0;
+}
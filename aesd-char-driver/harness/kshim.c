@@ -0,0 +1,62 @@
+/**
+ * @file kshim.c
+ * @brief Out of line parts of the userspace kernel shim, see shim/kshim.h
+ * @author Jake Michael
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "shim/kshim.h"
+
+// major number handed out by alloc_chrdev_region, from the local/experimental range
+#define SHIM_MAJOR (240)
+
+int shim_console_loglevel = 7;
+
+int printk(const char *fmt, ...)
+{
+  va_list args;
+  int level = 4;  // default message loglevel
+  int rc;
+
+  if (fmt[0] == KERN_SOH[0] && fmt[1] >= '0' && fmt[1] <= '7') {
+    level = fmt[1] - '0';
+    fmt += 2;
+  }
+  if (level >= shim_console_loglevel) {
+    return 0;
+  }
+  va_start(args, fmt);
+  rc = vfprintf(stderr, fmt, args);
+  va_end(args);
+  return rc;
+}
+
+void cdev_init(struct cdev *cdev, const struct file_operations *fops)
+{
+  memset(cdev, 0, sizeof(*cdev));
+  cdev->ops = fops;
+}
+
+int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count)
+{
+  cdev->dev = dev;
+  cdev->count = count;
+  return 0;
+}
+
+void cdev_del(struct cdev *cdev)
+{
+  cdev->count = 0;
+}
+
+int alloc_chrdev_region(dev_t *dev, unsigned int baseminor, unsigned int count,
+                        const char *name)
+{
+  *dev = MKDEV(SHIM_MAJOR, baseminor);
+  return 0;
+}
+
+void unregister_chrdev_region(dev_t from, unsigned int count)
+{
+}
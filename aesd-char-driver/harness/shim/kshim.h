@@ -0,0 +1,171 @@
+/**
+ * @file kshim.h
+ * @brief The kernel API used by the aesdchar driver, implemented in userspace
+ *
+ * Lets main.c and aesd-circular-buffer.c build unmodified as a normal
+ * program: the harness compiles them with -D__KERNEL__ and this directory
+ * ahead of the system include path, so their <linux/...> includes land
+ * here.  Only what the driver uses is provided, with the semantics it
+ * relies on:
+ *  - struct mutex is a pthread mutex, mutex_lock_interruptible() never
+ *    fails
+ *  - kmalloc/krealloc/kfree are malloc/realloc/free, krealloc keeps the
+ *    old buffer on failure like the kernel's
+ *  - the user and kernel address spaces are the same, so access_ok()
+ *    only rejects NULL and copy_{to,from}_user() are memcpy
+ *  - chrdev regions and cdevs are bookkeeping only, nothing is registered
+ *  - printk() only prints messages with a level below
+ *    shim_console_loglevel (7 by default, hiding KERN_DEBUG as a default
+ *    console does), so PDEBUG costs a call rather than a write to stderr
+ *
+ * @author Jake Michael
+ */
+
+#ifndef AESDCHAR_KSHIM_H
+#define AESDCHAR_KSHIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/* ---- compiler / types ---- */
+#define __user
+
+// the kernel's loff_t is long long, glibc's is long; the driver prints it with %lld
+typedef long long kshim_loff_t;
+#define loff_t kshim_loff_t
+#define container_of(ptr, type, member) \
+  ((type *) ((char *) (ptr) - offsetof(type, member)))
+
+// kernel internal, never seen by userspace
+#define ERESTARTSYS 512
+
+/* ---- module ---- */
+struct module;
+#define THIS_MODULE ((struct module *) NULL)
+// each expands to a harmless declaration so the trailing ';' stays valid
+#define MODULE_AUTHOR(s) struct kshim_module_info
+#define MODULE_LICENSE(s) struct kshim_module_info
+#define module_init(fn) struct kshim_module_info
+#define module_exit(fn) struct kshim_module_info
+
+/* ---- printk ---- */
+#define KERN_SOH "\001"
+#define KERN_ERR KERN_SOH "3"
+#define KERN_WARNING KERN_SOH "4"
+#define KERN_INFO KERN_SOH "6"
+#define KERN_DEBUG KERN_SOH "7"
+
+// messages with a level below this are printed to stderr
+extern int shim_console_loglevel;
+
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* ---- mutex ---- */
+struct mutex {
+  pthread_mutex_t m;
+};
+
+static inline void mutex_init(struct mutex *lock)
+{
+  pthread_mutex_init(&lock->m, NULL);
+}
+
+static inline int mutex_lock_interruptible(struct mutex *lock)
+{
+  return pthread_mutex_lock(&lock->m) == 0 ? 0 : -EINTR;
+}
+
+static inline void mutex_lock(struct mutex *lock)
+{
+  pthread_mutex_lock(&lock->m);
+}
+
+static inline void mutex_unlock(struct mutex *lock)
+{
+  pthread_mutex_unlock(&lock->m);
+}
+
+/* ---- slab ---- */
+typedef unsigned int gfp_t;
+#define GFP_KERNEL ((gfp_t) 0)
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+  return malloc(size);
+}
+
+static inline void *krealloc(const void *p, size_t size, gfp_t flags)
+{
+  return realloc((void *) p, size);
+}
+
+static inline void kfree(const void *p)
+{
+  free((void *) p);
+}
+
+/* ---- uaccess ---- */
+#define access_ok(addr, size) ((addr) != NULL)
+
+static inline unsigned long copy_to_user(void __user *to, const void *from, unsigned long n)
+{
+  memcpy(to, from, n);
+  return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void __user *from, unsigned long n)
+{
+  memcpy(to, from, n);
+  return 0;
+}
+
+/* ---- fs / cdev ---- */
+#define MINORBITS 20
+#define MKDEV(ma, mi) ((dev_t) (((ma) << MINORBITS) | (mi)))
+#define MAJOR(dev) ((unsigned int) ((dev) >> MINORBITS))
+#define MINOR(dev) ((unsigned int) ((dev) & ((1U << MINORBITS) - 1)))
+
+struct file;
+struct inode;
+
+struct file_operations {
+  struct module *owner;
+  loff_t (*llseek)(struct file *, loff_t, int);
+  ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+  ssize_t (*write)(struct file *, const char __user *, size_t, loff_t *);
+  long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+  int (*open)(struct inode *, struct file *);
+  int (*release)(struct inode *, struct file *);
+};
+
+struct cdev {
+  struct module *owner;
+  const struct file_operations *ops;
+  dev_t dev;
+  unsigned int count;
+};
+
+struct inode {
+  struct cdev *i_cdev;
+};
+
+struct file {
+  struct inode *f_inode;
+  loff_t f_pos;
+  void *private_data;
+};
+
+void cdev_init(struct cdev *cdev, const struct file_operations *fops);
+int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count);
+void cdev_del(struct cdev *cdev);
+int alloc_chrdev_region(dev_t *dev, unsigned int baseminor, unsigned int count,
+                        const char *name);
+void unregister_chrdev_region(dev_t from, unsigned int count);
+
+#endif /* AESDCHAR_KSHIM_H */
@@ -0,0 +1,5 @@
+/*
+ * linux/module.h for the userspace harness, everything main.c needs from the
+ * kernel is in one header
+ */
+#include "../kshim.h"
@@ -0,0 +1,351 @@
+/* ----------------------------------------------------------------------------
+ * @file aesdclient-bench.c
+ * @brief Measures the per-record cost of sending records to aesdsocket
+ *
+ * By default records go through libaesdclient, <batch> records in flight
+ * per pooled connection.  With -N each record gets a connection of its own
+ * and blocking socket calls, like a hand-written producer, for comparison.
+ * Every reply holds the whole log, so compare runs against the same log
+ * size, e.g. a freshly started server.  With -z the replies are compressed,
+ * the bytes received are printed next to the reply bytes they carried.
+ * The latency of a record runs from its send to its reply, the segments
+ * per reply are those the kernel counted receiving data.  The reply bytes
+ * per second measure how fast the server replays a large log.  A record
+ * whose reply does not hold it among its last lines counts as failed.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "aesdclient.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#define ERROR_LOG(msg,...) fprintf(stderr, "aesdclient-bench ERROR: " msg "\n" , ##__VA_ARGS__)
+
+struct bench_result {
+  unsigned long answered;
+  unsigned long failed;     // with an error, or a reply not holding the record
+  unsigned long shed;       // turned away by the server, EBUSY
+  size_t record_size;
+  size_t window;            // the most records one reply may answer
+  double *latency_us;       // of each answered record, in answer order
+  struct aesdclient_counters counters;
+};
+
+// the callback argument of a record
+struct record_slot {
+  struct bench_result *result;
+  unsigned long index;      // for make_record()
+  struct timespec sent;
+};
+
+static void print_usage(const char *progname)
+{
+  printf("Usage: %s [options]\n", progname);
+  printf("Options: \n");
+  printf("\t -H <host> \t Server host (default localhost)\n");
+  printf("\t -p <port> \t Server port (default 9000)\n");
+  printf("\t -n <records> \t Records to send (default 1000)\n");
+  printf("\t -s <bytes> \t Record size (default 32)\n");
+  printf("\t -c <conns> \t Pooled connections (default 1)\n");
+  printf("\t -b <batch> \t Records in flight per connection (default 64)\n");
+  printf("\t -U \t\t Do not negotiate framed replies\n");
+  printf("\t -z \t\t Ask for compressed replies\n");
+  printf("\t -N \t\t A connection per record, without the library\n");
+}
+
+static double elapsed_s(const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void make_record(char *record, size_t size, unsigned long i)
+{
+  int len = snprintf(record, size + 1, "bench-%lu-", i);
+
+  if ((size_t) len < size) {
+    memset(record + len, 'x', size - len);
+  }
+  record[size] = '\0';
+}
+
+/*
+ * @brief  checks data holds the record make_record() makes for i, without
+ *         building it
+ * @return true if it does
+ */
+static bool is_record(const char *data, size_t size, unsigned long i)
+{
+  char prefix[32];
+  size_t len = snprintf(prefix, sizeof(prefix), "bench-%lu-", i);
+  size_t n;
+
+  len = (len < size) ? len : size;
+  if (memcmp(data, prefix, len) != 0) {
+    return false;
+  }
+  for (n = len; n < size && data[n] == 'x'; n++);
+  return n == size;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+static void on_reply(void *arg, const char *reply, size_t len, int err)
+{
+  struct record_slot *slot = arg;
+  struct bench_result *result = slot->result;
+  size_t line = result->record_size + 1;
+  const char *at;
+  size_t n;
+
+  if (err == EBUSY) {
+    result->shed++;
+    return;
+  } else if (err != 0) {
+    result->failed++;
+    return;
+  }
+  // the log up to the last record the reply answers, the records it
+  // answers were stored together so the record is one of the last lines
+  for (n = 1; n <= result->window && n * line <= len; n++) {
+    at = reply + len - n * line;
+    if ((at == reply || at[-1] == '\n') && at[line - 1] == '\n' &&
+        is_record(at, result->record_size, slot->index)) {
+      break;
+    }
+  }
+  if (n > result->window || n * line > len) {
+    if (result->failed++ == 0) {
+      ERROR_LOG("the reply to record %lu, %zu bytes, does not end with it",
+                slot->index, len);
+    }
+    return;
+  }
+  result->latency_us[result->answered++] = 1e6 * elapsed_s(&slot->sent);
+}
+
+static int run_pool(const char *host, const char *port, unsigned long nrecords,
+                    size_t size, unsigned int nconns, unsigned int batch, int flags,
+                    struct bench_result *result)
+{
+  struct aesdclient_pool *pool;
+  char *record = malloc(size + 1);
+  struct record_slot *slots = calloc(nrecords, sizeof(struct record_slot));
+  unsigned long sent = 0;
+  size_t window = (size_t) batch * nconns;
+
+  result->record_size = size;
+  result->window = window;
+
+  pool = aesdclient_pool_create(host, port, nconns, flags);
+  if (pool == NULL || record == NULL || slots == NULL) {
+    ERROR_LOG("could not create the pool: %s", strerror(errno));
+    aesdclient_pool_destroy(pool);
+    free(record);
+    free(slots);
+    return -1;
+  }
+  while (result->answered + result->failed + result->shed < nrecords) {
+    // refill the window, the records queued here go out as one batch
+    while (sent < nrecords && aesdclient_pending(pool) < window) {
+      make_record(record, size, sent);
+      slots[sent].result = result;
+      slots[sent].index = sent;
+      clock_gettime(CLOCK_MONOTONIC, &slots[sent].sent);
+      if (aesdclient_send(pool, record, size, on_reply, &slots[sent]) == -1) {
+        if (errno == EAGAIN)
+          break;
+        ERROR_LOG("aesdclient_send: %s", strerror(errno));
+        goto handle_errors;
+      }
+      sent++;
+    }
+    if (aesdclient_poll(pool, 1000) == -1) {
+      ERROR_LOG("aesdclient_poll: %s", strerror(errno));
+      goto handle_errors;
+    }
+  }
+  aesdclient_counters(pool, &result->counters);
+  aesdclient_pool_destroy(pool);
+  free(record);
+  free(slots);
+  return 0;
+
+handle_errors:
+  // fails the records still pending, their slots are freed after
+  aesdclient_pool_destroy(pool);
+  free(record);
+  free(slots);
+  return -1;
+}
+
+// what a producer without the library does, connect, send, read, close
+static int run_naive(const char *host, const char *port, unsigned long nrecords,
+                     size_t size, struct bench_result *result)
+{
+  struct addrinfo hints;
+  struct addrinfo *res = NULL;
+  char *record = malloc(size + 2);
+  char *reply = NULL;
+  size_t reply_size = 0;
+  size_t len;
+  struct timespec sent;
+  unsigned long i;
+  ssize_t n;
+  int fd;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (record == NULL || getaddrinfo(host, port, &hints, &res) != 0) {
+    ERROR_LOG("could not resolve %s:%s", host, port);
+    free(record);
+    return -1;
+  }
+  for (i = 0; i < nrecords; i++) {
+    make_record(record, size, i);
+    record[size] = '\n';
+    clock_gettime(CLOCK_MONOTONIC, &sent);
+    fd = socket(res->ai_family, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, res->ai_addr, res->ai_addrlen) == -1 ||
+        send(fd, record, size + 1, MSG_NOSIGNAL) != size + 1) {
+      result->failed++;
+      if (fd != -1)
+        close(fd);
+      continue;
+    }
+    // the reply is complete once it ends with the record
+    len = 0;
+    for (;;) {
+      if (reply_size - len < 65536) {
+        reply_size = reply_size ? 2 * reply_size : 65536;
+        reply = realloc(reply, reply_size);
+      }
+      n = recv(fd, reply + len, reply_size - len, 0);
+      if (n <= 0) {
+        break;
+      }
+      len += n;
+      if (len >= size + 1 && memcmp(reply + len - size - 1, record, size + 1) == 0) {
+        break;
+      }
+    }
+    if (n <= 0) {
+      result->failed++;
+    } else {
+      result->latency_us[result->answered++] = 1e6 * elapsed_s(&sent);
+    }
+    close(fd);
+  }
+  freeaddrinfo(res);
+  free(reply);
+  free(record);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *host = "localhost";
+  const char *port = "9000";
+  unsigned long nrecords = 1000;
+  size_t size = 32;
+  unsigned int nconns = 1;
+  unsigned int batch = 64;
+  int flags = 0;
+  bool naive = false;
+  struct bench_result result = { 0 };
+  struct timespec start;
+  double secs;
+  int opt;
+  int rc;
+
+  while ((opt = getopt(argc, argv, "H:p:n:s:c:b:UzN")) != -1) {
+    switch (opt) {
+      case 'H': host = optarg; break;
+      case 'p': port = optarg; break;
+      case 'n': nrecords = strtoul(optarg, NULL, 0); break;
+      case 's': size = strtoul(optarg, NULL, 0); break;
+      case 'c': nconns = strtoul(optarg, NULL, 0); break;
+      case 'b': batch = strtoul(optarg, NULL, 0); break;
+      case 'U': flags |= AESDCLIENT_UNFRAMED; break;
+      case 'z': flags |= AESDCLIENT_LZ4; break;
+      case 'N': naive = true; break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (nrecords == 0 || size < 16 || nconns == 0 || batch == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  result.latency_us = malloc(nrecords * sizeof(double));
+  if (result.latency_us == NULL) {
+    ERROR_LOG("malloc: %s", strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (naive) {
+    rc = run_naive(host, port, nrecords, size, &result);
+  } else {
+    rc = run_pool(host, port, nrecords, size, nconns, batch, flags, &result);
+  }
+  secs = elapsed_s(&start);
+  if (rc == -1) {
+    return EXIT_FAILURE;
+  }
+
+  if (naive) {
+    printf("naive: ");
+  } else {
+    printf("pool %s%s, %u conns, batch %u: ",
+           (flags & AESDCLIENT_UNFRAMED) ? "unframed" : "framed",
+           (flags & AESDCLIENT_LZ4) ? " lz4" : "", nconns, batch);
+  }
+  printf("%lu records in %.3f s, %.0f records/s, %.2f us/record, %lu failed, %lu shed\n",
+         result.answered, secs, result.answered / secs,
+         1e6 * secs / (result.answered ? result.answered : 1), result.failed, result.shed);
+  if (result.answered > 0) {
+    double sum = 0;
+    unsigned long i;
+
+    qsort(result.latency_us, result.answered, sizeof(double), compare_double);
+    for (i = 0; i < result.answered; i++) {
+      sum += result.latency_us[i];
+    }
+    printf("latency us: mean %.1f, p50 %.1f, p99 %.1f, max %.1f\n",
+           sum / result.answered, result.latency_us[result.answered / 2],
+           result.latency_us[result.answered * 99 / 100],
+           result.latency_us[result.answered - 1]);
+  }
+  if (!naive) {
+    printf("%lu replies, %llu bytes received for %llu reply bytes (%.3f), %.1f MB/s\n",
+           result.counters.replies, result.counters.bytes_received,
+           result.counters.reply_bytes,
+           (double) result.counters.bytes_received /
+           (result.counters.reply_bytes ? result.counters.reply_bytes : 1),
+           result.counters.reply_bytes / secs / 1e6);
+    printf("%llu segments received, %.1f per reply\n", result.counters.segments_in,
+           (double) result.counters.segments_in /
+           (result.counters.replies ? result.counters.replies : 1));
+  }
+  free(result.latency_us);
+  return result.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,713 @@
+/* ----------------------------------------------------------------------------
+ * @file aesdclient.c
+ * @brief libaesdclient, an asynchronous client for aesdsocket
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "aesdclient.h"
+#include "aesd-proto.h"
+#include "aesd-lz.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+// for tcpi_data_segs_in, which the glibc struct tcp_info lacks
+#include <linux/tcp.h>
+
+// read at most this much per recv(), replies are the whole log
+#define READ_STEP (64 * 1024)
+#define MAX_EVENTS (64)
+
+enum conn_state {
+  CONN_CLOSED = 0,
+  CONN_CONNECTING,
+  CONN_HELLO,         // hello sent, waiting to learn if replies are framed
+  CONN_FRAMED,
+  CONN_UNFRAMED       // one record at a time
+};
+
+// bytes [start, end) of data are in use, reused across replies
+struct buffer {
+  char *data;
+  size_t start;
+  size_t end;
+  size_t size;
+};
+
+struct pending {
+  aesdclient_reply_fn fn;
+  void *arg;
+};
+
+struct conn {
+  int fd;
+  enum conn_state state;
+  uint32_t events;          // registered with the pool's epoll
+  struct buffer out;        // queued records, the hello in front of them
+  size_t out_allowed;       // bytes at the front of out which may go now
+  struct buffer in;         // received and not parsed yet
+  struct buffer reply;      // framed reply being put together
+  size_t chunk_left;        // bytes of the current chunk still to come
+  size_t chunk_raw;         // its size decompressed, 0 if sent as is
+  struct buffer zchunk;     // compressed chunk being put together
+  bool lz;                  // compressed replies negotiated
+  struct buffer inflight;   // unframed, the record waiting for its reply
+  struct pending *pend;     // ring of records queued or sent, oldest first
+  size_t pend_head;
+  size_t pend_count;
+  size_t pend_size;
+};
+
+struct aesdclient_pool {
+  int epfd;
+  int flags;
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  unsigned int nconns;
+  struct conn *conns;
+  size_t pending;
+  struct aesdclient_counters counters;
+};
+
+/* ============================================================================
+ *    BUFFERS
+ * ===========================================================================*/
+
+static size_t buf_len(const struct buffer *b)
+{
+  return b->end - b->start;
+}
+
+static void buf_consume(struct buffer *b, size_t n)
+{
+  b->start += n;
+  if (b->start == b->end) {
+    b->start = b->end = 0;
+  }
+}
+
+// makes room for n more bytes at the end
+static int buf_reserve(struct buffer *b, size_t n)
+{
+  size_t size;
+  char *data;
+
+  if (b->size - b->end >= n) {
+    return 0;
+  }
+  if (b->start > 0) {
+    memmove(b->data, b->data + b->start, buf_len(b));
+    b->end -= b->start;
+    b->start = 0;
+    if (b->size - b->end >= n) {
+      return 0;
+    }
+  }
+  for (size = b->size ? b->size : 256; size - b->end < n; size *= 2);
+  data = realloc(b->data, size);
+  if (data == NULL) {
+    return -1;
+  }
+  b->data = data;
+  b->size = size;
+  return 0;
+}
+
+static int buf_append(struct buffer *b, const void *data, size_t n)
+{
+  if (buf_reserve(b, n) == -1) {
+    return -1;
+  }
+  memcpy(b->data + b->end, data, n);
+  b->end += n;
+  return 0;
+}
+
+static int buf_prepend(struct buffer *b, const void *data, size_t n)
+{
+  size_t len = buf_len(b);
+
+  if (buf_reserve(b, n) == -1) {
+    return -1;
+  }
+  memmove(b->data + b->start + n, b->data + b->start, len);
+  memcpy(b->data + b->start, data, n);
+  b->end += n;
+  return 0;
+}
+
+static void buf_free(struct buffer *b)
+{
+  free(b->data);
+  memset(b, 0, sizeof(*b));
+}
+
+/* ============================================================================
+ *    CONNECTIONS
+ * ===========================================================================*/
+
+static int pend_push(struct conn *c, aesdclient_reply_fn fn, void *arg)
+{
+  if (c->pend_count == c->pend_size) {
+    size_t size = c->pend_size ? 2 * c->pend_size : 64;
+    struct pending *pend = malloc(size * sizeof(*pend));
+    size_t i;
+    if (pend == NULL) {
+      return -1;
+    }
+    for (i = 0; i < c->pend_count; i++) {
+      pend[i] = c->pend[(c->pend_head + i) % c->pend_size];
+    }
+    free(c->pend);
+    c->pend = pend;
+    c->pend_head = 0;
+    c->pend_size = size;
+  }
+  c->pend[(c->pend_head + c->pend_count) % c->pend_size] = (struct pending) { fn, arg };
+  c->pend_count++;
+  return 0;
+}
+
+// answers the n oldest records, a callback may queue more meanwhile
+static void pend_answer(struct aesdclient_pool *pool, struct conn *c, size_t n,
+                        const char *reply, size_t len, int err)
+{
+  struct pending p;
+
+  while (n-- > 0 && c->pend_count > 0) {
+    p = c->pend[c->pend_head];
+    c->pend_head = (c->pend_head + 1) % c->pend_size;
+    c->pend_count--;
+    pool->pending--;
+    if (p.fn != NULL) {
+      p.fn(p.arg, reply, len, err);
+    }
+  }
+}
+
+static void conn_update_events(struct aesdclient_pool *pool, struct conn *c)
+{
+  struct epoll_event ev = { .data.ptr = c };
+
+  if (c->state == CONN_CLOSED) {
+    return;
+  } else if (c->state == CONN_CONNECTING) {
+    ev.events = EPOLLOUT;
+  } else {
+    ev.events = EPOLLIN;
+    // unframed, the next record is only taken once the last one is answered
+    if (buf_len(&c->out) > 0 && c->out_allowed > 0) {
+      ev.events |= EPOLLOUT;
+    } else if (c->state == CONN_UNFRAMED && buf_len(&c->out) > 0 &&
+               buf_len(&c->inflight) == 0) {
+      ev.events |= EPOLLOUT;
+    }
+  }
+  if (ev.events != c->events) {
+    epoll_ctl(pool->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = ev.events;
+  }
+}
+
+// segments carrying data received on the connection, 0 if unknown
+static unsigned long conn_segments(const struct conn *c)
+{
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+
+  memset(&info, 0, sizeof(info));
+  if (c->state == CONN_CLOSED ||
+      getsockopt(c->fd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1) {
+    return 0;
+  }
+  return info.tcpi_data_segs_in;
+}
+
+// closes the connection and fails its records
+static int conn_fail(struct aesdclient_pool *pool, struct conn *c, int err)
+{
+  size_t n = c->pend_count;
+
+  if (c->state != CONN_CLOSED) {
+    pool->counters.segments_in += conn_segments(c);
+    epoll_ctl(pool->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    c->state = CONN_CLOSED;
+  }
+  c->out.start = c->out.end = 0;
+  c->in.start = c->in.end = 0;
+  c->reply.start = c->reply.end = 0;
+  c->inflight.start = c->inflight.end = 0;
+  c->chunk_left = 0;
+  c->chunk_raw = 0;
+  c->zchunk.start = c->zchunk.end = 0;
+  c->lz = false;
+  pend_answer(pool, c, n, NULL, 0, err);
+  return n;
+}
+
+static int conn_open(struct aesdclient_pool *pool, struct conn *c)
+{
+  struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = c };
+
+  c->fd = socket(pool->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (c->fd == -1) {
+    return -1;
+  }
+  if ((connect(c->fd, (struct sockaddr *) &pool->addr, pool->addrlen) == -1 &&
+       errno != EINPROGRESS) ||
+      epoll_ctl(pool->epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1) {
+    close(c->fd);
+    c->fd = -1;
+    return -1;
+  }
+  // a batch is sent whole, holding back its tail for an ack only delays it
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+  c->state = CONN_CONNECTING;
+  c->events = ev.events;
+  return 0;
+}
+
+static int conn_connected(struct aesdclient_pool *pool, struct conn *c)
+{
+  const char *hello = (pool->flags & AESDCLIENT_LZ4) ? AESD_PROTO_HELLO_LZ4 : AESD_PROTO_HELLO;
+  int err = 0;
+  socklen_t len = sizeof(err);
+
+  if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+    err = errno;
+  }
+  if (err != 0) {
+    return conn_fail(pool, c, err);
+  }
+  if (pool->flags & AESDCLIENT_UNFRAMED) {
+    c->state = CONN_UNFRAMED;
+    c->out_allowed = 0;
+    return 0;
+  }
+  // records queued meanwhile wait behind the hello until it is answered
+  if (buf_prepend(&c->out, hello, strlen(hello)) == -1) {
+    return conn_fail(pool, c, ENOMEM);
+  }
+  c->state = CONN_HELLO;
+  c->out_allowed = strlen(hello);
+  return 0;
+}
+
+static int conn_flush(struct aesdclient_pool *pool, struct conn *c)
+{
+  size_t len;
+  ssize_t n;
+  char *nl;
+
+  if (c->state == CONN_CLOSED || c->state == CONN_CONNECTING) {
+    return 0;
+  }
+  // unframed, a record goes once the one before it is answered, and is kept
+  // to find the end of its reply
+  if (c->state == CONN_UNFRAMED && c->out_allowed == 0 &&
+      buf_len(&c->inflight) == 0 && buf_len(&c->out) > 0) {
+    nl = memchr(c->out.data + c->out.start, '\n', buf_len(&c->out));
+    c->out_allowed = nl - (c->out.data + c->out.start) + 1;
+    if (buf_append(&c->inflight, c->out.data + c->out.start, c->out_allowed) == -1) {
+      return conn_fail(pool, c, ENOMEM);
+    }
+  }
+  while ((len = buf_len(&c->out)) > 0 && c->out_allowed > 0) {
+    if (len > c->out_allowed) {
+      len = c->out_allowed;
+    }
+    n = send(c->fd, c->out.data + c->out.start, len, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else if (n == -1) {
+      return conn_fail(pool, c, errno);
+    }
+    buf_consume(&c->out, n);
+    pool->counters.bytes_sent += n;
+    if (c->out_allowed != SIZE_MAX) {
+      c->out_allowed -= n;
+    }
+  }
+  return 0;
+}
+
+// the hello is answered by the ack, or by a log ending with the hello
+static int parse_hello(struct aesdclient_pool *pool, struct conn *c)
+{
+  const char *in = c->in.data + c->in.start;
+  size_t len = buf_len(&c->in);
+  const char *hello = (pool->flags & AESDCLIENT_LZ4) ? AESD_PROTO_HELLO_LZ4 : AESD_PROTO_HELLO;
+  size_t hello_len = strlen(hello);
+  size_t ack_len = strlen(AESD_PROTO_ACK);
+  size_t lz_ack_len = strlen(AESD_PROTO_ACK_LZ4);
+
+  // a server may answer a request for compression with the plain ack
+  if (len >= ack_len && memcmp(in, AESD_PROTO_ACK, ack_len) == 0) {
+    buf_consume(&c->in, ack_len);
+    c->state = CONN_FRAMED;
+    c->out_allowed = SIZE_MAX;
+    return 1;
+  }
+  if ((pool->flags & AESDCLIENT_LZ4) && len >= lz_ack_len &&
+      memcmp(in, AESD_PROTO_ACK_LZ4, lz_ack_len) == 0) {
+    buf_consume(&c->in, lz_ack_len);
+    c->state = CONN_FRAMED;
+    c->out_allowed = SIZE_MAX;
+    c->lz = true;
+    return 1;
+  }
+  if (len >= hello_len && memcmp(in + len - hello_len, hello, hello_len) == 0 &&
+      (len == hello_len || in[len - hello_len - 1] == '\n')) {
+    buf_consume(&c->in, len);
+    c->state = CONN_UNFRAMED;
+    c->out_allowed = 0;
+    return 1;
+  }
+  return 0;
+}
+
+// returns the number of records answered, -1 on a protocol error
+static int parse_framed(struct aesdclient_pool *pool, struct conn *c)
+{
+  int answered = 0;
+  size_t len;
+  char *line;
+  char *nl;
+  char *endp;
+  unsigned long value;
+  unsigned long raw;
+  ssize_t n;
+
+  while (c->state == CONN_FRAMED) {
+    len = buf_len(&c->in);
+    if (c->chunk_left > 0) {
+      if (len > c->chunk_left) {
+        len = c->chunk_left;
+      }
+      // a compressed chunk is put together first, it decompresses whole
+      if (buf_append(c->chunk_raw ? &c->zchunk : &c->reply,
+                     c->in.data + c->in.start, len) == -1) {
+        return -1;
+      }
+      buf_consume(&c->in, len);
+      c->chunk_left -= len;
+      if (c->chunk_left > 0) {
+        break;
+      }
+      if (c->chunk_raw > 0) {
+        if (buf_reserve(&c->reply, c->chunk_raw) == -1) {
+          return -1;
+        }
+        n = aesd_lz_decompress(c->zchunk.data + c->zchunk.start, buf_len(&c->zchunk),
+                               c->reply.data + c->reply.end, c->chunk_raw);
+        if (n != (ssize_t) c->chunk_raw) {
+          return -1;
+        }
+        c->reply.end += n;
+        c->zchunk.start = c->zchunk.end = 0;
+        c->chunk_raw = 0;
+      }
+      continue;
+    }
+    line = c->in.data + c->in.start;
+    nl = memchr(line, '\n', len);
+    if (nl == NULL) {
+      if (len > 2 * AESD_PROTO_CHUNK_HDR_MAX) {
+        return -1; // no header is that long
+      }
+      break;
+    }
+    *nl = '\0';
+    if (strncmp(line, AESD_PROTO_BUSY " ", strlen(AESD_PROTO_BUSY " ")) == 0) {
+      // the server shed the oldest records instead of storing them
+      value = strtoul(line + strlen(AESD_PROTO_BUSY " "), &endp, 10);
+      if (*endp != '\0' || value == 0 || value > c->pend_count || buf_len(&c->reply) > 0) {
+        return -1;
+      }
+      pend_answer(pool, c, value, NULL, 0, EBUSY);
+      answered += value;
+      buf_consume(&c->in, nl - line + 1);
+      continue;
+    }
+    value = strtoul(line, &endp, 10);
+    if (value > 0 && *endp == '\0') {
+      c->chunk_left = value;
+    } else if (value > 0 && *endp == ' ' && c->lz) {
+      // "<clen> <rawlen>", the bytes are sent as is when both are equal
+      raw = strtoul(endp + 1, &endp, 10);
+      if (*endp != '\0' || raw == 0 || raw > AESD_LZ_MAX_INPUT ||
+          value > aesd_lz_bound(raw)) {
+        return -1;
+      }
+      c->chunk_left = value;
+      c->chunk_raw = (value == raw) ? 0 : raw;
+    } else if (value == 0 && *endp == ' ') {
+      // the end of a reply, answering the oldest records
+      value = strtoul(endp + 1, &endp, 10);
+      if (*endp != '\0' || value == 0 || value > c->pend_count) {
+        return -1;
+      }
+      pool->counters.replies++;
+      pool->counters.reply_bytes += buf_len(&c->reply);
+      pend_answer(pool, c, value, c->reply.data + c->reply.start, buf_len(&c->reply), 0);
+      c->reply.start = c->reply.end = 0;
+      answered += value;
+    } else {
+      return -1;
+    }
+    buf_consume(&c->in, nl - line + 1);
+  }
+  return answered;
+}
+
+// the reply is complete once it ends with the record, at the start of a line
+static int parse_unframed(struct aesdclient_pool *pool, struct conn *c)
+{
+  const char *in = c->in.data + c->in.start;
+  size_t len = buf_len(&c->in);
+  const char *rec = c->inflight.data + c->inflight.start;
+  size_t rec_len = buf_len(&c->inflight);
+
+  if (rec_len == 0 || len < rec_len ||
+      memcmp(in + len - rec_len, rec, rec_len) != 0 ||
+      (len > rec_len && in[len - rec_len - 1] != '\n')) {
+    return 0;
+  }
+  c->inflight.start = c->inflight.end = 0;
+  pool->counters.replies++;
+  pool->counters.reply_bytes += len;
+  pend_answer(pool, c, 1, in, len, 0);
+  c->in.start = c->in.end = 0;
+  return 1;
+}
+
+static int conn_read(struct aesdclient_pool *pool, struct conn *c)
+{
+  int answered = 0;
+  int rc;
+  ssize_t n;
+
+  while (c->state != CONN_CLOSED) {
+    if (buf_reserve(&c->in, READ_STEP) == -1) {
+      return answered + conn_fail(pool, c, ENOMEM);
+    }
+    n = recv(c->fd, c->in.data + c->in.end, c->in.size - c->in.end, 0);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else if (n == 0 && buf_len(&c->in) == strlen(AESD_PROTO_BUSY "\n") &&
+               memcmp(c->in.data + c->in.start, AESD_PROTO_BUSY "\n", buf_len(&c->in)) == 0) {
+      return answered + conn_fail(pool, c, EBUSY); // turned away by a loaded server
+    } else if (n <= 0) {
+      return answered + conn_fail(pool, c, n == 0 ? ECONNRESET : errno);
+    }
+    c->in.end += n;
+    pool->counters.bytes_received += n;
+    // the server may send a reply in several writes, an ack delayed by us
+    // would hold its tail back.  Quick acks do not stick, so set again every time
+    setsockopt(c->fd, IPPROTO_TCP, TCP_QUICKACK, &(int){1}, sizeof(int));
+
+    if (c->state == CONN_HELLO && parse_hello(pool, c) == 0) {
+      continue;
+    }
+    if (c->state == CONN_FRAMED) {
+      rc = parse_framed(pool, c);
+    } else {
+      rc = parse_unframed(pool, c);
+    }
+    if (rc == -1) {
+      return answered + conn_fail(pool, c, EPROTO);
+    }
+    answered += rc;
+  }
+  return answered;
+}
+
+/* ============================================================================
+ *    POOL
+ * ===========================================================================*/
+
+struct aesdclient_pool *aesdclient_pool_create(const char *host, const char *port,
+                                               unsigned int nconns, int flags)
+{
+  struct aesdclient_pool *pool;
+  struct addrinfo hints;
+  struct addrinfo *res = NULL;
+  unsigned int i;
+  int rc;
+
+  if (nconns == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  pool = calloc(1, sizeof(*pool));
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->epfd = -1;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  rc = getaddrinfo(host, port, &hints, &res);
+  if (rc != 0) {
+    errno = (rc == EAI_SYSTEM) ? errno : EHOSTUNREACH;
+    goto handle_errors;
+  }
+  memcpy(&pool->addr, res->ai_addr, res->ai_addrlen);
+  pool->addrlen = res->ai_addrlen;
+  freeaddrinfo(res);
+
+  pool->conns = calloc(nconns, sizeof(*pool->conns));
+  pool->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (pool->conns == NULL || pool->epfd == -1) {
+    goto handle_errors;
+  }
+  for (i = 0; i < nconns; i++) {
+    pool->conns[i].fd = -1;
+  }
+  pool->nconns = nconns;
+  pool->flags = flags;
+  return pool;
+
+handle_errors:
+  if (pool->epfd != -1)
+    close(pool->epfd);
+  free(pool->conns);
+  free(pool);
+  return NULL;
+}
+
+void aesdclient_pool_destroy(struct aesdclient_pool *pool)
+{
+  struct conn *c;
+  unsigned int i;
+
+  if (pool == NULL)
+    return;
+  for (i = 0; i < pool->nconns; i++) {
+    c = &pool->conns[i];
+    conn_fail(pool, c, ECANCELED);
+    buf_free(&c->out);
+    buf_free(&c->in);
+    buf_free(&c->reply);
+    buf_free(&c->inflight);
+    buf_free(&c->zchunk);
+    free(c->pend);
+  }
+  close(pool->epfd);
+  free(pool->conns);
+  free(pool);
+}
+
+int aesdclient_pool_fd(const struct aesdclient_pool *pool)
+{
+  return pool->epfd;
+}
+
+size_t aesdclient_pending(const struct aesdclient_pool *pool)
+{
+  return pool->pending;
+}
+
+void aesdclient_counters(const struct aesdclient_pool *pool,
+                         struct aesdclient_counters *counters)
+{
+  unsigned int i;
+
+  *counters = pool->counters;
+  // those of closed connections are counted already
+  for (i = 0; i < pool->nconns; i++) {
+    counters->segments_in += conn_segments(&pool->conns[i]);
+  }
+}
+
+int aesdclient_send(struct aesdclient_pool *pool, const char *record, size_t len,
+                    aesdclient_reply_fn fn, void *arg)
+{
+  struct conn *best = NULL;
+  struct conn *c;
+  unsigned int i;
+
+  if (memchr(record, '\n', len) != NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  // the fewest records waiting, an open connection before a new one
+  for (i = 0; i < pool->nconns; i++) {
+    c = &pool->conns[i];
+    if (buf_len(&c->out) + len + 1 > AESDCLIENT_MAX_QUEUED) {
+      continue;
+    }
+    if (best == NULL || c->pend_count < best->pend_count ||
+        (c->pend_count == best->pend_count && best->state == CONN_CLOSED &&
+         c->state != CONN_CLOSED)) {
+      best = c;
+    }
+  }
+  if (best == NULL) {
+    errno = EAGAIN;
+    return -1;
+  }
+  if (best->state == CONN_CLOSED && conn_open(pool, best) == -1) {
+    return -1;
+  }
+  if (buf_reserve(&best->out, len + 1) == -1 || pend_push(best, fn, arg) == -1) {
+    errno = ENOMEM;
+    return -1;
+  }
+  buf_append(&best->out, record, len);
+  buf_append(&best->out, "\n", 1);
+  pool->pending++;
+  conn_update_events(pool, best);
+  return 0;
+}
+
+int aesdclient_poll(struct aesdclient_pool *pool, int timeout_ms)
+{
+  struct epoll_event events[MAX_EVENTS];
+  struct conn *c;
+  int answered = 0;
+  int n;
+  int i;
+
+  // what was queued since the last call goes out now, as one batch
+  for (i = 0; i < pool->nconns; i++) {
+    c = &pool->conns[i];
+    answered += conn_flush(pool, c);
+    conn_update_events(pool, c);
+  }
+  if (answered > 0) {
+    timeout_ms = 0;
+  }
+
+  n = epoll_wait(pool->epfd, events, MAX_EVENTS, timeout_ms);
+  if (n == -1) {
+    return (errno == EINTR) ? answered : -1;
+  }
+  for (i = 0; i < n; i++) {
+    c = events[i].data.ptr;
+    if (c->state == CONN_CONNECTING) {
+      if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+        answered += conn_connected(pool, c);
+      }
+    } else if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+      answered += conn_read(pool, c);
+    }
+    // sends what the read made sendable too, e.g. after the hello is answered
+    answered += conn_flush(pool, c);
+    conn_update_events(pool, c);
+  }
+  return answered;
+}
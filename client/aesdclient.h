@@ -0,0 +1,109 @@
+/* ----------------------------------------------------------------------------
+ * @file aesdclient.h
+ * @brief libaesdclient, an asynchronous client for aesdsocket
+ *
+ * A pool keeps up to a fixed number of connections to one server open and
+ * spreads records over them, so producers do not pay a connect per record.
+ * aesdclient_send() only queues a record, a newline terminated packet, and
+ * never blocks.  The records queued between two calls to aesdclient_poll()
+ * go out together in one send per connection and, with framed replies
+ * (lib/aesd-proto.h), are stored together and answered with one reply, so
+ * the per-record cost is spread over the batch.
+ *
+ * Each record's callback is called with the reply which answered it, the
+ * log up to and including the record.  The reply lives in a buffer reused
+ * by the connection and is only valid during the callback.
+ *
+ * aesdclient_poll() waits and dispatches by itself.  For an event loop of
+ * its own, the application adds aesdclient_pool_fd() to its epoll set and
+ * calls aesdclient_poll() with a timeout of 0 when it is readable, and
+ * after queueing records.
+ *
+ * With AESDCLIENT_LZ4 the replies travel compressed where the server
+ * supports it, the callbacks get them decompressed.
+ *
+ * A server without framing gets one record at a time per connection.  The
+ * library is not thread safe, a pool belongs to one thread.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESDCLIENT_H
+#define AESDCLIENT_H
+
+#include <stddef.h>
+
+// do not negotiate framed replies, the hello would be stored by old servers
+#define AESDCLIENT_UNFRAMED (1 << 0)
+// ask for compressed replies, for slow links and long logs
+#define AESDCLIENT_LZ4      (1 << 1)
+
+// bytes queued on a connection before aesdclient_send() fails with EAGAIN
+#define AESDCLIENT_MAX_QUEUED (1024 * 1024)
+
+struct aesdclient_pool;
+
+struct aesdclient_counters {
+  unsigned long long bytes_sent;      // on the wire
+  unsigned long long bytes_received;  // on the wire, compressed or not
+  unsigned long long reply_bytes;     // in the replies, decompressed
+  unsigned long replies;              // each answering one or more records
+  unsigned long long segments_in;     // TCP segments carrying bytes_received
+};
+
+/**
+* Called once per record with @param reply, @param len bytes of the log up
+* to and including it, or with @param err set to an errno value and no reply
+* when the connection failed before the record was answered.  EBUSY means
+* an overloaded server turned the record away without storing it.
+*/
+typedef void (*aesdclient_reply_fn)(void *arg, const char *reply, size_t len, int err);
+
+/**
+* Create a pool of at most @param nconns connections to @param host and
+* @param port, opened as records are sent.  @param flags is 0,
+* AESDCLIENT_UNFRAMED or AESDCLIENT_LZ4.
+* @return the pool, or NULL with errno set
+*/
+struct aesdclient_pool *aesdclient_pool_create(const char *host, const char *port,
+                                               unsigned int nconns, int flags);
+
+/**
+* Close every connection of @param pool and free it.  Records still waiting
+* for a reply are failed with ECANCELED.
+*/
+void aesdclient_pool_destroy(struct aesdclient_pool *pool);
+
+/**
+* @return an epoll descriptor, readable when aesdclient_poll() has work
+*/
+int aesdclient_pool_fd(const struct aesdclient_pool *pool);
+
+/**
+* Queue @param record of @param len bytes, without a newline, on the least
+* loaded connection.  @param fn, if not NULL, is called with its reply.
+* @return 0 on success, -1 with errno EINVAL if the record holds a newline,
+*         EAGAIN if every connection has AESDCLIENT_MAX_QUEUED bytes queued
+*/
+int aesdclient_send(struct aesdclient_pool *pool, const char *record, size_t len,
+                    aesdclient_reply_fn fn, void *arg);
+
+/**
+* Send the queued records, wait up to @param timeout_ms (-1 for ever) for
+* the sockets and handle replies, calling the records' callbacks.
+* @return the number of records answered or failed, -1 on error
+*/
+int aesdclient_poll(struct aesdclient_pool *pool, int timeout_ms);
+
+/**
+* @return the number of records queued or sent and not answered yet
+*/
+size_t aesdclient_pending(const struct aesdclient_pool *pool);
+
+/**
+* Fill @param counters with the traffic of @param pool since its creation.
+*/
+void aesdclient_counters(const struct aesdclient_pool *pool,
+                         struct aesdclient_counters *counters);
+
+#endif /* AESDCLIENT_H */
@@ -0,0 +1,792 @@
+/* ----------------------------------------------------------------------------
+ * @file aesdtrace-replay.c
+ * @brief Replays a trace recorded by aesdsocket -T against a server
+ *
+ * Each connection of the trace is opened, sends packets of the traced
+ * sizes and is closed at the traced times, divided by the speedup of -x,
+ * all of them concurrently from one epoll loop.  A framed connection sends
+ * each packet on time, pipelined behind the replies still outstanding as
+ * its client did.  A plain one can only have one packet in flight, a
+ * packet due before the previous reply is complete waits for it.  The
+ * packets hold no traced content, only "replay-<conn>-<packet>-" padded to
+ * the traced size.
+ *
+ * The latency of a packet runs from its send to the end of the reply
+ * answering it.  The schedule slip is how late events were issued, large
+ * when the replayer cannot keep up with the speedup asked for.  Replies
+ * hold the whole log, so compare runs against the same log size, e.g. a
+ * freshly started server.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "aesd-trace.h"
+#include "aesd-proto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#define ERROR_LOG(msg,...) fprintf(stderr, "aesdtrace-replay ERROR: " msg "\n" , ##__VA_ARGS__)
+
+#define MAX_EVENTS (64)
+// epoll_pwait2() needs glibc 2.35 to build and Linux 5.11 to run
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 35)
+#define HAVE_EPOLL_PWAIT2 (1)
+#endif
+#endif
+#define RECV_SIZE (64 * 1024)
+#define LINE_MAX_LEN (64)
+#define DRAIN_TIMEOUT_S (30)
+
+enum conn_state {
+  CONN_IDLE = 0,      // not opened yet
+  CONN_CONNECTING,
+  CONN_OPEN,
+  CONN_CLOSED,
+};
+
+// a FIFO of numbers, packet send times or sizes
+struct fifo {
+  double *items;
+  size_t head;
+  size_t tail;
+  size_t size;
+};
+
+struct replay_conn {
+  size_t id;
+  int fd;
+  enum conn_state state;
+  bool framed;
+  bool acked;             // the server answered the hello
+  bool closing;           // the trace closed it, once its replies are in
+  bool turned_away;       // the server closed it after AESD_PROTO_BUSY
+  unsigned long npackets; // sent so far, numbers the packet contents
+  char *out;              // bytes not sent yet
+  size_t out_len;
+  size_t out_off;
+  size_t out_size;
+  struct fifo sent;       // send times of the packets not answered yet
+  struct fifo waiting;    // plain connections: sizes of packets not sent yet
+  // framed replies: the header line being read, the chunk bytes to skip
+  char line[LINE_MAX_LEN];
+  size_t line_len;
+  unsigned long skip;
+  // plain replies: the packet in flight, the last bytes of the reply
+  char *expect;
+  size_t expect_len;
+  char *tail;
+  size_t tail_len;
+};
+
+struct replay {
+  int epfd;
+  struct addrinfo *addr;
+  struct replay_conn *conns;
+  size_t nopen;
+  double *latency_us;     // of each answered packet, in answer order
+  unsigned long answered;
+  unsigned long shed;     // turned away by the server, AESD_PROTO_BUSY
+  unsigned long failed;
+  unsigned long sent;
+  double slip_sum_us;
+  double slip_max_us;
+  unsigned long issued;
+};
+
+static void print_usage(const char *progname)
+{
+  printf("Usage: %s [options] <trace>\n", progname);
+  printf("Options: \n");
+  printf("\t -H <host> \t Server host (default localhost)\n");
+  printf("\t -p <port> \t Server port (default 9000)\n");
+  printf("\t -x <speedup> \t Replay <speedup> times faster than recorded,\n"
+         "\t\t\t fractions slow it down (default 1)\n");
+}
+
+static double now_us(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+static int fifo_push(struct fifo *fifo, double item)
+{
+  if (fifo->tail == fifo->size) {
+    if (fifo->head > 0) {
+      memmove(fifo->items, fifo->items + fifo->head,
+              (fifo->tail - fifo->head) * sizeof(double));
+      fifo->tail -= fifo->head;
+      fifo->head = 0;
+    } else {
+      size_t size = fifo->size ? 2 * fifo->size : 16;
+      double *grown = realloc(fifo->items, size * sizeof(double));
+      if (grown == NULL) {
+        return -1;
+      }
+      fifo->items = grown;
+      fifo->size = size;
+    }
+  }
+  fifo->items[fifo->tail++] = item;
+  return 0;
+}
+
+static size_t fifo_len(const struct fifo *fifo)
+{
+  return fifo->tail - fifo->head;
+}
+
+static double fifo_pop(struct fifo *fifo)
+{
+  return fifo->items[fifo->head++];
+}
+
+/*
+ * @brief  watches conn for replies, and for room to send while it has bytes
+ *         to send or is connecting
+ */
+static void conn_watch(struct replay *replay, struct replay_conn *conn)
+{
+  struct epoll_event ev = { 0 };
+
+  ev.events = EPOLLIN;
+  if (conn->state == CONN_CONNECTING || conn->out_off < conn->out_len) {
+    ev.events |= EPOLLOUT;
+  }
+  ev.data.ptr = conn;
+  epoll_ctl(replay->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+/*
+ * @brief  closes conn, the packets it has not had answered failed
+ */
+static void conn_close(struct replay *replay, struct replay_conn *conn)
+{
+  if (conn->state == CONN_CLOSED) {
+    return;
+  }
+  replay->failed += fifo_len(&conn->sent) + fifo_len(&conn->waiting);
+  if (conn->fd != -1) {
+    close(conn->fd);
+    conn->fd = -1;
+  }
+  if (conn->state != CONN_IDLE) {
+    replay->nopen--;
+  }
+  conn->state = CONN_CLOSED;
+  free(conn->out);
+  free(conn->sent.items);
+  free(conn->waiting.items);
+  free(conn->expect);
+  free(conn->tail);
+  conn->out = conn->expect = conn->tail = NULL;
+  conn->sent.items = conn->waiting.items = NULL;
+}
+
+static int conn_queue(struct replay_conn *conn, const char *data, size_t len)
+{
+  if (conn->out_off == conn->out_len) {
+    conn->out_off = conn->out_len = 0;
+  }
+  if (conn->out_len + len > conn->out_size) {
+    size_t size = conn->out_size ? conn->out_size : 4096;
+    char *grown;
+    while (size < conn->out_len + len) {
+      size *= 2;
+    }
+    grown = realloc(conn->out, size);
+    if (grown == NULL) {
+      return -1;
+    }
+    conn->out = grown;
+    conn->out_size = size;
+  }
+  memcpy(conn->out + conn->out_len, data, len);
+  conn->out_len += len;
+  return 0;
+}
+
+/*
+ * @brief  sends what conn has queued, as much as the socket takes
+ * @return 0 on success, -1 if the connection failed
+ */
+static int conn_flush(struct replay *replay, struct replay_conn *conn)
+{
+  ssize_t n;
+
+  if (conn->state != CONN_OPEN) {
+    return 0;
+  }
+  while (conn->out_off < conn->out_len) {
+    n = send(conn->fd, conn->out + conn->out_off, conn->out_len - conn->out_off,
+             MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else if (n == -1) {
+      conn_close(replay, conn);
+      return -1;
+    }
+    conn->out_off += n;
+  }
+  conn_watch(replay, conn);
+  return 0;
+}
+
+/*
+ * @brief  fills record with size bytes of packet number i of conn
+ */
+static void make_packet(char *record, size_t size, size_t conn, unsigned long i)
+{
+  char prefix[48];
+  int len = snprintf(prefix, sizeof(prefix), "replay-%zu-%lu-", conn, i);
+
+  if ((size_t) len > size - 1) {
+    len = size - 1;
+  }
+  memcpy(record, prefix, len);
+  memset(record + len, 'x', size - 1 - len);
+  record[size - 1] = '\n';
+}
+
+/*
+ * @brief  sends a packet of size bytes on conn
+ * @return 0 on success, -1 if the connection failed
+ */
+static int conn_send_packet(struct replay *replay, struct replay_conn *conn,
+                            size_t size)
+{
+  char *record = malloc(size);
+
+  if (record == NULL || fifo_push(&conn->sent, now_us()) == -1) {
+    free(record);
+    conn_close(replay, conn);
+    return -1;
+  }
+  make_packet(record, size, conn->id, conn->npackets++);
+  if (conn_queue(conn, record, size) == -1) {
+    free(record);
+    conn_close(replay, conn);
+    return -1;
+  }
+  replay->sent++;
+  if (conn->framed) {
+    free(record);
+  } else {
+    // a plain reply is complete once it ends with the packet
+    free(conn->expect);
+    conn->expect = record;
+    conn->expect_len = size;
+    conn->tail_len = 0;
+    free(conn->tail);
+    conn->tail = malloc(size);
+    if (conn->tail == NULL) {
+      conn_close(replay, conn);
+      return -1;
+    }
+  }
+  return conn_flush(replay, conn);
+}
+
+/*
+ * @brief  the packets of conn have been answered, close it if the trace did
+ */
+static void conn_idle(struct replay *replay, struct replay_conn *conn)
+{
+  if (conn->closing && fifo_len(&conn->sent) == 0 && fifo_len(&conn->waiting) == 0) {
+    conn_close(replay, conn);
+  }
+}
+
+/*
+ * @brief  the oldest n packets of conn were answered at now, or shed
+ */
+static void conn_answered(struct replay *replay, struct replay_conn *conn,
+                          unsigned long n, bool shed, double now)
+{
+  for (; n > 0 && fifo_len(&conn->sent) > 0; n--) {
+    double sent = fifo_pop(&conn->sent);
+    if (shed) {
+      replay->shed++;
+    } else {
+      replay->latency_us[replay->answered++] = now - sent;
+    }
+  }
+}
+
+/*
+ * @brief  the server turned conn away, its packets are shed, those sent
+ *         and those the trace has yet to send
+ */
+static void conn_turned_away(struct replay *replay, struct replay_conn *conn,
+                             double now)
+{
+  conn_answered(replay, conn, fifo_len(&conn->sent), true, now);
+  replay->shed += fifo_len(&conn->waiting);
+  conn->waiting.head = conn->waiting.tail;
+  conn->turned_away = true;
+}
+
+/*
+ * @brief  handles a line of a framed reply, the ack, a chunk header or the end
+ * @return 0 on success, -1 if it is not one
+ */
+static int framed_line(struct replay *replay, struct replay_conn *conn, double now)
+{
+  unsigned long a;
+  unsigned long b;
+  int n;
+
+  // a connection turned away gets AESD_PROTO_BUSY in place of the ack
+  if (!conn->acked && !strcmp(conn->line, AESD_PROTO_BUSY "\n")) {
+    conn_turned_away(replay, conn, now);
+    return 0;
+  }
+  if (!conn->acked) {
+    conn->acked = (!strcmp(conn->line, AESD_PROTO_ACK) ||
+                   !strcmp(conn->line, AESD_PROTO_ACK_LZ4));
+    return conn->acked ? 0 : -1;
+  }
+  if (!strncmp(conn->line, AESD_PROTO_BUSY, strlen(AESD_PROTO_BUSY))) {
+    conn_answered(replay, conn, strtoul(conn->line + strlen(AESD_PROTO_BUSY), NULL, 10),
+                  true, now);
+    return 0;
+  }
+  // "<len>", "<clen> <rawlen>" when compressed, or "0 <packets>" at the end
+  n = sscanf(conn->line, "%lu %lu", &a, &b);
+  if (n == 2 && a == 0) {
+    conn_answered(replay, conn, b, false, now);
+  } else if (n >= 1 && a > 0) {
+    conn->skip = a;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * @brief  reads a framed reply from buf, skipping the log it carries
+ * @return 0 on success, -1 on a protocol error
+ */
+static int framed_input(struct replay *replay, struct replay_conn *conn,
+                        const char *buf, size_t len, double now)
+{
+  size_t i = 0;
+  size_t k;
+
+  while (i < len) {
+    if (conn->skip > 0) {
+      k = (len - i < conn->skip) ? len - i : conn->skip;
+      i += k;
+      conn->skip -= k;
+      continue;
+    }
+    if (conn->line_len == LINE_MAX_LEN - 1) {
+      return -1;
+    }
+    conn->line[conn->line_len++] = buf[i];
+    if (buf[i++] == '\n') {
+      conn->line[conn->line_len] = '\0';
+      conn->line_len = 0;
+      if (framed_line(replay, conn, now) == -1) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * @brief  reads a plain reply from buf, keeping its last bytes to tell when
+ *         it ends with the packet in flight, then sends the next
+ * @return 0 on success, -1 if the connection failed
+ */
+static int plain_input(struct replay *replay, struct replay_conn *conn,
+                       const char *buf, size_t len, double now)
+{
+  size_t keep;
+
+  if (conn->expect == NULL) {
+    return 0;
+  }
+  if (len >= conn->expect_len) {
+    memcpy(conn->tail, buf + len - conn->expect_len, conn->expect_len);
+    conn->tail_len = conn->expect_len;
+  } else {
+    keep = conn->expect_len - len;
+    if (conn->tail_len > keep) {
+      memmove(conn->tail, conn->tail + conn->tail_len - keep, keep);
+      conn->tail_len = keep;
+    }
+    memcpy(conn->tail + conn->tail_len, buf, len);
+    conn->tail_len += len;
+  }
+  if (conn->tail_len < conn->expect_len ||
+      memcmp(conn->tail, conn->expect, conn->expect_len) != 0) {
+    return 0;
+  }
+  conn_answered(replay, conn, 1, false, now);
+  free(conn->expect);
+  conn->expect = NULL;
+  if (fifo_len(&conn->waiting) > 0) {
+    return conn_send_packet(replay, conn, (size_t) fifo_pop(&conn->waiting));
+  }
+  conn_idle(replay, conn);
+  return 0;
+}
+
+static void conn_input(struct replay *replay, struct replay_conn *conn)
+{
+  static char buf[RECV_SIZE];
+  double now;
+  ssize_t n;
+  int rc;
+
+  for (;;) {
+    n = recv(conn->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    } else if (n <= 0) {
+      // a plain connection turned away is closed after AESD_PROTO_BUSY
+      if (!conn->framed && conn->tail_len >= strlen(AESD_PROTO_BUSY "\n") &&
+          !memcmp(conn->tail + conn->tail_len - strlen(AESD_PROTO_BUSY "\n"),
+                  AESD_PROTO_BUSY "\n", strlen(AESD_PROTO_BUSY "\n"))) {
+        conn_turned_away(replay, conn, now_us());
+      }
+      conn_close(replay, conn);
+      return;
+    }
+    now = now_us();
+    rc = conn->framed ? framed_input(replay, conn, buf, n, now)
+                      : plain_input(replay, conn, buf, n, now);
+    if (rc == -1) {
+      if (conn->state != CONN_CLOSED) {
+        ERROR_LOG("connection %zu: unexpected reply", conn->id);
+        conn_close(replay, conn);
+      }
+      return;
+    }
+    if (conn->state == CONN_CLOSED) {
+      return;
+    }
+    if (conn->framed) {
+      conn_idle(replay, conn);
+      if (conn->state == CONN_CLOSED) {
+        return;
+      }
+    }
+  }
+}
+
+static void conn_output(struct replay *replay, struct replay_conn *conn)
+{
+  int err = 0;
+  socklen_t len = sizeof(err);
+
+  if (conn->state == CONN_CONNECTING) {
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+      ERROR_LOG("connection %zu: connect: %s", conn->id, strerror(err ? err : errno));
+      conn_close(replay, conn);
+      return;
+    }
+    conn->state = CONN_OPEN;
+  }
+  conn_flush(replay, conn);
+}
+
+static void conn_open(struct replay *replay, struct replay_conn *conn)
+{
+  struct epoll_event ev = { 0 };
+
+  conn->fd = socket(replay->addr->ai_family,
+                    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (conn->fd == -1) {
+    ERROR_LOG("socket: %s", strerror(errno));
+    conn->state = CONN_CLOSED;
+    return;
+  }
+  replay->nopen++;
+  conn->state = CONN_CONNECTING;
+  if (connect(conn->fd, replay->addr->ai_addr, replay->addr->ai_addrlen) == -1 &&
+      errno != EINPROGRESS) {
+    ERROR_LOG("connect: %s", strerror(errno));
+    conn_close(replay, conn);
+    return;
+  }
+  ev.events = EPOLLIN | EPOLLOUT;
+  ev.data.ptr = conn;
+  if (epoll_ctl(replay->epfd, EPOLL_CTL_ADD, conn->fd, &ev) == -1) {
+    ERROR_LOG("epoll_ctl: %s", strerror(errno));
+    conn_close(replay, conn);
+  }
+}
+
+/*
+ * @brief  issues event ev of the trace
+ */
+static void replay_event(struct replay *replay, const struct aesd_trace_event *ev)
+{
+  struct replay_conn *conn = &replay->conns[ev->conn];
+  const char *hello;
+
+  if (ev->type == AESD_TRACE_OPEN) {
+    if (conn->state == CONN_IDLE) {
+      conn_open(replay, conn);
+    }
+    return;
+  }
+  if (conn->state != CONN_CONNECTING && conn->state != CONN_OPEN) {
+    // turned away, failed, or its open was not recorded
+    if (ev->type == AESD_TRACE_PACKET && conn->turned_away) {
+      replay->shed++;
+    } else if (ev->type == AESD_TRACE_PACKET) {
+      replay->failed++;
+    }
+    return;
+  }
+  switch (ev->type) {
+    case AESD_TRACE_HELLO:
+      conn->framed = true;
+      hello = (ev->value & AESD_TRACE_FRAMED_LZ4) ? AESD_PROTO_HELLO_LZ4
+                                                   : AESD_PROTO_HELLO;
+      if (conn_queue(conn, hello, strlen(hello)) == -1) {
+        conn_close(replay, conn);
+        return;
+      }
+      conn_flush(replay, conn);
+      break;
+    case AESD_TRACE_PACKET:
+      if (ev->value == 0) {
+        break;
+      }
+      // a plain connection has one packet in flight at a time
+      if (!conn->framed && fifo_len(&conn->sent) > 0) {
+        if (fifo_push(&conn->waiting, ev->value) == -1) {
+          conn_close(replay, conn);
+        }
+        break;
+      }
+      conn_send_packet(replay, conn, ev->value);
+      break;
+    case AESD_TRACE_CLOSE:
+      conn->closing = true;
+      conn_idle(replay, conn);
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+ * @brief  waits at most wait_us for the sockets of the replay, to the
+ *         microsecond with epoll_pwait2() as gaps between packets are short,
+ *         otherwise rounded up to the millisecond
+ * @return the number of ready sockets, -1 on error
+ */
+static int wait_ready(struct replay *replay, struct epoll_event *ready, double wait_us)
+{
+#ifdef HAVE_EPOLL_PWAIT2
+  static bool no_pwait2 = false;
+  struct timespec timeout;
+  int n;
+
+  if (!no_pwait2) {
+    timeout.tv_sec = (time_t) (wait_us / 1e6);
+    timeout.tv_nsec = (long) ((wait_us - timeout.tv_sec * 1e6) * 1e3);
+    n = epoll_pwait2(replay->epfd, ready, MAX_EVENTS, &timeout, NULL);
+    if (n != -1 || errno != ENOSYS) {
+      return n;
+    }
+    no_pwait2 = true; // a kernel before 5.11
+  }
+#endif
+  return epoll_wait(replay->epfd, ready, MAX_EVENTS, (int) ((wait_us + 999) / 1e3));
+}
+
+/*
+ * @brief  replays the events, then waits for the last replies
+ * @return 0 on success, -1 on error
+ */
+static int run_replay(struct replay *replay, const struct aesd_trace_event *events,
+                      size_t nevents, size_t nconns, double speedup)
+{
+  struct epoll_event ready[MAX_EVENTS];
+  double start = now_us();
+  double due;
+  double now;
+  double wait_us;
+  double drain_end = 0;
+  size_t next = 0;
+  size_t i;
+  int n;
+
+  while (next < nevents || replay->nopen > 0) {
+    now = now_us();
+    for (; next < nevents; next++) {
+      due = start + events[next].time_us / speedup;
+      if (due > now) {
+        break;
+      }
+      replay->slip_sum_us += now - due;
+      if (now - due > replay->slip_max_us) {
+        replay->slip_max_us = now - due;
+      }
+      replay->issued++;
+      replay_event(replay, &events[next]);
+    }
+    if (next == nevents && replay->nopen == 0) {
+      break;
+    } else if (next == nevents) {
+      if (drain_end == 0) {
+        drain_end = now + DRAIN_TIMEOUT_S * 1e6;
+      } else if (now > drain_end) {
+        ERROR_LOG("%zu connections still waiting for replies, closing them",
+                  replay->nopen);
+        for (i = 0; i < nconns; i++) {
+          conn_close(replay, &replay->conns[i]);
+        }
+        break;
+      }
+      wait_us = drain_end - now;
+    } else {
+      wait_us = start + events[next].time_us / speedup - now;
+    }
+    n = wait_ready(replay, ready, wait_us);
+    if (n == -1 && errno != EINTR) {
+      ERROR_LOG("epoll wait: %s", strerror(errno));
+      return -1;
+    }
+    for (i = 0; i < (size_t) (n > 0 ? n : 0); i++) {
+      struct replay_conn *conn = ready[i].data.ptr;
+      if (conn->state != CONN_CLOSED && (ready[i].events & (EPOLLOUT | EPOLLERR))) {
+        conn_output(replay, conn);
+      }
+      if (conn->state != CONN_CLOSED && (ready[i].events & (EPOLLIN | EPOLLHUP))) {
+        conn_input(replay, conn);
+      }
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *host = "localhost";
+  const char *port = "9000";
+  double speedup = 1;
+  struct aesd_trace_event *events = NULL;
+  size_t nevents = 0;
+  size_t nconns = 0;
+  size_t npackets = 0;
+  struct replay replay = { 0 };
+  struct addrinfo hints;
+  struct rlimit limit;
+  double start;
+  double secs;
+  size_t i;
+  int opt;
+  int rc;
+
+  while ((opt = getopt(argc, argv, "H:p:x:")) != -1) {
+    switch (opt) {
+      case 'H': host = optarg; break;
+      case 'p': port = optarg; break;
+      case 'x': speedup = strtod(optarg, NULL); break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1 || !(speedup > 0)) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (aesd_trace_load(argv[optind], &events, &nevents, &nconns) == -1) {
+    return EXIT_FAILURE;
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &replay.addr) != 0) {
+    ERROR_LOG("could not resolve %s:%s", host, port);
+    free(events);
+    return EXIT_FAILURE;
+  }
+  // as many connections may be open at once as were in the trace
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  for (i = 0; i < nevents; i++) {
+    npackets += (events[i].type == AESD_TRACE_PACKET);
+  }
+  replay.conns = calloc(nconns ? nconns : 1, sizeof(struct replay_conn));
+  replay.latency_us = malloc((npackets ? npackets : 1) * sizeof(double));
+  replay.epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (replay.conns == NULL || replay.latency_us == NULL || replay.epfd == -1) {
+    ERROR_LOG("setup: %s", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < nconns; i++) {
+    replay.conns[i].id = i;
+    replay.conns[i].fd = -1;
+  }
+
+  start = now_us();
+  rc = run_replay(&replay, events, nevents, nconns, speedup);
+  secs = (now_us() - start) / 1e6;
+  if (rc == -1) {
+    return EXIT_FAILURE;
+  }
+
+  printf("%zu connections, %lu packets sent in %.3f s, trace of %.3f s at %gx\n",
+         nconns, replay.sent, secs, nevents ? events[nevents - 1].time_us / 1e6 : 0,
+         speedup);
+  printf("%lu answered, %lu shed, %lu failed\n", replay.answered, replay.shed,
+         replay.failed);
+  if (replay.answered > 0) {
+    double sum = 0;
+    double *lat = replay.latency_us;
+    unsigned long n = replay.answered;
+
+    qsort(lat, n, sizeof(double), compare_double);
+    for (i = 0; i < n; i++) {
+      sum += lat[i];
+    }
+    printf("latency us: mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+           sum / n, lat[n / 2], lat[n * 90 / 100], lat[n * 99 / 100],
+           lat[n * 999 / 1000], lat[n - 1]);
+  }
+  printf("schedule slip us: mean %.1f, max %.1f\n",
+         replay.slip_sum_us / (replay.issued ? replay.issued : 1), replay.slip_max_us);
+
+  close(replay.epfd);
+  freeaddrinfo(replay.addr);
+  free(replay.conns);
+  free(replay.latency_us);
+  free(events);
+  return replay.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,93 @@
+/* ----------------------------------------------------------------------------
+ * @file systemcalls-batch.c
+ * @brief runs many do_execv() commands concurrently on the aesd-sched
+ *        work-stealing scheduler
+ *
+ * Each command becomes one task.  A task spends nearly all its time in
+ * waitpid(), so nworkers is really the number of child processes allowed to
+ * run at once.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <pthread.h>
+#include "systemcalls-batch.h"
+#include "../../lib/aesd-sched.h"
+
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+
+struct batch_entry {
+  char * const *command;
+  bool result;
+};
+
+static void open_log(void)
+{
+  openlog(NULL, 0, LOG_USER);
+}
+
+static void batch_task(void *arg)
+{
+  struct batch_entry *entry = (struct batch_entry *) arg;
+  entry->result = do_execv(entry->command);
+}
+
+bool do_exec_batch(char * const *commands[], int count, bool results[],
+                   unsigned int nworkers)
+{
+  struct aesd_sched *sched;
+  struct aesd_task_group group;
+  struct batch_entry *entries;
+  bool retval = true;
+  long ncpus;
+  int i;
+
+  if (count <= 0) {
+    return true;
+  }
+  if (nworkers == 0) {
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nworkers = ncpus > 0 ? (unsigned int) ncpus : 1;
+  }
+  if (nworkers > (unsigned int) count) {
+    nworkers = (unsigned int) count;
+  }
+
+  pthread_once(&log_once, open_log);
+
+  entries = calloc(count, sizeof(struct batch_entry));
+  if (entries == NULL) {
+    syslog(LOG_ERR, "malloc fail");
+    return false;
+  }
+  sched = aesd_sched_create(nworkers);
+  if (sched == NULL) {
+    syslog(LOG_ERR, "could not start %u batch workers", nworkers);
+    free(entries);
+    return false;
+  }
+
+  aesd_task_group_init(&group);
+  for (i = 0; i < count; i++) {
+    entries[i].command = commands[i];
+    if (aesd_sched_submit(sched, &group, batch_task, &entries[i]) != 0) {
+      syslog(LOG_ERR, "could not queue command %d", i);
+      entries[i].result = false;
+    }
+  }
+  aesd_task_group_wait(sched, &group);
+  aesd_sched_destroy(sched);
+
+  for (i = 0; i < count; i++) {
+    if (results != NULL) {
+      results[i] = entries[i].result;
+    }
+    retval = retval && entries[i].result;
+  }
+
+  free(entries);
+  return retval;
+}
@@ -0,0 +1,27 @@
+/* ----------------------------------------------------------------------------
+ * @file systemcalls-batch.h
+ * @brief runs many do_execv() commands concurrently on the aesd-sched
+ *        work-stealing scheduler
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef SYSTEMCALLS_BATCH_H
+#define SYSTEMCALLS_BATCH_H
+
+#include <stdbool.h>
+#include "systemcalls.h"
+
+/**
+* @param commands - array of @param count NULL terminated argument vectors,
+* each executed as with do_execv()
+* @param results - if non-NULL, results[i] is set to the do_execv() result
+* of commands[i]
+* @param nworkers - number of commands allowed to run at once, 0 for one per
+* online CPU
+* @return true if every command was executed successfully, false if any
+* command failed or the batch could not be started
+*/
+bool do_exec_batch(char * const *commands[], int count, bool results[],
+                   unsigned int nworkers);
+
+#endif /* SYSTEMCALLS_BATCH_H */
@@ -69,9 +69,7 @@ bool do_exec(int count, ...)
   va_list args;
   va_start(args, count);
   char * command[count+1];
-  int i, status, rc;
-  bool retval = true;
-  pid_t pid;
+  int i;
 
   for(i=0; i<count; i++)
   {
@@ -82,6 +80,19 @@ bool do_exec(int count, ...)
 
   va_end(args);
 
+  return do_execv(command);
+}
+
+/**
+* @param command - NULL terminated argument vector, command[0] is the full path
+* to the command to execute.  See do_exec above.
+*/
+bool do_execv(char * const command[])
+{
+  int status, rc;
+  bool retval = true;
+  pid_t pid;
+
   /*
    *   Execute a system command by calling fork, execv(),
    *   and wait instead of system (see LSP page 161).
@@ -117,9 +128,7 @@ bool do_exec(int count, ...)
       syslog(LOG_ERR, "waitpid fail");
       retval = false;
 
-    }
-    
-    if ( !WIFEXITED(status) ) {
+    } else if ( !WIFEXITED(status) ) {
 
       syslog(LOG_ERR, "child process terminated abnormally");
       retval = false;
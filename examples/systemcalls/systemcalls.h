@@ -6,4 +6,6 @@ bool do_system(const char *command);
 
 bool do_exec(int count, ...);
 
+bool do_execv(char * const command[]);
+
 bool do_exec_redirect(const char *outputfile, int count, ...);
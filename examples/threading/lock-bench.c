@@ -0,0 +1,268 @@
+/* ----------------------------------------------------------------------------
+ * @file lock-bench.c
+ * @brief Lock contention benchmark for the aesd-lock implementations
+ * @usage ./lock-bench [-t threads] [-H hold_ns] [-T think_ns] [-d seconds]
+ *                     [-l mutex|ticket|mcs|adaptive] [-s]
+ *        Like threadfunc() in threading.c every thread repeatedly obtains a
+ *        shared lock, holds it for hold_ns and releases it, then "thinks"
+ *        for think_ns before trying again.  Holding and thinking busy-wait
+ *        unless -s is given, in which case the threads sleep instead.
+ *        Every lock type is measured unless -l selects some of them.
+ *        Reports throughput, fairness (Jain's index over per-thread
+ *        acquisitions, and the min/max thread share) and the distribution
+ *        of time spent waiting to acquire.
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "aesd-lock.h"
+
+// log-linear latency histogram: 16 buckets per power of two
+#define HIST_SUB_BITS (4)
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_SIZE (64 * HIST_SUB)
+
+struct bench_thread {
+  pthread_t thread;
+  unsigned long acquisitions;
+  uint64_t max_wait_ns;
+  uint64_t *hist;
+} __attribute__((aligned(64)));
+
+static struct aesd_lock bench_lock;
+static atomic_bool stop;
+static atomic_bool go;
+static unsigned long shared_counter; // only touched while holding bench_lock
+static long hold_ns = 1000;
+static long think_ns = 1000;
+static bool sleep_mode = false;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned int hist_index(uint64_t v)
+{
+  int msb;
+
+  if (v < HIST_SUB) {
+    return (unsigned int) v;
+  }
+  msb = 63 - __builtin_clzll(v);
+  return (msb - HIST_SUB_BITS + 1) * HIST_SUB +
+         (unsigned int) ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static uint64_t hist_value(unsigned int idx)
+{
+  unsigned int msb;
+
+  if (idx < HIST_SUB) {
+    return idx;
+  }
+  msb = idx / HIST_SUB + HIST_SUB_BITS - 1;
+  return (uint64_t) (HIST_SUB + idx % HIST_SUB) << (msb - HIST_SUB_BITS);
+}
+
+static void wait_ns(long ns)
+{
+  uint64_t until;
+
+  if (ns <= 0) {
+    return;
+  }
+  if (sleep_mode) {
+    struct timespec ts = { ns / 1000000000L, ns % 1000000000L };
+    nanosleep(&ts, NULL);
+    return;
+  }
+  until = now_ns() + ns;
+  while (now_ns() < until) {
+    // busy wait to model work done with or without the lock
+  }
+}
+
+static void* bench_threadfunc(void *param)
+{
+  struct bench_thread *self = (struct bench_thread *) param;
+  uint64_t start;
+  uint64_t acquired;
+
+  while (!atomic_load(&go)) {
+    sched_yield();
+  }
+
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    // obtain
+    start = now_ns();
+    aesd_lock_acquire(&bench_lock);
+    acquired = now_ns();
+
+    // hold, then release
+    shared_counter++;
+    wait_ns(hold_ns);
+    aesd_lock_release(&bench_lock);
+
+    self->hist[hist_index(acquired - start)]++;
+    if (acquired - start > self->max_wait_ns) {
+      self->max_wait_ns = acquired - start;
+    }
+    self->acquisitions++;
+
+    // think
+    wait_ns(think_ns);
+  }
+
+  return NULL;
+}
+
+static uint64_t percentile(const uint64_t *hist, unsigned long total, double pct)
+{
+  unsigned long target = (unsigned long) (total * pct);
+  unsigned long seen = 0;
+  unsigned int i;
+
+  for (i = 0; i < HIST_SIZE; i++) {
+    seen += hist[i];
+    if (seen > target) {
+      return hist_value(i);
+    }
+  }
+  return hist_value(HIST_SIZE - 1);
+}
+
+static int run_bench(enum aesd_lock_type type, unsigned int nthreads, double seconds)
+{
+  struct bench_thread *threads;
+  uint64_t *hist;
+  unsigned long total = 0;
+  unsigned long min = ~0ul;
+  unsigned long max = 0;
+  uint64_t max_wait = 0;
+  double sum_sq = 0;
+  double jain;
+  uint64_t start;
+  double elapsed;
+  unsigned int i;
+  unsigned int j;
+
+  threads = calloc(nthreads, sizeof(struct bench_thread));
+  hist = calloc(HIST_SIZE, sizeof(uint64_t));
+  if (threads == NULL || hist == NULL || aesd_lock_init(&bench_lock, type) != 0) {
+    printf("lock-bench ERROR: setup failed for %s\n", aesd_lock_type_name(type));
+    free(threads);
+    free(hist);
+    return -1;
+  }
+  atomic_store(&stop, false);
+  atomic_store(&go, false);
+  shared_counter = 0;
+
+  for (i = 0; i < nthreads; i++) {
+    threads[i].hist = calloc(HIST_SIZE, sizeof(uint64_t));
+    if (threads[i].hist == NULL ||
+        pthread_create(&threads[i].thread, NULL, bench_threadfunc, &threads[i]) != 0) {
+      printf("lock-bench ERROR: could not start thread %u\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  start = now_ns();
+  atomic_store(&go, true);
+  usleep((useconds_t) (seconds * 1e6));
+  atomic_store(&stop, true);
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(threads[i].thread, NULL);
+  }
+  elapsed = (now_ns() - start) / 1e9;
+
+  for (i = 0; i < nthreads; i++) {
+    unsigned long n = threads[i].acquisitions;
+    total += n;
+    sum_sq += (double) n * n;
+    if (n < min) min = n;
+    if (n > max) max = n;
+    if (threads[i].max_wait_ns > max_wait) max_wait = threads[i].max_wait_ns;
+    for (j = 0; j < HIST_SIZE; j++) {
+      hist[j] += threads[i].hist[j];
+    }
+    free(threads[i].hist);
+  }
+  jain = sum_sq > 0 ? ((double) total * total) / (nthreads * sum_sq) : 0;
+
+  printf("%-9s %7u %12.0f %6.3f %6.3f %6.3f %9lu %9lu %9lu %10lu %s\n",
+         aesd_lock_type_name(type), nthreads, total / elapsed, jain,
+         total ? (double) min * nthreads / total : 0,
+         total ? (double) max * nthreads / total : 0,
+         (unsigned long) percentile(hist, total, 0.50),
+         (unsigned long) percentile(hist, total, 0.99),
+         (unsigned long) percentile(hist, total, 0.999),
+         (unsigned long) max_wait,
+         shared_counter == total ? "ok" : "BROKEN");
+
+  aesd_lock_destroy(&bench_lock);
+  free(threads);
+  free(hist);
+  return shared_counter == total ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  int rc = 0;
+  int i;
+  unsigned int nthreads = 4;
+  double seconds = 2.0;
+  bool selected[AESD_LOCK_NUM_TYPES] = { false };
+  bool any_selected = false;
+  enum aesd_lock_type type;
+
+  while ((opt = getopt(argc, argv, "t:H:T:d:l:s")) != -1) {
+    switch (opt) {
+      case 't': nthreads = (unsigned int) strtoul(optarg, NULL, 0); break;
+      case 'H': hold_ns = atol(optarg); break;
+      case 'T': think_ns = atol(optarg); break;
+      case 'd': seconds = atof(optarg); break;
+      case 's': sleep_mode = true; break;
+      case 'l':
+        if (aesd_lock_type_from_name(optarg, &type) == 0) {
+          selected[type] = any_selected = true;
+          break;
+        }
+        // fall through, unknown lock type
+      default:
+        printf("Usage: %s [-t threads] [-H hold_ns] [-T think_ns] [-d seconds]"
+               " [-l mutex|ticket|mcs|adaptive] [-s]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (nthreads == 0) {
+    nthreads = 1;
+  }
+
+  printf("threads=%u hold_ns=%ld think_ns=%ld seconds=%.1f %s\n", nthreads, hold_ns,
+         think_ns, seconds, sleep_mode ? "sleeping" : "spinning");
+  printf("%-9s %7s %12s %6s %6s %6s %9s %9s %9s %10s %s\n", "lock", "threads", "acq/s",
+         "jain", "min", "max", "p50_ns", "p99_ns", "p999_ns", "max_ns", "check");
+
+  for (i = 0; i < AESD_LOCK_NUM_TYPES; i++) {
+    if (!any_selected || selected[i]) {
+      if (run_bench((enum aesd_lock_type) i, nthreads, seconds) != 0) {
+        rc = 1;
+      }
+    }
+  }
+
+  return rc;
+}
@@ -0,0 +1,154 @@
+/* ----------------------------------------------------------------------------
+ * @file sched-bench.c
+ * @brief Fine-grained task overhead of the aesd-sched work-stealing scheduler
+ * @usage ./sched-bench [-w workers] [-n tasks] [-D depth] [-W work_ns]
+ *        flat:    the main thread submits -n tasks and waits for them, so
+ *                 every task goes through the injection queue
+ *        tree:    one task recursively spawns two children down to -D levels
+ *                 and waits for them, exercising the per-worker deques and
+ *                 stealing
+ *        pthread: the flat workload with one pthread_create/join per task,
+ *                 for comparison with what threading.c does today
+ *        Each task busy-waits for -W ns (default 0, an empty task).
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "aesd-sched.h"
+
+static struct aesd_sched *sched;
+static long work_ns = 0;
+static atomic_long tasks_run;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void do_work(void)
+{
+  uint64_t until;
+
+  atomic_fetch_add_explicit(&tasks_run, 1, memory_order_relaxed);
+  if (work_ns <= 0) {
+    return;
+  }
+  until = now_ns() + work_ns;
+  while (now_ns() < until) {
+    // busy wait to model the task body
+  }
+}
+
+static void flat_task(void *arg)
+{
+  do_work();
+}
+
+static void* flat_thread(void *arg)
+{
+  do_work();
+  return NULL;
+}
+
+static void tree_task(void *arg)
+{
+  long depth = (long) (intptr_t) arg;
+  struct aesd_task_group group;
+
+  do_work();
+  if (depth <= 0) {
+    return;
+  }
+  aesd_task_group_init(&group);
+  aesd_sched_submit(sched, &group, tree_task, (void*) (intptr_t) (depth - 1));
+  aesd_sched_submit(sched, &group, tree_task, (void*) (intptr_t) (depth - 1));
+  aesd_task_group_wait(sched, &group);
+}
+
+static void report(const char *mode, unsigned long expected, uint64_t elapsed)
+{
+  long ran = atomic_load(&tasks_run);
+
+  printf("%-8s %10ld %12.1f %14.0f %s\n", mode, ran, (double) elapsed / (ran ? ran : 1),
+         ran * 1e9 / elapsed, (unsigned long) ran == expected ? "ok" : "BROKEN");
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  unsigned int nworkers = 4;
+  unsigned long ntasks = 1000000;
+  unsigned long npthreads;
+  long depth = 18;
+  struct aesd_task_group group;
+  pthread_t thread;
+  uint64_t start;
+  unsigned long i;
+
+  while ((opt = getopt(argc, argv, "w:n:D:W:")) != -1) {
+    switch (opt) {
+      case 'w': nworkers = (unsigned int) strtoul(optarg, NULL, 0); break;
+      case 'n': ntasks = strtoul(optarg, NULL, 0); break;
+      case 'D': depth = atol(optarg); break;
+      case 'W': work_ns = atol(optarg); break;
+      default:
+        printf("Usage: %s [-w workers] [-n tasks] [-D depth] [-W work_ns]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  sched = aesd_sched_create(nworkers);
+  if (sched == NULL) {
+    printf("sched-bench ERROR: could not start %u workers\n", nworkers);
+    return 1;
+  }
+
+  printf("workers=%u work_ns=%ld\n", aesd_sched_workers(sched), work_ns);
+  printf("%-8s %10s %12s %14s %s\n", "mode", "tasks", "ns/task", "tasks/s", "check");
+
+  // flat: external submission of independent tasks
+  atomic_store(&tasks_run, 0);
+  aesd_task_group_init(&group);
+  start = now_ns();
+  for (i = 0; i < ntasks; i++) {
+    if (aesd_sched_submit(sched, &group, flat_task, NULL) != 0) {
+      printf("sched-bench ERROR: submit failed\n");
+      return 1;
+    }
+  }
+  aesd_task_group_wait(sched, &group);
+  report("flat", ntasks, now_ns() - start);
+
+  // tree: nested spawn and wait from inside the workers
+  atomic_store(&tasks_run, 0);
+  aesd_task_group_init(&group);
+  start = now_ns();
+  aesd_sched_submit(sched, &group, tree_task, (void*) (intptr_t) depth);
+  aesd_task_group_wait(sched, &group);
+  report("tree", (2ul << depth) - 1, now_ns() - start);
+
+  aesd_sched_destroy(sched);
+
+  // pthread per task is far slower, keep its run short
+  npthreads = ntasks < 20000 ? ntasks : 20000;
+  atomic_store(&tasks_run, 0);
+  start = now_ns();
+  for (i = 0; i < npthreads; i++) {
+    if (pthread_create(&thread, NULL, flat_thread, NULL) != 0) {
+      printf("sched-bench ERROR: pthread_create failed\n");
+      return 1;
+    }
+    pthread_join(thread, NULL);
+  }
+  report("pthread", npthreads, now_ns() - start);
+
+  return 0;
+}
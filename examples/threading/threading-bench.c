@@ -0,0 +1,300 @@
+/* ----------------------------------------------------------------------------
+ * @file threading-bench.c
+ * @brief Compares thread-per-request against the worker pool and timer heap
+ * @usage ./threading-bench [-w workers] [-t timer_threads] [-m mutexes]
+ *                          [-o obtain_ms] [-r release_ms] [-M mode] [count ...]
+ *        runs 1000, 10000 and 100000 requests when no counts are given, in
+ *        every mode (thread, pool, timer) unless -M selects some of them.
+ *        Requests are spread round-robin over -m mutexes.  For timer mode the
+ *        lateness of each acquisition against its deadline is reported.
+ *        Every run happens in a forked child so the peak RSS reported for a
+ *        run belongs to that run alone.
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "threading.h"
+#include "threadpool.h"
+#include "threadtimer.h"
+
+struct bench_result {
+  double seconds;
+  unsigned long started;
+  unsigned long succeeded;
+  bool has_lateness;
+  long late_p50_us;
+  long late_p99_us;
+  long late_max_us;
+};
+
+static pthread_mutex_t *bench_mutexes;
+static unsigned int nmutexes = 1;
+static unsigned int workers = 4;
+static unsigned int timer_threads = 2;
+static int obtain_ms = 0;
+static int release_ms = 0;
+
+#define BENCH_MUTEX(i) (&bench_mutexes[(i) % nmutexes])
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// one pthread per request, exactly as a caller of threading.c would do it
+static void run_threads(unsigned long count, struct bench_result *res)
+{
+  unsigned long i;
+  pthread_t *threads = calloc(count, sizeof(pthread_t));
+  struct thread_data *data;
+
+  if (threads == NULL) {
+    return;
+  }
+  for (i = 0; i < count; i++) {
+    if (!start_thread_obtaining_mutex(&threads[i], BENCH_MUTEX(i), obtain_ms, release_ms)) {
+      break;
+    }
+  }
+  res->started = i;
+  for (i = 0; i < res->started; i++) {
+    pthread_join(threads[i], (void **) &data);
+    if (data->thread_complete_success) {
+      res->succeeded++;
+    }
+    free(data);
+  }
+  free(threads);
+}
+
+// the same requests queued on a pool of reusable workers
+static void run_pool(unsigned long count, struct bench_result *res)
+{
+  unsigned long i;
+  struct thread_pool pool;
+  thread_pool_handle_t *handles = calloc(count, sizeof(thread_pool_handle_t));
+  struct thread_data *data;
+
+  if (handles == NULL || !thread_pool_init(&pool, workers)) {
+    free(handles);
+    return;
+  }
+  for (i = 0; i < count; i++) {
+    if (!start_pooled_thread_obtaining_mutex(&pool, &handles[i], BENCH_MUTEX(i),
+                                             obtain_ms, release_ms)) {
+      break;
+    }
+  }
+  res->started = i;
+  for (i = 0; i < res->started; i++) {
+    data = thread_pool_join(&pool, handles[i]);
+    if (data->thread_complete_success) {
+      res->succeeded++;
+    }
+    free(data);
+  }
+  thread_pool_destroy(&pool);
+  free(handles);
+}
+
+static int compare_long(const void *a, const void *b)
+{
+  long la = *(const long *) a;
+  long lb = *(const long *) b;
+  return (la > lb) - (la < lb);
+}
+
+// delayed acquisitions registered with a few timer service threads
+static void run_timer(unsigned long count, struct bench_result *res)
+{
+  unsigned long i;
+  struct timer_sched sched;
+  timer_request_handle_t *handles = calloc(count, sizeof(timer_request_handle_t));
+  long *lateness = calloc(count, sizeof(long));
+  struct thread_data *data;
+
+  if (handles == NULL || lateness == NULL || !timer_sched_init(&sched, timer_threads)) {
+    free(handles);
+    free(lateness);
+    return;
+  }
+  for (i = 0; i < count; i++) {
+    if (!start_timed_obtaining_mutex(&sched, &handles[i], BENCH_MUTEX(i),
+                                     obtain_ms, release_ms)) {
+      break;
+    }
+  }
+  res->started = i;
+  for (i = 0; i < res->started; i++) {
+    data = timer_sched_join(&sched, handles[i]);
+    if (data->thread_complete_success) {
+      res->succeeded++;
+    }
+    lateness[i] = handles[i]->obtain_lateness_us;
+    free(data);
+  }
+  timer_sched_destroy(&sched);
+
+  if (res->started > 0) {
+    qsort(lateness, res->started, sizeof(long), compare_long);
+    res->has_lateness = true;
+    res->late_p50_us = lateness[res->started / 2];
+    res->late_p99_us = lateness[(res->started * 99) / 100];
+    res->late_max_us = lateness[res->started - 1];
+  }
+  free(handles);
+  free(lateness);
+}
+
+static int run_forked(const char *mode, unsigned long count,
+                      void (*run)(unsigned long, struct bench_result *))
+{
+  int fds[2];
+  pid_t pid;
+  int status;
+  struct rusage usage;
+  struct bench_result res;
+
+  if (pipe(fds) == -1) {
+    perror("pipe");
+    return -1;
+  }
+  fflush(stdout);
+  pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    return -1;
+  }
+  if (pid == 0) {
+    double start;
+    memset(&res, 0, sizeof(res));
+    close(fds[0]);
+    start = now_seconds();
+    run(count, &res);
+    res.seconds = now_seconds() - start;
+    if (write(fds[1], &res, sizeof(res)) != sizeof(res)) {
+      _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+  }
+
+  close(fds[1]);
+  memset(&res, 0, sizeof(res));
+  if (read(fds[0], &res, sizeof(res)) != sizeof(res)) {
+    res.seconds = -1;
+  }
+  close(fds[0]);
+  if (wait4(pid, &status, 0, &usage) == -1) {
+    perror("wait4");
+    return -1;
+  }
+
+  printf("%-8s %8lu %8lu %9lu %10.3f %12.0f %10ld", mode, count, res.started,
+         res.succeeded, res.seconds * 1e3,
+         res.seconds > 0 ? res.succeeded / res.seconds : 0.0, usage.ru_maxrss);
+  if (res.has_lateness) {
+    printf(" %8ld %8ld %8ld\n", res.late_p50_us, res.late_p99_us, res.late_max_us);
+  } else {
+    printf(" %8s %8s %8s\n", "-", "-", "-");
+  }
+  return 0;
+}
+
+static const struct {
+  const char *name;
+  void (*run)(unsigned long, struct bench_result *);
+} modes[] = {
+  { "thread", run_threads },
+  { "pool", run_pool },
+  { "timer", run_timer },
+};
+#define NUM_MODES (sizeof(modes) / sizeof(modes[0]))
+
+int main(int argc, char **argv)
+{
+  int opt;
+  int i;
+  unsigned int m;
+  bool selected[NUM_MODES] = { false };
+  bool any_selected = false;
+  unsigned long default_counts[] = { 1000, 10000, 100000 };
+  unsigned long *counts = default_counts;
+  int ncounts = 3;
+
+  while ((opt = getopt(argc, argv, "w:t:m:o:r:M:")) != -1) {
+    switch (opt) {
+      case 'w': workers = (unsigned int) strtoul(optarg, NULL, 0); break;
+      case 't': timer_threads = (unsigned int) strtoul(optarg, NULL, 0); break;
+      case 'm': nmutexes = (unsigned int) strtoul(optarg, NULL, 0); break;
+      case 'o': obtain_ms = atoi(optarg); break;
+      case 'r': release_ms = atoi(optarg); break;
+      case 'M':
+        for (m = 0; m < NUM_MODES; m++) {
+          if (!strcmp(optarg, modes[m].name)) {
+            selected[m] = any_selected = true;
+            break;
+          }
+        }
+        if (m < NUM_MODES) {
+          break;
+        }
+        // fall through, unknown mode
+      default:
+        printf("Usage: %s [-w workers] [-t timer_threads] [-m mutexes] [-o obtain_ms]"
+               " [-r release_ms] [-M thread|pool|timer] [count ...]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (nmutexes == 0) {
+    nmutexes = 1;
+  }
+
+  bench_mutexes = calloc(nmutexes, sizeof(pthread_mutex_t));
+  if (bench_mutexes == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  for (m = 0; m < nmutexes; m++) {
+    pthread_mutex_init(&bench_mutexes[m], NULL);
+  }
+
+  if (optind < argc) {
+    ncounts = argc - optind;
+    counts = calloc(ncounts, sizeof(unsigned long));
+    if (counts == NULL) {
+      perror("calloc");
+      return 1;
+    }
+    for (i = 0; i < ncounts; i++) {
+      counts[i] = strtoul(argv[optind + i], NULL, 0);
+    }
+  }
+
+  printf("workers=%u timer_threads=%u mutexes=%u obtain_ms=%d release_ms=%d\n",
+         workers, timer_threads, nmutexes, obtain_ms, release_ms);
+  printf("%-8s %8s %8s %9s %10s %12s %10s %8s %8s %8s\n", "mode", "requests", "started",
+         "succeeded", "ms", "requests/s", "maxrss_kb", "late_p50", "late_p99", "late_max");
+
+  for (i = 0; i < ncounts; i++) {
+    for (m = 0; m < NUM_MODES; m++) {
+      if (!any_selected || selected[m]) {
+        run_forked(modes[m].name, counts[i], modes[m].run);
+      }
+    }
+  }
+
+  if (counts != default_counts) {
+    free(counts);
+  }
+  free(bench_mutexes);
+  return 0;
+}
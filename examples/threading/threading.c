@@ -27,8 +27,8 @@ void* threadfunc(void* thread_param)
   // note that we cast the void* into a struct thread_data* 
   struct thread_data* tdata = (struct thread_data *) thread_param;
 
-  // wait to obtain mutex
-  rc = usleep(tdata->wait_to_obtain_ms*1000);
+  // wait to obtain mutex (usleep(0) would still cost a syscall)
+  rc = tdata->wait_to_obtain_ms ? usleep(tdata->wait_to_obtain_ms*1000) : 0;
   if (rc != 0) {
     ERROR_LOG("usleep failed, returned %s\n", strerror(rc));  
     completion_error = true;
@@ -42,7 +42,7 @@ void* threadfunc(void* thread_param)
   }
 
   // wait to release mutex
-  rc = usleep(tdata->wait_to_release_ms*1000);
+  rc = tdata->wait_to_release_ms ? usleep(tdata->wait_to_release_ms*1000) : 0;
   if (rc != 0) {
     ERROR_LOG("usleep failed, returned %s\n", strerror(rc));  
     completion_error = true;
@@ -5,6 +5,9 @@
  *         Dan Walkes
  *---------------------------------------------------------------------------*/
 
+#ifndef THREADING_H
+#define THREADING_H
+
 #include <stdbool.h>
 #include <pthread.h>
 
@@ -48,3 +51,13 @@ struct thread_data {
 * @return true if the thread could be started, false if a failure occurred.
 */
 bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex,int wait_to_obtain_ms, int wait_to_release_ms);
+
+/**
+* The thread body used by start_thread_obtaining_mutex.  Sleeps, obtains, holds and releases the
+* mutex described by @param thread_param (a struct thread_data*) and sets thread_complete_success
+* when every step succeeded.
+* @return thread_param
+*/
+void* threadfunc(void* thread_param);
+
+#endif /* THREADING_H */
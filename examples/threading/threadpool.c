@@ -0,0 +1,165 @@
+/* ----------------------------------------------------------------------------
+ * @file threadpool.c
+ * @brief A worker pool alternative to start_thread_obtaining_mutex
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "threadpool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ERROR_LOG(msg,...) printf("threadpool ERROR: " msg "\n" , ##__VA_ARGS__)
+
+static void* pool_worker(void* param)
+{
+  struct thread_pool *pool = (struct thread_pool *) param;
+  struct thread_pool_job *job;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true)
+  {
+    while (pool->head == NULL && !pool->shutdown) {
+      pthread_cond_wait(&pool->work_cond, &pool->lock);
+    }
+    if (pool->head == NULL) {
+      break; // shutdown requested and nothing left to run
+    }
+
+    // pop the oldest job
+    job = pool->head;
+    pool->head = job->next;
+    if (pool->head == NULL) {
+      pool->tail = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    // run exactly the body a dedicated thread would have run
+    threadfunc(&job->data);
+
+    pthread_mutex_lock(&pool->lock);
+    job->done = true;
+    pthread_cond_broadcast(&pool->done_cond);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+
+bool thread_pool_init(struct thread_pool *pool, unsigned int nworkers)
+{
+  int rc;
+  unsigned int i;
+
+  if (pool == NULL || nworkers == 0) {
+    return false;
+  }
+
+  memset(pool, 0, sizeof(*pool));
+  pool->workers = calloc(nworkers, sizeof(pthread_t));
+  if (pool->workers == NULL) {
+    ERROR_LOG("calloc fail for workers, returned NULL");
+    return false;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+
+  for (i = 0; i < nworkers; i++) {
+    rc = pthread_create(&pool->workers[i], NULL, pool_worker, pool);
+    if (rc != 0) {
+      ERROR_LOG("pthread_create fail, returned %s", strerror(rc));
+      break;
+    }
+    pool->nworkers++;
+  }
+
+  if (pool->nworkers != nworkers) {
+    thread_pool_destroy(pool);
+    return false;
+  }
+  return true;
+}
+
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+  unsigned int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->nworkers; i++) {
+    pthread_join(pool->workers[i], NULL);
+  }
+
+  free(pool->workers);
+  pool->workers = NULL;
+  pool->nworkers = 0;
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+
+bool start_pooled_thread_obtaining_mutex(struct thread_pool *pool, thread_pool_handle_t *handle,
+                                         pthread_mutex_t *mutex, int wait_to_obtain_ms,
+                                         int wait_to_release_ms)
+{
+  struct thread_pool_job *job;
+
+  // same argument checks as start_thread_obtaining_mutex
+  if (wait_to_obtain_ms < 0 || wait_to_release_ms < 0 || pool == NULL ||
+      handle == NULL || mutex == NULL) {
+    return false;
+  }
+
+  job = (struct thread_pool_job *) malloc(sizeof(struct thread_pool_job));
+  if (job == NULL) {
+    ERROR_LOG("malloc fail for job, returned NULL");
+    return false;
+  }
+  job->data.mutex_pass_to_thread = mutex;
+  job->data.wait_to_obtain_ms = (unsigned int) wait_to_obtain_ms;
+  job->data.wait_to_release_ms = (unsigned int) wait_to_release_ms;
+  job->data.thread_complete_success = false;
+  job->done = false;
+  job->next = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->shutdown) {
+    pthread_mutex_unlock(&pool->lock);
+    free(job);
+    return false;
+  }
+  if (pool->tail != NULL) {
+    pool->tail->next = job;
+  } else {
+    pool->head = job;
+  }
+  pool->tail = job;
+  pthread_cond_signal(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  *handle = job;
+  return true;
+}
+
+
+struct thread_data* thread_pool_join(struct thread_pool *pool, thread_pool_handle_t handle)
+{
+  if (pool == NULL || handle == NULL) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  while (!handle->done) {
+    pthread_cond_wait(&pool->done_cond, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return &handle->data;
+}
@@ -0,0 +1,75 @@
+/* ----------------------------------------------------------------------------
+ * @file threadpool.h
+ * @brief A worker pool alternative to start_thread_obtaining_mutex
+ *
+ * start_thread_obtaining_mutex() creates one pthread (and one stack) per
+ * request.  The functions below run the same threadfunc() body on a fixed
+ * set of reusable worker threads instead, so the number of outstanding
+ * requests is limited by memory for a small job record, not by thread
+ * stacks or the process thread limit.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include "threading.h"
+
+/**
+ * A single queued request.  The thread_data member must stay first so the
+ * pointer returned by thread_pool_join() can be passed straight to free(),
+ * exactly as with the pointer returned through pthread_join().
+ */
+struct thread_pool_job {
+    struct thread_data data;
+    bool done;
+    struct thread_pool_job *next;
+};
+
+typedef struct thread_pool_job *thread_pool_handle_t;
+
+struct thread_pool {
+    pthread_t *workers;
+    unsigned int nworkers;
+
+    pthread_mutex_t lock;         // protects everything below
+    pthread_cond_t work_cond;     // signalled when a job is queued
+    pthread_cond_t done_cond;     // broadcast when a job completes
+    struct thread_pool_job *head;
+    struct thread_pool_job *tail;
+    bool shutdown;
+};
+
+/**
+* Start @param nworkers worker threads servicing @param pool.
+* @return true on success, false if the workers could not be created.
+*/
+bool thread_pool_init(struct thread_pool *pool, unsigned int nworkers);
+
+/**
+* Let the workers finish every queued job, then stop and join them.  Jobs which
+* have not been joined by the caller are still owned (and must be freed) by the caller.
+*/
+void thread_pool_destroy(struct thread_pool *pool);
+
+/**
+* Same contract as start_thread_obtaining_mutex(), but the request is queued on
+* @param pool instead of receiving its own thread.  On success @param handle is
+* filled with a handle which must later be passed to thread_pool_join().
+* @return true if the request was queued, false if a failure occurred.
+*/
+bool start_pooled_thread_obtaining_mutex(struct thread_pool *pool, thread_pool_handle_t *handle,
+                                         pthread_mutex_t *mutex, int wait_to_obtain_ms,
+                                         int wait_to_release_ms);
+
+/**
+* Block until the request described by @param handle has completed.
+* @return the thread_data for the request, which the caller checks for
+* thread_complete_success and then frees, as with the pthread_join() return value.
+*/
+struct thread_data* thread_pool_join(struct thread_pool *pool, thread_pool_handle_t handle);
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,460 @@
+/* ----------------------------------------------------------------------------
+ * @file threadtimer.c
+ * @brief Timer driven alternative to start_thread_obtaining_mutex
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "threadtimer.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#define ERROR_LOG(msg,...) printf("threadtimer ERROR: " msg "\n" , ##__VA_ARGS__)
+
+#define BACKOFF_MIN_US (50)
+#define BACKOFF_MAX_US (2000)
+
+static void timespec_add_us(struct timespec *ts, long us)
+{
+  ts->tv_sec += us / 1000000;
+  ts->tv_nsec += (us % 1000000) * 1000;
+  if (ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
+
+static long timespec_diff_us(const struct timespec *a, const struct timespec *b)
+{
+  return (a->tv_sec - b->tv_sec) * 1000000L + (a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+static bool timespec_before(const struct timespec *a, const struct timespec *b)
+{
+  if (a->tv_sec != b->tv_sec) {
+    return a->tv_sec < b->tv_sec;
+  }
+  return a->tv_nsec < b->tv_nsec;
+}
+
+static bool deadline_before(const struct timer_request *a, const struct timer_request *b)
+{
+  return timespec_before(&a->deadline, &b->deadline);
+}
+
+// caller holds w->lock
+static bool heap_push(struct timer_worker *w, struct timer_request *req)
+{
+  size_t i;
+
+  if (w->heap_len == w->heap_cap) {
+    size_t cap = w->heap_cap ? w->heap_cap * 2 : 64;
+    struct timer_request **heap = realloc(w->heap, cap * sizeof(*heap));
+    if (heap == NULL) {
+      return false;
+    }
+    w->heap = heap;
+    w->heap_cap = cap;
+  }
+
+  // sift up
+  i = w->heap_len++;
+  while (i > 0 && deadline_before(req, w->heap[(i - 1) / 2])) {
+    w->heap[i] = w->heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  w->heap[i] = req;
+  return true;
+}
+
+// caller holds w->lock and has checked heap_len > 0
+static struct timer_request* heap_pop(struct timer_worker *w)
+{
+  struct timer_request *top = w->heap[0];
+  struct timer_request *last = w->heap[--w->heap_len];
+  size_t i = 0;
+  size_t child;
+
+  // sift down
+  while ((child = 2 * i + 1) < w->heap_len) {
+    if (child + 1 < w->heap_len && deadline_before(w->heap[child + 1], w->heap[child])) {
+      child++;
+    }
+    if (!deadline_before(w->heap[child], last)) {
+      break;
+    }
+    w->heap[i] = w->heap[child];
+    i = child;
+  }
+  if (w->heap_len > 0) {
+    w->heap[i] = last;
+  }
+  return top;
+}
+
+static void complete_request(struct timer_sched *sched, struct timer_request *req, bool success)
+{
+  pthread_mutex_lock(&sched->done_lock);
+  req->data.thread_complete_success = success;
+  req->done = true;
+  pthread_cond_broadcast(&sched->done_cond);
+  pthread_mutex_unlock(&sched->done_lock);
+}
+
+// completes req and every record parked behind it with an error
+static void fail_request(struct timer_sched *sched, struct timer_request *req)
+{
+  struct timer_request *waiter = req->waiters;
+  struct timer_request *next;
+
+  // req may be freed by its joiner as soon as it completes
+  complete_request(sched, req, false);
+  for (; waiter != NULL; waiter = next) {
+    next = waiter->next_waiter;
+    complete_request(sched, waiter, false);
+  }
+}
+
+static unsigned int mutex_hash(const pthread_mutex_t *mutex)
+{
+  return (unsigned int) (((uintptr_t) mutex) >> 4);
+}
+
+// the holders table is only ever touched by the worker's own thread
+static struct timer_request* find_holder(struct timer_worker *w, pthread_mutex_t *mutex)
+{
+  struct timer_request *holder;
+
+  holder = w->holders[mutex_hash(mutex) % TIMER_HOLDER_BUCKETS];
+  for (; holder != NULL; holder = holder->next_holder) {
+    if (holder->data.mutex_pass_to_thread == mutex) {
+      return holder;
+    }
+  }
+  return NULL;
+}
+
+static void add_holder(struct timer_worker *w, struct timer_request *req)
+{
+  struct timer_request **bucket;
+
+  bucket = &w->holders[mutex_hash(req->data.mutex_pass_to_thread) % TIMER_HOLDER_BUCKETS];
+  req->prev_holder = NULL;
+  req->next_holder = *bucket;
+  if (*bucket != NULL) {
+    (*bucket)->prev_holder = req;
+  }
+  *bucket = req;
+}
+
+static void remove_holder(struct timer_worker *w, struct timer_request *req)
+{
+  if (req->prev_holder != NULL) {
+    req->prev_holder->next_holder = req->next_holder;
+  } else {
+    w->holders[mutex_hash(req->data.mutex_pass_to_thread) % TIMER_HOLDER_BUCKETS] =
+      req->next_holder;
+  }
+  if (req->next_holder != NULL) {
+    req->next_holder->prev_holder = req->prev_holder;
+  }
+  req->next_holder = NULL;
+  req->prev_holder = NULL;
+}
+
+static void requeue_request(struct timer_sched *sched, struct timer_worker *w,
+                            struct timer_request *req)
+{
+  bool pushed;
+
+  pthread_mutex_lock(&w->lock);
+  pushed = heap_push(w, req);
+  pthread_mutex_unlock(&w->lock);
+
+  if (!pushed) {
+    ERROR_LOG("heap_push fail, request dropped");
+    if (req->holding) {
+      // hand the mutex back, nobody will be around to release it
+      pthread_mutex_unlock(req->data.mutex_pass_to_thread);
+      remove_holder(w, req);
+      req->holding = false;
+    }
+    fail_request(sched, req);
+  }
+}
+
+// park req (and whatever was parked behind it) behind holder
+static void park_request(struct timer_request *holder, struct timer_request *req)
+{
+  struct timer_request *tail = req->waiters ? req->waiters_tail : req;
+
+  req->next_waiter = req->waiters;
+  req->waiters = NULL;
+  req->waiters_tail = NULL;
+
+  if (holder->waiters_tail != NULL) {
+    holder->waiters_tail->next_waiter = req;
+  } else {
+    holder->waiters = req;
+  }
+  holder->waiters_tail = tail;
+}
+
+static void obtain_request(struct timer_sched *sched, struct timer_worker *w,
+                           struct timer_request *req, const struct timespec *now)
+{
+  struct timer_request *holder;
+  int rc;
+
+  rc = pthread_mutex_trylock(req->data.mutex_pass_to_thread);
+  if (rc == EBUSY) {
+    holder = find_holder(w, req->data.mutex_pass_to_thread);
+    if (holder != NULL) {
+      // one of our own records holds it, wait for its release
+      park_request(holder, req);
+      return;
+    }
+
+    // somebody else holds it, try again shortly
+    req->deadline = *now;
+    timespec_add_us(&req->deadline, req->backoff_us);
+    if (req->backoff_us < BACKOFF_MAX_US) {
+      req->backoff_us *= 2;
+    }
+    requeue_request(sched, w, req);
+    return;
+  } else if (rc != 0) {
+    ERROR_LOG("pthread_mutex_trylock failed, returned %s", strerror(rc));
+    fail_request(sched, req);
+    return;
+  }
+
+  req->obtain_lateness_us = timespec_diff_us(now, &req->obtain_deadline);
+  req->holding = true;
+  add_holder(w, req);
+  req->deadline = *now;
+  timespec_add_us(&req->deadline, req->data.wait_to_release_ms * 1000L);
+  requeue_request(sched, w, req);
+}
+
+static void release_request(struct timer_sched *sched, struct timer_worker *w,
+                            struct timer_request *req, const struct timespec *now)
+{
+  struct timer_request *next = req->waiters;
+  int rc;
+
+  rc = pthread_mutex_unlock(req->data.mutex_pass_to_thread);
+  if (rc != 0) {
+    ERROR_LOG("pthread_mutex_unlock failed, returned %s", strerror(rc));
+  }
+  remove_holder(w, req);
+  req->release_lateness_us = timespec_diff_us(now, &req->deadline);
+  req->holding = false;
+
+  if (next != NULL) {
+    // the first parked record is due right away and carries the rest with it
+    next->waiters = next->next_waiter;
+    next->waiters_tail = next->waiters ? req->waiters_tail : NULL;
+    next->next_waiter = NULL;
+    next->deadline = *now;
+    requeue_request(sched, w, next);
+  }
+
+  complete_request(sched, req, rc == 0);
+}
+
+struct worker_arg {
+  struct timer_sched *sched;
+  struct timer_worker *w;
+};
+
+static void* timer_worker_thread(void *param)
+{
+  struct timer_sched *sched = ((struct worker_arg *) param)->sched;
+  struct timer_worker *w = ((struct worker_arg *) param)->w;
+  struct timer_request *req;
+  struct timespec now;
+
+  free(param);
+
+  pthread_mutex_lock(&w->lock);
+  while (true)
+  {
+    if (w->heap_len == 0) {
+      if (w->shutdown) {
+        break;
+      }
+      pthread_cond_wait(&w->cond, &w->lock);
+      continue;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (timespec_before(&now, &w->heap[0]->deadline)) {
+      // earliest deadline is in the future, sleep until it (or a new earlier one)
+      pthread_cond_timedwait(&w->cond, &w->lock, &w->heap[0]->deadline);
+      continue;
+    }
+
+    req = heap_pop(w);
+    pthread_mutex_unlock(&w->lock);
+    if (req->holding) {
+      release_request(sched, w, req, &now);
+    } else {
+      obtain_request(sched, w, req, &now);
+    }
+    pthread_mutex_lock(&w->lock);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  return NULL;
+}
+
+
+bool timer_sched_init(struct timer_sched *sched, unsigned int nworkers)
+{
+  int rc;
+  unsigned int i;
+  pthread_condattr_t attr;
+
+  if (sched == NULL || nworkers == 0) {
+    return false;
+  }
+
+  memset(sched, 0, sizeof(*sched));
+  sched->workers = calloc(nworkers, sizeof(struct timer_worker));
+  if (sched->workers == NULL) {
+    ERROR_LOG("calloc fail for workers, returned NULL");
+    return false;
+  }
+  pthread_mutex_init(&sched->done_lock, NULL);
+  pthread_cond_init(&sched->done_cond, NULL);
+
+  // deadlines are CLOCK_MONOTONIC, so the timed waits must be too
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+  for (i = 0; i < nworkers; i++) {
+    struct timer_worker *w = &sched->workers[i];
+    struct worker_arg *arg = malloc(sizeof(struct worker_arg));
+    if (arg == NULL) {
+      ERROR_LOG("malloc fail for worker_arg, returned NULL");
+      break;
+    }
+    arg->sched = sched;
+    arg->w = w;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, &attr);
+    rc = pthread_create(&w->thread, NULL, timer_worker_thread, arg);
+    if (rc != 0) {
+      ERROR_LOG("pthread_create fail, returned %s", strerror(rc));
+      pthread_cond_destroy(&w->cond);
+      pthread_mutex_destroy(&w->lock);
+      free(arg);
+      break;
+    }
+    sched->nworkers++;
+  }
+  pthread_condattr_destroy(&attr);
+
+  if (sched->nworkers != nworkers) {
+    timer_sched_destroy(sched);
+    return false;
+  }
+  return true;
+}
+
+
+void timer_sched_destroy(struct timer_sched *sched)
+{
+  unsigned int i;
+
+  for (i = 0; i < sched->nworkers; i++) {
+    struct timer_worker *w = &sched->workers[i];
+    pthread_mutex_lock(&w->lock);
+    w->shutdown = true;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+  }
+
+  for (i = 0; i < sched->nworkers; i++) {
+    struct timer_worker *w = &sched->workers[i];
+    pthread_join(w->thread, NULL);
+    free(w->heap);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+  }
+
+  free(sched->workers);
+  sched->workers = NULL;
+  sched->nworkers = 0;
+  pthread_cond_destroy(&sched->done_cond);
+  pthread_mutex_destroy(&sched->done_lock);
+}
+
+
+bool start_timed_obtaining_mutex(struct timer_sched *sched, timer_request_handle_t *handle,
+                                 pthread_mutex_t *mutex, int wait_to_obtain_ms,
+                                 int wait_to_release_ms)
+{
+  struct timer_request *req;
+  struct timer_worker *w;
+  bool pushed;
+
+  // same argument checks as start_thread_obtaining_mutex
+  if (wait_to_obtain_ms < 0 || wait_to_release_ms < 0 || sched == NULL ||
+      handle == NULL || mutex == NULL) {
+    return false;
+  }
+
+  req = (struct timer_request *) calloc(1, sizeof(struct timer_request));
+  if (req == NULL) {
+    ERROR_LOG("calloc fail for timer_request, returned NULL");
+    return false;
+  }
+  req->data.mutex_pass_to_thread = mutex;
+  req->data.wait_to_obtain_ms = (unsigned int) wait_to_obtain_ms;
+  req->data.wait_to_release_ms = (unsigned int) wait_to_release_ms;
+  req->data.thread_complete_success = false;
+  req->backoff_us = BACKOFF_MIN_US;
+  // every request for one mutex goes to the same service thread
+  req->worker = mutex_hash(mutex) % sched->nworkers;
+
+  clock_gettime(CLOCK_MONOTONIC, &req->obtain_deadline);
+  timespec_add_us(&req->obtain_deadline, wait_to_obtain_ms * 1000L);
+  req->deadline = req->obtain_deadline;
+
+  w = &sched->workers[req->worker];
+  pthread_mutex_lock(&w->lock);
+  pushed = !w->shutdown && heap_push(w, req);
+  if (pushed && w->heap[0] == req) {
+    // new earliest deadline, the service thread must shorten its sleep
+    pthread_cond_signal(&w->cond);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  if (!pushed) {
+    free(req);
+    return false;
+  }
+
+  *handle = req;
+  return true;
+}
+
+
+struct thread_data* timer_sched_join(struct timer_sched *sched, timer_request_handle_t handle)
+{
+  if (sched == NULL || handle == NULL) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&sched->done_lock);
+  while (!handle->done) {
+    pthread_cond_wait(&sched->done_cond, &sched->done_lock);
+  }
+  pthread_mutex_unlock(&sched->done_lock);
+
+  return &handle->data;
+}
@@ -0,0 +1,114 @@
+/* ----------------------------------------------------------------------------
+ * @file threadtimer.h
+ * @brief Timer driven alternative to start_thread_obtaining_mutex
+ *
+ * Instead of parking a thread in usleep() for wait_to_obtain_ms and again
+ * for wait_to_release_ms, each request is a small record kept in a deadline
+ * ordered heap.  A few service threads sleep until the earliest deadline,
+ * obtain or release the mutex for the record which is due and re-queue it
+ * for its next deadline.  Pending requests therefore cost one record each,
+ * not a thread stack.
+ *
+ * A record is pinned to one service thread so the thread which obtained a
+ * mutex is also the one that releases it, and every request for the same
+ * mutex is placed on the same service thread.  Service threads never block
+ * on a mutex (that would stall every other deadline on the same heap): a
+ * request finding its mutex held by another record of the same service
+ * thread is parked behind that holder and handed the mutex as soon as it is
+ * released; a mutex held by some unrelated thread is retried with a short
+ * backoff.  Either way a request obtains the mutex as soon as possible after
+ * its deadline, just as the blocking pthread_mutex_lock() in threadfunc()
+ * would.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef THREADTIMER_H
+#define THREADTIMER_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include "threading.h"
+
+/**
+ * A single scheduled request.  The thread_data member must stay first so the
+ * pointer returned by timer_sched_join() can be passed straight to free().
+ */
+struct timer_request {
+    struct thread_data data;
+    struct timespec obtain_deadline; // when the mutex should be obtained
+    struct timespec deadline;        // next time this record is due
+    unsigned int backoff_us;         // retry delay while the mutex is busy
+    unsigned int worker;             // index of the owning service thread
+    bool holding;                    // the mutex is currently held
+    bool done;
+
+    struct timer_request *next_holder;   // worker's table of holding records
+    struct timer_request *prev_holder;
+    struct timer_request *waiters;       // records parked behind this holder
+    struct timer_request *waiters_tail;
+    struct timer_request *next_waiter;
+
+    /**
+     * How late (in microseconds) the mutex was obtained and released relative
+     * to the requested deadlines, for measuring scheduling accuracy.
+     */
+    long obtain_lateness_us;
+    long release_lateness_us;
+};
+
+typedef struct timer_request *timer_request_handle_t;
+
+#define TIMER_HOLDER_BUCKETS (256)
+
+struct timer_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;           // protects heap and shutdown
+    pthread_cond_t cond;            // signalled when the earliest deadline changes
+    struct timer_request **heap;    // binary min-heap ordered by deadline
+    size_t heap_len;
+    size_t heap_cap;
+    struct timer_request *holders[TIMER_HOLDER_BUCKETS]; // holding records by mutex
+    bool shutdown;
+};
+
+struct timer_sched {
+    struct timer_worker *workers;
+    unsigned int nworkers;
+
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;       // broadcast when a request completes
+};
+
+/**
+* Start @param nworkers service threads for @param sched.
+* @return true on success, false if the service threads could not be created.
+*/
+bool timer_sched_init(struct timer_sched *sched, unsigned int nworkers);
+
+/**
+* Let every pending request reach its release deadline, then stop and join
+* the service threads.  Requests which have not been joined are still owned
+* (and must be freed) by the caller.
+*/
+void timer_sched_destroy(struct timer_sched *sched);
+
+/**
+* Same contract as start_thread_obtaining_mutex(), but the request is registered
+* with the timer heap of one of the service threads.  On success @param handle
+* is filled with a handle which must later be passed to timer_sched_join().
+* @return true if the request was scheduled, false if a failure occurred.
+*/
+bool start_timed_obtaining_mutex(struct timer_sched *sched, timer_request_handle_t *handle,
+                                 pthread_mutex_t *mutex, int wait_to_obtain_ms,
+                                 int wait_to_release_ms);
+
+/**
+* Block until the request described by @param handle has released its mutex.
+* @return the thread_data for the request, which the caller checks for
+* thread_complete_success and then frees.
+*/
+struct thread_data* timer_sched_join(struct timer_sched *sched, timer_request_handle_t handle);
+
+#endif /* THREADTIMER_H */
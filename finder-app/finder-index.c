@@ -0,0 +1,757 @@
+/* ----------------------------------------------------------------------------
+ * @file finder-index.c
+ * @brief Persistent trigram index of a directory tree for finder -x
+ * @author Jake Michael, jami1063@colorado.edu
+ * @resources
+ * (+)  Russ Cox, "Regular Expression Matching with a Trigram Index or How
+ *      Google Code Search Worked", https://swtch.com/~rsc/regexp/regexp4.html
+ *---------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include "finder-index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define NUM_TRIGRAMS (1u << 24)
+#define READ_CHUNK (256 * 1024)
+// NUL bytes in this much of the start of a file make it binary, see finder.c
+#define BINARY_CHECK_SIZE (64 * 1024)
+// compact a file's trigram list once it holds this many unsorted entries
+#define TRIGRAM_COMPACT (1u << 20)
+
+struct finder_index {
+  const char *map;
+  size_t size;
+  const struct finder_index_header *hdr;
+  const struct finder_index_file *files;
+  const struct finder_index_trigram *trigrams;
+  const unsigned char *postings;
+  const char *strings;
+};
+
+// one file of an index being built
+struct build_file {
+  char *path;
+  uint64_t size;
+  int64_t mtime_ns;
+  uint32_t flags;
+  uint32_t ntris;
+  uint32_t *tris;             // sorted, unique
+};
+
+// a file of the old index, for reuse when it did not change
+struct old_file {
+  const char *path;           // points into old_strings
+  uint64_t size;
+  int64_t mtime_ns;
+  uint32_t flags;
+  uint32_t ntris;
+  uint32_t *tris;             // NULL once moved to a build_file
+};
+
+struct finder_index_builder {
+  char *root;
+
+  pthread_mutex_t lock;       // protects files, nfiles, capacity
+  struct build_file *files;
+  size_t nfiles;
+  size_t capacity;
+  unsigned long files_read;
+
+  // old index files hashed by path, open addressing
+  struct old_file *old;
+  size_t nold;
+  uint32_t *old_slots;        // index + 1 into old, 0 for empty
+  size_t old_nslots;
+  char *old_strings;          // copy of the old path strings
+};
+
+/* ============================================================================
+ *    HELPERS
+ * ===========================================================================*/
+
+static uint64_t hash_path(const char *path)
+{
+  // FNV-1a
+  uint64_t h = 1469598103934665603ull;
+  while (*path) {
+    h ^= (unsigned char) *path++;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+static uint32_t sort_unique(uint32_t *v, uint32_t n)
+{
+  uint32_t i;
+  uint32_t out = 0;
+
+  if (n == 0)
+    return 0;
+  qsort(v, n, sizeof(uint32_t), compare_u32);
+  for (i = 1; i < n; i++) {
+    if (v[i] != v[out])
+      v[++out] = v[i];
+  }
+  return out + 1;
+}
+
+static const unsigned char *varint_decode(const unsigned char *p, uint32_t *value)
+{
+  uint32_t v = 0;
+  int shift = 0;
+
+  while (*p & 0x80) {
+    v |= (uint32_t) (*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+  *value = v | ((uint32_t) *p++ << shift);
+  return p;
+}
+
+static size_t varint_encode(unsigned char *p, uint32_t value)
+{
+  size_t n = 0;
+
+  while (value >= 0x80) {
+    p[n++] = (unsigned char) (value | 0x80);
+    value >>= 7;
+  }
+  p[n++] = (unsigned char) value;
+  return n;
+}
+
+/* ============================================================================
+ *    QUERYING
+ * ===========================================================================*/
+
+struct finder_index *finder_index_open(const char *path)
+{
+  struct finder_index *index;
+  const struct finder_index_header *hdr;
+  struct stat st;
+  void *map;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+  if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(struct finder_index_header)) {
+    close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  hdr = (const struct finder_index_header *) map;
+  if (memcmp(hdr->magic, FINDER_INDEX_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->total_size != (uint64_t) st.st_size ||
+      hdr->strings_off > hdr->files_off || hdr->files_off > hdr->trigrams_off ||
+      hdr->trigrams_off > hdr->postings_off || hdr->postings_off > hdr->total_size ||
+      hdr->files_off + hdr->nfiles * sizeof(struct finder_index_file) > hdr->trigrams_off ||
+      hdr->trigrams_off + hdr->ntrigrams * sizeof(struct finder_index_trigram) >
+      hdr->postings_off) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  index = calloc(1, sizeof(struct finder_index));
+  if (index == NULL) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  index->map = map;
+  index->size = st.st_size;
+  index->hdr = hdr;
+  index->strings = index->map + hdr->strings_off;
+  index->files = (const struct finder_index_file *) (index->map + hdr->files_off);
+  index->trigrams = (const struct finder_index_trigram *) (index->map + hdr->trigrams_off);
+  index->postings = (const unsigned char *) index->map + hdr->postings_off;
+  return index;
+}
+
+void finder_index_close(struct finder_index *index)
+{
+  if (index == NULL) {
+    return;
+  }
+  munmap((void *) index->map, index->size);
+  free(index);
+}
+
+const char *finder_index_root(const struct finder_index *index)
+{
+  return index->strings;
+}
+
+unsigned long finder_index_num_files(const struct finder_index *index)
+{
+  return index->hdr->nfiles;
+}
+
+const char *finder_index_path(const struct finder_index *index, uint32_t id)
+{
+  return index->strings + index->files[id].path_off;
+}
+
+bool finder_index_file_changed(const struct finder_index *index, uint32_t id)
+{
+  const struct finder_index_file *f = &index->files[id];
+  struct stat st;
+
+  // as the walk sees it, a symbolic link is not followed
+  if (fstatat(AT_FDCWD, finder_index_path(index, id), &st, AT_SYMLINK_NOFOLLOW) == -1) {
+    return false;
+  }
+  return (uint64_t) st.st_size != f->size ||
+         (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec != f->mtime_ns;
+}
+
+static const struct finder_index_trigram *find_trigram(const struct finder_index *index,
+                                                       uint32_t trigram)
+{
+  size_t lo = 0;
+  size_t hi = index->hdr->ntrigrams;
+  size_t mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (index->trigrams[mid].trigram < trigram) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < index->hdr->ntrigrams && index->trigrams[lo].trigram == trigram) {
+    return &index->trigrams[lo];
+  }
+  return NULL;
+}
+
+static int compare_trigram_nfiles(const void *a, const void *b)
+{
+  const struct finder_index_trigram *x = *(const struct finder_index_trigram *const *) a;
+  const struct finder_index_trigram *y = *(const struct finder_index_trigram *const *) b;
+  return (x->nfiles > y->nfiles) - (x->nfiles < y->nfiles);
+}
+
+long finder_index_candidates(const struct finder_index *index, const char *literal,
+                             size_t len, uint32_t **ids)
+{
+  const struct finder_index_trigram **lists = NULL;
+  const unsigned char *p;
+  uint32_t *result = NULL;
+  uint32_t *tris = NULL;
+  uint32_t ntris;
+  uint32_t id;
+  uint32_t delta;
+  uint32_t i;
+  uint32_t j;
+  long count = 0;
+  long kept;
+  long k;
+
+  *ids = NULL;
+
+  if (len < 3) {
+    // no trigram to filter on, every text file is a candidate
+    result = malloc(sizeof(uint32_t) * (index->hdr->nfiles ? index->hdr->nfiles : 1));
+    if (result == NULL)
+      return -1;
+    for (id = 0; id < index->hdr->nfiles; id++) {
+      if (!(index->files[id].flags & FINDER_INDEX_FILE_BINARY))
+        result[count++] = id;
+    }
+    *ids = result;
+    return count;
+  }
+
+  tris = malloc(sizeof(uint32_t) * (len - 2));
+  lists = malloc(sizeof(*lists) * (len - 2));
+  if (tris == NULL || lists == NULL) {
+    count = -1;
+    goto out;
+  }
+  for (i = 0; i + 2 < len; i++) {
+    tris[i] = (uint32_t) (unsigned char) literal[i] << 16 |
+              (uint32_t) (unsigned char) literal[i + 1] << 8 |
+              (unsigned char) literal[i + 2];
+  }
+  ntris = sort_unique(tris, (uint32_t) (len - 2));
+  for (i = 0; i < ntris; i++) {
+    lists[i] = find_trigram(index, tris[i]);
+    if (lists[i] == NULL) {
+      count = 0; // a trigram no file contains
+      goto out;
+    }
+  }
+
+  // start from the shortest posting list and intersect the rest into it
+  qsort(lists, ntris, sizeof(*lists), compare_trigram_nfiles);
+  result = malloc(sizeof(uint32_t) * lists[0]->nfiles);
+  if (result == NULL) {
+    count = -1;
+    goto out;
+  }
+  p = index->postings + lists[0]->postings_off;
+  for (id = 0, j = 0; j < lists[0]->nfiles; j++) {
+    p = varint_decode(p, &delta);
+    id += delta;
+    result[count++] = id;
+  }
+  for (i = 1; i < ntris && count > 0; i++) {
+    p = index->postings + lists[i]->postings_off;
+    kept = 0;
+    k = 0;
+    for (id = 0, j = 0; j < lists[i]->nfiles && k < count; j++) {
+      p = varint_decode(p, &delta);
+      id += delta;
+      while (k < count && result[k] < id)
+        k++;
+      if (k < count && result[k] == id)
+        result[kept++] = result[k++];
+    }
+    count = kept;
+  }
+
+out:
+  free(tris);
+  free(lists);
+  if (count > 0) {
+    *ids = result;
+  } else {
+    free(result);
+  }
+  return count;
+}
+
+/* ============================================================================
+ *    BUILDING
+ * ===========================================================================*/
+
+static int load_old(struct finder_index_builder *b, const struct finder_index *old)
+{
+  const struct finder_index_header *hdr = old->hdr;
+  size_t strings_len = hdr->files_off - hdr->strings_off;
+  const unsigned char *p;
+  uint32_t *fill;
+  uint32_t id;
+  uint32_t delta;
+  uint64_t t;
+  uint32_t j;
+  size_t slot;
+  size_t i;
+
+  b->nold = hdr->nfiles;
+  b->old = calloc(b->nold ? b->nold : 1, sizeof(struct old_file));
+  b->old_strings = malloc(strings_len ? strings_len : 1);
+  fill = calloc(b->nold ? b->nold : 1, sizeof(uint32_t));
+  b->old_nslots = 16;
+  while (b->old_nslots < b->nold * 2)
+    b->old_nslots *= 2;
+  b->old_slots = calloc(b->old_nslots, sizeof(uint32_t));
+  if (b->old == NULL || b->old_strings == NULL || fill == NULL || b->old_slots == NULL) {
+    free(fill);
+    return -1;
+  }
+  memcpy(b->old_strings, old->strings, strings_len);
+
+  // first pass sizes each file's trigram list, the second fills them in
+  for (t = 0; t < hdr->ntrigrams; t++) {
+    p = old->postings + old->trigrams[t].postings_off;
+    for (id = 0, j = 0; j < old->trigrams[t].nfiles; j++) {
+      p = varint_decode(p, &delta);
+      id += delta;
+      if (id < b->nold)
+        b->old[id].ntris++;
+    }
+  }
+  for (i = 0; i < b->nold; i++) {
+    b->old[i].path = b->old_strings + old->files[i].path_off;
+    b->old[i].size = old->files[i].size;
+    b->old[i].mtime_ns = old->files[i].mtime_ns;
+    b->old[i].flags = old->files[i].flags;
+    b->old[i].tris = malloc(sizeof(uint32_t) * (b->old[i].ntris ? b->old[i].ntris : 1));
+    if (b->old[i].tris == NULL) {
+      free(fill);
+      return -1;
+    }
+    slot = hash_path(b->old[i].path) & (b->old_nslots - 1);
+    while (b->old_slots[slot] != 0)
+      slot = (slot + 1) & (b->old_nslots - 1);
+    b->old_slots[slot] = (uint32_t) i + 1;
+  }
+  for (t = 0; t < hdr->ntrigrams; t++) {
+    p = old->postings + old->trigrams[t].postings_off;
+    for (id = 0, j = 0; j < old->trigrams[t].nfiles; j++) {
+      p = varint_decode(p, &delta);
+      id += delta;
+      if (id < b->nold)
+        b->old[id].tris[fill[id]++] = old->trigrams[t].trigram;
+    }
+  }
+  // trigrams were visited in ascending order, so every list is sorted
+
+  free(fill);
+  return 0;
+}
+
+static struct old_file *lookup_old(struct finder_index_builder *b, const char *path)
+{
+  size_t slot;
+
+  if (b->nold == 0)
+    return NULL;
+  slot = hash_path(path) & (b->old_nslots - 1);
+  while (b->old_slots[slot] != 0) {
+    struct old_file *f = &b->old[b->old_slots[slot] - 1];
+    if (!strcmp(f->path, path))
+      return f;
+    slot = (slot + 1) & (b->old_nslots - 1);
+  }
+  return NULL;
+}
+
+struct finder_index_builder *finder_index_builder_create(const char *root,
+                                                         const struct finder_index *old)
+{
+  struct finder_index_builder *b = calloc(1, sizeof(struct finder_index_builder));
+
+  if (b == NULL) {
+    return NULL;
+  }
+  pthread_mutex_init(&b->lock, NULL);
+  b->root = strdup(root);
+  if (b->root == NULL) {
+    finder_index_builder_destroy(b);
+    return NULL;
+  }
+  if (old != NULL && !strcmp(finder_index_root(old), root) && load_old(b, old) != 0) {
+    finder_index_builder_destroy(b);
+    return NULL;
+  }
+  return b;
+}
+
+/*
+ * @brief  reads the file at fd and collects the trigrams of its contents
+ * @return 0 on success, -1 on error
+ */
+static int read_trigrams(int fd, struct build_file *f)
+{
+  unsigned char *buf;
+  uint32_t *tris = NULL;
+  uint32_t ntris = 0;
+  uint32_t cap = 0;
+  uint32_t unsorted = 0;
+  uint32_t t = 0;
+  uint64_t total = 0;
+  ssize_t nread;
+  ssize_t i;
+  int rc = 0;
+
+  buf = malloc(READ_CHUNK);
+  if (buf == NULL)
+    return -1;
+
+  while ((nread = read(fd, buf, READ_CHUNK)) != 0) {
+    if (nread == -1) {
+      if (errno == EINTR)
+        continue;
+      rc = -1;
+      break;
+    }
+    if (total < BINARY_CHECK_SIZE &&
+        memchr(buf, '\0', nread < (ssize_t) (BINARY_CHECK_SIZE - total) ?
+                          nread : (ssize_t) (BINARY_CHECK_SIZE - total)) != NULL) {
+      f->flags |= FINDER_INDEX_FILE_BINARY;
+      ntris = 0;
+      break;
+    }
+    if (cap - ntris < (uint32_t) nread) {
+      uint32_t *bigger;
+      cap = ntris + nread + 1024;
+      bigger = realloc(tris, sizeof(uint32_t) * cap);
+      if (bigger == NULL) {
+        rc = -1;
+        break;
+      }
+      tris = bigger;
+    }
+    for (i = 0; i < nread; i++) {
+      t = ((t << 8) | buf[i]) & (NUM_TRIGRAMS - 1);
+      if (total + i >= 2)
+        tris[ntris++] = t;
+    }
+    total += nread;
+    unsorted += nread;
+    if (unsorted >= TRIGRAM_COMPACT) {
+      // bound memory for big files, most of a file's trigrams repeat
+      ntris = sort_unique(tris, ntris);
+      unsorted = 0;
+    }
+  }
+  free(buf);
+  if (rc != 0) {
+    free(tris);
+    return -1;
+  }
+
+  f->ntris = sort_unique(tris, ntris);
+  f->tris = tris;
+  return 0;
+}
+
+int finder_index_builder_add(struct finder_index_builder *b, int dirfd,
+                             const char *name, const char *path, const struct stat *st)
+{
+  struct build_file f;
+  struct old_file *old;
+  int fd;
+
+  memset(&f, 0, sizeof(f));
+  f.size = st->st_size;
+  f.mtime_ns = (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+  f.path = strdup(path);
+  if (f.path == NULL)
+    return -1;
+
+  // each path is added once, so its old entry is only ever claimed here
+  old = lookup_old(b, path);
+  if (old != NULL && old->tris != NULL && old->size == f.size && old->mtime_ns == f.mtime_ns) {
+    f.flags = old->flags;
+    f.ntris = old->ntris;
+    f.tris = old->tris;
+    old->tris = NULL;
+  } else {
+    fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_NOCTTY);
+    if (fd == -1 || read_trigrams(fd, &f) != 0) {
+      if (fd != -1)
+        close(fd);
+      free(f.path);
+      return -1;
+    }
+    close(fd);
+    __atomic_fetch_add(&b->files_read, 1, __ATOMIC_RELAXED);
+  }
+
+  pthread_mutex_lock(&b->lock);
+  if (b->nfiles == b->capacity) {
+    size_t cap = b->capacity ? b->capacity * 2 : 1024;
+    struct build_file *bigger = realloc(b->files, cap * sizeof(struct build_file));
+    if (bigger == NULL) {
+      pthread_mutex_unlock(&b->lock);
+      free(f.path);
+      free(f.tris);
+      return -1;
+    }
+    b->files = bigger;
+    b->capacity = cap;
+  }
+  b->files[b->nfiles++] = f;
+  pthread_mutex_unlock(&b->lock);
+  return 0;
+}
+
+unsigned long finder_index_builder_files_read(const struct finder_index_builder *b)
+{
+  return b->files_read;
+}
+
+static int compare_build_path(const void *a, const void *b)
+{
+  return strcmp(((const struct build_file *) a)->path, ((const struct build_file *) b)->path);
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  ssize_t written;
+
+  while (len) {
+    written = write(fd, p, len);
+    if (written == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    len -= written;
+    p += written;
+  }
+  return 0;
+}
+
+int finder_index_builder_write(struct finder_index_builder *b, const char *path)
+{
+  struct finder_index_header hdr;
+  struct finder_index_file *files = NULL;
+  struct finder_index_trigram *trigrams = NULL;
+  uint32_t *counts = NULL;     // files per trigram, then reused as last id
+  uint64_t *offsets = NULL;    // posting list offset per trigram
+  unsigned char *postings = NULL;
+  char *tmppath = NULL;
+  uint64_t strings_len;
+  uint64_t postings_len = 0;
+  uint64_t ntrigrams = 0;
+  uint64_t reserved;
+  uint64_t off;
+  uint32_t t;
+  uint32_t last;
+  size_t i;
+  size_t j;
+  int fd = -1;
+  int rc = -1;
+
+  qsort(b->files, b->nfiles, sizeof(struct build_file), compare_build_path);
+
+  counts = calloc(NUM_TRIGRAMS, sizeof(uint32_t));
+  offsets = calloc(NUM_TRIGRAMS, sizeof(uint64_t));
+  files = calloc(b->nfiles ? b->nfiles : 1, sizeof(struct finder_index_file));
+  if (counts == NULL || offsets == NULL || files == NULL)
+    goto out;
+
+  // string table: root, then the file paths
+  strings_len = strlen(b->root) + 1;
+  for (i = 0; i < b->nfiles; i++) {
+    files[i].path_off = strings_len;
+    files[i].size = b->files[i].size;
+    files[i].mtime_ns = b->files[i].mtime_ns;
+    files[i].flags = b->files[i].flags;
+    strings_len += strlen(b->files[i].path) + 1;
+    for (j = 0; j < b->files[i].ntris; j++)
+      counts[b->files[i].tris[j]]++;
+  }
+
+  // size each posting list with the worst case varint length, then encode
+  for (t = 0; t < NUM_TRIGRAMS; t++) {
+    if (counts[t] == 0)
+      continue;
+    offsets[t] = postings_len;
+    postings_len += (uint64_t) counts[t] * 5;
+    ntrigrams++;
+  }
+  trigrams = calloc(ntrigrams ? ntrigrams : 1, sizeof(struct finder_index_trigram));
+  postings = malloc(postings_len ? postings_len : 1);
+  if (trigrams == NULL || postings == NULL)
+    goto out;
+  for (t = 0, j = 0; t < NUM_TRIGRAMS; t++) {
+    if (counts[t] == 0)
+      continue;
+    trigrams[j].trigram = t;
+    trigrams[j].nfiles = counts[t];
+    j++;
+    counts[t] = 0; // from here on, last file id + 1 written to the list
+  }
+  // files are visited in id order so every list is ascending
+  for (i = 0; i < b->nfiles; i++) {
+    for (j = 0; j < b->files[i].ntris; j++) {
+      t = b->files[i].tris[j];
+      last = counts[t] ? counts[t] - 1 : 0;
+      offsets[t] += varint_encode(postings + offsets[t], (uint32_t) i - last);
+      counts[t] = (uint32_t) i + 1;
+    }
+  }
+  // compact the lists, dropping the unused worst case space.  List starts
+  // are found by walking the reservations again in the same order.
+  for (j = 0, off = 0, reserved = 0; j < ntrigrams; j++) {
+    t = trigrams[j].trigram;
+    memmove(postings + off, postings + reserved, offsets[t] - reserved);
+    trigrams[j].postings_off = off;
+    off += offsets[t] - reserved;
+    reserved += (uint64_t) trigrams[j].nfiles * 5;
+  }
+  postings_len = off;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, FINDER_INDEX_MAGIC, sizeof(hdr.magic));
+  hdr.nfiles = (uint32_t) b->nfiles;
+  hdr.root_len = (uint32_t) strlen(b->root);
+  hdr.ntrigrams = ntrigrams;
+  hdr.strings_off = sizeof(hdr);
+  hdr.files_off = (hdr.strings_off + strings_len + 7) & ~7ull;
+  hdr.trigrams_off = hdr.files_off + b->nfiles * sizeof(struct finder_index_file);
+  hdr.postings_off = hdr.trigrams_off + ntrigrams * sizeof(struct finder_index_trigram);
+  hdr.total_size = hdr.postings_off + postings_len;
+
+  if (asprintf(&tmppath, "%s.tmp.%d", path, (int) getpid()) == -1) {
+    tmppath = NULL;
+    goto out;
+  }
+  fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    goto out;
+  if (write_all(fd, &hdr, sizeof(hdr)) != 0 ||
+      write_all(fd, b->root, strlen(b->root) + 1) != 0)
+    goto out;
+  for (i = 0; i < b->nfiles; i++) {
+    if (write_all(fd, b->files[i].path, strlen(b->files[i].path) + 1) != 0)
+      goto out;
+  }
+  if (write_all(fd, "\0\0\0\0\0\0\0", hdr.files_off - hdr.strings_off - strings_len) != 0 ||
+      write_all(fd, files, b->nfiles * sizeof(struct finder_index_file)) != 0 ||
+      write_all(fd, trigrams, ntrigrams * sizeof(struct finder_index_trigram)) != 0 ||
+      write_all(fd, postings, postings_len) != 0)
+    goto out;
+  if (close(fd) != 0) {
+    fd = -1;
+    goto out;
+  }
+  fd = -1;
+  if (rename(tmppath, path) != 0)
+    goto out;
+  rc = 0;
+
+out:
+  if (fd != -1)
+    close(fd);
+  if (rc != 0 && tmppath != NULL)
+    unlink(tmppath);
+  free(tmppath);
+  free(counts);
+  free(offsets);
+  free(files);
+  free(trigrams);
+  free(postings);
+  return rc;
+}
+
+void finder_index_builder_destroy(struct finder_index_builder *b)
+{
+  size_t i;
+
+  if (b == NULL) {
+    return;
+  }
+  for (i = 0; i < b->nfiles; i++) {
+    free(b->files[i].path);
+    free(b->files[i].tris);
+  }
+  for (i = 0; i < b->nold; i++) {
+    free(b->old[i].tris);
+  }
+  free(b->files);
+  free(b->old);
+  free(b->old_slots);
+  free(b->old_strings);
+  free(b->root);
+  pthread_mutex_destroy(&b->lock);
+  free(b);
+}
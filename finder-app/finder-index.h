@@ -0,0 +1,140 @@
+/* ----------------------------------------------------------------------------
+ * @file finder-index.h
+ * @brief Persistent trigram index of a directory tree for finder -x
+ *
+ * The index records every regular file below a root directory with its size
+ * and mtime, and for each trigram (3 byte sequence) occurring in file
+ * contents the list of files containing it.  A query for a fixed string of
+ * 3 or more bytes only needs the files containing all of its trigrams, found
+ * by intersecting posting lists, so its cost follows the number of candidate
+ * files rather than the size of the tree.  Shorter strings and regular
+ * expressions fall back to every text file in the index, still without
+ * walking the tree.  A query trusts the index, files changed since the last
+ * update are not looked at unless finder_index_file_changed() is asked
+ * about each of them, at the cost of a stat per indexed file.
+ *
+ * Updating walks the tree and stats every file, but only reads files whose
+ * size or mtime changed; the trigrams of the others are taken from the old
+ * index.  The index is written to a temporary file and renamed into place.
+ *
+ * File layout (native byte order, it is a local cache):
+ *   struct finder_index_header
+ *   root path and file paths, NUL terminated
+ *   struct finder_index_file[nfiles], sorted by path
+ *   struct finder_index_trigram[ntrigrams], sorted by trigram
+ *   posting lists, file ids as LEB128 varint deltas
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef FINDER_INDEX_H
+#define FINDER_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#define FINDER_INDEX_MAGIC "AESDIDX1"
+
+#define FINDER_INDEX_FILE_BINARY (1 << 0)  // contributes no lines, like grep
+
+struct finder_index_header {
+  char magic[8];
+  uint32_t nfiles;
+  uint32_t root_len;          // root path starts at strings_off
+  uint64_t ntrigrams;
+  uint64_t strings_off;
+  uint64_t files_off;
+  uint64_t trigrams_off;
+  uint64_t postings_off;
+  uint64_t total_size;
+};
+
+struct finder_index_file {
+  uint64_t path_off;          // from strings_off
+  uint64_t size;
+  int64_t mtime_ns;
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+struct finder_index_trigram {
+  uint32_t trigram;           // bytes b0 b1 b2 as b0 << 16 | b1 << 8 | b2
+  uint32_t nfiles;
+  uint64_t postings_off;      // from postings_off
+};
+
+struct finder_index;
+struct finder_index_builder;
+
+/**
+* Map the index at @param path.
+* @return the index, or NULL if it does not exist or is not a valid index
+*/
+struct finder_index *finder_index_open(const char *path);
+
+void finder_index_close(struct finder_index *index);
+
+/**
+* @return the directory @param index was built for
+*/
+const char *finder_index_root(const struct finder_index *index);
+
+/**
+* @return the number of regular files recorded in @param index
+*/
+unsigned long finder_index_num_files(const struct finder_index *index);
+
+/**
+* @return the path of file @param id of @param index
+*/
+const char *finder_index_path(const struct finder_index *index, uint32_t id);
+
+/**
+* @return whether file @param id of @param index now has a size or mtime
+* other than the one indexed, so its trigrams cannot be trusted.  A file
+* which no longer exists has not changed
+*/
+bool finder_index_file_changed(const struct finder_index *index, uint32_t id);
+
+/**
+* Find the text files of @param index which may contain the @param len
+* bytes at @param literal.  With len < 3 every text file is a candidate.
+* @param ids receives a malloc'd array of file ids, NULL if there are none
+* @return the number of candidates, or -1 on error
+*/
+long finder_index_candidates(const struct finder_index *index, const char *literal,
+                             size_t len, uint32_t **ids);
+
+/**
+* Start a new index for @param root.  If @param old is non-NULL and was built
+* for the same root, unchanged files reuse its trigrams.  old may be closed
+* once the builder is created.
+* @return the builder, or NULL on error
+*/
+struct finder_index_builder *finder_index_builder_create(const char *root,
+                                                         const struct finder_index *old);
+
+/**
+* Record the regular file @param name in @param dirfd, whose path is
+* @param path and whose metadata is @param st.  Thread safe.
+* @return 0 on success, -1 if the file could not be read
+*/
+int finder_index_builder_add(struct finder_index_builder *builder, int dirfd,
+                             const char *name, const char *path, const struct stat *st);
+
+/**
+* Write the index to @param path, replacing any existing index atomically.
+* @return 0 on success, -1 on error
+*/
+int finder_index_builder_write(struct finder_index_builder *builder, const char *path);
+
+/**
+* @return the number of files finder_index_builder_add() had to read
+*/
+unsigned long finder_index_builder_files_read(const struct finder_index_builder *builder);
+
+void finder_index_builder_destroy(struct finder_index_builder *builder);
+
+#endif /* FINDER_INDEX_H */
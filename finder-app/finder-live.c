@@ -0,0 +1,681 @@
+/* ----------------------------------------------------------------------------
+ * @file finder-live.c
+ * @brief Live file and match counts of a directory tree for finder -d
+ * @author Jake Michael, jami1063@colorado.edu
+ * @resources
+ * (+)  inotify(7), in particular "Limitations and caveats" on renames,
+ *      queue overflow and watching newly created directories
+ *---------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include "finder-live.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define WATCH_MASK (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | \
+                    IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+#define EVENT_BUF_SIZE (64 * 1024)
+#define HASH_INITIAL_BUCKETS (1024)
+
+// a regular file of the tree and its matching line count
+struct live_file {
+  struct live_file *next;     // hash chain
+  uint64_t hash;
+  unsigned long lines;
+  bool dirty;                 // queued for a recount
+  char path[];
+};
+
+struct live_state {
+  const char *root;
+  finder_live_count_fn count;
+  int inotify_fd;
+
+  char **dirs;                // directory path by watch descriptor
+  int ndirs;
+
+  struct live_file **buckets;
+  size_t nbuckets;
+  size_t nentries;
+
+  char **dirty;               // paths to recount after this batch of events
+  size_t ndirty;
+  size_t dirty_cap;
+
+  unsigned long num_files;
+  unsigned long num_lines;
+};
+
+static volatile sig_atomic_t abort_flag = 0;
+
+static void signal_handler(int signo)
+{
+  abort_flag = 1;
+}
+
+/* ============================================================================
+ *    FILE TABLE
+ * ===========================================================================*/
+
+static uint64_t hash_path(const char *path)
+{
+  uint64_t h = 14695981039346656037ull;  // FNV-1a
+
+  while (*path) {
+    h ^= (unsigned char) *path++;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+static struct live_file **find_slot(struct live_state *state, const char *path, uint64_t h)
+{
+  struct live_file **slot = &state->buckets[h & (state->nbuckets - 1)];
+
+  while (*slot != NULL && ((*slot)->hash != h || strcmp((*slot)->path, path) != 0)) {
+    slot = &(*slot)->next;
+  }
+  return slot;
+}
+
+static int grow_table(struct live_state *state)
+{
+  size_t nbuckets = state->nbuckets ? state->nbuckets * 2 : HASH_INITIAL_BUCKETS;
+  struct live_file **buckets = calloc(nbuckets, sizeof(struct live_file *));
+  struct live_file *f;
+  struct live_file *next;
+  size_t i;
+
+  if (buckets == NULL) {
+    return -1;
+  }
+  for (i = 0; i < state->nbuckets; i++) {
+    for (f = state->buckets[i]; f != NULL; f = next) {
+      next = f->next;
+      f->next = buckets[f->hash & (nbuckets - 1)];
+      buckets[f->hash & (nbuckets - 1)] = f;
+    }
+  }
+  free(state->buckets);
+  state->buckets = buckets;
+  state->nbuckets = nbuckets;
+  return 0;
+}
+
+/*
+ * @brief  finds path in the table, adding it with no lines if absent
+ * @return the entry, or NULL on allocation failure
+ */
+static struct live_file *get_file(struct live_state *state, const char *path)
+{
+  uint64_t h = hash_path(path);
+  struct live_file **slot;
+  struct live_file *f;
+  size_t len;
+
+  if (state->nentries >= state->nbuckets && grow_table(state) != 0) {
+    return NULL;
+  }
+  slot = find_slot(state, path, h);
+  if (*slot != NULL) {
+    return *slot;
+  }
+  len = strlen(path);
+  f = malloc(sizeof(*f) + len + 1);
+  if (f == NULL) {
+    return NULL;
+  }
+  f->next = NULL;
+  f->hash = h;
+  f->lines = 0;
+  f->dirty = false;
+  memcpy(f->path, path, len + 1);
+  *slot = f;
+  state->nentries++;
+  state->num_files++;
+  return f;
+}
+
+static void remove_file(struct live_state *state, const char *path)
+{
+  struct live_file **slot = find_slot(state, path, hash_path(path));
+  struct live_file *f = *slot;
+
+  if (f == NULL) {
+    return;
+  }
+  *slot = f->next;
+  state->nentries--;
+  state->num_files--;
+  state->num_lines -= f->lines;
+  free(f);
+}
+
+/*
+ * @brief  removes every file below the directory dirpath
+ */
+static void remove_subtree(struct live_state *state, const char *dirpath)
+{
+  size_t len = strlen(dirpath);
+  struct live_file **slot;
+  struct live_file *f;
+  size_t i;
+
+  for (i = 0; i < state->nbuckets; i++) {
+    slot = &state->buckets[i];
+    while ((f = *slot) != NULL) {
+      if (strncmp(f->path, dirpath, len) == 0 && f->path[len] == '/') {
+        *slot = f->next;
+        state->nentries--;
+        state->num_files--;
+        state->num_lines -= f->lines;
+        free(f);
+      } else {
+        slot = &f->next;
+      }
+    }
+  }
+}
+
+/*
+ * @brief  counts the regular file at path into the totals, or drops it if
+ *         it is no longer a regular file
+ */
+static void count_file(struct live_state *state, const char *path)
+{
+  struct live_file *f;
+  struct stat st;
+  unsigned long lines;
+
+  if (fstatat(AT_FDCWD, path, &st, AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(st.st_mode)) {
+    remove_file(state, path);
+    return;
+  }
+  f = get_file(state, path);
+  if (f == NULL) {
+    fprintf(stderr, "finder: malloc fail\n");
+    return;
+  }
+  lines = state->count(path);
+  state->num_lines += lines - f->lines;
+  f->lines = lines;
+}
+
+static void mark_dirty(struct live_state *state, const char *path)
+{
+  struct live_file *f = get_file(state, path);
+  char **bigger;
+
+  if (f == NULL || f->dirty) {
+    return;
+  }
+  if (state->ndirty == state->dirty_cap) {
+    state->dirty_cap = state->dirty_cap ? state->dirty_cap * 2 : 64;
+    bigger = realloc(state->dirty, state->dirty_cap * sizeof(char *));
+    if (bigger == NULL) {
+      // recount now rather than lose the change
+      count_file(state, path);
+      return;
+    }
+    state->dirty = bigger;
+  }
+  state->dirty[state->ndirty] = strdup(path);
+  if (state->dirty[state->ndirty] == NULL) {
+    count_file(state, path);
+    return;
+  }
+  state->ndirty++;
+  f->dirty = true;
+}
+
+static void recount_dirty(struct live_state *state)
+{
+  struct live_file *f;
+  size_t i;
+
+  for (i = 0; i < state->ndirty; i++) {
+    f = *find_slot(state, state->dirty[i], hash_path(state->dirty[i]));
+    if (f != NULL) {
+      f->dirty = false;
+      count_file(state, state->dirty[i]);
+    }
+    free(state->dirty[i]);
+  }
+  state->ndirty = 0;
+}
+
+/* ============================================================================
+ *    DIRECTORIES
+ * ===========================================================================*/
+
+static char *join_path(const char *dirpath, const char *name)
+{
+  char *path;
+
+  if (asprintf(&path, "%s/%s", dirpath, name) == -1) {
+    return NULL;
+  }
+  return path;
+}
+
+static int set_dir(struct live_state *state, int wd, char *path)
+{
+  char **bigger;
+  int n;
+
+  if (wd >= state->ndirs) {
+    n = wd < 64 ? 128 : wd * 2;
+    bigger = realloc(state->dirs, n * sizeof(char *));
+    if (bigger == NULL) {
+      return -1;
+    }
+    memset(bigger + state->ndirs, 0, (n - state->ndirs) * sizeof(char *));
+    state->dirs = bigger;
+    state->ndirs = n;
+  }
+  // the same directory reached twice (e.g. scanned on create and by its
+  // parent's rescan) keeps one watch
+  free(state->dirs[wd]);
+  state->dirs[wd] = path;
+  return 0;
+}
+
+/*
+ * @brief  watches and counts the tree at path, taking ownership of path.
+ *         The watch is added before reading a directory so that files
+ *         created meanwhile are seen by one or the other.
+ */
+static void scan_tree(struct live_state *state, char *path)
+{
+  char **stack = NULL;
+  size_t depth = 0;
+  size_t cap = 0;
+  char **bigger;
+  char *dirpath;
+  char *child;
+  DIR *dir;
+  struct dirent *d;
+  struct stat st;
+  unsigned char type;
+  int wd;
+
+  stack = malloc(sizeof(char *));
+  if (stack == NULL) {
+    free(path);
+    return;
+  }
+  cap = 1;
+  stack[depth++] = path;
+
+  while (depth > 0) {
+    dirpath = stack[--depth];
+    wd = inotify_add_watch(state->inotify_fd, dirpath, WATCH_MASK);
+    if (wd == -1) {
+      fprintf(stderr, "finder: cannot watch %s: %s\n", dirpath, strerror(errno));
+    }
+    dir = opendir(dirpath);
+    if (dir == NULL) {
+      fprintf(stderr, "finder: %s: %s\n", dirpath, strerror(errno));
+      free(dirpath);
+      continue;
+    }
+    while ((d = readdir(dir)) != NULL) {
+      if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..")) {
+        continue;
+      }
+      type = d->d_type;
+      if (type == DT_UNKNOWN) {
+        if (fstatat(dirfd(dir), d->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+          continue;
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+      }
+      if (type != DT_DIR && type != DT_REG) {
+        continue;
+      }
+      child = join_path(dirpath, d->d_name);
+      if (child == NULL) {
+        continue;
+      }
+      if (type == DT_REG) {
+        count_file(state, child);
+        free(child);
+        continue;
+      }
+      if (depth == cap) {
+        bigger = realloc(stack, cap * 2 * sizeof(char *));
+        if (bigger == NULL) {
+          free(child);
+          continue;
+        }
+        stack = bigger;
+        cap *= 2;
+      }
+      stack[depth++] = child;
+    }
+    closedir(dir);
+    if (wd == -1 || set_dir(state, wd, dirpath) != 0) {
+      free(dirpath);
+    }
+  }
+  free(stack);
+}
+
+/*
+ * @brief  stops watching the directory dirpath and those below it
+ */
+static void unwatch_subtree(struct live_state *state, const char *dirpath)
+{
+  size_t len = strlen(dirpath);
+  int wd;
+
+  for (wd = 0; wd < state->ndirs; wd++) {
+    if (state->dirs[wd] != NULL && strncmp(state->dirs[wd], dirpath, len) == 0 &&
+        (state->dirs[wd][len] == '\0' || state->dirs[wd][len] == '/')) {
+      inotify_rm_watch(state->inotify_fd, wd);
+      free(state->dirs[wd]);
+      state->dirs[wd] = NULL;
+    }
+  }
+}
+
+/*
+ * @brief  forgets everything and scans the whole tree again
+ * @return 0 on success, -1 on error
+ */
+static int rescan(struct live_state *state)
+{
+  struct live_file *f;
+  struct live_file *next;
+  char *root;
+  size_t i;
+  int wd;
+
+  for (i = 0; i < state->nbuckets; i++) {
+    for (f = state->buckets[i]; f != NULL; f = next) {
+      next = f->next;
+      free(f);
+    }
+    state->buckets[i] = NULL;
+  }
+  state->nentries = 0;
+  state->num_files = 0;
+  state->num_lines = 0;
+  for (i = 0; i < state->ndirty; i++) {
+    free(state->dirty[i]);
+  }
+  state->ndirty = 0;
+
+  // a new inotify instance drops all old watches at once
+  if (state->inotify_fd != -1) {
+    close(state->inotify_fd);
+  }
+  for (wd = 0; wd < state->ndirs; wd++) {
+    free(state->dirs[wd]);
+    state->dirs[wd] = NULL;
+  }
+  state->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (state->inotify_fd == -1) {
+    perror("inotify_init1");
+    return -1;
+  }
+
+  root = strdup(state->root);
+  if (root == NULL) {
+    return -1;
+  }
+  scan_tree(state, root);
+  return 0;
+}
+
+/* ============================================================================
+ *    EVENTS
+ * ===========================================================================*/
+
+static void handle_event(struct live_state *state, const struct inotify_event *ev)
+{
+  const char *dirpath;
+  char *path;
+
+  if (ev->mask & IN_IGNORED) {
+    // the watch went away with its directory
+    if (ev->wd >= 0 && ev->wd < state->ndirs) {
+      free(state->dirs[ev->wd]);
+      state->dirs[ev->wd] = NULL;
+    }
+    return;
+  }
+  if (ev->wd < 0 || ev->wd >= state->ndirs || state->dirs[ev->wd] == NULL || ev->len == 0) {
+    return;
+  }
+  dirpath = state->dirs[ev->wd];
+  path = join_path(dirpath, ev->name);
+  if (path == NULL) {
+    return;
+  }
+
+  if (ev->mask & IN_ISDIR) {
+    if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+      // a rename within the tree shows up again as IN_MOVED_TO
+      unwatch_subtree(state, path);
+      remove_subtree(state, path);
+    } else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+      scan_tree(state, path);
+      return;
+    }
+  } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+    remove_file(state, path);
+  } else if (ev->mask & (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO)) {
+    mark_dirty(state, path);
+  }
+  free(path);
+}
+
+/*
+ * @brief  reads and handles all queued events, then recounts changed files
+ * @return 0 on success, -1 on error
+ */
+static int handle_events(struct live_state *state, char *buf)
+{
+  ssize_t nread;
+  char *pos;
+  const struct inotify_event *ev;
+
+  while ((nread = read(state->inotify_fd, buf, EVENT_BUF_SIZE)) > 0) {
+    for (pos = buf; pos < buf + nread; pos += sizeof(*ev) + ev->len) {
+      ev = (const struct inotify_event *) pos;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        fprintf(stderr, "finder: inotify queue overflow, rescanning %s\n", state->root);
+        return rescan(state);
+      }
+      handle_event(state, ev);
+    }
+  }
+  if (nread == -1 && errno != EAGAIN && errno != EINTR) {
+    perror("read inotify");
+    return -1;
+  }
+  recount_dirty(state);
+  return 0;
+}
+
+static void answer_query(struct live_state *state, int listenfd)
+{
+  char reply[128];
+  int peerfd;
+  int len;
+
+  while ((peerfd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+    len = snprintf(reply, sizeof(reply),
+                   "The number of files are %lu and the number of matching lines are %lu\n",
+                   state->num_files, state->num_lines);
+    // the reply fits the socket buffer, a client that is gone is ignored
+    if (send(peerfd, reply, len, MSG_NOSIGNAL | MSG_DONTWAIT) == -1) {
+      perror("send");
+    }
+    close(peerfd);
+  }
+}
+
+static int open_socket(const char *socket_path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "finder: socket path %s too long\n", socket_path);
+    return -1;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    perror("socket");
+    return -1;
+  }
+  // a socket left behind by an earlier daemon
+  unlink(socket_path);
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, 64) == -1) {
+    fprintf(stderr, "finder: cannot listen on %s: %s\n", socket_path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* ============================================================================
+ *    INTERFACE
+ * ===========================================================================*/
+
+int finder_live_run(const char *root, const char *socket_path, finder_live_count_fn count)
+{
+  struct live_state state;
+  struct pollfd fds[2];
+  char *buf = NULL;
+  int listenfd = -1;
+  int rc = -1;
+  size_t i;
+  int wd;
+
+  memset(&state, 0, sizeof(state));
+  state.root = root;
+  state.count = count;
+  state.inotify_fd = -1;
+
+  if (signal(SIGINT, signal_handler) == SIG_ERR || signal(SIGTERM, signal_handler) == SIG_ERR) {
+    perror("signal");
+    return -1;
+  }
+
+  buf = malloc(EVENT_BUF_SIZE);
+  if (buf == NULL || grow_table(&state) != 0 || rescan(&state) != 0) {
+    goto handle_errors;
+  }
+  listenfd = open_socket(socket_path);
+  if (listenfd == -1) {
+    goto handle_errors;
+  }
+  fprintf(stderr, "finder: watching %s, %lu files, %lu matching lines, socket %s\n",
+          root, state.num_files, state.num_lines, socket_path);
+
+  while (!abort_flag) {
+    fds[0].fd = state.inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = listenfd;
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      goto handle_errors;
+    }
+    // changes first, so a query sees everything that happened before it
+    if ((fds[0].revents & POLLIN) && handle_events(&state, buf) != 0) {
+      goto handle_errors;
+    }
+    if (fds[1].revents & POLLIN) {
+      answer_query(&state, listenfd);
+    }
+  }
+  rc = 0;
+
+handle_errors:
+  if (listenfd != -1) {
+    close(listenfd);
+    unlink(socket_path);
+  }
+  if (state.inotify_fd != -1) {
+    close(state.inotify_fd);
+  }
+  for (wd = 0; wd < state.ndirs; wd++) {
+    free(state.dirs[wd]);
+  }
+  free(state.dirs);
+  for (i = 0; i < state.ndirty; i++) {
+    free(state.dirty[i]);
+  }
+  free(state.dirty);
+  for (i = 0; i < state.nbuckets; i++) {
+    struct live_file *f = state.buckets[i];
+    while (f != NULL) {
+      struct live_file *next = f->next;
+      free(f);
+      f = next;
+    }
+  }
+  free(state.buckets);
+  free(buf);
+  return rc;
+}
+
+int finder_live_query(const char *socket_path)
+{
+  struct sockaddr_un addr;
+  char reply[256];
+  ssize_t nread;
+  size_t len = 0;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "finder: socket path %s too long\n", socket_path);
+    return -1;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+    fprintf(stderr, "finder: cannot connect to %s: %s\n", socket_path, strerror(errno));
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+  while (len < sizeof(reply) && (nread = read(fd, reply + len, sizeof(reply) - len)) != 0) {
+    if (nread == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("read");
+      close(fd);
+      return -1;
+    }
+    len += nread;
+  }
+  close(fd);
+  fwrite(reply, 1, len, stdout);
+  return 0;
+}
@@ -0,0 +1,44 @@
+/* ----------------------------------------------------------------------------
+ * @file finder-live.h
+ * @brief Live file and match counts of a directory tree for finder -d
+ *
+ * The tree is scanned once, recording the matching line count of every
+ * regular file, and every directory is watched with inotify.  Events then
+ * adjust the totals: a created, modified or moved in file is recounted, a
+ * deleted or moved out file subtracts its count, and new directories are
+ * scanned and watched.  Modifications are coalesced, each changed file is
+ * recounted once per batch of events.  If the kernel's event queue
+ * overflows the whole tree is rescanned.
+ *
+ * The totals are kept up to date, so each client connecting to the Unix
+ * socket is answered in O(1) with finder's usual line:
+ *   "The number of files are N and the number of matching lines are M\n"
+ * after which the connection is closed.
+ *
+ * Everything runs on one thread, so the initial scan is sequential, and a
+ * query waits while a batch of changes is being recounted.  Directories
+ * beyond fs.inotify.max_user_watches are counted but not kept live.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef FINDER_LIVE_H
+#define FINDER_LIVE_H
+
+// matching lines of the regular file at path
+typedef unsigned long (*finder_live_count_fn)(const char *path);
+
+/**
+* Count the tree at @param root with @param count and serve the totals on
+* the Unix socket @param socket_path until SIGINT or SIGTERM.
+* @return 0 on a clean shutdown, -1 on error
+*/
+int finder_live_run(const char *root, const char *socket_path, finder_live_count_fn count);
+
+/**
+* Ask the daemon at @param socket_path for the totals and print them.
+* @return 0 on success, -1 on error
+*/
+int finder_live_query(const char *socket_path);
+
+#endif /* FINDER_LIVE_H */
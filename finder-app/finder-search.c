@@ -0,0 +1,280 @@
+/* ----------------------------------------------------------------------------
+ * @file finder-search.c
+ * @brief Counts lines containing a fixed string, without splitting the
+ *        buffer into lines first
+ * @author Jake Michael, jami1063@colorado.edu
+ * @resources
+ * (+)  two byte filter: Wojciech Mula, "SIMD-friendly algorithms for
+ *      substring searching", http://0x80.pl/articles/simd-strfind.html
+ * (+)  filtering on rare bytes rather than first/last is the approach of the
+ *      Rust memchr crate's memmem
+ *---------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include "finder-search.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+  #define HAVE_X86_SIMD (1)
+#endif
+#if defined(__ARM_NEON)
+  #include <arm_neon.h>
+  #define HAVE_NEON (1)
+#endif
+
+typedef const char *(*find_fn)(const struct finder_search *search,
+                               const char *pos, const char *end);
+
+static const char *const impl_names[FINDER_SEARCH_NUM_IMPLS] = {
+  [FINDER_SEARCH_MEMMEM] = "memmem",
+  [FINDER_SEARCH_SSE2]   = "sse2",
+  [FINDER_SEARCH_AVX2]   = "avx2",
+  [FINDER_SEARCH_NEON]   = "neon",
+};
+
+/* ============================================================================
+ *    FIND FIRST OCCURRENCE
+ *    Each returns the first occurrence of the needle (n >= 1 bytes) in
+ *    [pos, end), or NULL.
+ * ===========================================================================*/
+
+static const char *find_memmem(const struct finder_search *s, const char *pos, const char *end)
+{
+  return memmem(pos, end - pos, s->needle, s->len);
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static const char *find_sse2(const struct finder_search *s, const char *pos, const char *end)
+{
+  const size_t n = s->len;
+  const __m128i first = _mm_set1_epi8(s->needle[s->off1]);
+  const __m128i last = _mm_set1_epi8(s->needle[s->off2]);
+  unsigned int mask;
+  int bit;
+
+  // both loads, and a candidate found by them, must stay inside the buffer
+  while ((size_t) (end - pos) >= n + 15) {
+    __m128i a = _mm_loadu_si128((const __m128i *) (pos + s->off1));
+    __m128i b = _mm_loadu_si128((const __m128i *) (pos + s->off2));
+    mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                           _mm_cmpeq_epi8(b, last)));
+    while (mask) {
+      bit = __builtin_ctz(mask);
+      if (memcmp(pos + bit, s->needle, n) == 0)
+        return pos + bit;
+      mask &= mask - 1;
+    }
+    pos += 16;
+  }
+  return memmem(pos, end - pos, s->needle, n);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const struct finder_search *s, const char *pos, const char *end)
+{
+  const size_t n = s->len;
+  const __m256i first = _mm256_set1_epi8(s->needle[s->off1]);
+  const __m256i last = _mm256_set1_epi8(s->needle[s->off2]);
+  unsigned int mask;
+  int bit;
+
+  while ((size_t) (end - pos) >= n + 31) {
+    __m256i a = _mm256_loadu_si256((const __m256i *) (pos + s->off1));
+    __m256i b = _mm256_loadu_si256((const __m256i *) (pos + s->off2));
+    mask = (unsigned int) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                                _mm256_cmpeq_epi8(b, last)));
+    while (mask) {
+      bit = __builtin_ctz(mask);
+      if (memcmp(pos + bit, s->needle, n) == 0)
+        return pos + bit;
+      mask &= mask - 1;
+    }
+    pos += 32;
+  }
+  return memmem(pos, end - pos, s->needle, n);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+#ifdef HAVE_NEON
+
+static const char *find_neon(const struct finder_search *s, const char *pos, const char *end)
+{
+  const size_t n = s->len;
+  const uint8x16_t first = vdupq_n_u8((uint8_t) s->needle[s->off1]);
+  const uint8x16_t last = vdupq_n_u8((uint8_t) s->needle[s->off2]);
+  uint64_t mask;
+  int bit;
+
+  while ((size_t) (end - pos) >= n + 15) {
+    uint8x16_t a = vld1q_u8((const uint8_t *) (pos + s->off1));
+    uint8x16_t b = vld1q_u8((const uint8_t *) (pos + s->off2));
+    uint8x16_t eq = vandq_u8(vceqq_u8(a, first), vceqq_u8(b, last));
+    // no movemask on NEON, narrow each byte of eq to 4 bits of a 64 bit mask
+    mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    while (mask) {
+      bit = __builtin_ctzll(mask) >> 2;
+      if (memcmp(pos + bit, s->needle, n) == 0)
+        return pos + bit;
+      mask &= ~(0xfull << (bit * 4));
+    }
+    pos += 16;
+  }
+  return memmem(pos, end - pos, s->needle, n);
+}
+
+#endif /* HAVE_NEON */
+
+static find_fn find_for_impl(enum finder_search_impl impl)
+{
+  switch (impl) {
+#ifdef HAVE_X86_SIMD
+    case FINDER_SEARCH_SSE2: return find_sse2;
+    case FINDER_SEARCH_AVX2: return find_avx2;
+#endif
+#ifdef HAVE_NEON
+    case FINDER_SEARCH_NEON: return find_neon;
+#endif
+    default: return find_memmem;
+  }
+}
+
+static int impl_supported(enum finder_search_impl impl)
+{
+  switch (impl) {
+    case FINDER_SEARCH_MEMMEM:
+      return 1;
+#ifdef HAVE_X86_SIMD
+    case FINDER_SEARCH_SSE2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("sse2");
+    case FINDER_SEARCH_AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+#ifdef HAVE_NEON
+    case FINDER_SEARCH_NEON:
+      return 1;
+#endif
+    default:
+      return 0;
+  }
+}
+
+/*
+ * @brief  rough frequency of byte c in text files, higher is more common
+ */
+static int byte_rank(unsigned char c)
+{
+  if (c == ' ')
+    return 255;
+  if (strchr("etaoinshrdlu", c) != NULL && c != '\0')
+    return 200;
+  if (c >= 'a' && c <= 'z')
+    return 150;
+  if (c >= 'A' && c <= 'Z')
+    return 100;
+  if (c >= '0' && c <= '9')
+    return 90;
+  if (strchr(".,;:-/'\"()=\t", c) != NULL && c != '\0')
+    return 80;
+  if (c >= 0x20 && c < 0x7f)
+    return 40;
+  return 10;
+}
+
+/* ============================================================================
+ *    INTERFACE
+ * ===========================================================================*/
+
+void finder_search_init(struct finder_search *search, const char *needle, size_t len)
+{
+  static const enum finder_search_impl preferred[] = {
+    FINDER_SEARCH_AVX2, FINDER_SEARCH_SSE2, FINDER_SEARCH_NEON
+  };
+  size_t i;
+
+  search->needle = needle;
+  search->len = len;
+  search->off1 = 0;
+  search->off2 = 0;
+  search->impl = FINDER_SEARCH_MEMMEM;
+
+  // filter on the two rarest bytes, ties keep the first/last positions
+  if (len >= 2) {
+    for (i = 1; i < len; i++) {
+      if (byte_rank(needle[i]) < byte_rank(needle[search->off1]))
+        search->off1 = i;
+    }
+    search->off2 = search->off1 == len - 1 ? 0 : len - 1;
+    for (i = 0; i < len; i++) {
+      if (i != search->off1 && byte_rank(needle[i]) < byte_rank(needle[search->off2]))
+        search->off2 = i;
+    }
+  }
+
+  for (i = 0; i < sizeof(preferred) / sizeof(preferred[0]); i++) {
+    if (impl_supported(preferred[i])) {
+      search->impl = preferred[i];
+      break;
+    }
+  }
+}
+
+int finder_search_set_impl(struct finder_search *search, enum finder_search_impl impl)
+{
+  if (impl < 0 || impl >= FINDER_SEARCH_NUM_IMPLS || !impl_supported(impl)) {
+    return -1;
+  }
+  search->impl = impl;
+  return 0;
+}
+
+unsigned long finder_search_count_lines(const struct finder_search *search,
+                                        const char *buf, size_t len)
+{
+  const char *pos = buf;
+  const char *end = buf + len;
+  const char *hit;
+  const char *eol;
+  unsigned long count = 0;
+  find_fn find = find_for_impl(search->impl);
+
+  if (search->len == 0) {
+    // the empty pattern matches every line
+    while (pos < end && (eol = memchr(pos, '\n', end - pos)) != NULL) {
+      count++;
+      pos = eol + 1;
+    }
+    return count + (pos < end);
+  }
+
+  // find the next occurrence, count its line, resume after that line
+  while (pos < end) {
+    if (search->len == 1) {
+      hit = memchr(pos, search->needle[0], end - pos);
+    } else {
+      hit = find(search, pos, end);
+    }
+    if (hit == NULL)
+      break;
+    count++;
+    eol = memchr(hit + search->len, '\n', end - hit - search->len);
+    if (eol == NULL)
+      break;
+    pos = eol + 1;
+  }
+  return count;
+}
+
+const char *finder_search_impl_name(enum finder_search_impl impl)
+{
+  if (impl < 0 || impl >= FINDER_SEARCH_NUM_IMPLS) {
+    return NULL;
+  }
+  return impl_names[impl];
+}
@@ -0,0 +1,63 @@
+/* ----------------------------------------------------------------------------
+ * @file finder-search.h
+ * @brief Counts lines containing a fixed string, without splitting the
+ *        buffer into lines first
+ *
+ * Candidate positions are found with a SIMD filter on two bytes of the
+ * needle (AVX2 or SSE2 on x86, NEON on aarch64, picked at run time where
+ * the CPU may lack it) and verified with memcmp.  The two bytes are the
+ * ones expected to be rarest in text, which keeps false candidates few.
+ * After a match the search skips to the next line, so each matching line
+ * is counted once.  Single byte needles use memchr.  Other targets, and
+ * buffer tails too short for a vector load, use memmem.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef FINDER_SEARCH_H
+#define FINDER_SEARCH_H
+
+#include <stddef.h>
+
+enum finder_search_impl {
+  FINDER_SEARCH_MEMMEM = 0,
+  FINDER_SEARCH_SSE2,
+  FINDER_SEARCH_AVX2,
+  FINDER_SEARCH_NEON,
+  FINDER_SEARCH_NUM_IMPLS
+};
+
+struct finder_search {
+  const char *needle;
+  size_t len;
+  size_t off1;      // offsets of the two filter bytes within needle
+  size_t off2;
+  enum finder_search_impl impl;
+};
+
+/**
+* Prepare @param search to look for the @param len bytes at @param needle,
+* which must stay valid while search is used, with the fastest
+* implementation this CPU supports.
+*/
+void finder_search_init(struct finder_search *search, const char *needle, size_t len);
+
+/**
+* Use @param impl for @param search instead of the automatic choice.
+* @return 0 on success, -1 if impl is not supported on this CPU
+*/
+int finder_search_set_impl(struct finder_search *search, enum finder_search_impl impl);
+
+/**
+* @return the number of lines of buf[0..len) containing the needle.  The
+* last line need not end in a newline.  An empty needle matches every line.
+*/
+unsigned long finder_search_count_lines(const struct finder_search *search,
+                                        const char *buf, size_t len);
+
+/**
+* @return a short name for @param impl, such as "avx2"
+*/
+const char *finder_search_impl_name(enum finder_search_impl impl);
+
+#endif /* FINDER_SEARCH_H */
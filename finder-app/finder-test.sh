@@ -21,8 +21,11 @@ else
   WRITER_UTILITY="writer"
 fi
 
-# use the appropriate finder utility
-if ! command -v finder.sh &> /dev/null; then
+# use the appropriate finder utility.  FINDER_UTILITY=finder (or ./finder)
+# in the environment validates the native finder instead of finder.sh
+if [ -n "${FINDER_UTILITY:-}" ]; then
+  echo "Using ${FINDER_UTILITY} from the environment as the finder utility" >&2
+elif ! command -v finder.sh &> /dev/null; then
   # the finder-test script is probably running from build machine
   FINDER_UTILITY="./finder.sh"
 else
@@ -31,6 +34,136 @@ else
   FINDER_UTILITY="finder.sh"
 fi
 
+# ----------------------------------------------------------------------------
+# Benchmark mode: ./finder-test.sh --bench [results.csv]
+# Sweeps the number of files, file size and match density (percent of files
+# holding WRITESTR), timing writer's file creation and each finder's search
+# separately, and appends one CSV row per finder run to results.csv (default
+# stdout).  The sweep is set by the environment:
+#   BENCH_NUMFILES   default "10 100 1000 10000 100000 1000000"
+#   BENCH_SIZES      bytes per file, default "64 4096"
+#   BENCH_DENSITIES  default "100 1"
+#   BENCH_MAX_BYTES  skip points writing more than this, default 1 GiB
+#   BENCH_DROP_CACHES=1  drop the page cache before each search (root only)
+#   WRITER_QUEUE_DEPTH   passed to writer as -q, as in the normal test
+# Files go in subdirectories of 1000 below WRITEDIR, which is removed after.
+# ----------------------------------------------------------------------------
+
+bench_now() {
+  # seconds with nanoseconds where date supports %N
+  date +%s.%N | sed 's/\.N*$//; s/%N$//'
+}
+
+bench_elapsed() {
+  awk -v a="$1" -v b="$2" 'BEGIN { printf "%.3f", b - a }'
+}
+
+# writes the manifest for numfiles files of about size bytes, density percent
+# of them holding one line with the search string
+bench_manifest() {
+  # the string goes through the environment, awk -v would decode its escapes
+  BENCH_STR="$5" awk -v n="$1" -v size="$2" -v density="$3" -v dir="$4" 'BEGIN {
+    str = ENVIRON["BENCH_STR"]
+    gsub(/\\/, "&&", str)
+    filler = "the quick brown fox jumps over the lazy dog"
+    hit = str; miss = filler
+    while (length(hit) + length(filler) + 1 < size) hit = hit "\\n" filler
+    while (length(miss) + length(filler) + 1 < size) miss = miss "\\n" filler
+    every = (density > 0) ? int(100 / density) : 0
+    for (i = 0; i < n; i++) {
+      printf "%s/d%d/f%d.txt\t%s\\n\n", dir, int(i / 1000), i,
+             (every > 0 && i % every == 0) ? hit : miss
+    }
+  }'
+}
+
+run_bench() {
+  out=${1:-/dev/stdout}
+  numfiles_list=${BENCH_NUMFILES:-"10 100 1000 10000 100000 1000000"}
+  sizes=${BENCH_SIZES:-"64 4096"}
+  densities=${BENCH_DENSITIES:-"100 1"}
+  max_bytes=${BENCH_MAX_BYTES:-1073741824}
+  writer_opts=""
+  if [ -n "${WRITER_QUEUE_DEPTH:-}" ]; then
+    writer_opts="-q ${WRITER_QUEUE_DEPTH}"
+  fi
+
+  # both implementations when present; finder.sh relies on bash's [[
+  finders=""
+  if [ -x ./finder ]; then
+    finders="native:./finder"
+  elif command -v finder > /dev/null 2>&1; then
+    finders="native:finder"
+  fi
+  script=./finder.sh
+  [ -e "$script" ] || script=$(command -v finder.sh || true)
+  if [ -n "$script" ]; then
+    if command -v bash > /dev/null 2>&1; then
+      finders="$finders script:bash:$script"
+    else
+      finders="$finders script:$script"
+    fi
+  fi
+
+  # appending to an earlier run keeps its header
+  if [ "$out" = /dev/stdout ] || [ ! -s "$out" ]; then
+    echo "numfiles,size,density,matches,writer_s,writer_files_per_s,finder,finder_s,finder_mb_per_s,ok" > "$out"
+  fi
+
+  for numfiles in $numfiles_list; do
+    for size in $sizes; do
+      if [ $((numfiles * size)) -gt "$max_bytes" ]; then
+        echo "skipping $numfiles files of $size bytes, over BENCH_MAX_BYTES" >&2
+        continue
+      fi
+      for density in $densities; do
+        echo "bench: $numfiles files, $size bytes, density $density%" >&2
+        rm -rf "$WRITEDIR"
+        mkdir -p "$WRITEDIR"
+        seq 0 $(((numfiles - 1) / 1000)) | sed "s|^|$WRITEDIR/d|" | xargs mkdir -p
+
+        bench_manifest "$numfiles" "$size" "$density" "$WRITEDIR" "$WRITESTR" \
+          > "$WRITEDIR.manifest"
+        start=$(bench_now)
+        ${WRITER_UTILITY} ${writer_opts} -m "$WRITEDIR.manifest"
+        writer_s=$(bench_elapsed "$start" "$(bench_now)")
+        # keep writeback of these files out of the search timings
+        sync
+        rm -f "$WRITEDIR.manifest"
+
+        matches=$(awk -v n="$numfiles" -v d="$density" 'BEGIN {
+          e = (d > 0) ? int(100 / d) : 0; print ((e > 0) ? int((n + e - 1) / e) : 0) }')
+        expected="The number of files are ${numfiles} and the number of matching lines are ${matches}"
+
+        for f in $finders; do
+          name=${f%%:*}
+          cmd=$(echo "${f#*:}" | tr ':' ' ')
+          if [ "${BENCH_DROP_CACHES:-0}" = 1 ]; then
+            sync
+            echo 3 > /proc/sys/vm/drop_caches
+          fi
+          start=$(bench_now)
+          result=$($cmd "$WRITEDIR" "$WRITESTR" 2> /dev/null || true)
+          finder_s=$(bench_elapsed "$start" "$(bench_now)")
+          ok=no
+          [ "$result" = "$expected" ] && ok=yes
+          awk -v n="$numfiles" -v s="$size" -v d="$density" -v m="$matches" \
+              -v ws="$writer_s" -v f="$name" -v fs="$finder_s" -v ok="$ok" 'BEGIN {
+            printf "%d,%d,%s,%d,%s,%.0f,%s,%s,%.2f,%s\n", n, s, d, m, ws,
+                   (ws > 0) ? n / ws : 0, f, fs, (fs > 0) ? n * s / fs / 1e6 : 0, ok }' >> "$out"
+        done
+      done
+    done
+  done
+  rm -rf "$WRITEDIR"
+}
+
+if [ "${1:-}" = "--bench" ]; then
+  shift
+  run_bench "$@"
+  exit $?
+fi
+
 # find where we have stored the conf/username.txt 
 if [ -e ./conf/username.txt ]; then
   username=$(cat conf/username.txt)
@@ -74,10 +207,18 @@ fi
 #make clean
 #make
 
+# write all the files from a single writer process, one manifest line per file
+# (backslashes in WRITESTR are escaped since the manifest decodes them).
+# WRITER_QUEUE_DEPTH=n in the environment writes them through io_uring.
+WRITER_OPTS=""
+if [ -n "${WRITER_QUEUE_DEPTH:-}" ]; then
+  WRITER_OPTS="-q ${WRITER_QUEUE_DEPTH}"
+fi
+MANIFESTSTR=$(printf '%s' "$WRITESTR" | sed 's/\\/\\\\/g')
 for i in $( seq 1 $NUMFILES)
 do
-  ${WRITER_UTILITY} "$WRITEDIR/${username}$i.txt" "$WRITESTR"
-done
+  printf '%s\t%s\n' "$WRITEDIR/${username}$i.txt" "$MANIFESTSTR"
+done | ${WRITER_UTILITY} ${WRITER_OPTS} -m -
 
 # record output from finder utility and post result to /tmp/assignment-4-result.txt
 OUTPUTSTRING=$(${FINDER_UTILITY} "$WRITEDIR" "$WRITESTR")
@@ -0,0 +1,667 @@
+/* ----------------------------------------------------------------------------
+ * @file finder.c
+ * @brief Native replacement for finder.sh
+ * @usage ./finder [-j threads] [-x index [-u | -c]] <filesdir> <searchstr>
+ *        ./finder -d <socket> <filesdir> <searchstr>
+ *        ./finder -Q <socket>
+ *        prints the same line as finder.sh:
+ *        "The number of files are N and the number of matching lines are M"
+ *        where N counts regular files like `find <filesdir> -type f | wc -l`
+ *        and M counts lines like `grep -re <searchstr> <filesdir> | wc -l`.
+ *
+ *        The tree is walked once, each directory is read with getdents64 and
+ *        becomes one aesd-sched task, so idle threads pick up (steal)
+ *        directories found by busy ones.  Files are searched as they are
+ *        found: small files with one read() into a per-task buffer, files
+ *        over MMAP_THRESHOLD through mmap.  Like find and grep -r, symbolic
+ *        links below filesdir are not followed.  searchstr is a POSIX basic
+ *        regular expression as for grep; patterns without regex
+ *        metacharacters are counted with the SIMD search in finder-search.c.
+ *        Like GNU grep 3.5+, files with a NUL byte in their first block are
+ *        treated as binary and contribute no lines.
+ *
+ *        -x keeps a trigram index of filesdir in the file index (see
+ *        finder-index.h), building it on first use.  Queries then read only
+ *        the files that may contain searchstr and do not walk the tree, so
+ *        they trust the index: files changed or added since it was updated
+ *        are counted as they were.  -u updates the index before the query,
+ *        rereading only files whose size or mtime changed, and -d keeps the
+ *        counts fresh on its own.  -c instead stats every indexed file and
+ *        searches those whose size or mtime changed as they are now, which
+ *        makes a query linear in the size of the tree again.
+ *
+ *        -d stays running, keeping the counts up to date with inotify and
+ *        answering each connection to the Unix socket with the line above
+ *        (see finder-live.h).  -Q asks such a daemon for its counts.
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <regex.h>
+#include <dirent.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "aesd-sched.h"
+#include "finder-search.h"
+#include "finder-index.h"
+#include "finder-live.h"
+
+#define DENTS_BUF_SIZE (64 * 1024)
+#define READ_BUF_SIZE (64 * 1024)
+// files larger than this are mapped and searched in one pass
+#define MMAP_THRESHOLD (256 * 1024)
+// index candidates searched per task
+#define QUERY_BATCH (256)
+
+// getdents64 record, see getdents(2)
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+/* ============================================================================
+ *    GLOBALS
+ * ===========================================================================*/
+static struct aesd_sched *sched;
+static struct aesd_task_group walk_group;
+static atomic_ulong num_files;
+static atomic_ulong num_lines;
+
+static bool use_regex;
+static bool check_changed;      // -c, search changed indexed files too
+static regex_t search_regex;
+static struct finder_search search;
+
+// set while walking the tree to build an index instead of searching
+static struct finder_index_builder *index_builder;
+static struct finder_index *tree_index;
+
+struct query_batch {
+  const uint32_t *ids;
+  long count;
+};
+
+// file read buffer of a directory task, grown to hold the longest line seen
+struct read_buf {
+  char *data;
+  size_t size;
+};
+
+/* ============================================================================
+ *    SEARCH
+ * ===========================================================================*/
+
+/*
+ * @brief  counts lines of buf[0..len) matching searchstr, buf holds whole lines
+ *         except possibly an unterminated last one
+ * @return number of matching lines
+ */
+static unsigned long count_matches(const char *buf, size_t len)
+{
+  const char *pos = buf;
+  const char *end = buf + len;
+  const char *eol;
+  unsigned long count = 0;
+  regmatch_t match;
+
+  if (!use_regex) {
+    return finder_search_count_lines(&search, buf, len);
+  }
+
+  while (pos < end) {
+    eol = memchr(pos, '\n', end - pos);
+    if (eol == NULL)
+      eol = end;
+    match.rm_so = 0;
+    match.rm_eo = eol - pos;
+    if (regexec(&search_regex, pos, 1, &match, REG_STARTEND) == 0)
+      count++;
+    pos = eol + 1;
+  }
+  return count;
+}
+
+/*
+ * @brief  counts the matching lines of a large file by mapping it
+ * @return number of matching lines, or -1 if it could not be mapped
+ */
+static long search_mapped(int fd, size_t size)
+{
+  char *map;
+  long count;
+
+  map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  if (memchr(map, '\0', size < READ_BUF_SIZE ? size : READ_BUF_SIZE) != NULL) {
+    count = 0; // binary file
+  } else {
+    count = (long) count_matches(map, size);
+  }
+  munmap(map, size);
+  return count;
+}
+
+/*
+ * @brief  counts the matching lines of the regular file name in dirfd,
+ *         dirpath is only used for messages and may be NULL
+ * @return number of matching lines
+ */
+static unsigned long search_file(int dirfd, const char *name, const char *dirpath,
+                                 struct read_buf *rb)
+{
+  const char *sep = dirpath ? "/" : "";
+  int fd;
+  size_t filled = 0;   // bytes in rb->data
+  size_t complete;     // bytes up to and including the last newline
+  ssize_t nread;
+  bool first = true;
+  unsigned long count = 0;
+  char *nl;
+  struct stat st;
+  bool sized = false;  // checked whether the file is worth mapping
+  long mapped;
+
+  fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_NOCTTY);
+  if (fd == -1) {
+    fprintf(stderr, "finder: %s%s%s: %s\n", dirpath ? dirpath : "", sep, name,
+            strerror(errno));
+    return 0;
+  }
+
+  if (rb->data == NULL) {
+    rb->size = READ_BUF_SIZE;
+    rb->data = malloc(rb->size);
+    if (rb->data == NULL) {
+      close(fd);
+      return 0;
+    }
+  }
+
+  while (true) {
+    if (filled == rb->size) {
+      // a single line longer than the buffer
+      char *bigger = realloc(rb->data, rb->size * 2);
+      if (bigger == NULL) {
+        fprintf(stderr, "finder: %s%s%s: line too long\n", dirpath ? dirpath : "", sep, name);
+        break;
+      }
+      rb->data = bigger;
+      rb->size *= 2;
+    }
+    nread = read(fd, rb->data + filled, rb->size - filled);
+    if (nread == -1) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "finder: %s%s%s: %s\n", dirpath ? dirpath : "", sep, name,
+              strerror(errno));
+      break;
+    }
+    if (nread == 0) {
+      // unterminated last line
+      count += count_matches(rb->data, filled);
+      break;
+    }
+    if (first && memchr(rb->data, '\0', nread) != NULL) {
+      count = 0; // binary file
+      break;
+    }
+    first = false;
+    filled += nread;
+
+    if (filled < rb->size) {
+      // a short read of a regular file only happens at end of file, which
+      // saves the extra read() returning 0 for the many small files
+      count += count_matches(rb->data, filled);
+      break;
+    }
+
+    if (!sized) {
+      // a big file, search it in place rather than copying it through rb
+      sized = true;
+      if (fstat(fd, &st) == 0 && st.st_size > MMAP_THRESHOLD &&
+          (mapped = search_mapped(fd, st.st_size)) >= 0) {
+        count = mapped;
+        break;
+      }
+    }
+
+    nl = memrchr(rb->data, '\n', filled);
+    if (nl == NULL)
+      continue;
+    complete = nl - rb->data + 1;
+    count += count_matches(rb->data, complete);
+    memmove(rb->data, rb->data + complete, filled - complete);
+    filled -= complete;
+  }
+
+  close(fd);
+  return count;
+}
+
+/* ============================================================================
+ *    TRAVERSAL
+ * ===========================================================================*/
+
+static void walk_dir_task(void *param);
+
+static int index_file(int dirfd, const char *name, const char *dirpath, const struct stat *st)
+{
+  char path[PATH_MAX];
+
+  if (snprintf(path, sizeof(path), "%s/%s", dirpath, name) >= (int) sizeof(path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  return finder_index_builder_add(index_builder, dirfd, name, path, st);
+}
+
+static void queue_dir(const char *dirpath, const char *name)
+{
+  size_t dirlen = strlen(dirpath);
+  size_t namelen = strlen(name);
+  char *path = malloc(dirlen + namelen + 2);
+
+  if (path == NULL) {
+    fprintf(stderr, "finder: malloc fail\n");
+    return;
+  }
+  memcpy(path, dirpath, dirlen);
+  path[dirlen] = '/';
+  memcpy(path + dirlen + 1, name, namelen + 1);
+
+  if (aesd_sched_submit(sched, &walk_group, walk_dir_task, path) != 0) {
+    fprintf(stderr, "finder: %s: cannot queue directory\n", path);
+    free(path);
+  }
+}
+
+/*
+ * @brief  reads one directory, searches its files and queues its
+ *         subdirectories, then frees param (the directory path)
+ */
+static void walk_dir_task(void *param)
+{
+  char *path = (char *) param;
+  char *dents;
+  long nread;
+  long off;
+  int dirfd;
+  unsigned char type;
+  struct stat st;
+  unsigned long files = 0;
+  unsigned long lines = 0;
+  struct read_buf rb = { NULL, 0 };
+
+  dirfd = open(path, O_RDONLY | O_DIRECTORY | O_NOCTTY);
+  if (dirfd == -1) {
+    fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+    free(path);
+    return;
+  }
+  dents = malloc(DENTS_BUF_SIZE);
+  if (dents == NULL) {
+    close(dirfd);
+    free(path);
+    return;
+  }
+
+  while ((nread = syscall(SYS_getdents64, dirfd, dents, DENTS_BUF_SIZE)) > 0) {
+    for (off = 0; off < nread; ) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *) (dents + off);
+      off += d->d_reclen;
+
+      if (d->d_name[0] == '.' && (d->d_name[1] == '\0' ||
+          (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+        continue;
+
+      type = d->d_type;
+      if (type == DT_UNKNOWN) {
+        // some filesystems do not fill in d_type
+        if (fstatat(dirfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+          continue;
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+      }
+
+      if (type == DT_DIR) {
+        queue_dir(path, d->d_name);
+      } else if (type == DT_REG && index_builder != NULL) {
+        files++;
+        if (d->d_type != DT_UNKNOWN &&
+            fstatat(dirfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+          continue;
+        if (index_file(dirfd, d->d_name, path, &st) != 0)
+          fprintf(stderr, "finder: %s/%s: cannot index\n", path, d->d_name);
+      } else if (type == DT_REG) {
+        files++;
+        lines += search_file(dirfd, d->d_name, path, &rb);
+      }
+    }
+  }
+  if (nread == -1) {
+    fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+  }
+
+  atomic_fetch_add_explicit(&num_files, files, memory_order_relaxed);
+  atomic_fetch_add_explicit(&num_lines, lines, memory_order_relaxed);
+  free(rb.data);
+  free(dents);
+  close(dirfd);
+  free(path);
+}
+
+/* ============================================================================
+ *    INDEX
+ * ===========================================================================*/
+
+static void query_task(void *param)
+{
+  struct query_batch *batch = (struct query_batch *) param;
+  struct read_buf rb = { NULL, 0 };
+  unsigned long lines = 0;
+  long i;
+  char dirpath[PATH_MAX] = "";
+  size_t dirlen = 0;
+  int dirfd = -1;
+  const char *path;
+  const char *slash;
+
+  // paths are sorted, so open each directory once and the files relative to it
+  for (i = 0; i < batch->count; i++) {
+    path = finder_index_path(tree_index, batch->ids[i]);
+    slash = strrchr(path, '/');
+    if (slash == NULL || (size_t) (slash - path) >= sizeof(dirpath)) {
+      lines += search_file(AT_FDCWD, path, NULL, &rb);
+      continue;
+    }
+    if (dirfd == -1 || (size_t) (slash - path) != dirlen || memcmp(path, dirpath, dirlen) != 0) {
+      if (dirfd != -1)
+        close(dirfd);
+      dirlen = slash - path;
+      memcpy(dirpath, path, dirlen);
+      dirpath[dirlen] = '\0';
+      dirfd = open(dirlen ? dirpath : "/", O_RDONLY | O_DIRECTORY | O_PATH);
+      if (dirfd == -1) {
+        lines += search_file(AT_FDCWD, path, NULL, &rb);
+        continue;
+      }
+    }
+    lines += search_file(dirfd, slash + 1, dirpath, &rb);
+  }
+  if (dirfd != -1)
+    close(dirfd);
+  atomic_fetch_add_explicit(&num_lines, lines, memory_order_relaxed);
+  free(rb.data);
+  free(batch);
+}
+
+/*
+ * @brief  walks filesdir, searching each regular file or, while
+ *         index_builder is set, adding it to the index
+ * @return 0 on success, -1 on error
+ */
+static int walk_tree(const char *filesdir)
+{
+  // the root task owns its path like every other directory task
+  char *root = strdup(filesdir);
+
+  if (root == NULL) {
+    return -1;
+  }
+  aesd_task_group_init(&walk_group);
+  if (aesd_sched_submit(sched, &walk_group, walk_dir_task, root) != 0) {
+    free(root);
+    return -1;
+  }
+  aesd_task_group_wait(sched, &walk_group);
+  return 0;
+}
+
+/*
+ * @brief  opens the index at index_path for filesdir, building or updating
+ *         it first if needed
+ * @return 0 on success, -1 on error
+ */
+static int load_index(const char *index_path, const char *filesdir, bool update)
+{
+  tree_index = finder_index_open(index_path);
+  if (tree_index != NULL && strcmp(finder_index_root(tree_index), filesdir) != 0) {
+    fprintf(stderr, "finder: %s indexes %s, rebuilding for %s\n", index_path,
+            finder_index_root(tree_index), filesdir);
+    update = true;
+  }
+  if (tree_index != NULL && !update) {
+    return 0;
+  }
+
+  index_builder = finder_index_builder_create(filesdir, tree_index);
+  finder_index_close(tree_index);
+  tree_index = NULL;
+  if (index_builder == NULL || walk_tree(filesdir) != 0 ||
+      finder_index_builder_write(index_builder, index_path) != 0) {
+    fprintf(stderr, "finder: cannot write index %s: %s\n", index_path, strerror(errno));
+    finder_index_builder_destroy(index_builder);
+    index_builder = NULL;
+    return -1;
+  }
+  finder_index_builder_destroy(index_builder);
+  index_builder = NULL;
+
+  tree_index = finder_index_open(index_path);
+  return tree_index != NULL ? 0 : -1;
+}
+
+/*
+ * @brief  adds the indexed files changed since the index was updated to the
+ *         candidates, their trigrams may no longer say whether they match
+ * @param  ids, the candidates in id order, replaced by a malloc'd array
+ * @param  ncandidates, their number
+ * @return the number of files to search, or -1 on error
+ */
+static long add_changed_files(uint32_t **ids, long ncandidates)
+{
+  unsigned long nfiles = finder_index_num_files(tree_index);
+  uint32_t *merged = malloc(sizeof(uint32_t) * (nfiles ? nfiles : 1));
+  long count = 0;
+  long k = 0;
+  uint32_t id;
+
+  if (merged == NULL) {
+    return -1;
+  }
+  for (id = 0; id < nfiles; id++) {
+    if (k < ncandidates && (*ids)[k] == id) {
+      merged[count++] = id;
+      k++;
+    } else if (finder_index_file_changed(tree_index, id)) {
+      merged[count++] = id;
+    }
+  }
+  free(*ids);
+  *ids = merged;
+  return count;
+}
+
+/*
+ * @brief  counts matching lines of the index candidates for searchstr
+ * @return 0 on success, -1 on error
+ */
+static int query_index(const char *searchstr)
+{
+  struct aesd_task_group group;
+  struct query_batch *batch;
+  uint32_t *ids;
+  long ncandidates;
+  long i;
+
+  // regular expressions have no fixed string to filter on
+  ncandidates = finder_index_candidates(tree_index, searchstr,
+                                        use_regex ? 0 : strlen(searchstr), &ids);
+  if (ncandidates >= 0 && check_changed) {
+    ncandidates = add_changed_files(&ids, ncandidates);
+  }
+  if (ncandidates < 0) {
+    free(ids);
+    return -1;
+  }
+
+  aesd_task_group_init(&group);
+  for (i = 0; i < ncandidates; i += QUERY_BATCH) {
+    batch = malloc(sizeof(struct query_batch));
+    if (batch == NULL) {
+      break;
+    }
+    batch->ids = ids + i;
+    batch->count = ncandidates - i < QUERY_BATCH ? ncandidates - i : QUERY_BATCH;
+    if (aesd_sched_submit(sched, &group, query_task, batch) != 0) {
+      free(batch);
+      break;
+    }
+  }
+  aesd_task_group_wait(sched, &group);
+  free(ids);
+
+  atomic_store(&num_files, finder_index_num_files(tree_index));
+  return i < ncandidates ? -1 : 0;
+}
+
+static unsigned long live_count(const char *path)
+{
+  // the daemon counts from a single thread
+  static struct read_buf rb = { NULL, 0 };
+
+  return search_file(AT_FDCWD, path, NULL, &rb);
+}
+
+/* ============================================================================
+ *    MAIN
+ * ===========================================================================*/
+
+static bool has_regex_metachars(const char *str)
+{
+  // the characters special somewhere in a POSIX basic regular expression
+  return strpbrk(str, ".[]*^$\\") != NULL;
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  int rc;
+  const char *searchstr;
+  long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  struct stat st;
+  char errbuf[128];
+  const char *index_path = NULL;
+  bool update = false;
+  const char *live_socket = NULL;
+  const char *query_socket = NULL;
+
+  while ((opt = getopt(argc, argv, "+j:x:ucd:Q:")) != -1) {
+    switch (opt) {
+      case 'j':
+        nthreads = atol(optarg);
+        break;
+      case 'x':
+        index_path = optarg;
+        break;
+      case 'u':
+        update = true;
+        break;
+      case 'c':
+        check_changed = true;
+        break;
+      case 'd':
+        live_socket = optarg;
+        break;
+      case 'Q':
+        query_socket = optarg;
+        break;
+      default:
+        printf("Usage: %s [-j threads] [-x index [-u | -c]] <filesdir> <searchstr>\n",
+               argv[0]);
+        printf("       %s -d <socket> <filesdir> <searchstr>\n", argv[0]);
+        printf("       %s -Q <socket>\n", argv[0]);
+        return 1;
+    }
+  }
+  if (query_socket != NULL) {
+    return finder_live_query(query_socket) == 0 ? 0 : 1;
+  }
+  if (nthreads < 1) {
+    nthreads = 1;
+  }
+
+  // ensure 2 arguments are passed (filesdir and searchstr)
+  if (argc - optind < 2) {
+    printf("error: %d arguments given, 2 expected\n", argc - optind);
+    return 1;
+  }
+  searchstr = argv[optind + 1];
+
+  // check if filesdir exists on filesystem
+  if (stat(argv[optind], &st) == -1 || !S_ISDIR(st.st_mode)) {
+    printf("%s is not a directory or does not exist\n", argv[optind]);
+    return 1;
+  }
+
+  finder_search_init(&search, searchstr, strlen(searchstr));
+  use_regex = has_regex_metachars(searchstr);
+  if (use_regex) {
+    rc = regcomp(&search_regex, searchstr, REG_NOSUB);
+    if (rc != 0) {
+      regerror(rc, &search_regex, errbuf, sizeof(errbuf));
+      fprintf(stderr, "finder: %s\n", errbuf);
+      return 2;
+    }
+  }
+
+  if (live_socket != NULL) {
+    rc = finder_live_run(argv[optind], live_socket, live_count);
+    if (use_regex) {
+      regfree(&search_regex);
+    }
+    return rc == 0 ? 0 : 1;
+  }
+
+  sched = aesd_sched_create((unsigned int) nthreads);
+  if (sched == NULL) {
+    fprintf(stderr, "finder: cannot start %ld threads\n", nthreads);
+    return 1;
+  }
+
+  if (index_path != NULL) {
+    rc = load_index(index_path, argv[optind], update) == 0 ? query_index(searchstr) : -1;
+    finder_index_close(tree_index);
+  } else {
+    rc = walk_tree(argv[optind]);
+  }
+  aesd_sched_destroy(sched);
+  if (rc != 0) {
+    return 1;
+  }
+
+  printf("The number of files are %lu and the number of matching lines are %lu\n",
+         atomic_load(&num_files), atomic_load(&num_lines));
+
+  if (use_regex) {
+    regfree(&search_regex);
+  }
+  return 0;
+}
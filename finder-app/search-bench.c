@@ -0,0 +1,225 @@
+/* ----------------------------------------------------------------------------
+ * @file search-bench.c
+ * @brief Line counting throughput of finder-search.c against grep -c
+ * @usage ./search-bench [-p pattern] [-s size_mb] [-r rate] [file ...]
+ *        Every available search implementation counts the lines of each
+ *        file containing pattern (default AELD_IS_FUN), then grep -c does the
+ *        same with LC_ALL=C.  Files are mapped and faulted in first so both
+ *        sides read from the page cache.  Without files a synthetic corpus of
+ *        size_mb (default 256) MB of word lines is written to /tmp, with the
+ *        pattern on roughly one line in rate (default 100).
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "finder-search.h"
+
+#define MIN_BENCH_SECONDS (0.5)
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int make_corpus(const char *path, size_t size, const char *pattern, unsigned int rate)
+{
+  static const char *const words[] = {
+    "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "kernel",
+    "driver", "buffer", "socket", "thread", "mutex", "embedded", "linux",
+    "AELD", "IS", "FUN", "assignment", "yocto", "buildroot", "qemu", "aarch64"
+  };
+  unsigned int nwords = sizeof(words) / sizeof(words[0]);
+  unsigned int seed = 12345;
+  size_t written = 0;
+  size_t linelen;
+  char line[256];
+  FILE *stream;
+
+  stream = fopen(path, "w");
+  if (stream == NULL) {
+    perror("fopen");
+    return -1;
+  }
+  while (written < size) {
+    linelen = 0;
+    seed = seed * 1103515245u + 12345u;
+    if (rate > 0 && (seed >> 16) % rate == 0) {
+      linelen += snprintf(line, sizeof(line), "%s ", pattern);
+    }
+    while (linelen < 60) {
+      seed = seed * 1103515245u + 12345u;
+      linelen += snprintf(line + linelen, sizeof(line) - linelen, "%s ",
+                          words[(seed >> 16) % nwords]);
+    }
+    line[linelen - 1] = '\n';
+    fwrite(line, 1, linelen, stream);
+    written += linelen;
+  }
+  fclose(stream);
+  return 0;
+}
+
+// runs grep -c, returning its count and wall time
+static long run_grep(const char *pattern, const char *path, double *seconds)
+{
+  int pipefd[2];
+  char out[64];
+  ssize_t n;
+  double start;
+  pid_t pid;
+  int status;
+
+  if (pipe(pipefd) == -1) {
+    return -1;
+  }
+  start = now_seconds();
+  pid = fork();
+  if (pid == 0) {
+    dup2(pipefd[1], STDOUT_FILENO);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    setenv("LC_ALL", "C", 1);
+    execlp("grep", "grep", "-c", "-e", pattern, path, (char *) NULL);
+    _exit(127);
+  }
+  close(pipefd[1]);
+  n = read(pipefd[0], out, sizeof(out) - 1);
+  close(pipefd[0]);
+  waitpid(pid, &status, 0);
+  *seconds = now_seconds() - start;
+  if (pid == -1 || n <= 0 || !WIFEXITED(status) || WEXITSTATUS(status) > 1) {
+    return -1;
+  }
+  out[n] = '\0';
+  return atol(out);
+}
+
+static int bench_file(const char *path, const char *pattern)
+{
+  struct finder_search search;
+  struct stat st;
+  const char *map;
+  unsigned long count = 0;
+  unsigned long expected = 0;
+  unsigned int impl;
+  unsigned int iters;
+  volatile unsigned long sink = 0;
+  double start;
+  double elapsed;
+  long grep_count;
+  int fd;
+  int rc = 0;
+  size_t i;
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) {
+    printf("search-bench ERROR: cannot open %s\n", path);
+    return -1;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  for (i = 0; i < (size_t) st.st_size; i += 4096) {
+    sink += map[i];
+  }
+
+  printf("%s: %.1f MB, pattern \"%s\"\n", path, st.st_size / 1e6, pattern);
+  printf("%-8s %10s %10s %s\n", "impl", "lines", "GB/s", "check");
+
+  finder_search_init(&search, pattern, strlen(pattern));
+  for (impl = 0; impl < FINDER_SEARCH_NUM_IMPLS; impl++) {
+    if (finder_search_set_impl(&search, (enum finder_search_impl) impl) != 0) {
+      continue;
+    }
+    iters = 0;
+    start = now_seconds();
+    do {
+      count = finder_search_count_lines(&search, map, st.st_size);
+      iters++;
+      elapsed = now_seconds() - start;
+    } while (elapsed < MIN_BENCH_SECONDS);
+    if (impl == FINDER_SEARCH_MEMMEM) {
+      expected = count;
+    }
+    printf("%-8s %10lu %10.2f %s\n", finder_search_impl_name((enum finder_search_impl) impl),
+           count, (double) st.st_size * iters / elapsed / 1e9,
+           count == expected ? "ok" : "MISMATCH");
+    if (count != expected) {
+      rc = -1;
+    }
+  }
+
+  // once to warm up the binary, then timed
+  run_grep(pattern, path, &elapsed);
+  grep_count = run_grep(pattern, path, &elapsed);
+  if (grep_count < 0) {
+    printf("%-8s %10s\n", "grep -c", "failed");
+  } else {
+    printf("%-8s %10ld %10.2f %s\n", "grep -c", grep_count, st.st_size / elapsed / 1e9,
+           (unsigned long) grep_count == expected ? "ok" : "MISMATCH");
+    if ((unsigned long) grep_count != expected) {
+      rc = -1;
+    }
+  }
+
+  munmap((void *) map, st.st_size);
+  return rc;
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  int i;
+  int rc = 0;
+  const char *pattern = "AELD_IS_FUN";
+  size_t size_mb = 256;
+  unsigned int rate = 100;
+  char corpus[] = "/tmp/search-bench-XXXXXX";
+  int fd;
+
+  while ((opt = getopt(argc, argv, "p:s:r:")) != -1) {
+    switch (opt) {
+      case 'p': pattern = optarg; break;
+      case 's': size_mb = strtoul(optarg, NULL, 0); break;
+      case 'r': rate = (unsigned int) strtoul(optarg, NULL, 0); break;
+      default:
+        printf("Usage: %s [-p pattern] [-s size_mb] [-r rate] [file ...]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (optind < argc) {
+    for (i = optind; i < argc; i++) {
+      if (bench_file(argv[i], pattern) != 0) {
+        rc = 1;
+      }
+    }
+    return rc;
+  }
+
+  fd = mkstemp(corpus);
+  if (fd == -1) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+  if (make_corpus(corpus, size_mb << 20, pattern, rate) != 0 ||
+      bench_file(corpus, pattern) != 0) {
+    rc = 1;
+  }
+  unlink(corpus);
+  return rc;
+}
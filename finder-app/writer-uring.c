@@ -0,0 +1,459 @@
+/* ----------------------------------------------------------------------------
+ * @file writer-uring.c
+ * @brief io_uring path for writer's bulk mode
+ * @author Jake Michael, jami1063@colorado.edu
+ * @resources
+ * (+)  io_uring(7), io_uring_setup(2), io_uring_enter(2),
+ *      io_uring_register(2)
+ * (+)  Jens Axboe, "Efficient IO with io_uring",
+ *      https://kernel.dk/io_uring.pdf
+ *---------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include "writer-uring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__has_include)
+  #if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+    #include <linux/io_uring.h>
+    #define HAVE_IO_URING (1)
+  #endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+// user_data of a completion, the slot and which step of its chain
+#define OP_OPEN  (0)
+#define OP_WRITE (1)
+#define OP_CLOSE (2)
+#define OPS_PER_FILE (3)
+#define USER_DATA(slot, op) (((uint64_t) (slot) << 2) | (op))
+
+struct uring_slot {
+  char *buf;                  // path, NUL, content; stays put until the chain completes
+  size_t cap;
+  size_t pathlen;
+  size_t len;                 // content length
+  int pending;                // completions still to come
+  int failed;
+};
+
+struct writer_uring {
+  int fd;
+  unsigned int depth;
+  writer_uring_fallback fallback;
+
+  void *sq_map;
+  size_t sq_map_len;
+  void *cq_map;               // same as sq_map with IORING_FEAT_SINGLE_MMAP
+  size_t cq_map_len;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int sq_mask;
+  unsigned int sq_entries;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int cq_mask;
+  struct io_uring_cqe *cqes;
+
+  unsigned int sq_local_tail; // queued but not yet visible to the kernel
+  unsigned int to_submit;
+
+  struct uring_slot *slots;
+  unsigned int *free_slots;
+  unsigned int nfree;
+
+  unsigned long files;
+  unsigned long long bytes;
+  int rc;
+};
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                       unsigned int flags)
+{
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+  return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * @brief  checks the kernel knows every operation of a chain
+ * @return 1 if so, 0 otherwise
+ */
+static int ops_supported(int fd)
+{
+  static const int needed[] = { IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE };
+  struct io_uring_probe *probe;
+  size_t probe_len = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+  size_t i;
+  int ok = 0;
+
+  probe = calloc(1, probe_len);
+  if (probe == NULL) {
+    return 0;
+  }
+  if (uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+    ok = 1;
+    for (i = 0; i < sizeof(needed) / sizeof(needed[0]); i++) {
+      if (needed[i] > probe->last_op ||
+          !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+        ok = 0;
+      }
+    }
+  }
+  free(probe);
+  return ok;
+}
+
+static struct io_uring_sqe *get_sqe(struct writer_uring *ring)
+{
+  struct io_uring_sqe *sqe;
+  unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+  if (ring->sq_local_tail - head >= ring->sq_entries) {
+    return NULL;
+  }
+  sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+  ring->sq_local_tail++;
+  ring->to_submit++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+/*
+ * @brief  a chain finished, counts the file or hands it to the fallback
+ */
+static void complete_slot(struct writer_uring *ring, unsigned int slot)
+{
+  struct uring_slot *s = &ring->slots[slot];
+
+  if (s->failed) {
+    if (ring->fallback(s->buf, s->buf + s->pathlen + 1, s->len) != 0) {
+      ring->rc = -1;
+      goto done;
+    }
+  }
+  ring->files++;
+  ring->bytes += s->len;
+
+done:
+  ring->free_slots[ring->nfree++] = slot;
+}
+
+static void reap(struct writer_uring *ring)
+{
+  unsigned int head = *ring->cq_head;
+  unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  struct io_uring_cqe *cqe;
+  struct uring_slot *s;
+  unsigned int slot;
+  unsigned int op;
+
+  while (head != tail) {
+    cqe = &ring->cqes[head & ring->cq_mask];
+    slot = (unsigned int) (cqe->user_data >> 2);
+    op = (unsigned int) (cqe->user_data & 3);
+    s = &ring->slots[slot];
+    // a short write breaks the link like an error, the close is then cancelled
+    if (cqe->res < 0 || (op == OP_WRITE && (size_t) cqe->res != s->len)) {
+      s->failed = 1;
+    }
+    head++;
+    if (--s->pending == 0) {
+      complete_slot(ring, slot);
+    }
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * @brief  submits queued entries and waits for at least min_complete
+ *         completions
+ * @return 0 on success, -1 on error
+ */
+static int submit_and_wait(struct writer_uring *ring, unsigned int min_complete)
+{
+  int submitted;
+
+  __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+  do {
+    submitted = uring_enter(ring->fd, ring->to_submit, min_complete,
+                            min_complete ? IORING_ENTER_GETEVENTS : 0);
+  } while (submitted == -1 && errno == EINTR);
+  if (submitted == -1 && errno != EBUSY && errno != EAGAIN) {
+    syslog(LOG_ERR, "io_uring_enter: %s", strerror(errno));
+    return -1;
+  }
+  if (submitted > 0) {
+    ring->to_submit -= submitted;
+  }
+  reap(ring);
+  return 0;
+}
+
+/* ============================================================================
+ *    INTERFACE
+ * ===========================================================================*/
+
+struct writer_uring *writer_uring_create(unsigned int depth, writer_uring_fallback fallback)
+{
+  struct writer_uring *ring;
+  struct io_uring_params p;
+  int *files = NULL;
+  unsigned int i;
+  unsigned int *sq_array;
+  unsigned int nworkers[2];
+
+  if (depth == 0) {
+    return NULL;
+  }
+  ring = calloc(1, sizeof(*ring));
+  if (ring == NULL) {
+    return NULL;
+  }
+  ring->fd = -1;
+  ring->depth = depth;
+  ring->fallback = fallback;
+
+  memset(&p, 0, sizeof(p));
+  ring->fd = uring_setup(depth * OPS_PER_FILE, &p);
+  if (ring->fd == -1) {
+    syslog(LOG_INFO, "io_uring unavailable (%s), using synchronous writes", strerror(errno));
+    goto handle_errors;
+  }
+  if (!ops_supported(ring->fd)) {
+    syslog(LOG_INFO, "io_uring lacks openat/write/close, using synchronous writes");
+    goto handle_errors;
+  }
+
+  ring->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  ring->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_map_len > ring->sq_map_len)
+      ring->sq_map_len = ring->cq_map_len;
+    ring->cq_map_len = ring->sq_map_len;
+  }
+  ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED) {
+    ring->sq_map = NULL;
+    goto handle_errors;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_map = ring->sq_map;
+  } else {
+    ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) {
+      ring->cq_map = NULL;
+      goto handle_errors;
+    }
+  }
+  ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    goto handle_errors;
+  }
+
+  ring->sq_head = (unsigned int *) ((char *) ring->sq_map + p.sq_off.head);
+  ring->sq_tail = (unsigned int *) ((char *) ring->sq_map + p.sq_off.tail);
+  ring->sq_mask = *(unsigned int *) ((char *) ring->sq_map + p.sq_off.ring_mask);
+  ring->sq_entries = p.sq_entries;
+  ring->cq_head = (unsigned int *) ((char *) ring->cq_map + p.cq_off.head);
+  ring->cq_tail = (unsigned int *) ((char *) ring->cq_map + p.cq_off.tail);
+  ring->cq_mask = *(unsigned int *) ((char *) ring->cq_map + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_map + p.cq_off.cqes);
+  ring->sq_local_tail = *ring->sq_tail;
+
+  // sqe i always sits at array index i
+  sq_array = (unsigned int *) ((char *) ring->sq_map + p.sq_off.array);
+  for (i = 0; i < p.sq_entries; i++) {
+    sq_array[i] = i;
+  }
+
+  // an empty (all -1) direct file table, one slot per chain in flight
+  files = malloc(depth * sizeof(int));
+  ring->slots = calloc(depth, sizeof(struct uring_slot));
+  ring->free_slots = malloc(depth * sizeof(unsigned int));
+  if (files == NULL || ring->slots == NULL || ring->free_slots == NULL) {
+    goto handle_errors;
+  }
+  for (i = 0; i < depth; i++) {
+    files[i] = -1;
+    ring->free_slots[i] = depth - 1 - i;
+  }
+  ring->nfree = depth;
+  if (uring_register(ring->fd, IORING_REGISTER_FILES, files, depth) == -1) {
+    syslog(LOG_INFO, "io_uring file table unavailable (%s), using synchronous writes",
+           strerror(errno));
+    goto handle_errors;
+  }
+  free(files);
+
+  // opens that create files always go to io-wq workers, more of them than
+  // CPUs only adds contention on the directory lock
+  nworkers[0] = nworkers[1] = (unsigned int) sysconf(_SC_NPROCESSORS_ONLN);
+  uring_register(ring->fd, IORING_REGISTER_IOWQ_MAX_WORKERS, nworkers, 2);
+  return ring;
+
+handle_errors:
+  free(files);
+  writer_uring_destroy(ring);
+  return NULL;
+}
+
+int writer_uring_add(struct writer_uring *ring, const char *path, const char *content,
+                     size_t len)
+{
+  struct io_uring_sqe *sqe;
+  struct uring_slot *s;
+  unsigned int slot;
+  size_t pathlen = strlen(path);
+  size_t need = pathlen + 1 + len;
+  char *bigger;
+
+  while (ring->nfree == 0) {
+    if (submit_and_wait(ring, 1) != 0) {
+      return -1;
+    }
+  }
+
+  slot = ring->free_slots[ring->nfree - 1];
+  s = &ring->slots[slot];
+  if (need > s->cap) {
+    bigger = realloc(s->buf, need);
+    if (bigger == NULL) {
+      syslog(LOG_ERR, "cannot allocate %zu bytes for %s", need, path);
+      return -1;
+    }
+    s->buf = bigger;
+    s->cap = need;
+  }
+  ring->nfree--;
+  memcpy(s->buf, path, pathlen + 1);
+  memcpy(s->buf + pathlen + 1, content, len);
+  s->pathlen = pathlen;
+  s->len = len;
+  s->pending = OPS_PER_FILE;
+  s->failed = 0;
+
+  // there is room for a whole chain: each of the depth slots uses 3 entries
+  sqe = get_sqe(ring);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->flags = IOSQE_IO_LINK;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uint64_t) (uintptr_t) s->buf;
+  sqe->len = 0644;
+  sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+  sqe->file_index = slot + 1;             // open into direct slot, 1 based
+  sqe->user_data = USER_DATA(slot, OP_OPEN);
+
+  sqe = get_sqe(ring);
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->flags = IOSQE_IO_LINK | IOSQE_FIXED_FILE;
+  sqe->fd = (int) slot;
+  sqe->addr = (uint64_t) (uintptr_t) (s->buf + pathlen + 1);
+  sqe->len = (unsigned int) len;
+  sqe->off = 0;
+  sqe->user_data = USER_DATA(slot, OP_WRITE);
+
+  sqe = get_sqe(ring);
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->file_index = slot + 1;
+  sqe->user_data = USER_DATA(slot, OP_CLOSE);
+
+  return 0;
+}
+
+int writer_uring_finish(struct writer_uring *ring, unsigned long *files,
+                        unsigned long long *bytes)
+{
+  int rc = 0;
+
+  while (ring->nfree < ring->depth) {
+    if (submit_and_wait(ring, 1) != 0) {
+      rc = -1;
+      break;
+    }
+  }
+  *files += ring->files;
+  *bytes += ring->bytes;
+  ring->files = 0;
+  ring->bytes = 0;
+  return rc == 0 ? ring->rc : -1;
+}
+
+void writer_uring_destroy(struct writer_uring *ring)
+{
+  unsigned int i;
+
+  if (ring == NULL) {
+    return;
+  }
+  if (ring->sqes != NULL)
+    munmap(ring->sqes, ring->sqes_len);
+  if (ring->cq_map != NULL && ring->cq_map != ring->sq_map)
+    munmap(ring->cq_map, ring->cq_map_len);
+  if (ring->sq_map != NULL)
+    munmap(ring->sq_map, ring->sq_map_len);
+  // closing the ring also closes anything left in the direct file table
+  if (ring->fd != -1)
+    close(ring->fd);
+  if (ring->slots != NULL) {
+    for (i = 0; i < ring->depth; i++) {
+      free(ring->slots[i].buf);
+    }
+  }
+  free(ring->slots);
+  free(ring->free_slots);
+  free(ring);
+}
+
+#else /* !HAVE_IO_URING */
+
+struct writer_uring *writer_uring_create(unsigned int depth, writer_uring_fallback fallback)
+{
+  (void) depth;
+  (void) fallback;
+  return NULL;
+}
+
+int writer_uring_add(struct writer_uring *ring, const char *path, const char *content,
+                     size_t len)
+{
+  return -1;
+}
+
+int writer_uring_finish(struct writer_uring *ring, unsigned long *files,
+                        unsigned long long *bytes)
+{
+  return -1;
+}
+
+void writer_uring_destroy(struct writer_uring *ring)
+{
+}
+
+#endif /* HAVE_IO_URING */
@@ -1,52 +1,390 @@
-/* ---------------------------------------------------------------------------- 
+/* ----------------------------------------------------------------------------
  * @file writer.c
  * @brief A writing application which writes the string writestr to writefile
  * @usage ./writer </path/to/writefile> <writestr>
  *        where directory /path/to/ must exist on the filesystem, but writefile
  *        will be created / overwritten
+ *
+ *        ./writer [-r] [-q depth] -m <manifest|->
+ *        bulk mode, writes many files from one process.  Each manifest line
+ *        is "<path>\t<content>", where content may use the escapes \n, \t
+ *        and \\.  A manifest of - is read from stdin.  -q writes the files
+ *        through io_uring with depth of them in flight (see writer-uring.h),
+ *        falling back to one at a time where io_uring is unavailable.
+ *
+ *        ./writer [-r] [-b bufsize] [-D] [-S size] -s </path/to/writefile>
+ *        stream mode, copies stdin to writefile in bufsize (default 1 MiB)
+ *        writes.  -D uses O_DIRECT where the filesystem supports it, -S
+ *        preallocates size bytes when the final size is known up front.
+ *
+ *        -r reports files/s and MB/s on stdout when done
  * @author Jake Michael, jami1063@colorado.edu
  *---------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <syslog.h>
+#include "writer-uring.h"
 
-#define CLI_MAX_ARGS (3) 
+#define CLI_MAX_ARGS (3)
+#define STREAM_BUF_DEFAULT (1 << 20)
+// O_DIRECT needs buffer, offset and length aligned to the logical block size
+#define DIRECT_ALIGN (4096)
 
-int main(int argc, char **argv) {
-  
+struct write_stats {
+  unsigned long files;
+  unsigned long long bytes;
+};
+
+/*
+ * @brief  writes all of len bytes from buf to fd
+ * @return 0 on success, -1 on error
+ */
+static int write_all(int fd, const char *buf, size_t len)
+{
+  ssize_t written;
+
+  while (len) {
+    written = write(fd, buf, len);
+    if (written == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    len -= written;
+    buf += written;
+  }
+  return 0;
+}
+
+/*
+ * @brief  creates / overwrites path with len bytes of content
+ * @return 0 on success, -1 on error
+ */
+static int write_file(const char *path, const char *content, size_t len)
+{
+  int fd;
+  int rc = 0;
+
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    syslog(LOG_ERR, "error opening file %s: %s", path, strerror(errno));
+    return -1;
+  }
+  if (write_all(fd, content, len) == -1) {
+    syslog(LOG_ERR, "cannot write to file %s: %s", path, strerror(errno));
+    rc = -1;
+  }
+  if (close(fd) == -1) {
+    syslog(LOG_ERR, "error closing file %s: %s", path, strerror(errno));
+    rc = -1;
+  }
+  return rc;
+}
+
+/*
+ * @brief  decodes the \n, \t and \\ escapes of str in place
+ * @return the decoded length
+ */
+static size_t unescape(char *str)
+{
+  char *in = str;
+  char *out = str;
+
+  while (*in) {
+    if (*in == '\\' && in[1] != '\0') {
+      in++;
+      switch (*in) {
+        case 'n': *out++ = '\n'; break;
+        case 't': *out++ = '\t'; break;
+        default:  *out++ = *in; break;  // \\ and anything unknown
+      }
+      in++;
+    } else {
+      *out++ = *in++;
+    }
+  }
+  *out = '\0';
+  return out - str;
+}
+
+/*
+ * @brief  writes every "<path>\t<content>" line of manifest, through ring
+ *         unless it is NULL
+ * @return 0 if every file was written, -1 otherwise
+ */
+static int write_manifest(const char *manifest, struct writer_uring *ring,
+                          struct write_stats *stats)
+{
   FILE *stream;
+  char *line = NULL;
+  size_t linecap = 0;
+  ssize_t linelen;
+  unsigned long lineno = 0;
+  char *content;
+  size_t len;
+  int rc = 0;
+
+  if (!strcmp(manifest, "-")) {
+    stream = stdin;
+  } else {
+    stream = fopen(manifest, "r");
+    if (!stream) {
+      syslog(LOG_ERR, "error opening manifest %s: %s", manifest, strerror(errno));
+      return -1;
+    }
+  }
+
+  while ((linelen = getline(&line, &linecap, stream)) != -1) {
+    lineno++;
+    if (linelen > 0 && line[linelen - 1] == '\n') {
+      line[--linelen] = '\0';
+    }
+    if (linelen == 0) {
+      continue;
+    }
+    content = strchr(line, '\t');
+    if (content == NULL) {
+      syslog(LOG_ERR, "manifest line %lu has no tab separator", lineno);
+      rc = -1;
+      continue;
+    }
+    *content++ = '\0';
+    len = unescape(content);
+    if (ring != NULL) {
+      if (writer_uring_add(ring, line, content, len) == -1) {
+        rc = -1;
+        break;
+      }
+      continue;
+    }
+    if (write_file(line, content, len) == -1) {
+      rc = -1;
+      continue;
+    }
+    stats->files++;
+    stats->bytes += len;
+  }
+  if (ferror(stream)) {
+    syslog(LOG_ERR, "error reading manifest %s", manifest);
+    rc = -1;
+  }
+  if (ring != NULL && writer_uring_finish(ring, &stats->files, &stats->bytes) == -1) {
+    rc = -1;
+  }
+
+  free(line);
+  if (stream != stdin) {
+    fclose(stream);
+  }
+  return rc;
+}
+
+/*
+ * @brief  fills buf with up to len bytes from fd, stopping early only at EOF
+ * @return bytes read, or -1 on error
+ */
+static ssize_t read_full(int fd, char *buf, size_t len)
+{
+  size_t total = 0;
+  ssize_t nread;
+
+  while (total < len) {
+    nread = read(fd, buf + total, len - total);
+    if (nread == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (nread == 0)
+      break;
+    total += nread;
+  }
+  return total;
+}
+
+/*
+ * @brief  copies stdin to path
+ * @return 0 on success, -1 on error
+ */
+static int write_stream(const char *path, size_t bufsize, bool direct, off_t prealloc,
+                        struct write_stats *stats)
+{
+  int fd = -1;
+  char *buf = NULL;
+  ssize_t nread;
+  unsigned long long total = 0;
+  int rc = -1;
+
+  if (direct) {
+    // round up so that every full buffer is an aligned O_DIRECT write
+    bufsize = (bufsize + DIRECT_ALIGN - 1) & ~((size_t) DIRECT_ALIGN - 1);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd == -1 && errno == EINVAL) {
+      syslog(LOG_WARNING, "O_DIRECT not supported for %s, using buffered writes", path);
+      direct = false;
+    }
+  }
+  if (fd == -1) {
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  }
+  if (fd == -1) {
+    syslog(LOG_ERR, "error opening file %s: %s", path, strerror(errno));
+    return -1;
+  }
+
+  if (prealloc > 0 && fallocate(fd, 0, 0, prealloc) == -1) {
+    // only an optimization, the writes below still extend the file
+    syslog(LOG_WARNING, "fallocate of %lld bytes for %s failed: %s",
+           (long long) prealloc, path, strerror(errno));
+  }
+
+  if (posix_memalign((void **) &buf, DIRECT_ALIGN, bufsize) != 0) {
+    syslog(LOG_ERR, "cannot allocate %zu byte buffer", bufsize);
+    goto handle_errors;
+  }
+
+  while ((nread = read_full(STDIN_FILENO, buf, bufsize)) > 0) {
+    if (direct && (size_t) nread < bufsize && (nread % DIRECT_ALIGN) != 0) {
+      // unaligned tail, finish with a buffered write
+      if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT) == -1) {
+        syslog(LOG_ERR, "cannot clear O_DIRECT on %s: %s", path, strerror(errno));
+        goto handle_errors;
+      }
+      direct = false;
+    }
+    if (write_all(fd, buf, nread) == -1) {
+      syslog(LOG_ERR, "cannot write to file %s: %s", path, strerror(errno));
+      goto handle_errors;
+    }
+    total += nread;
+  }
+  if (nread == -1) {
+    syslog(LOG_ERR, "error reading stdin: %s", strerror(errno));
+    goto handle_errors;
+  }
+
+  // drop any preallocated space we did not fill
+  if (prealloc > 0 && (unsigned long long) prealloc > total && ftruncate(fd, total) == -1) {
+    syslog(LOG_ERR, "cannot truncate %s: %s", path, strerror(errno));
+    goto handle_errors;
+  }
+
+  stats->files++;
+  stats->bytes += total;
+  rc = 0;
+
+handle_errors:
+  free(buf);
+  if (close(fd) == -1) {
+    syslog(LOG_ERR, "error closing file %s: %s", path, strerror(errno));
+    rc = -1;
+  }
+  return rc;
+}
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_usage(const char *progname)
+{
+  printf("Usage: %s <writefile> <writestr>\n", progname);
+  printf("       %s [-r] [-q depth] -m <manifest|->\n", progname);
+  printf("       %s [-r] [-b bufsize] [-D] [-S size] -s <writefile>\n", progname);
+}
+
+int main(int argc, char **argv) {
+
+  int opt;
   int rc;
+  const char *manifest = NULL;
+  const char *streamfile = NULL;
+  size_t bufsize = STREAM_BUF_DEFAULT;
+  bool direct = false;
+  bool report = false;
+  off_t prealloc = 0;
+  unsigned int depth = 0;
+  struct writer_uring *ring = NULL;
+  struct write_stats stats = { 0, 0 };
+  double start;
+  double elapsed;
 
   // open the syslog
   openlog(NULL, 0, LOG_USER);
 
-  // check number of arguments is valid
-  if (argc < CLI_MAX_ARGS) {
-    syslog(LOG_ERR, "invalid number of arguments, %d provided 3 expected", argc);
-    return 1;
+  // '+' stops at the first non-option so writestr may begin with '-'
+  while ((opt = getopt(argc, argv, "+m:s:b:DS:rq:")) != -1) {
+    switch (opt) {
+      case 'm': manifest = optarg; break;
+      case 's': streamfile = optarg; break;
+      case 'b': bufsize = strtoul(optarg, NULL, 0); break;
+      case 'D': direct = true; break;
+      case 'S': prealloc = strtoll(optarg, NULL, 0); break;
+      case 'r': report = true; break;
+      case 'q': depth = (unsigned int) strtoul(optarg, NULL, 0); break;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
   }
 
-  const char* writefile = argv[1];
-  const char* writestr = argv[2];
+  start = now_seconds();
 
-  // open file 
-  stream = fopen(writefile, "w");
-  if (!stream) {
-    syslog(LOG_ERR, "error opening file %s\n", writefile);
-    return 1;
-  }
+  if (manifest != NULL || streamfile != NULL) {
+
+    if ((manifest != NULL && streamfile != NULL) || optind != argc || bufsize == 0) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    if (manifest != NULL) {
+      // NULL without -q or when io_uring is unavailable
+      ring = writer_uring_create(depth, write_file);
+      rc = write_manifest(manifest, ring, &stats);
+      writer_uring_destroy(ring);
+    } else {
+      rc = write_stream(streamfile, bufsize, direct, prealloc, &stats);
+    }
+
+  } else {
+
+    // check number of arguments is valid
+    if (argc - optind + 1 < CLI_MAX_ARGS) {
+      syslog(LOG_ERR, "invalid number of arguments, %d provided 3 expected", argc - optind + 1);
+      return 1;
+    }
+
+    const char* writefile = argv[optind];
+    const char* writestr = argv[optind + 1];
+
+    rc = write_file(writefile, writestr, strlen(writestr));
+    if (rc == 0) {
+      stats.files++;
+      stats.bytes += strlen(writestr);
+    }
 
-  // write to file
-  rc = fputs(writestr, stream);
-  if ( rc == EOF ) {
-    syslog(LOG_ERR, "cannot write %s to file %s\n", writestr, writefile);
-    fclose(stream);
-    return 1;
   }
 
-  fclose(stream);
+  if (report) {
+    elapsed = now_seconds() - start;
+    if (elapsed <= 0)
+      elapsed = 1e-9;
+    printf("%lu files, %llu bytes in %.3f s: %.0f files/s, %.2f MB/s\n", stats.files,
+           stats.bytes, elapsed, stats.files / elapsed, stats.bytes / elapsed / 1e6);
+  }
 
-  return 0;
+  return rc == 0 ? 0 : 1;
 
 } // end main
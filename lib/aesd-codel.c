@@ -0,0 +1,91 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-codel.c
+ * @brief Admission control from measured queueing delay, after CoDel
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "aesd-codel.h"
+#include <time.h>
+
+#define NS_PER_MS (1000000ULL)
+
+uint64_t aesd_codel_now(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void aesd_codel_init(struct aesd_codel *codel, unsigned int target_ms,
+                     unsigned int interval_ms)
+{
+  pthread_mutex_init(&codel->mutex, NULL);
+  atomic_store(&codel->min_delay, UINT64_MAX);
+  atomic_store(&codel->last_min, 0);
+  atomic_store(&codel->overloaded, false);
+  aesd_codel_set(codel, target_ms, interval_ms);
+  atomic_store(&codel->interval_end, aesd_codel_now() + atomic_load(&codel->interval_ns));
+}
+
+void aesd_codel_set(struct aesd_codel *codel, unsigned int target_ms,
+                    unsigned int interval_ms)
+{
+  atomic_store(&codel->target_ns, target_ms * NS_PER_MS);
+  atomic_store(&codel->interval_ns, (interval_ms ? interval_ms : 1) * NS_PER_MS);
+  if (target_ms == 0) {
+    atomic_store(&codel->overloaded, false);
+  }
+}
+
+/*
+ * @brief  ends the interval if it is over, deciding on the next one from
+ *         the lowest delay seen in it
+ */
+static void codel_roll(struct aesd_codel *codel, uint64_t now)
+{
+  uint64_t min;
+
+  pthread_mutex_lock(&codel->mutex);
+  // another thread may have ended it while we waited
+  if (now >= atomic_load(&codel->interval_end)) {
+    min = atomic_exchange(&codel->min_delay, UINT64_MAX);
+    atomic_store(&codel->last_min, (min == UINT64_MAX) ? 0 : min);
+    atomic_store(&codel->overloaded, min != UINT64_MAX &&
+                 min > atomic_load(&codel->target_ns));
+    atomic_store(&codel->interval_end, now + atomic_load(&codel->interval_ns));
+  }
+  pthread_mutex_unlock(&codel->mutex);
+}
+
+void aesd_codel_sample(struct aesd_codel *codel, uint64_t delay_ns)
+{
+  uint64_t now = aesd_codel_now();
+  uint64_t min = atomic_load(&codel->min_delay);
+
+  if (now >= atomic_load(&codel->interval_end)) {
+    codel_roll(codel, now);
+    min = atomic_load(&codel->min_delay);
+  }
+  while (delay_ns < min &&
+         !atomic_compare_exchange_weak(&codel->min_delay, &min, delay_ns));
+}
+
+bool aesd_codel_admit(struct aesd_codel *codel)
+{
+  uint64_t now;
+
+  if (atomic_load(&codel->target_ns) == 0) {
+    return true;
+  }
+  now = aesd_codel_now();
+  if (now >= atomic_load(&codel->interval_end)) {
+    codel_roll(codel, now);
+  }
+  return !atomic_load(&codel->overloaded);
+}
+
+unsigned long aesd_codel_delay_us(const struct aesd_codel *codel)
+{
+  return atomic_load(&codel->last_min) / 1000;
+}
@@ -0,0 +1,72 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-codel.h
+ * @brief Admission control from measured queueing delay, after CoDel
+ *
+ * The time each request waited in a queue is reported when it leaves the
+ * queue.  Over every interval the controller keeps the lowest such delay:
+ * a queue which drains now and then has some short waits, a standing queue
+ * has none.  When even the lowest delay of a whole interval was above the
+ * target, the controller is overloaded for the next interval and new work
+ * should be turned away at the door instead of joining the queue.  An
+ * interval without any delay reported, the queue having drained, ends the
+ * overload.
+ *
+ * Every function may be called from any thread.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESD_CODEL_H
+#define AESD_CODEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+struct aesd_codel {
+  pthread_mutex_t mutex;          // serializes the end of an interval
+  _Atomic uint64_t target_ns;     // 0 when disabled
+  _Atomic uint64_t interval_ns;
+  _Atomic uint64_t interval_end;  // monotonic ns at which the interval ends
+  _Atomic uint64_t min_delay;     // lowest delay of the interval, UINT64_MAX if none
+  _Atomic uint64_t last_min;      // lowest delay of the previous interval
+  atomic_bool overloaded;
+};
+
+/**
+* Initialize @param codel with a @param target_ms delay over
+* @param interval_ms.  A target of 0 disables it, it always admits.
+*/
+void aesd_codel_init(struct aesd_codel *codel, unsigned int target_ms,
+                     unsigned int interval_ms);
+
+/**
+* Change the target and interval of a running @param codel, taking effect
+* from its next interval.
+*/
+void aesd_codel_set(struct aesd_codel *codel, unsigned int target_ms,
+                    unsigned int interval_ms);
+
+/**
+* Report that a request left the queue after waiting @param delay_ns.
+*/
+void aesd_codel_sample(struct aesd_codel *codel, uint64_t delay_ns);
+
+/**
+* @return false if new work should be rejected, the queue delay having
+*         stayed above target for the last interval
+*/
+bool aesd_codel_admit(struct aesd_codel *codel);
+
+/**
+* @return the lowest delay of the last complete interval, in microseconds
+*/
+unsigned long aesd_codel_delay_us(const struct aesd_codel *codel);
+
+/**
+* @return the current CLOCK_MONOTONIC time in nanoseconds, for the delays
+*/
+uint64_t aesd_codel_now(void);
+
+#endif /* AESD_CODEL_H */
@@ -0,0 +1,773 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-coro.c
+ * @brief Stackful coroutines scheduled over one epoll loop per thread
+ * @author Jake Michael, jami1063@colorado.edu
+ * @resources
+ * (+)  System V AMD64 ABI for the registers a context switch must preserve
+ * (+)  epoll(7) for EPOLLONESHOT re-arming with EPOLL_CTL_MOD
+ *---------------------------------------------------------------------------*/
+
+#include "aesd-coro.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+// x86-64 switches with the few instructions below, other targets (and
+// -DAESD_CORO_UCONTEXT) use swapcontext(), which also saves the signal
+// mask with a system call on every switch
+#if defined(__x86_64__) && !defined(AESD_CORO_UCONTEXT)
+  #define CORO_ASM_SWITCH (1)
+#else
+  #include <ucontext.h>
+#endif
+
+#define ERROR_LOG(msg,...) fprintf(stderr, "aesd-coro ERROR: " msg "\n" , ##__VA_ARGS__)
+
+// finished coroutines kept per loop with their stacks, instead of unmapped
+#define STACK_POOL_MAX (1024)
+#define EVENTS_MAX (256)
+
+enum coro_state {
+  CORO_NEW,
+  CORO_READY,
+  CORO_RUNNING,
+  CORO_WAIT_IO,
+  CORO_WAIT_LOCK,
+  CORO_DONE
+};
+
+struct coro_ctx {
+#ifdef CORO_ASM_SWITCH
+  void *sp;                       // registers are saved on the stack itself
+#else
+  ucontext_t uc;
+#endif
+};
+
+struct aesd_coro {
+  struct coro_ctx ctx;
+  struct coro_loop *loop;
+  aesd_coro_fn fn;
+  void *arg;
+  char *map;                      // guard page, then the stack
+  size_t map_size;
+  enum coro_state state;
+  int armed_fd;                   // last fd registered with the loop's epoll
+  bool canceled;                  // woken from an I/O wait by aesd_coro_destroy()
+  struct aesd_coro *next;         // ready queue, wake queue or pool link
+  struct aesd_coro *all_prev;     // every live coroutine of the loop
+  struct aesd_coro *all_next;
+};
+
+struct aesd_coro_waiter {
+  struct aesd_coro *coro;         // NULL for a thread
+  bool granted;                   // thread waiters only
+  struct aesd_coro_waiter *next;
+};
+
+struct coro_loop {
+  pthread_t thread;
+  struct aesd_coro_sched *sched;
+  int epfd;
+  int evfd;                       // wakes the loop for its wake queue
+  struct coro_ctx loop_ctx;
+  struct aesd_coro *current;      // running coroutine, NULL in the loop itself
+
+  // owned by the loop thread
+  struct aesd_coro *ready_head;
+  struct aesd_coro *ready_tail;
+  struct aesd_coro *all;
+  bool canceled;                  // I/O waits were canceled for shutdown
+  atomic_long live;               // spawned and not yet returned
+
+  // shared with other threads
+  pthread_mutex_t remote_lock;    // protects the wake queue and the pool
+  struct aesd_coro *wake_head;    // new or woken coroutines for this loop
+  struct aesd_coro *wake_tail;
+  struct aesd_coro *pool;
+  unsigned int npool;
+} __attribute__((aligned(64)));
+
+struct aesd_coro_sched {
+  struct coro_loop *loops;
+  unsigned int nloops;
+  unsigned int nstarted;          // loop threads running
+  size_t stack_size;
+  size_t page_size;
+  atomic_uint next_loop;
+  atomic_bool stopping;
+};
+
+static __thread struct coro_loop *current_loop;
+
+/* ============================================================================
+ *    CONTEXT SWITCH
+ * ===========================================================================*/
+
+#ifdef CORO_ASM_SWITCH
+// void aesd_coro_switch(void **save_sp, void *new_sp)
+// pushes the callee-saved registers and the SSE/x87 control words, saves the
+// stack pointer to *save_sp, then pops the same from new_sp and returns there
+__asm__(
+  ".text\n"
+  ".globl aesd_coro_switch\n"
+  ".hidden aesd_coro_switch\n"
+  ".type aesd_coro_switch, @function\n"
+  ".p2align 4\n"
+  "aesd_coro_switch:\n"
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  subq $8, %rsp\n"
+  "  stmxcsr (%rsp)\n"
+  "  fnstcw 4(%rsp)\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq %rsi, %rsp\n"
+  "  ldmxcsr (%rsp)\n"
+  "  fldcw 4(%rsp)\n"
+  "  addq $8, %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  ret\n"
+  ".size aesd_coro_switch, .-aesd_coro_switch\n"
+);
+void aesd_coro_switch(void **save_sp, void *new_sp);
+
+static void ctx_init(struct coro_ctx *ctx, char *stack, size_t size, void (*entry)(void))
+{
+  uint64_t *sp = (uint64_t *) (((uintptr_t) stack + size) & ~(uintptr_t) 15);
+
+  // the first switch pops a zeroed register frame and returns into entry,
+  // leaving the stack aligned as if entry had been called
+  sp -= 2;
+  sp[0] = (uint64_t) (uintptr_t) entry;
+  sp -= 6;
+  memset(sp, 0, 6 * sizeof(uint64_t));
+  sp -= 1;
+  __asm__ __volatile__("stmxcsr (%0)\n\tfnstcw 4(%0)" : : "r"(sp) : "memory");
+  ctx->sp = sp;
+}
+
+static inline void ctx_switch(struct coro_ctx *from, struct coro_ctx *to)
+{
+  aesd_coro_switch(&from->sp, to->sp);
+}
+#else
+static void ctx_init(struct coro_ctx *ctx, char *stack, size_t size, void (*entry)(void))
+{
+  getcontext(&ctx->uc);
+  ctx->uc.uc_stack.ss_sp = stack;
+  ctx->uc.uc_stack.ss_size = size;
+  ctx->uc.uc_link = NULL;
+  makecontext(&ctx->uc, entry, 0);
+}
+
+static inline void ctx_switch(struct coro_ctx *from, struct coro_ctx *to)
+{
+  swapcontext(&from->uc, &to->uc);
+}
+#endif
+
+/* ============================================================================
+ *    COROUTINES
+ * ===========================================================================*/
+
+static void coro_entry(void)
+{
+  struct aesd_coro *c = current_loop->current;
+
+  c->fn(c->arg);
+  c->state = CORO_DONE;
+  // the loop recycles the stack we are running on
+  ctx_switch(&c->ctx, &current_loop->loop_ctx);
+  abort();
+}
+
+/*
+ * @brief  takes a coroutine with a stack from the pool of loop, or maps one
+ * @return the coroutine, or NULL if out of memory
+ */
+static struct aesd_coro* coro_alloc(struct coro_loop *loop)
+{
+  struct aesd_coro_sched *sched = loop->sched;
+  struct aesd_coro *c;
+
+  pthread_mutex_lock(&loop->remote_lock);
+  c = loop->pool;
+  if (c != NULL) {
+    loop->pool = c->next;
+    loop->npool--;
+  }
+  pthread_mutex_unlock(&loop->remote_lock);
+  if (c != NULL) {
+    return c;
+  }
+
+  c = calloc(1, sizeof(struct aesd_coro));
+  if (c == NULL) {
+    return NULL;
+  }
+  c->map_size = sched->stack_size + sched->page_size;
+  c->map = mmap(NULL, c->map_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (c->map == MAP_FAILED) {
+    free(c);
+    return NULL;
+  }
+  // stacks grow down, an overflow faults on the guard page instead of
+  // corrupting the next stack
+  if (mprotect(c->map, sched->page_size, PROT_NONE) == -1) {
+    munmap(c->map, c->map_size);
+    free(c);
+    return NULL;
+  }
+  return c;
+}
+
+static void coro_unmap(struct aesd_coro *c)
+{
+  munmap(c->map, c->map_size);
+  free(c);
+}
+
+static void ready_push(struct coro_loop *loop, struct aesd_coro *c)
+{
+  c->state = CORO_READY;
+  c->next = NULL;
+  if (loop->ready_tail != NULL) {
+    loop->ready_tail->next = c;
+  } else {
+    loop->ready_head = c;
+  }
+  loop->ready_tail = c;
+}
+
+static void all_link(struct coro_loop *loop, struct aesd_coro *c)
+{
+  c->all_prev = NULL;
+  c->all_next = loop->all;
+  if (loop->all != NULL) {
+    loop->all->all_prev = c;
+  }
+  loop->all = c;
+}
+
+static void all_unlink(struct coro_loop *loop, struct aesd_coro *c)
+{
+  if (c->all_prev != NULL) {
+    c->all_prev->all_next = c->all_next;
+  } else {
+    loop->all = c->all_next;
+  }
+  if (c->all_next != NULL) {
+    c->all_next->all_prev = c->all_prev;
+  }
+}
+
+/*
+ * @brief  makes c runnable on its loop, from any thread
+ */
+static void coro_wake(struct aesd_coro *c)
+{
+  struct coro_loop *loop = c->loop;
+  bool was_empty;
+
+  if (loop == current_loop) {
+    if (c->state == CORO_NEW) {
+      all_link(loop, c);
+    }
+    ready_push(loop, c);
+    return;
+  }
+  pthread_mutex_lock(&loop->remote_lock);
+  was_empty = loop->wake_head == NULL;
+  c->next = NULL;
+  if (loop->wake_tail != NULL) {
+    loop->wake_tail->next = c;
+  } else {
+    loop->wake_head = c;
+  }
+  loop->wake_tail = c;
+  pthread_mutex_unlock(&loop->remote_lock);
+
+  // the loop drains the whole queue after reading evfd, so only the push
+  // onto an empty queue needs to wake it
+  if (was_empty) {
+    eventfd_write(loop->evfd, 1);
+  }
+}
+
+/*
+ * @brief  switches from the running coroutine back to its loop
+ */
+static inline void coro_park(struct aesd_coro *c, enum coro_state state)
+{
+  c->state = state;
+  ctx_switch(&c->ctx, &c->loop->loop_ctx);
+}
+
+static void coro_run(struct coro_loop *loop, struct aesd_coro *c)
+{
+  loop->current = c;
+  c->state = CORO_RUNNING;
+  ctx_switch(&loop->loop_ctx, &c->ctx);
+  loop->current = NULL;
+
+  if (c->state == CORO_DONE) {
+    all_unlink(loop, c);
+    atomic_fetch_sub(&loop->live, 1);
+    pthread_mutex_lock(&loop->remote_lock);
+    if (loop->npool < STACK_POOL_MAX) {
+      c->next = loop->pool;
+      loop->pool = c;
+      loop->npool++;
+      c = NULL;
+    }
+    pthread_mutex_unlock(&loop->remote_lock);
+    if (c != NULL) {
+      coro_unmap(c);
+    }
+  }
+}
+
+/* ============================================================================
+ *    EVENT LOOP
+ * ===========================================================================*/
+
+static void drain_wake_queue(struct coro_loop *loop)
+{
+  struct aesd_coro *c;
+  struct aesd_coro *next;
+
+  pthread_mutex_lock(&loop->remote_lock);
+  c = loop->wake_head;
+  loop->wake_head = NULL;
+  loop->wake_tail = NULL;
+  pthread_mutex_unlock(&loop->remote_lock);
+
+  for (; c != NULL; c = next) {
+    next = c->next;
+    if (c->state == CORO_NEW) {
+      all_link(loop, c);
+    }
+    ready_push(loop, c);
+  }
+}
+
+/*
+ * @brief  wakes every coroutine waiting on I/O with ECANCELED, for shutdown
+ */
+static void cancel_io(struct coro_loop *loop)
+{
+  struct aesd_coro *c;
+
+  for (c = loop->all; c != NULL; c = c->all_next) {
+    if (c->state == CORO_WAIT_IO) {
+      // still armed, an event after the coroutine returned would be stale
+      epoll_ctl(loop->epfd, EPOLL_CTL_DEL, c->armed_fd, NULL);
+      c->armed_fd = -1;
+      c->canceled = true;
+      ready_push(loop, c);
+    }
+  }
+  loop->canceled = true;
+}
+
+static void* loop_thread(void *param)
+{
+  struct coro_loop *loop = (struct coro_loop *) param;
+  struct aesd_coro_sched *sched = loop->sched;
+  struct epoll_event events[EVENTS_MAX];
+  struct aesd_coro *c;
+  struct aesd_coro *batch;
+  eventfd_t value;
+  bool stopping;
+  int timeout;
+  int n;
+  int i;
+
+  current_loop = loop;
+
+  while (true)
+  {
+    drain_wake_queue(loop);
+    stopping = atomic_load(&sched->stopping);
+    if (stopping) {
+      if (!loop->canceled) {
+        cancel_io(loop);
+      }
+      if (atomic_load(&loop->live) == 0) {
+        break;
+      }
+    }
+
+    // run what is ready now, coroutines made ready meanwhile go next round
+    // so that I/O is polled between rounds
+    batch = loop->ready_head;
+    loop->ready_head = NULL;
+    loop->ready_tail = NULL;
+    while (batch != NULL) {
+      c = batch;
+      batch = c->next;
+      coro_run(loop, c);
+    }
+
+    timeout = -1;
+    if (loop->ready_head != NULL || (stopping && atomic_load(&loop->live) == 0)) {
+      timeout = 0;
+    }
+    n = epoll_wait(loop->epfd, events, EVENTS_MAX, timeout);
+    for (i = 0; i < n; i++) {
+      c = (struct aesd_coro *) events[i].data.ptr;
+      if (c == NULL) {
+        eventfd_read(loop->evfd, &value);
+      } else if (c->state == CORO_WAIT_IO) {
+        ready_push(loop, c);
+      }
+    }
+  }
+
+  current_loop = NULL;
+  return NULL;
+}
+
+
+struct aesd_coro_sched *aesd_coro_create(unsigned int nloops, size_t stack_size)
+{
+  struct aesd_coro_sched *sched;
+  struct epoll_event ev;
+  unsigned int i;
+
+  if (nloops == 0) {
+    return NULL;
+  }
+  sched = calloc(1, sizeof(struct aesd_coro_sched));
+  if (sched == NULL) {
+    return NULL;
+  }
+  sched->page_size = (size_t) sysconf(_SC_PAGESIZE);
+  if (stack_size == 0) {
+    stack_size = AESD_CORO_DEFAULT_STACK;
+  } else if (stack_size < AESD_CORO_MIN_STACK) {
+    stack_size = AESD_CORO_MIN_STACK;
+  }
+  sched->stack_size = (stack_size + sched->page_size - 1) & ~(sched->page_size - 1);
+  sched->nloops = nloops;
+  sched->loops = aligned_alloc(64, nloops * sizeof(struct coro_loop));
+  if (sched->loops == NULL) {
+    free(sched);
+    return NULL;
+  }
+  memset(sched->loops, 0, nloops * sizeof(struct coro_loop));
+
+  for (i = 0; i < nloops; i++) {
+    struct coro_loop *loop = &sched->loops[i];
+    loop->sched = sched;
+    loop->epfd = -1;
+    loop->evfd = -1;
+    pthread_mutex_init(&loop->remote_lock, NULL);
+  }
+  for (i = 0; i < nloops; i++) {
+    struct coro_loop *loop = &sched->loops[i];
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->epfd == -1 || loop->evfd == -1) {
+      ERROR_LOG("epoll/eventfd: %s", strerror(errno));
+      goto handle_errors;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->evfd, &ev) == -1) {
+      ERROR_LOG("epoll_ctl: %s", strerror(errno));
+      goto handle_errors;
+    }
+    if (pthread_create(&loop->thread, NULL, loop_thread, loop) != 0) {
+      ERROR_LOG("could not create loop thread %u", i);
+      goto handle_errors;
+    }
+    sched->nstarted++;
+  }
+  return sched;
+
+handle_errors:
+  aesd_coro_destroy(sched);
+  return NULL;
+}
+
+void aesd_coro_destroy(struct aesd_coro_sched *sched)
+{
+  struct aesd_coro *c;
+  unsigned int i;
+
+  if (sched == NULL) {
+    return;
+  }
+  atomic_store(&sched->stopping, true);
+  for (i = 0; i < sched->nstarted; i++) {
+    eventfd_write(sched->loops[i].evfd, 1);
+  }
+  for (i = 0; i < sched->nstarted; i++) {
+    pthread_join(sched->loops[i].thread, NULL);
+  }
+  for (i = 0; i < sched->nloops; i++) {
+    struct coro_loop *loop = &sched->loops[i];
+    while ((c = loop->pool) != NULL) {
+      loop->pool = c->next;
+      coro_unmap(c);
+    }
+    if (loop->epfd != -1)
+      close(loop->epfd);
+    if (loop->evfd != -1)
+      close(loop->evfd);
+    pthread_mutex_destroy(&loop->remote_lock);
+  }
+  free(sched->loops);
+  free(sched);
+}
+
+int aesd_coro_spawn(struct aesd_coro_sched *sched, aesd_coro_fn fn, void *arg)
+{
+  struct coro_loop *loop;
+  struct aesd_coro *c;
+
+  if (atomic_load(&sched->stopping)) {
+    return -1;
+  }
+  loop = &sched->loops[atomic_fetch_add(&sched->next_loop, 1) % sched->nloops];
+  c = coro_alloc(loop);
+  if (c == NULL) {
+    ERROR_LOG("cannot allocate a coroutine stack");
+    return -1;
+  }
+  c->loop = loop;
+  c->fn = fn;
+  c->arg = arg;
+  c->armed_fd = -1;
+  c->canceled = false;
+  c->state = CORO_NEW;
+  ctx_init(&c->ctx, c->map + sched->page_size, sched->stack_size, coro_entry);
+  atomic_fetch_add(&loop->live, 1);
+  coro_wake(c);
+  return 0;
+}
+
+long aesd_coro_count(struct aesd_coro_sched *sched)
+{
+  long count = 0;
+  unsigned int i;
+
+  for (i = 0; i < sched->nloops; i++) {
+    count += atomic_load(&sched->loops[i].live);
+  }
+  return count;
+}
+
+/* ============================================================================
+ *    BLOCKING CALLS
+ * ===========================================================================*/
+
+static inline struct aesd_coro* coro_self(void)
+{
+  return current_loop != NULL ? current_loop->current : NULL;
+}
+
+bool aesd_coro_running(void)
+{
+  return coro_self() != NULL;
+}
+
+void aesd_coro_yield(void)
+{
+  struct aesd_coro *c = coro_self();
+
+  if (c != NULL) {
+    ready_push(c->loop, c);
+    coro_park(c, CORO_READY);
+  }
+}
+
+int aesd_coro_wait_fd(int fd, uint32_t events)
+{
+  struct aesd_coro *c = coro_self();
+  struct epoll_event ev;
+  struct pollfd pfd;
+  int rc;
+
+  if (c == NULL) {
+    // EPOLLIN and EPOLLOUT have the values of POLLIN and POLLOUT
+    pfd.fd = fd;
+    pfd.events = (short) events;
+    do {
+      rc = poll(&pfd, 1, -1);
+    } while (rc == -1 && errno == EINTR);
+    return rc == -1 ? -1 : 0;
+  }
+  if (atomic_load(&c->loop->sched->stopping)) {
+    errno = ECANCELED;
+    return -1;
+  }
+
+  // one shot: the registration disarms itself when it fires, so no event
+  // arrives for a coroutine which is not waiting, and re-arming is one MOD
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events | EPOLLONESHOT;
+  ev.data.ptr = c;
+  if (c->armed_fd == fd) {
+    rc = epoll_ctl(c->loop->epfd, EPOLL_CTL_MOD, fd, &ev);
+    if (rc == -1 && errno == ENOENT) {
+      rc = epoll_ctl(c->loop->epfd, EPOLL_CTL_ADD, fd, &ev);   // closed and reopened
+    }
+  } else {
+    rc = epoll_ctl(c->loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+    if (rc == -1 && errno == EEXIST) {
+      rc = epoll_ctl(c->loop->epfd, EPOLL_CTL_MOD, fd, &ev);
+    }
+  }
+  if (rc == -1) {
+    return -1;
+  }
+  c->armed_fd = fd;
+
+  coro_park(c, CORO_WAIT_IO);
+  if (c->canceled) {
+    errno = ECANCELED;
+    return -1;
+  }
+  return 0;
+}
+
+ssize_t aesd_coro_recv(int fd, void *buf, size_t len, int flags)
+{
+  ssize_t n;
+
+  if (!aesd_coro_running()) {
+    return recv(fd, buf, len, flags);
+  }
+  while (true) {
+    n = recv(fd, buf, len, flags | MSG_DONTWAIT);
+    if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      return n;
+    }
+    if (aesd_coro_wait_fd(fd, EPOLLIN) == -1) {
+      return -1;
+    }
+  }
+}
+
+ssize_t aesd_coro_write(int fd, const void *buf, size_t len)
+{
+  ssize_t n;
+
+  while (true) {
+    n = write(fd, buf, len);
+    if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || !aesd_coro_running()) {
+      return n;
+    }
+    if (aesd_coro_wait_fd(fd, EPOLLOUT) == -1) {
+      return -1;
+    }
+  }
+}
+
+ssize_t aesd_coro_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+  ssize_t n;
+
+  while (true) {
+    n = writev(fd, iov, iovcnt);
+    if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || !aesd_coro_running()) {
+      return n;
+    }
+    if (aesd_coro_wait_fd(fd, EPOLLOUT) == -1) {
+      return -1;
+    }
+  }
+}
+
+/* ============================================================================
+ *    MUTEX
+ * ===========================================================================*/
+
+void aesd_coro_mutex_init(struct aesd_coro_mutex *mutex)
+{
+  pthread_mutex_init(&mutex->lock, NULL);
+  pthread_cond_init(&mutex->cond, NULL);
+  mutex->locked = false;
+  mutex->head = NULL;
+  mutex->tail = NULL;
+}
+
+void aesd_coro_mutex_lock(struct aesd_coro_mutex *mutex)
+{
+  struct aesd_coro_waiter w = { .coro = coro_self(), .granted = false, .next = NULL };
+
+  pthread_mutex_lock(&mutex->lock);
+  if (!mutex->locked) {
+    mutex->locked = true;
+    pthread_mutex_unlock(&mutex->lock);
+    return;
+  }
+  if (mutex->tail != NULL) {
+    mutex->tail->next = &w;
+  } else {
+    mutex->head = &w;
+  }
+  mutex->tail = &w;
+
+  if (w.coro != NULL) {
+    // a wake from another thread goes through our loop, which only looks
+    // once we have parked, so unlocking first cannot lose it
+    pthread_mutex_unlock(&mutex->lock);
+    coro_park(w.coro, CORO_WAIT_LOCK);
+    return; // the unlocking side handed the mutex to us
+  }
+  while (!w.granted) {
+    pthread_cond_wait(&mutex->cond, &mutex->lock);
+  }
+  pthread_mutex_unlock(&mutex->lock);
+}
+
+void aesd_coro_mutex_unlock(struct aesd_coro_mutex *mutex)
+{
+  struct aesd_coro_waiter *w;
+  struct aesd_coro *coro;
+
+  pthread_mutex_lock(&mutex->lock);
+  w = mutex->head;
+  if (w == NULL) {
+    mutex->locked = false;
+    pthread_mutex_unlock(&mutex->lock);
+    return;
+  }
+  // hand over without unlocking, so the waiter cannot be overtaken
+  mutex->head = w->next;
+  if (mutex->head == NULL) {
+    mutex->tail = NULL;
+  }
+  coro = w->coro;
+  if (coro == NULL) {
+    w->granted = true;
+    pthread_cond_broadcast(&mutex->cond);
+    pthread_mutex_unlock(&mutex->lock);
+    return;
+  }
+  // w lives on the waiter's stack, it is not touched past this point
+  pthread_mutex_unlock(&mutex->lock);
+  coro_wake(coro);
+}
@@ -0,0 +1,122 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-coro.h
+ * @brief Stackful coroutines scheduled over one epoll loop per thread
+ *
+ * A coroutine runs ordinary blocking-style code on a small stack of its own
+ * (64 KiB by default, pooled and guarded by an unmapped page).  The I/O
+ * calls below never block the thread: when a socket would block, the
+ * coroutine parks until epoll reports the socket ready and the loop runs
+ * other coroutines meanwhile.  Each loop is one thread; coroutines stay on
+ * the loop they were spawned on.
+ *
+ * The I/O calls and aesd_coro_mutex work outside coroutines as well, as the
+ * plain blocking call and a blocking mutex, so the same code serves both.
+ * Sockets waited on must be non-blocking for writes (recv always is).
+ *
+ * Code run in a coroutine must not block the thread for long by other
+ * means, e.g. a pthread mutex held across a yield, and must fit its stack.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESD_CORO_H
+#define AESD_CORO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define AESD_CORO_DEFAULT_STACK (64 * 1024)
+#define AESD_CORO_MIN_STACK (16 * 1024)
+
+typedef void (*aesd_coro_fn)(void *arg);
+
+struct aesd_coro_sched;
+struct aesd_coro_waiter;
+
+struct aesd_coro_mutex {
+  pthread_mutex_t lock;             // protects the fields below
+  pthread_cond_t cond;              // threads waiting outside coroutines
+  bool locked;
+  struct aesd_coro_waiter *head;    // FIFO of coroutines and threads waiting
+  struct aesd_coro_waiter *tail;
+};
+
+/**
+* Start @param nloops event loop threads, typically one per core, running
+* coroutines on stacks of @param stack_size bytes (0 for the default).
+* @return the scheduler, or NULL if it could not be created
+*/
+struct aesd_coro_sched *aesd_coro_create(unsigned int nloops, size_t stack_size);
+
+/**
+* Run fn(arg) as a new coroutine on the next loop, round robin.  May be
+* called from any thread, including from a coroutine.
+* @return 0 on success, -1 if the scheduler is stopping or out of memory
+*/
+int aesd_coro_spawn(struct aesd_coro_sched *sched, aesd_coro_fn fn, void *arg);
+
+/**
+* Stop @param sched: coroutines waiting on I/O are woken with ECANCELED, the
+* loops run until every coroutine has returned, then everything is freed.
+* Must not be called from a coroutine.
+*/
+void aesd_coro_destroy(struct aesd_coro_sched *sched);
+
+/**
+* @return the number of coroutines alive on every loop of @param sched
+*/
+long aesd_coro_count(struct aesd_coro_sched *sched);
+
+/**
+* @return true when called from a coroutine
+*/
+bool aesd_coro_running(void);
+
+/**
+* Let the other runnable coroutines of this loop run.  No-op outside a coroutine.
+*/
+void aesd_coro_yield(void);
+
+/**
+* Park the calling coroutine until @param fd reports any of @param events
+* (EPOLLIN, EPOLLOUT).  Outside a coroutine this polls the fd.
+* @return 0 when ready, -1 with errno ECANCELED if the scheduler is stopping
+*/
+int aesd_coro_wait_fd(int fd, uint32_t events);
+
+/**
+* recv(2) which parks the coroutine instead of blocking.
+*/
+ssize_t aesd_coro_recv(int fd, void *buf, size_t len, int flags);
+
+/**
+* write(2) which parks the coroutine while a non-blocking fd is full.
+*/
+ssize_t aesd_coro_write(int fd, const void *buf, size_t len);
+
+/**
+* writev(2) which parks the coroutine while a non-blocking fd is full.
+*/
+ssize_t aesd_coro_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+* Prepare @param mutex for use.
+*/
+void aesd_coro_mutex_init(struct aesd_coro_mutex *mutex);
+
+/**
+* Acquire @param mutex in FIFO order.  A coroutine parks while waiting, a
+* thread blocks.  The holder may yield, e.g. in aesd_coro_write().
+*/
+void aesd_coro_mutex_lock(struct aesd_coro_mutex *mutex);
+
+/**
+* Release @param mutex, handing it to the longest waiter.
+*/
+void aesd_coro_mutex_unlock(struct aesd_coro_mutex *mutex);
+
+#endif /* AESD_CORO_H */
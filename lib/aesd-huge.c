@@ -0,0 +1,128 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-huge.c
+ * @brief Large memory regions backed by huge pages where the system allows
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "aesd-huge.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#define ERROR_LOG(msg,...) fprintf(stderr, "aesd-huge ERROR: " msg "\n" , ##__VA_ARGS__)
+
+#define THP_ENABLED "/sys/kernel/mm/transparent_hugepage/enabled"
+#define THP_SHMEM_ENABLED "/sys/kernel/mm/transparent_hugepage/shmem_enabled"
+#define DEFAULT_HUGE_PAGE (2UL * 1024 * 1024)
+
+static const char *mode_names[AESD_HUGE_NUM_MODES] = {
+  [AESD_HUGE_OFF] = "off",
+  [AESD_HUGE_MADVISE] = "madvise",
+  [AESD_HUGE_HUGETLB] = "hugetlb",
+};
+
+/*
+ * @brief  the default huge page size, the one MAP_HUGETLB maps
+ */
+static size_t huge_page_size(void)
+{
+  size_t kb = 0;
+  char line[128];
+  FILE *f = fopen("/proc/meminfo", "r");
+
+  if (f == NULL) {
+    return DEFAULT_HUGE_PAGE;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1) {
+      break;
+    }
+  }
+  fclose(f);
+  return kb ? kb * 1024 : DEFAULT_HUGE_PAGE;
+}
+
+/*
+ * @brief  whether madvise(MADV_HUGEPAGE) gets transparent huge pages for a
+ *         shared or private region, the selected setting is in brackets
+ */
+static bool thp_advisable(bool shared)
+{
+  static const char *private_ok[] = { "[always]", "[madvise]", NULL };
+  static const char *shared_ok[] = { "[always]", "[within_size]", "[advise]",
+                                     "[force]", NULL };
+  const char **ok = shared ? shared_ok : private_ok;
+  char setting[256];
+  FILE *f = fopen(shared ? THP_SHMEM_ENABLED : THP_ENABLED, "r");
+  bool allowed = false;
+
+  if (f == NULL) {
+    return false;
+  }
+  if (fgets(setting, sizeof(setting), f) != NULL) {
+    for (; *ok != NULL && !allowed; ok++) {
+      allowed = (strstr(setting, *ok) != NULL);
+    }
+  }
+  fclose(f);
+  return allowed;
+}
+
+void *aesd_huge_map(size_t *size, bool shared, enum aesd_huge_mode *mode)
+{
+  int flags = (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS;
+  size_t page;
+  size_t map_size;
+  void *map;
+
+  if (*mode == AESD_HUGE_HUGETLB) {
+    // reserved up front, so no MAP_NORESERVE: a short pool fails here
+    // instead of with SIGBUS on a later fault
+    page = huge_page_size();
+    map_size = (*size + page - 1) / page * page;
+    map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+    if (map != MAP_FAILED) {
+      *size = map_size;
+      return map;
+    }
+    ERROR_LOG("no %zu bytes of huge pages (%s), trying madvise", map_size,
+              strerror(errno));
+    *mode = AESD_HUGE_MADVISE;
+  }
+
+  map = mmap(NULL, *size, PROT_READ | PROT_WRITE, flags | MAP_NORESERVE, -1, 0);
+  if (map == MAP_FAILED) {
+    ERROR_LOG("mmap %zu bytes: %s", *size, strerror(errno));
+    return NULL;
+  }
+  if (*mode == AESD_HUGE_MADVISE &&
+      (!thp_advisable(shared) || madvise(map, *size, MADV_HUGEPAGE) == -1)) {
+    *mode = AESD_HUGE_OFF;
+  }
+  return map;
+}
+
+const char *aesd_huge_mode_name(enum aesd_huge_mode mode)
+{
+  if (mode < 0 || mode >= AESD_HUGE_NUM_MODES) {
+    return "unknown";
+  }
+  return mode_names[mode];
+}
+
+int aesd_huge_mode_from_name(const char *name, enum aesd_huge_mode *mode)
+{
+  int i;
+
+  if (name == NULL || mode == NULL) {
+    return -1;
+  }
+  for (i = 0; i < AESD_HUGE_NUM_MODES; i++) {
+    if (!strcmp(name, mode_names[i])) {
+      *mode = (enum aesd_huge_mode) i;
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,57 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-huge.h
+ * @brief Large memory regions backed by huge pages where the system allows
+ *
+ * A region spanning gigabytes in 4 KiB pages needs a TLB entry per page,
+ * and walking it misses the TLB on nearly every page.  Huge pages cover
+ * the same bytes with 512 times fewer entries.  They come two ways:
+ *
+ * - hugetlb: pages from the pool reserved by the administrator
+ *   (vm.nr_hugepages), all of the region reserved when it is mapped, so
+ *   mapping fails rather than a later fault when the pool is short.
+ * - madvise: ordinary pages the kernel may back with transparent huge
+ *   pages, if transparent_hugepage (shmem_enabled for shared regions) is
+ *   set to allow it.
+ *
+ * Each mode falls back to the next, down to ordinary pages, and reports the
+ * one in effect.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESD_HUGE_H
+#define AESD_HUGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum aesd_huge_mode {
+  AESD_HUGE_OFF = 0,    // ordinary pages
+  AESD_HUGE_MADVISE,    // transparent huge pages
+  AESD_HUGE_HUGETLB,    // reserved huge pages
+  AESD_HUGE_NUM_MODES
+};
+
+/**
+* Map @param size bytes of zeroed anonymous memory, shared with children
+* forked later if @param shared.  @param mode is the mode asked for on
+* entry and the one in effect on return.  With hugetlb, size is rounded up
+* to a whole number of huge pages, the size to munmap() later.  Otherwise
+* the pages are only used as they are written.
+* @return the region, or NULL on error
+*/
+void *aesd_huge_map(size_t *size, bool shared, enum aesd_huge_mode *mode);
+
+/**
+* @return the name used for @param mode in configuration ("off", "madvise",
+*         "hugetlb")
+*/
+const char *aesd_huge_mode_name(enum aesd_huge_mode mode);
+
+/**
+* Look up the mode called @param name and store it in @param mode.
+* @return 0 on success, -1 if the name is unknown
+*/
+int aesd_huge_mode_from_name(const char *name, enum aesd_huge_mode *mode);
+
+#endif /* AESD_HUGE_H */
@@ -0,0 +1,133 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-listen.c
+ * @brief Inherited listening sockets and readiness notification
+ * @author Jake Michael, jami1063@colorado.edu
+ * @resources
+ * (+)  sd_listen_fds(3) and sd_notify(3) for the environment protocol
+ *---------------------------------------------------------------------------*/
+
+#include "aesd-listen.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define ERROR_LOG(msg,...) fprintf(stderr, "aesd-listen ERROR: " msg "\n" , ##__VA_ARGS__)
+
+/*
+ * @brief  parses a whole decimal number
+ * @return 0 on success, -1 if str is not a number
+ */
+static int parse_long(const char *str, long *val)
+{
+  char *end;
+
+  if (str == NULL || *str == '\0')
+    return -1;
+  errno = 0;
+  *val = strtol(str, &end, 10);
+  if (errno != 0 || *end != '\0')
+    return -1;
+  return 0;
+}
+
+int aesd_listen_fds(int *fds, int max)
+{
+  long pid;
+  long nfds;
+  int accepting;
+  int type;
+  socklen_t len;
+  int fd;
+  int rc = -1;
+
+  if (getenv("LISTEN_FDS") == NULL) {
+    return 0;
+  }
+  if (parse_long(getenv("LISTEN_PID"), &pid) == -1 ||
+      parse_long(getenv("LISTEN_FDS"), &nfds) == -1 || nfds < 0) {
+    ERROR_LOG("invalid LISTEN_PID or LISTEN_FDS");
+    goto handle_errors;
+  }
+  // meant for another process, e.g. the parent which exec'd us without unsetting them
+  if ((pid_t) pid != getpid()) {
+    rc = 0;
+    goto handle_errors;
+  }
+  if (nfds > max) {
+    ERROR_LOG("%ld sockets passed, at most %d supported", nfds, max);
+    goto handle_errors;
+  }
+
+  for (fd = AESD_LISTEN_FDS_START; fd < AESD_LISTEN_FDS_START + nfds; fd++) {
+    len = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1 || type != SOCK_STREAM) {
+      ERROR_LOG("fd %d is not a stream socket", fd);
+      goto handle_errors;
+    }
+    len = sizeof(accepting);
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &len) == -1 || !accepting) {
+      ERROR_LOG("fd %d is not listening", fd);
+      goto handle_errors;
+    }
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+      ERROR_LOG("fcntl fd %d: %s", fd, strerror(errno));
+      goto handle_errors;
+    }
+    fds[fd - AESD_LISTEN_FDS_START] = fd;
+  }
+  rc = (int) nfds;
+
+handle_errors:
+  unsetenv("LISTEN_PID");
+  unsetenv("LISTEN_FDS");
+  unsetenv("LISTEN_FDNAMES");
+  return rc;
+}
+
+int aesd_listen_notify(const char *state)
+{
+  const char *path = getenv("NOTIFY_SOCKET");
+  struct sockaddr_un addr;
+  socklen_t addrlen;
+  size_t pathlen;
+  int fd;
+  int rc = -1;
+
+  if (path == NULL || *path == '\0') {
+    return 0;
+  }
+  pathlen = strlen(path);
+  if ((path[0] != '/' && path[0] != '@') || pathlen >= sizeof(addr.sun_path)) {
+    ERROR_LOG("unsupported NOTIFY_SOCKET %s", path);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path, pathlen);
+  // a leading @ names a socket in the abstract namespace
+  if (path[0] == '@')
+    addr.sun_path[0] = '\0';
+  addrlen = offsetof(struct sockaddr_un, sun_path) + pathlen;
+
+  fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    ERROR_LOG("socket: %s", strerror(errno));
+    return -1;
+  }
+  if (sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *) &addr,
+             addrlen) == -1) {
+    ERROR_LOG("notify %s: %s", path, strerror(errno));
+    goto handle_errors;
+  }
+  rc = 1;
+
+handle_errors:
+  close(fd);
+  return rc;
+}
@@ -0,0 +1,43 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-listen.h
+ * @brief Inherited listening sockets and readiness notification
+ *
+ * Implements the two halves of the systemd socket activation protocol that a
+ * server needs, without depending on libsystemd:
+ *
+ * - LISTEN_PID / LISTEN_FDS: a supervisor which holds the listening socket
+ *   passes it as fd 3 (and following) to each new instance of the server, so
+ *   the port keeps accepting connections into the kernel backlog while the
+ *   server restarts.
+ * - NOTIFY_SOCKET: the server tells the supervisor it is ready, or is
+ *   stopping, with a datagram of KEY=value lines.
+ *
+ * Both are no-ops when the environment does not ask for them.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESD_LISTEN_H
+#define AESD_LISTEN_H
+
+// the first descriptor passed by the supervisor
+#define AESD_LISTEN_FDS_START (3)
+
+/**
+* Take the listening sockets passed with LISTEN_FDS if LISTEN_PID names this
+* process.  Up to @param max descriptors are stored in @param fds and marked
+* close-on-exec; the variables are removed from the environment so children
+* do not inherit them.  Descriptors which are not listening stream sockets
+* are rejected.
+* @return the number of descriptors, 0 if none were passed, -1 on error
+*/
+int aesd_listen_fds(int *fds, int max);
+
+/**
+* Send @param state, e.g. "READY=1" or "STOPPING=1", to the supervisor's
+* NOTIFY_SOCKET.
+* @return 1 if sent, 0 if there is no supervisor to notify, -1 on error
+*/
+int aesd_listen_notify(const char *state);
+
+#endif /* AESD_LISTEN_H */
@@ -0,0 +1,289 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-lock.c
+ * @brief Interchangeable mutual exclusion locks behind one interface
+ * @author Jake Michael, jami1063@colorado.edu
+ * @resources
+ * (+)  MCS lock: Mellor-Crummey and Scott, "Algorithms for Scalable
+ *      Synchronization on Shared-Memory Multiprocessors", 1991
+ * (+)  futex based lock: Ulrich Drepper, "Futexes Are Tricky", 2011
+ *---------------------------------------------------------------------------*/
+
+#include "aesd-lock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// spins before a waiting thread gives up its time slice
+#define SPINS_BEFORE_YIELD (128)
+// spins before the adaptive lock goes to sleep on its futex
+#define ADAPTIVE_SPINS (256)
+
+#if defined(__x86_64__) || defined(__i386__)
+  #define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+  #define cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+  #define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+static const char *const lock_names[AESD_LOCK_NUM_TYPES] = {
+  [AESD_LOCK_MUTEX]    = "mutex",
+  [AESD_LOCK_TICKET]   = "ticket",
+  [AESD_LOCK_MCS]      = "mcs",
+  [AESD_LOCK_ADAPTIVE] = "adaptive",
+};
+
+static __thread struct aesd_mcs_node mcs_nodes[AESD_LOCK_MCS_MAX_NESTING];
+static __thread int mcs_depth;
+
+static void spin_wait(unsigned int *spins)
+{
+  if (++(*spins) < SPINS_BEFORE_YIELD) {
+    cpu_relax();
+  } else {
+    *spins = 0;
+    sched_yield(); // the holder may be waiting for our CPU
+  }
+}
+
+static void futex_wait(atomic_int *addr, int val)
+{
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_int *addr, int nwake)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, nwake, NULL, NULL, 0);
+}
+
+/* ============================================================================
+ *    TICKET
+ * ===========================================================================*/
+
+static void ticket_acquire(struct aesd_lock *lock)
+{
+  unsigned int spins = 0;
+  unsigned int ticket = atomic_fetch_add_explicit(&lock->u.ticket.next, 1,
+                                                  memory_order_relaxed);
+
+  while (atomic_load_explicit(&lock->u.ticket.serving, memory_order_acquire) != ticket) {
+    spin_wait(&spins);
+  }
+}
+
+static bool ticket_tryacquire(struct aesd_lock *lock)
+{
+  unsigned int serving = atomic_load_explicit(&lock->u.ticket.serving, memory_order_acquire);
+  unsigned int expected = serving;
+
+  // only take a ticket if it would be served immediately
+  return atomic_compare_exchange_strong_explicit(&lock->u.ticket.next, &expected,
+                                                 serving + 1, memory_order_acquire,
+                                                 memory_order_relaxed);
+}
+
+static void ticket_release(struct aesd_lock *lock)
+{
+  unsigned int serving = atomic_load_explicit(&lock->u.ticket.serving, memory_order_relaxed);
+  atomic_store_explicit(&lock->u.ticket.serving, serving + 1, memory_order_release);
+}
+
+/* ============================================================================
+ *    MCS
+ * ===========================================================================*/
+
+static struct aesd_mcs_node* mcs_node_get(void)
+{
+  struct aesd_mcs_node *node;
+
+  // one more node would be past the array, corrupting whatever follows it
+  if (mcs_depth == AESD_LOCK_MCS_MAX_NESTING) {
+    fprintf(stderr, "aesd-lock: a thread holds more than %d MCS locks\n",
+            AESD_LOCK_MCS_MAX_NESTING);
+    abort();
+  }
+  node = &mcs_nodes[mcs_depth++];
+
+  atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+  atomic_store_explicit(&node->locked, 1, memory_order_relaxed);
+  return node;
+}
+
+static void mcs_acquire(struct aesd_lock *lock)
+{
+  unsigned int spins = 0;
+  struct aesd_mcs_node *node = mcs_node_get();
+  struct aesd_mcs_node *prev;
+
+  prev = atomic_exchange_explicit(&lock->u.mcs.tail, node, memory_order_acq_rel);
+  if (prev != NULL) {
+    // queue behind prev and spin on our own node until it hands over
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+    while (atomic_load_explicit(&node->locked, memory_order_acquire)) {
+      spin_wait(&spins);
+    }
+  }
+  lock->u.mcs.owner = node;
+}
+
+static bool mcs_tryacquire(struct aesd_lock *lock)
+{
+  struct aesd_mcs_node *node = mcs_node_get();
+  struct aesd_mcs_node *expected = NULL;
+
+  if (atomic_compare_exchange_strong_explicit(&lock->u.mcs.tail, &expected, node,
+                                              memory_order_acq_rel, memory_order_relaxed)) {
+    lock->u.mcs.owner = node;
+    return true;
+  }
+  mcs_depth--;
+  return false;
+}
+
+static void mcs_release(struct aesd_lock *lock)
+{
+  unsigned int spins = 0;
+  struct aesd_mcs_node *node = lock->u.mcs.owner;
+  struct aesd_mcs_node *next = atomic_load_explicit(&node->next, memory_order_acquire);
+  struct aesd_mcs_node *expected = node;
+
+  if (next == NULL) {
+    // nobody queued, try to mark the lock free
+    if (atomic_compare_exchange_strong_explicit(&lock->u.mcs.tail, &expected, NULL,
+                                                memory_order_acq_rel, memory_order_relaxed)) {
+      mcs_depth--;
+      return;
+    }
+    // a waiter swapped itself in but has not linked to us yet
+    while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) == NULL) {
+      spin_wait(&spins);
+    }
+  }
+  atomic_store_explicit(&next->locked, 0, memory_order_release);
+  mcs_depth--;
+}
+
+/* ============================================================================
+ *    ADAPTIVE (spin, then futex)
+ * ===========================================================================*/
+
+static bool adaptive_tryacquire(struct aesd_lock *lock)
+{
+  int expected = 0;
+  return atomic_compare_exchange_strong_explicit(&lock->u.adaptive.state, &expected, 1,
+                                                 memory_order_acquire, memory_order_relaxed);
+}
+
+static void adaptive_acquire(struct aesd_lock *lock)
+{
+  int spins;
+  int c;
+
+  for (spins = 0; spins < ADAPTIVE_SPINS; spins++) {
+    if (atomic_load_explicit(&lock->u.adaptive.state, memory_order_relaxed) == 0 &&
+        adaptive_tryacquire(lock)) {
+      return;
+    }
+    cpu_relax();
+  }
+
+  // mark the lock contended and sleep until the holder wakes us
+  c = atomic_exchange_explicit(&lock->u.adaptive.state, 2, memory_order_acquire);
+  while (c != 0) {
+    futex_wait(&lock->u.adaptive.state, 2);
+    c = atomic_exchange_explicit(&lock->u.adaptive.state, 2, memory_order_acquire);
+  }
+}
+
+static void adaptive_release(struct aesd_lock *lock)
+{
+  if (atomic_exchange_explicit(&lock->u.adaptive.state, 0, memory_order_release) == 2) {
+    futex_wake(&lock->u.adaptive.state, 1);
+  }
+}
+
+/* ============================================================================
+ *    COMMON INTERFACE
+ * ===========================================================================*/
+
+int aesd_lock_init(struct aesd_lock *lock, enum aesd_lock_type type)
+{
+  if (lock == NULL || type < 0 || type >= AESD_LOCK_NUM_TYPES) {
+    return -1;
+  }
+
+  memset(lock, 0, sizeof(*lock));
+  lock->type = type;
+  if (type == AESD_LOCK_MUTEX && pthread_mutex_init(&lock->u.mutex, NULL) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+void aesd_lock_destroy(struct aesd_lock *lock)
+{
+  if (lock->type == AESD_LOCK_MUTEX) {
+    pthread_mutex_destroy(&lock->u.mutex);
+  }
+}
+
+void aesd_lock_acquire(struct aesd_lock *lock)
+{
+  switch (lock->type) {
+    case AESD_LOCK_MUTEX:    pthread_mutex_lock(&lock->u.mutex); break;
+    case AESD_LOCK_TICKET:   ticket_acquire(lock); break;
+    case AESD_LOCK_MCS:      mcs_acquire(lock); break;
+    case AESD_LOCK_ADAPTIVE: adaptive_acquire(lock); break;
+    default: break;
+  }
+}
+
+bool aesd_lock_tryacquire(struct aesd_lock *lock)
+{
+  switch (lock->type) {
+    case AESD_LOCK_MUTEX:    return pthread_mutex_trylock(&lock->u.mutex) == 0;
+    case AESD_LOCK_TICKET:   return ticket_tryacquire(lock);
+    case AESD_LOCK_MCS:      return mcs_tryacquire(lock);
+    case AESD_LOCK_ADAPTIVE: return adaptive_tryacquire(lock);
+    default: return false;
+  }
+}
+
+void aesd_lock_release(struct aesd_lock *lock)
+{
+  switch (lock->type) {
+    case AESD_LOCK_MUTEX:    pthread_mutex_unlock(&lock->u.mutex); break;
+    case AESD_LOCK_TICKET:   ticket_release(lock); break;
+    case AESD_LOCK_MCS:      mcs_release(lock); break;
+    case AESD_LOCK_ADAPTIVE: adaptive_release(lock); break;
+    default: break;
+  }
+}
+
+const char *aesd_lock_type_name(enum aesd_lock_type type)
+{
+  if (type < 0 || type >= AESD_LOCK_NUM_TYPES) {
+    return NULL;
+  }
+  return lock_names[type];
+}
+
+int aesd_lock_type_from_name(const char *name, enum aesd_lock_type *type)
+{
+  int i;
+
+  if (name == NULL || type == NULL) {
+    return -1;
+  }
+  for (i = 0; i < AESD_LOCK_NUM_TYPES; i++) {
+    if (!strcmp(name, lock_names[i])) {
+      *type = (enum aesd_lock_type) i;
+      return 0;
+    }
+  }
+  return -1;
+}
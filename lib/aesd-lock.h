@@ -0,0 +1,101 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-lock.h
+ * @brief Interchangeable mutual exclusion locks behind one interface
+ *
+ * AESD_LOCK_MUTEX     pthread_mutex_t
+ * AESD_LOCK_TICKET    FIFO ticket spinlock
+ * AESD_LOCK_MCS       MCS queue lock, each waiter spins on its own node
+ * AESD_LOCK_ADAPTIVE  spins briefly, then sleeps on a futex
+ *
+ * The spinning locks yield the CPU after a bounded number of spins so they
+ * degrade gracefully when there are more runnable threads than cores, but
+ * they are still a poor fit for critical sections which block (for example
+ * on socket I/O).
+ *
+ * MCS queue nodes are taken from a small per-thread array, so a thread may
+ * hold at most AESD_LOCK_MCS_MAX_NESTING MCS locks at once, taking one more
+ * aborts, and must release them in the reverse order they were acquired.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESD_LOCK_H
+#define AESD_LOCK_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define AESD_LOCK_MCS_MAX_NESTING (4)
+
+enum aesd_lock_type {
+    AESD_LOCK_MUTEX = 0,
+    AESD_LOCK_TICKET,
+    AESD_LOCK_MCS,
+    AESD_LOCK_ADAPTIVE,
+    AESD_LOCK_NUM_TYPES
+};
+
+struct aesd_mcs_node {
+    struct aesd_mcs_node *_Atomic next;
+    atomic_int locked;
+};
+
+struct aesd_lock {
+    enum aesd_lock_type type;
+    union {
+        pthread_mutex_t mutex;
+        struct {
+            atomic_uint next;               // next ticket to hand out
+            atomic_uint serving;            // ticket currently allowed in
+        } ticket;
+        struct {
+            struct aesd_mcs_node *_Atomic tail;
+            struct aesd_mcs_node *owner;    // node of the current holder
+        } mcs;
+        struct {
+            atomic_int state;               // 0 free, 1 locked, 2 locked with sleepers
+        } adaptive;
+    } u;
+};
+
+/**
+* Initialize @param lock as a lock of @param type.
+* @return 0 on success, -1 if type is invalid or the lock could not be created
+*/
+int aesd_lock_init(struct aesd_lock *lock, enum aesd_lock_type type);
+
+/**
+* Release any resources held by @param lock, which must not be held.
+*/
+void aesd_lock_destroy(struct aesd_lock *lock);
+
+/**
+* Block until @param lock is held by the calling thread.
+*/
+void aesd_lock_acquire(struct aesd_lock *lock);
+
+/**
+* Take @param lock only if that is possible without waiting.
+* @return true if the lock is now held by the calling thread
+*/
+bool aesd_lock_tryacquire(struct aesd_lock *lock);
+
+/**
+* Release @param lock, which must be held by the calling thread.
+*/
+void aesd_lock_release(struct aesd_lock *lock);
+
+/**
+* @return the name used for @param type in configuration ("mutex", "ticket",
+* "mcs" or "adaptive"), or NULL for an invalid type
+*/
+const char *aesd_lock_type_name(enum aesd_lock_type type);
+
+/**
+* Look up the lock type called @param name and store it in @param type.
+* @return 0 on success, -1 if the name is unknown
+*/
+int aesd_lock_type_from_name(const char *name, enum aesd_lock_type *type);
+
+#endif /* AESD_LOCK_H */
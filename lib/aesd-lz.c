@@ -0,0 +1,189 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-lz.c
+ * @brief A small, fast LZ compressor for aesdsocket replies
+ * @author Jake Michael, jami1063@colorado.edu
+ * @resources
+ * (+)  the LZ4 block format:
+ * https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ *---------------------------------------------------------------------------*/
+
+#include "aesd-lz.h"
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_MATCH     (4)
+#define LAST_LITERALS (5)   // a block ends with at least this many literals
+#define MF_LIMIT      (12)  // and its last match starts before this
+#define MAX_OFFSET    (65535)
+// 4 KiB of positions, small enough for a coroutine stack
+#define HASH_LOG      (11)
+
+static uint32_t read32(const uint8_t *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t hash32(uint32_t v)
+{
+  return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+// a length of 15 or more continues in bytes of 255, ended by one below
+static uint8_t *write_length(uint8_t *op, size_t len)
+{
+  for (; len >= 255; len -= 255) {
+    *op++ = 255;
+  }
+  *op++ = (uint8_t) len;
+  return op;
+}
+
+size_t aesd_lz_bound(size_t len)
+{
+  return len + len / 255 + 16;
+}
+
+size_t aesd_lz_compress(const char *src, size_t len, char *dst, size_t cap)
+{
+  uint16_t table[1 << HASH_LOG];
+  const uint8_t *base = (const uint8_t *) src;
+  const uint8_t *ip = base;
+  const uint8_t *anchor = base;
+  const uint8_t *end = base + len;
+  const uint8_t *mf_limit;
+  const uint8_t *match_limit;
+  uint8_t *op = (uint8_t *) dst;
+  uint8_t *oend = op + cap;
+  const uint8_t *ref;
+  const uint8_t *m;
+  size_t lit_len;
+  size_t match_len;
+  uint32_t h;
+
+  if (len > AESD_LZ_MAX_INPUT) {
+    return 0;
+  }
+  memset(table, 0, sizeof(table));
+  // shorter inputs are all literals, and the limits would lie before src
+  if (len > MF_LIMIT) {
+    mf_limit = end - MF_LIMIT;
+    match_limit = end - LAST_LITERALS;
+    while (ip < mf_limit) {
+      h = hash32(read32(ip));
+      ref = base + table[h];
+      table[h] = (uint16_t) (ip - base);
+      if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != read32(ip)) {
+        ip++;
+        continue;
+      }
+      // extend the match backwards into the literals, then forwards
+      while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+      for (m = ip + MIN_MATCH; m < match_limit && *m == ref[m - ip]; m++);
+
+      lit_len = ip - anchor;
+      match_len = m - ip - MIN_MATCH;
+      if (op + 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1 > oend) {
+        return 0;
+      }
+      uint8_t *token = op++;
+      *token = (uint8_t) ((lit_len >= 15 ? 15 : lit_len) << 4);
+      if (lit_len >= 15) {
+        op = write_length(op, lit_len - 15);
+      }
+      memcpy(op, anchor, lit_len);
+      op += lit_len;
+      *op++ = (uint8_t) (ip - ref);
+      *op++ = (uint8_t) ((ip - ref) >> 8);
+      *token |= (uint8_t) (match_len >= 15 ? 15 : match_len);
+      if (match_len >= 15) {
+        op = write_length(op, match_len - 15);
+      }
+      ip = anchor = m;
+      // the position just before the next one is the likeliest next match
+      if (ip < mf_limit) {
+        table[hash32(read32(ip - 2))] = (uint16_t) (ip - 2 - base);
+      }
+    }
+  }
+
+  // the rest are literals, a sequence without a match
+  lit_len = end - anchor;
+  if (op + 1 + lit_len / 255 + 1 + lit_len > oend) {
+    return 0;
+  }
+  *op++ = (uint8_t) ((lit_len >= 15 ? 15 : lit_len) << 4);
+  if (lit_len >= 15) {
+    op = write_length(op, lit_len - 15);
+  }
+  memcpy(op, anchor, lit_len);
+  op += lit_len;
+  return op - (uint8_t *) dst;
+}
+
+ssize_t aesd_lz_decompress(const char *src, size_t len, char *dst, size_t cap)
+{
+  const uint8_t *ip = (const uint8_t *) src;
+  const uint8_t *iend = ip + len;
+  uint8_t *op = (uint8_t *) dst;
+  uint8_t *oend = op + cap;
+  size_t lit_len;
+  size_t match_len;
+  size_t offset;
+  uint8_t token;
+  uint8_t b;
+
+  while (ip < iend) {
+    token = *ip++;
+    lit_len = token >> 4;
+    if (lit_len == 15) {
+      do {
+        if (ip >= iend)
+          return -1;
+        b = *ip++;
+        lit_len += b;
+      } while (b == 255);
+    }
+    if (lit_len > (size_t) (iend - ip) || lit_len > (size_t) (oend - op)) {
+      return -1;
+    }
+    memcpy(op, ip, lit_len);
+    ip += lit_len;
+    op += lit_len;
+    if (ip == iend) {
+      break; // the last sequence has no match
+    }
+
+    if (iend - ip < 2) {
+      return -1;
+    }
+    offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t) (op - (uint8_t *) dst)) {
+      return -1;
+    }
+    match_len = token & 15;
+    if (match_len == 15) {
+      do {
+        if (ip >= iend)
+          return -1;
+        b = *ip++;
+        match_len += b;
+      } while (b == 255);
+    }
+    match_len += MIN_MATCH;
+    if (match_len > (size_t) (oend - op)) {
+      return -1;
+    }
+    // byte by byte, a match may overlap the bytes it produces
+    for (; match_len > 0; match_len--, op++) {
+      *op = op[-offset];
+    }
+  }
+  return op - (uint8_t *) dst;
+}
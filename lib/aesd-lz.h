@@ -0,0 +1,42 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-lz.h
+ * @brief A small, fast LZ compressor for aesdsocket replies
+ *
+ * Greedy LZ77 with a hash table of 4-byte sequences, writing the LZ4 block
+ * format, so a block may also be decoded with LZ4_decompress_safe() from
+ * liblz4.  Blocks are independent and at most AESD_LZ_MAX_INPUT bytes, the
+ * 64 KiB window of the format.  Text like the aesdsocket log, with its
+ * repeated "timestamp:" lines, compresses to a fraction of its size at
+ * hundreds of MB/s.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESD_LZ_H
+#define AESD_LZ_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define AESD_LZ_MAX_INPUT (64 * 1024)
+
+/**
+* @return the largest compressed size of @param len bytes
+*/
+size_t aesd_lz_bound(size_t len);
+
+/**
+* Compress @param len bytes of @param src, at most AESD_LZ_MAX_INPUT, into
+* @param dst of @param cap bytes.
+* @return the compressed size, 0 if it does not fit in cap
+*/
+size_t aesd_lz_compress(const char *src, size_t len, char *dst, size_t cap);
+
+/**
+* Decompress the block of @param len bytes at @param src into @param dst of
+* @param cap bytes.
+* @return the decompressed size, -1 if the block is corrupt or too big
+*/
+ssize_t aesd_lz_decompress(const char *src, size_t len, char *dst, size_t cap);
+
+#endif /* AESD_LZ_H */
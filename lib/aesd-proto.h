@@ -0,0 +1,48 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-proto.h
+ * @brief Framed replies on an aesdsocket connection
+ *
+ * A plain aesdsocket reply is the whole log with no length or end marker,
+ * so a client can only tell it is complete by finding its own packet at
+ * the end, one packet at a time.  A client which sends AESD_PROTO_HELLO as
+ * its first packet is answered with AESD_PROTO_ACK, which is not stored,
+ * and from then on:
+ *
+ *  - the packets received together are stored together and answered with
+ *    one reply, so a client may pipeline a batch of packets in one send
+ *  - a reply is a series of chunks, each "<len>\n" and <len> bytes of the
+ *    log, ended by "0 <packets>\n" giving the number of packets it answers
+ *
+ * A client may ask for compressed replies with AESD_PROTO_HELLO_LZ4 instead,
+ * answered by AESD_PROTO_ACK_LZ4 if the server compresses, else by the
+ * plain ack.  Each chunk header is then "<clen> <rawlen>\n", followed by
+ * <clen> bytes which are an LZ4 format block (lib/aesd-lz.h) of <rawlen>
+ * bytes of the log, or the bytes themselves when clen equals rawlen.
+ *
+ * An overloaded server turns work away instead of queueing it.  Packets of
+ * a framed connection it does not store are answered by the line
+ * AESD_PROTO_BUSY " <packets>" in place of a reply, and the connection
+ * stays open.  Any other connection it rejects, on accept or with a packet,
+ * gets AESD_PROTO_BUSY "\n" and is closed.  Either way the client may retry
+ * later.
+ *
+ * A server without framing stores the hello as a packet and answers with
+ * the log, which ends with the hello rather than being the ack, so the
+ * client can tell it apart and fall back to plain replies.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESD_PROTO_H
+#define AESD_PROTO_H
+
+#define AESD_PROTO_HELLO "AESDSOCKET_FRAMED:1\n"
+#define AESD_PROTO_ACK   "AESDSOCKET_FRAMED:1 OK\n"
+#define AESD_PROTO_HELLO_LZ4 "AESDSOCKET_FRAMED:1 lz4\n"
+#define AESD_PROTO_ACK_LZ4   "AESDSOCKET_FRAMED:1 OK lz4\n"
+#define AESD_PROTO_BUSY      "AESDSOCKET_BUSY"
+
+// longest chunk header, "<len>\n" for an int length
+#define AESD_PROTO_CHUNK_HDR_MAX (12)
+
+#endif /* AESD_PROTO_H */
@@ -0,0 +1,561 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-sched.c
+ * @brief Work-stealing task scheduler
+ * @author Jake Michael, jami1063@colorado.edu
+ * @resources
+ * (+)  Chase and Lev, "Dynamic Circular Work-Stealing Deque", SPAA 2005
+ * (+)  memory orderings from Le, Pop, Cohen and Zappa Nardelli, "Correct and
+ *      Efficient Work-Stealing for Weak Memory Models", PPoPP 2013
+ *---------------------------------------------------------------------------*/
+
+#include "aesd-sched.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define ERROR_LOG(msg,...) fprintf(stderr, "aesd-sched ERROR: " msg "\n" , ##__VA_ARGS__)
+
+#define DEQUE_INITIAL_SIZE (256)
+// rounds of looking for work before an idle worker parks
+#define IDLE_ROUNDS (16)
+
+#if defined(__x86_64__) || defined(__i386__)
+  #define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+  #define cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+  #define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+struct aesd_task {
+  aesd_task_fn fn;
+  void *arg;
+  struct aesd_task_group *group;
+  struct aesd_task *next;         // injection queue link
+};
+
+/* ============================================================================
+ *    CHASE-LEV DEQUE
+ * ===========================================================================*/
+
+struct cl_array {
+  long size;                      // power of two
+  struct cl_array *retired_next;  // arrays replaced by a resize, freed on destroy
+  _Atomic(struct aesd_task *) buf[];
+};
+
+struct cl_deque {
+  atomic_long top;                // stealers take from here
+  char pad[64 - sizeof(atomic_long)];
+  atomic_long bottom;             // the owner pushes and takes here
+  _Atomic(struct cl_array *) array;
+  struct cl_array *retired;
+};
+
+#define CL_EMPTY ((struct aesd_task *) 0)
+#define CL_ABORT ((struct aesd_task *) 1)
+
+static struct cl_array* cl_array_new(long size)
+{
+  struct cl_array *a = calloc(1, sizeof(struct cl_array) + size * sizeof(struct aesd_task *));
+  if (a != NULL) {
+    a->size = size;
+  }
+  return a;
+}
+
+static int cl_init(struct cl_deque *d)
+{
+  struct cl_array *a = cl_array_new(DEQUE_INITIAL_SIZE);
+  if (a == NULL) {
+    return -1;
+  }
+  atomic_init(&d->top, 0);
+  atomic_init(&d->bottom, 0);
+  atomic_init(&d->array, a);
+  d->retired = NULL;
+  return 0;
+}
+
+static void cl_free(struct cl_deque *d)
+{
+  struct cl_array *a = atomic_load(&d->array);
+  struct cl_array *next;
+
+  free(a);
+  for (a = d->retired; a != NULL; a = next) {
+    next = a->retired_next;
+    free(a);
+  }
+}
+
+// owner only
+static int cl_push(struct cl_deque *d, struct aesd_task *task)
+{
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&d->top, memory_order_acquire);
+  struct cl_array *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+  long i;
+
+  if (b - t > a->size - 1) {
+    // full, move the live range into an array twice the size.  Stealers may
+    // still be reading the old one, so it is only retired, not freed.
+    struct cl_array *bigger = cl_array_new(a->size * 2);
+    if (bigger == NULL) {
+      return -1;
+    }
+    for (i = t; i < b; i++) {
+      atomic_store_explicit(&bigger->buf[i & (bigger->size - 1)],
+                            atomic_load_explicit(&a->buf[i & (a->size - 1)],
+                                                 memory_order_relaxed),
+                            memory_order_relaxed);
+    }
+    a->retired_next = d->retired;
+    d->retired = a;
+    atomic_store_explicit(&d->array, bigger, memory_order_release);
+    a = bigger;
+  }
+  atomic_store_explicit(&a->buf[b & (a->size - 1)], task, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  return 0;
+}
+
+// owner only
+static struct aesd_task* cl_take(struct cl_deque *d)
+{
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+  struct cl_array *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+  struct aesd_task *task;
+  long t;
+
+  atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+  if (t > b) {
+    // empty
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return CL_EMPTY;
+  }
+
+  task = atomic_load_explicit(&a->buf[b & (a->size - 1)], memory_order_relaxed);
+  if (t == b) {
+    // last element, race the stealers for it
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+      task = CL_EMPTY;
+    }
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  }
+  return task;
+}
+
+// any thread
+static struct aesd_task* cl_steal(struct cl_deque *d)
+{
+  long t = atomic_load_explicit(&d->top, memory_order_acquire);
+  long b;
+  struct cl_array *a;
+  struct aesd_task *task;
+
+  atomic_thread_fence(memory_order_seq_cst);
+  b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+  if (t >= b) {
+    return CL_EMPTY;
+  }
+
+  a = atomic_load_explicit(&d->array, memory_order_acquire);
+  task = atomic_load_explicit(&a->buf[t & (a->size - 1)], memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst,
+                                               memory_order_relaxed)) {
+    return CL_ABORT; // lost the race to another thief or the owner
+  }
+  return task;
+}
+
+static bool cl_empty(struct cl_deque *d)
+{
+  return atomic_load_explicit(&d->top, memory_order_relaxed) >=
+         atomic_load_explicit(&d->bottom, memory_order_relaxed);
+}
+
+/* ============================================================================
+ *    SCHEDULER
+ * ===========================================================================*/
+
+struct aesd_worker {
+  pthread_t thread;
+  struct aesd_sched *sched;
+  struct cl_deque deque;
+  unsigned int rng;               // victim selection
+} __attribute__((aligned(64)));
+
+struct aesd_sched {
+  struct aesd_worker *workers;
+  unsigned int nworkers;
+  unsigned int nstarted;          // worker threads running
+
+  pthread_mutex_t inject_lock;    // protects the injection queue
+  struct aesd_task *inject_head;
+  struct aesd_task *inject_tail;
+  atomic_long inject_len;
+
+  atomic_int epoch;               // futex word idle workers park on
+  atomic_int sleepers;
+  atomic_bool shutdown;
+
+  struct aesd_task_group all;     // every task, for aesd_sched_destroy()
+};
+
+static __thread struct aesd_worker *current_worker;
+
+static long futex(atomic_int *addr, int op, int val)
+{
+  return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+static int group_pending(struct aesd_task_group *group)
+{
+  return atomic_load(&group->pending) & ~AESD_TASK_GROUP_WAITERS;
+}
+
+static void group_complete(struct aesd_task_group *group)
+{
+  // a waiter may return and free the group as soon as the count reaches 0,
+  // so the wake only uses its address.  A wake on memory reused since is
+  // spurious, futex waiters recheck their word
+  if (atomic_fetch_sub(&group->pending, 1) == (AESD_TASK_GROUP_WAITERS | 1)) {
+    futex(&group->pending, FUTEX_WAKE_PRIVATE, INT_MAX);
+  }
+}
+
+static void run_task(struct aesd_sched *sched, struct aesd_task *task)
+{
+  struct aesd_task_group *group = task->group;
+
+  task->fn(task->arg);
+  free(task);
+  if (group != NULL) {
+    group_complete(group);
+  }
+  group_complete(&sched->all);
+}
+
+static struct aesd_task* inject_pop(struct aesd_sched *sched)
+{
+  struct aesd_task *task = NULL;
+
+  if (atomic_load_explicit(&sched->inject_len, memory_order_relaxed) == 0) {
+    return NULL;
+  }
+  pthread_mutex_lock(&sched->inject_lock);
+  if (sched->inject_head != NULL) {
+    task = sched->inject_head;
+    sched->inject_head = task->next;
+    if (sched->inject_head == NULL) {
+      sched->inject_tail = NULL;
+    }
+    atomic_fetch_sub_explicit(&sched->inject_len, 1, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&sched->inject_lock);
+  return task;
+}
+
+static void inject_push(struct aesd_sched *sched, struct aesd_task *task)
+{
+  task->next = NULL;
+  pthread_mutex_lock(&sched->inject_lock);
+  if (sched->inject_tail != NULL) {
+    sched->inject_tail->next = task;
+  } else {
+    sched->inject_head = task;
+  }
+  sched->inject_tail = task;
+  atomic_fetch_add_explicit(&sched->inject_len, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&sched->inject_lock);
+}
+
+static struct aesd_task* find_task(struct aesd_worker *w)
+{
+  struct aesd_sched *sched = w->sched;
+  struct aesd_task *task;
+  unsigned int i;
+  unsigned int start;
+  bool aborted;
+
+  // own deque first (LIFO, cache warm), then the shared injection queue
+  task = cl_take(&w->deque);
+  if (task != CL_EMPTY) {
+    return task;
+  }
+  task = inject_pop(sched);
+  if (task != NULL) {
+    return task;
+  }
+
+  // steal from the other workers starting at a random victim
+  do {
+    aborted = false;
+    w->rng = w->rng * 1103515245u + 12345u;
+    start = (w->rng >> 16) % sched->nworkers;
+    for (i = 0; i < sched->nworkers; i++) {
+      struct aesd_worker *victim = &sched->workers[(start + i) % sched->nworkers];
+      if (victim == w) {
+        continue;
+      }
+      task = cl_steal(&victim->deque);
+      if (task == CL_ABORT) {
+        aborted = true;
+      } else if (task != CL_EMPTY) {
+        return task;
+      }
+    }
+  } while (aborted);
+
+  return NULL;
+}
+
+static bool has_work(struct aesd_sched *sched)
+{
+  unsigned int i;
+
+  if (atomic_load(&sched->inject_len) > 0) {
+    return true;
+  }
+  for (i = 0; i < sched->nworkers; i++) {
+    if (!cl_empty(&sched->workers[i].deque)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void wake_one(struct aesd_sched *sched)
+{
+  // pairs with the sleepers increment in worker_thread()
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&sched->sleepers) > 0) {
+    atomic_fetch_add(&sched->epoch, 1);
+    futex(&sched->epoch, FUTEX_WAKE_PRIVATE, 1);
+  }
+}
+
+static void* worker_thread(void *param)
+{
+  struct aesd_worker *w = (struct aesd_worker *) param;
+  struct aesd_sched *sched = w->sched;
+  struct aesd_task *task;
+  int idle = 0;
+  int epoch;
+
+  current_worker = w;
+
+  while (true)
+  {
+    task = find_task(w);
+    if (task != NULL) {
+      idle = 0;
+      run_task(sched, task);
+      continue;
+    }
+
+    if (atomic_load(&sched->shutdown)) {
+      break;
+    }
+    if (++idle < IDLE_ROUNDS) {
+      cpu_relax();
+      if (idle > IDLE_ROUNDS / 2) {
+        sched_yield();
+      }
+      continue;
+    }
+
+    // park: announce ourselves, re-check, then sleep until the epoch moves
+    epoch = atomic_load(&sched->epoch);
+    atomic_fetch_add(&sched->sleepers, 1);
+    if (!has_work(sched) && !atomic_load(&sched->shutdown)) {
+      futex(&sched->epoch, FUTEX_WAIT_PRIVATE, epoch);
+    }
+    atomic_fetch_sub(&sched->sleepers, 1);
+    idle = 0;
+  }
+
+  current_worker = NULL;
+  return NULL;
+}
+
+
+struct aesd_sched *aesd_sched_create(unsigned int nworkers)
+{
+  struct aesd_sched *sched;
+  unsigned int i;
+  int rc;
+
+  if (nworkers == 0) {
+    return NULL;
+  }
+  sched = calloc(1, sizeof(struct aesd_sched));
+  if (sched == NULL) {
+    return NULL;
+  }
+  sched->workers = aligned_alloc(64, nworkers * sizeof(struct aesd_worker));
+  if (sched->workers == NULL) {
+    free(sched);
+    return NULL;
+  }
+  memset(sched->workers, 0, nworkers * sizeof(struct aesd_worker));
+  pthread_mutex_init(&sched->inject_lock, NULL);
+  aesd_task_group_init(&sched->all);
+
+  for (i = 0; i < nworkers; i++) {
+    struct aesd_worker *w = &sched->workers[i];
+    w->sched = sched;
+    w->rng = i * 2654435761u + 1;
+    if (cl_init(&w->deque) != 0) {
+      ERROR_LOG("deque allocation fail");
+      break;
+    }
+  }
+  if (i < nworkers) {
+    while (i-- > 0) {
+      cl_free(&sched->workers[i].deque);
+    }
+    free(sched->workers);
+    free(sched);
+    return NULL;
+  }
+
+  // all deques exist before any worker may try to steal from them
+  sched->nworkers = nworkers;
+  for (i = 0; i < nworkers; i++) {
+    rc = pthread_create(&sched->workers[i].thread, NULL, worker_thread, &sched->workers[i]);
+    if (rc != 0) {
+      ERROR_LOG("pthread_create fail, returned %s", strerror(rc));
+      break;
+    }
+  }
+  if (i < nworkers) {
+    sched->nstarted = i;
+    aesd_sched_destroy(sched);
+    return NULL;
+  }
+  sched->nstarted = nworkers;
+  return sched;
+}
+
+
+void aesd_sched_destroy(struct aesd_sched *sched)
+{
+  unsigned int i;
+
+  if (sched == NULL) {
+    return;
+  }
+
+  aesd_task_group_wait(sched, &sched->all);
+
+  atomic_store(&sched->shutdown, true);
+  atomic_fetch_add(&sched->epoch, 1);
+  futex(&sched->epoch, FUTEX_WAKE_PRIVATE, INT_MAX);
+  for (i = 0; i < sched->nstarted; i++) {
+    pthread_join(sched->workers[i].thread, NULL);
+  }
+
+  for (i = 0; i < sched->nworkers; i++) {
+    cl_free(&sched->workers[i].deque);
+  }
+  pthread_mutex_destroy(&sched->inject_lock);
+  free(sched->workers);
+  free(sched);
+}
+
+
+unsigned int aesd_sched_workers(const struct aesd_sched *sched)
+{
+  return sched->nworkers;
+}
+
+
+void aesd_task_group_init(struct aesd_task_group *group)
+{
+  atomic_init(&group->pending, 0);
+}
+
+
+int aesd_sched_submit(struct aesd_sched *sched, struct aesd_task_group *group,
+                      aesd_task_fn fn, void *arg)
+{
+  struct aesd_worker *w = current_worker;
+  struct aesd_task *task;
+
+  if (sched == NULL || fn == NULL || atomic_load(&sched->shutdown)) {
+    return -1;
+  }
+
+  task = malloc(sizeof(struct aesd_task));
+  if (task == NULL) {
+    ERROR_LOG("malloc fail for task");
+    return -1;
+  }
+  task->fn = fn;
+  task->arg = arg;
+  task->group = group;
+
+  if (group != NULL) {
+    atomic_fetch_add(&group->pending, 1);
+  }
+  atomic_fetch_add(&sched->all.pending, 1);
+
+  if (w != NULL && w->sched == sched && cl_push(&w->deque, task) == 0) {
+    // spawned from one of our own tasks, keep it local
+  } else {
+    inject_push(sched, task);
+  }
+  wake_one(sched);
+  return 0;
+}
+
+
+void aesd_task_group_wait(struct aesd_sched *sched, struct aesd_task_group *group)
+{
+  struct aesd_worker *w = current_worker;
+  struct aesd_task *task;
+  int pending;
+
+  if (w != NULL && w->sched == sched) {
+    // a worker must not sleep here, the tasks it waits for may be in its own deque
+    while (group_pending(group) > 0) {
+      task = find_task(w);
+      if (task != NULL) {
+        run_task(sched, task);
+      } else {
+        sched_yield();
+      }
+    }
+    return;
+  }
+
+  // flag the sleep in the word itself, the last task to complete sees it in
+  // its decrement and needs nothing else from the group
+  pending = atomic_load(&group->pending);
+  while ((pending & ~AESD_TASK_GROUP_WAITERS) > 0) {
+    if (!(pending & AESD_TASK_GROUP_WAITERS) &&
+        !atomic_compare_exchange_weak(&group->pending, &pending,
+                                      pending | AESD_TASK_GROUP_WAITERS)) {
+      continue;
+    }
+    futex(&group->pending, FUTEX_WAIT_PRIVATE, pending | AESD_TASK_GROUP_WAITERS);
+    pending = atomic_load(&group->pending);
+  }
+  // clear the flag for the group's next use, unless tasks were already
+  // submitted against it again
+  pending = AESD_TASK_GROUP_WAITERS;
+  atomic_compare_exchange_strong(&group->pending, &pending, 0);
+}
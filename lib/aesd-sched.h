@@ -0,0 +1,80 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-sched.h
+ * @brief Work-stealing task scheduler
+ *
+ * A fixed set of worker threads each own a Chase-Lev deque.  Tasks submitted
+ * from a worker (for example by a running task) are pushed onto that
+ * worker's deque and popped back LIFO for locality; idle workers steal FIFO
+ * from the other end of a random victim's deque.  Tasks submitted from any
+ * other thread go through a shared injection queue.  Workers which find
+ * nothing to do park on a futex and are woken by the next submission.
+ *
+ * Tasks may be tracked with a task group: aesd_task_group_wait() returns
+ * once every task submitted against the group has run.  Waiting from a
+ * worker thread keeps executing other tasks instead of blocking, so tasks
+ * may spawn and wait for subtasks.  A single task is simply a group of one.
+ *
+ * Tasks should not block for long periods: a blocked task occupies its
+ * worker thread until it returns.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESD_SCHED_H
+#define AESD_SCHED_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <limits.h>
+
+typedef void (*aesd_task_fn)(void *arg);
+
+#define AESD_TASK_GROUP_WAITERS (INT_MIN)
+
+struct aesd_sched;
+
+// the completing task's decrement of pending is its last access to the
+// group, so a group may live on the stack of the thread waiting on it
+struct aesd_task_group {
+    atomic_int pending;     // futex word, tasks submitted but not yet
+                            // completed, with AESD_TASK_GROUP_WAITERS set
+                            // while a thread sleeps on it
+};
+
+/**
+* Start a scheduler with @param nworkers worker threads.
+* @return the scheduler, or NULL if it could not be created
+*/
+struct aesd_sched *aesd_sched_create(unsigned int nworkers);
+
+/**
+* Wait for every submitted task to complete, then stop the workers and
+* free @param sched.  Must not be called from a task.
+*/
+void aesd_sched_destroy(struct aesd_sched *sched);
+
+/**
+* @return the number of worker threads of @param sched
+*/
+unsigned int aesd_sched_workers(const struct aesd_sched *sched);
+
+/**
+* Prepare @param group for use.  A group may be reused once a wait on it returned.
+*/
+void aesd_task_group_init(struct aesd_task_group *group);
+
+/**
+* Queue fn(arg) for execution on @param sched.  If @param group is non-NULL
+* the task is counted in it until it completes.
+* @return 0 on success, -1 if the task could not be queued
+*/
+int aesd_sched_submit(struct aesd_sched *sched, struct aesd_task_group *group,
+                      aesd_task_fn fn, void *arg);
+
+/**
+* Block until every task submitted against @param group has completed.
+* Called from a worker thread this runs other queued tasks while waiting.
+*/
+void aesd_task_group_wait(struct aesd_sched *sched, struct aesd_task_group *group);
+
+#endif /* AESD_SCHED_H */
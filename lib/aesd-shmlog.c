@@ -0,0 +1,97 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-shmlog.c
+ * @brief Append-only log in memory shared by forked processes
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "aesd-shmlog.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define ERROR_LOG(msg,...) fprintf(stderr, "aesd-shmlog ERROR: " msg "\n" , ##__VA_ARGS__)
+
+// lives at the start of the shared mapping, the data follows it
+struct aesd_shmlog {
+  pthread_mutex_t lock;           // process-shared and robust
+  atomic_size_t size;             // committed bytes, published after the copy
+  size_t capacity;
+  size_t map_size;
+  char data[] __attribute__((aligned(64)));
+};
+
+struct aesd_shmlog *aesd_shmlog_create(size_t capacity, enum aesd_huge_mode *mode)
+{
+  struct aesd_shmlog *log;
+  pthread_mutexattr_t attr;
+  size_t map_size = sizeof(struct aesd_shmlog) + capacity;
+
+  // shared anonymous memory is inherited across fork() as the same pages
+  log = aesd_huge_map(&map_size, true, mode);
+  if (log == NULL) {
+    ERROR_LOG("could not map %zu bytes", map_size);
+    return NULL;
+  }
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&log->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  atomic_init(&log->size, 0);
+  log->capacity = capacity;
+  log->map_size = map_size;
+  return log;
+}
+
+void aesd_shmlog_destroy(struct aesd_shmlog *log)
+{
+  if (log != NULL) {
+    munmap(log, log->map_size);
+  }
+}
+
+int aesd_shmlog_lock(struct aesd_shmlog *log)
+{
+  int rc = pthread_mutex_lock(&log->lock);
+
+  if (rc == EOWNERDEAD) {
+    // the owner died mid append at worst, before publishing the new size
+    pthread_mutex_consistent(&log->lock);
+    return 1;
+  }
+  return 0;
+}
+
+void aesd_shmlog_unlock(struct aesd_shmlog *log)
+{
+  pthread_mutex_unlock(&log->lock);
+}
+
+int aesd_shmlog_append(struct aesd_shmlog *log, const void *buf, size_t len)
+{
+  size_t size = atomic_load_explicit(&log->size, memory_order_relaxed);
+
+  if (len > log->capacity - size) {
+    errno = ENOSPC;
+    return -1;
+  }
+  memcpy(log->data + size, buf, len);
+  // readers that see the new size see the bytes copied before it
+  atomic_store_explicit(&log->size, size + len, memory_order_release);
+  return 0;
+}
+
+size_t aesd_shmlog_size(const struct aesd_shmlog *log)
+{
+  return atomic_load_explicit(&((struct aesd_shmlog *) log)->size, memory_order_acquire);
+}
+
+const char *aesd_shmlog_data(const struct aesd_shmlog *log)
+{
+  return log->data;
+}
@@ -0,0 +1,66 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-shmlog.h
+ * @brief Append-only log in memory shared by forked processes
+ *
+ * The log is created before fork() and inherited by the children.  Appends
+ * are serialized by a process-shared robust mutex.  The data is copied
+ * before the new length is published, so the log is consistent even if a
+ * process dies in the middle of an append: the next locker recovers the
+ * mutex and the torn append is simply not there.  Committed bytes never
+ * change, so readers need no lock: they read up to aesd_shmlog_size().
+ *
+ * The capacity is reserved as address space up front and only the pages
+ * written use memory, unless it is mapped with reserved huge pages
+ * (lib/aesd-huge.h), which readers walking a large log miss the TLB less on.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESD_SHMLOG_H
+#define AESD_SHMLOG_H
+
+#include <stddef.h>
+#include "aesd-huge.h"
+
+struct aesd_shmlog;
+
+/**
+* Map a log of at most @param capacity bytes shared with future children,
+* in huge pages as asked by @param mode, set to the mode in effect.
+* @return the log, or NULL on error
+*/
+struct aesd_shmlog *aesd_shmlog_create(size_t capacity, enum aesd_huge_mode *mode);
+
+/**
+* Unmap @param log in the calling process.
+*/
+void aesd_shmlog_destroy(struct aesd_shmlog *log);
+
+/**
+* Acquire the log's mutex, shared by every process.
+* @return 0, or 1 if its previous owner died holding it (the log is intact)
+*/
+int aesd_shmlog_lock(struct aesd_shmlog *log);
+
+/**
+* Release the log's mutex.
+*/
+void aesd_shmlog_unlock(struct aesd_shmlog *log);
+
+/**
+* Append @param len bytes of @param buf.  Caller holds the mutex.
+* @return 0 on success, -1 with errno ENOSPC if the log is full
+*/
+int aesd_shmlog_append(struct aesd_shmlog *log, const void *buf, size_t len);
+
+/**
+* @return the number of committed bytes, readable at aesd_shmlog_data()
+*/
+size_t aesd_shmlog_size(const struct aesd_shmlog *log);
+
+/**
+* @return the start of the log data
+*/
+const char *aesd_shmlog_data(const struct aesd_shmlog *log);
+
+#endif /* AESD_SHMLOG_H */
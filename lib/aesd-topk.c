@@ -0,0 +1,173 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-topk.c
+ * @brief Heavy hitters among client addresses in a fixed amount of memory
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "aesd-topk.h"
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+static uint64_t mix64(uint64_t x)
+{
+  // splitmix64 finalizer
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/*
+ * @brief  hashes a client, never 0 so it can tag a slot
+ */
+static uint64_t key_hash(uint64_t w0, uint64_t w1)
+{
+  uint64_t h = mix64(w0 ^ mix64(w1));
+
+  return h ? h : 1;
+}
+
+/*
+ * @brief  raises *count to value unless it is larger already
+ */
+static void atomic_max(_Atomic uint64_t *count, uint64_t value)
+{
+  uint64_t old = atomic_load_explicit(count, memory_order_relaxed);
+
+  while (old < value &&
+         !atomic_compare_exchange_weak_explicit(count, &old, value,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed));
+}
+
+void aesd_topk_add(struct aesd_topk *topk, const struct aesd_topk_key *key,
+                   uint64_t amount)
+{
+  uint64_t hash = key_hash(key->w[0], key->w[1]);
+  uint32_t h1 = (uint32_t) hash;
+  uint32_t h2 = (uint32_t) (hash >> 32) | 1;
+  uint64_t estimate = UINT64_MAX;
+  uint64_t count;
+  uint64_t tag;
+  uint64_t min_tag = 0;
+  uint64_t min_count = UINT64_MAX;
+  struct aesd_topk_slot *min_slot = NULL;
+  struct aesd_topk_slot *slot;
+  int i;
+
+  if (amount == 0) {
+    return;
+  }
+  // the rows are indexed by h1 + i * h2, as good as independent hashes
+  for (i = 0; i < AESD_TOPK_DEPTH; i++) {
+    count = atomic_fetch_add_explicit(&topk->sketch[i][(h1 + i * h2) % AESD_TOPK_WIDTH],
+                                      amount, memory_order_relaxed) + amount;
+    if (count < estimate) {
+      estimate = count;
+    }
+  }
+
+  for (i = 0; i < AESD_TOPK_SLOTS; i++) {
+    slot = &topk->slots[i];
+    tag = atomic_load_explicit(&slot->tag, memory_order_acquire);
+    if (tag == hash) {
+      atomic_max(&slot->count, estimate);
+      return;
+    }
+    count = tag ? atomic_load_explicit(&slot->count, memory_order_relaxed) : 0;
+    if (count < min_count) {
+      min_count = count;
+      min_tag = tag;
+      min_slot = slot;
+    }
+  }
+  // take the smallest slot over, unless another thread just did
+  if (estimate > min_count &&
+      atomic_compare_exchange_strong(&min_slot->tag, &min_tag, hash)) {
+    atomic_store_explicit(&min_slot->key[0], key->w[0], memory_order_relaxed);
+    atomic_store_explicit(&min_slot->key[1], key->w[1], memory_order_relaxed);
+    atomic_store_explicit(&min_slot->count, estimate, memory_order_release);
+  }
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+  uint64_t x = ((const struct aesd_topk_entry *) a)->count;
+  uint64_t y = ((const struct aesd_topk_entry *) b)->count;
+
+  return (x < y) - (x > y);
+}
+
+size_t aesd_topk_get(struct aesd_topk *topk, struct aesd_topk_entry *entries,
+                     size_t max)
+{
+  struct aesd_topk_entry found[AESD_TOPK_SLOTS];
+  struct aesd_topk_slot *slot;
+  uint64_t tags[AESD_TOPK_SLOTS];
+  uint64_t tag;
+  size_t n = 0;
+  size_t i;
+  size_t j;
+
+  for (i = 0; i < AESD_TOPK_SLOTS; i++) {
+    slot = &topk->slots[i];
+    tag = atomic_load_explicit(&slot->tag, memory_order_acquire);
+    if (tag == 0) {
+      continue;
+    }
+    found[n].count = atomic_load_explicit(&slot->count, memory_order_acquire);
+    found[n].key.w[0] = atomic_load_explicit(&slot->key[0], memory_order_relaxed);
+    found[n].key.w[1] = atomic_load_explicit(&slot->key[1], memory_order_relaxed);
+    // a slot being taken over may still hold the previous client's address
+    if (key_hash(found[n].key.w[0], found[n].key.w[1]) != tag) {
+      continue;
+    }
+    // two threads may have taken a slot each for the same new client
+    for (j = 0; j < n && tags[j] != tag; j++);
+    if (j < n) {
+      if (found[n].count > found[j].count) {
+        found[j].count = found[n].count;
+      }
+      continue;
+    }
+    tags[n++] = tag;
+  }
+  qsort(found, n, sizeof(found[0]), compare_entries);
+  if (n > max) {
+    n = max;
+  }
+  memcpy(entries, found, n * sizeof(found[0]));
+  return n;
+}
+
+int aesd_topk_key_from_addr(const struct sockaddr *sa, struct aesd_topk_key *key)
+{
+  uint8_t bytes[16];
+
+  if (sa->sa_family == AF_INET) {
+    memset(bytes, 0, 10);
+    bytes[10] = bytes[11] = 0xff;
+    memcpy(bytes + 12, &((const struct sockaddr_in *) sa)->sin_addr, 4);
+  } else if (sa->sa_family == AF_INET6) {
+    memcpy(bytes, &((const struct sockaddr_in6 *) sa)->sin6_addr, 16);
+  } else {
+    return -1;
+  }
+  memcpy(key->w, bytes, sizeof(bytes));
+  return 0;
+}
+
+const char *aesd_topk_key_name(const struct aesd_topk_key *key, char *buf,
+                               size_t size)
+{
+  struct in6_addr addr;
+
+  memcpy(&addr, key->w, sizeof(addr));
+  if (IN6_IS_ADDR_V4MAPPED(&addr)) {
+    inet_ntop(AF_INET, &addr.s6_addr[12], buf, size);
+  } else {
+    inet_ntop(AF_INET6, &addr, buf, size);
+  }
+  return buf;
+}
@@ -0,0 +1,81 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-topk.h
+ * @brief Heavy hitters among client addresses in a fixed amount of memory
+ *
+ * Amounts are added per client to a Count-Min sketch, AESD_TOPK_DEPTH rows
+ * of AESD_TOPK_WIDTH counters each hashed to by the address.  A client's
+ * estimate is its smallest counter: never below its true total, and above
+ * it by at most e / AESD_TOPK_WIDTH of the grand total with high
+ * probability, however many clients there are.  The AESD_TOPK_SLOTS
+ * clients with the largest estimates seen are kept by address alongside,
+ * each new estimate replacing the smallest of them when larger.
+ *
+ * Updates are lock-free and may come from any thread, or any process when
+ * the structure is in shared memory.  A zeroed structure is empty, it needs
+ * no initialization.  Totals run from startup.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESD_TOPK_H
+#define AESD_TOPK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+#define AESD_TOPK_DEPTH (4)
+#define AESD_TOPK_WIDTH (1024)
+#define AESD_TOPK_SLOTS (32)
+
+// an IPv6 address, IPv4 ones mapped into ::ffff:0:0/96
+struct aesd_topk_key {
+  uint64_t w[2];
+};
+
+struct aesd_topk_slot {
+  _Atomic uint64_t tag;       // hash of the client, 0 while empty
+  _Atomic uint64_t count;     // its estimate when last updated
+  _Atomic uint64_t key[2];    // written after tag, checked against it
+};
+
+struct aesd_topk {
+  _Atomic uint64_t sketch[AESD_TOPK_DEPTH][AESD_TOPK_WIDTH];
+  struct aesd_topk_slot slots[AESD_TOPK_SLOTS];
+};
+
+struct aesd_topk_entry {
+  struct aesd_topk_key key;
+  uint64_t count;
+};
+
+/**
+* Add @param amount to the total of client @param key in @param topk.
+*/
+void aesd_topk_add(struct aesd_topk *topk, const struct aesd_topk_key *key,
+                   uint64_t amount);
+
+/**
+* Copy at most @param max of the heaviest clients of @param topk to
+* @param entries, largest first.
+* @return the number of entries filled
+*/
+size_t aesd_topk_get(struct aesd_topk *topk, struct aesd_topk_entry *entries,
+                     size_t max);
+
+/**
+* Make @param key from the address, without the port, of @param sa.
+* @return 0 on success, -1 if sa is neither IPv4 nor IPv6
+*/
+int aesd_topk_key_from_addr(const struct sockaddr *sa, struct aesd_topk_key *key);
+
+/**
+* Format @param key into @param buf of @param size bytes, at least
+* INET6_ADDRSTRLEN, IPv4 clients as such.
+* @return buf
+*/
+const char *aesd_topk_key_name(const struct aesd_topk_key *key, char *buf,
+                               size_t size);
+
+#endif /* AESD_TOPK_H */
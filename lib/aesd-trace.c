@@ -0,0 +1,382 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-trace.c
+ * @brief A compact binary trace of the traffic of aesdsocket, for replay
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "aesd-trace.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#define ERROR_LOG(msg,...) fprintf(stderr, "aesd-trace ERROR: " msg "\n" , ##__VA_ARGS__)
+
+#define TRACE_BLOCK (64 * 1024)
+#define TRACE_BLOCK_START (0)   // the type byte of a block header
+#define VARINT_MAX (10)
+#define EVENT_MAX (1 + 3 * VARINT_MAX)
+
+struct aesd_trace {
+  int fd;
+  pthread_mutex_t mutex;        // guards the block
+  _Atomic uint64_t next_conn;
+  pid_t pid;                    // the process writing the block
+  uint64_t started_us;          // the time of its first block
+  uint64_t last_us;             // time of the last event in the block
+  size_t len;                   // 0 until the block has its header
+  uint8_t block[TRACE_BLOCK];
+};
+
+// an event as read, before its connection is numbered across processes
+struct raw_event {
+  struct aesd_trace_event event;
+  size_t proc;                  // index of the writing process in procs
+  size_t seq;                   // position in the file, orders equal times
+};
+
+static size_t put_varint(uint8_t *p, uint64_t v)
+{
+  size_t n = 0;
+
+  while (v >= 0x80) {
+    p[n++] = (uint8_t) v | 0x80;
+    v >>= 7;
+  }
+  p[n++] = (uint8_t) v;
+  return n;
+}
+
+/*
+ * @brief  decodes a varint at *p, before end
+ * @return 0 on success, -1 if it is truncated
+ */
+static int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+  int shift;
+
+  *v = 0;
+  for (shift = 0; *p < end && shift < 64; shift += 7) {
+    uint8_t byte = *(*p)++;
+    *v |= (uint64_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, buf, len);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1) {
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+struct aesd_trace *aesd_trace_open(const char *path)
+{
+  struct aesd_trace *trace = calloc(1, sizeof(struct aesd_trace));
+
+  if (trace == NULL) {
+    ERROR_LOG("calloc: %s", strerror(errno));
+    return NULL;
+  }
+  // appended a block at a time, so processes sharing it do not interleave
+  trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (trace->fd == -1) {
+    ERROR_LOG("open %s: %s", path, strerror(errno));
+    free(trace);
+    return NULL;
+  }
+  if (write_all(trace->fd, (const uint8_t *) AESD_TRACE_MAGIC,
+                strlen(AESD_TRACE_MAGIC)) == -1) {
+    ERROR_LOG("write %s: %s", path, strerror(errno));
+    close(trace->fd);
+    free(trace);
+    return NULL;
+  }
+  pthread_mutex_init(&trace->mutex, NULL);
+  atomic_init(&trace->next_conn, 1);
+  return trace;
+}
+
+uint64_t aesd_trace_now(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+uint64_t aesd_trace_connection(struct aesd_trace *trace)
+{
+  if (trace == NULL) {
+    return 0;
+  }
+  return atomic_fetch_add(&trace->next_conn, 1);
+}
+
+/*
+ * @brief  appends the block to the file and empties it, with the mutex held
+ */
+static int flush_locked(struct aesd_trace *trace)
+{
+  int rc = 0;
+
+  if (trace->len > 0 && write_all(trace->fd, trace->block, trace->len) == -1) {
+    ERROR_LOG("write: %s", strerror(errno));
+    rc = -1;
+  }
+  trace->len = 0;
+  return rc;
+}
+
+void aesd_trace_record(struct aesd_trace *trace, enum aesd_trace_type type,
+                       uint64_t conn, uint64_t time_us, uint64_t value)
+{
+  int64_t delta;
+  uint8_t *p;
+
+  if (trace == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&trace->mutex);
+  if (trace->len + EVENT_MAX > TRACE_BLOCK) {
+    flush_locked(trace);
+  }
+  // the pid and the time of its first block tell the connections of forked
+  // processes apart, a respawned worker may get the pid of a dead one
+  if (trace->len == 0) {
+    if (trace->pid != getpid()) {
+      trace->pid = getpid();
+      trace->started_us = time_us;
+    }
+    p = trace->block;
+    *p++ = TRACE_BLOCK_START;
+    p += put_varint(p, (uint64_t) trace->pid);
+    p += put_varint(p, trace->started_us);
+    p += put_varint(p, time_us);
+    trace->len = p - trace->block;
+    trace->last_us = time_us;
+  }
+  // times are taken before the mutex, so they may step back a little
+  delta = (int64_t) (time_us - trace->last_us);
+  trace->last_us = time_us;
+  p = trace->block + trace->len;
+  *p++ = (uint8_t) type;
+  p += put_varint(p, conn);
+  p += put_varint(p, ((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63));
+  p += put_varint(p, value);
+  trace->len = p - trace->block;
+  pthread_mutex_unlock(&trace->mutex);
+}
+
+int aesd_trace_flush(struct aesd_trace *trace)
+{
+  int rc;
+
+  pthread_mutex_lock(&trace->mutex);
+  rc = flush_locked(trace);
+  pthread_mutex_unlock(&trace->mutex);
+  return rc;
+}
+
+void aesd_trace_close(struct aesd_trace *trace)
+{
+  if (trace == NULL) {
+    return;
+  }
+  aesd_trace_flush(trace);
+  close(trace->fd);
+  pthread_mutex_destroy(&trace->mutex);
+  free(trace);
+}
+
+/*
+ * @brief  reads all of the file at path into a malloc'ed buffer
+ */
+static uint8_t *read_file(const char *path, size_t *len)
+{
+  struct stat st;
+  uint8_t *buf = NULL;
+  ssize_t n;
+  size_t got = 0;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    ERROR_LOG("open %s: %s", path, strerror(errno));
+    goto handle_errors;
+  }
+  buf = malloc(st.st_size ? st.st_size : 1);
+  if (buf == NULL) {
+    ERROR_LOG("malloc: %s", strerror(errno));
+    goto handle_errors;
+  }
+  while (got < (size_t) st.st_size) {
+    n = read(fd, buf + got, st.st_size - got);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      ERROR_LOG("read %s: %s", path, n ? strerror(errno) : "truncated");
+      goto handle_errors;
+    }
+    got += n;
+  }
+  close(fd);
+  *len = got;
+  return buf;
+
+handle_errors:
+  free(buf);
+  if (fd != -1)
+    close(fd);
+  return NULL;
+}
+
+static int compare_raw(const void *a, const void *b)
+{
+  const struct raw_event *x = a;
+  const struct raw_event *y = b;
+
+  if (x->event.time_us != y->event.time_us) {
+    return (x->event.time_us > y->event.time_us) - (x->event.time_us < y->event.time_us);
+  }
+  return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+int aesd_trace_load(const char *path, struct aesd_trace_event **events,
+                    size_t *nevents, size_t *nconns)
+{
+  size_t magic_len = strlen(AESD_TRACE_MAGIC);
+  size_t len = 0;
+  uint8_t *buf = read_file(path, &len);
+  const uint8_t *p;
+  const uint8_t *end = buf + len;
+  struct raw_event *raw = NULL;
+  size_t nraw = 0;
+  size_t raw_size = 0;
+  // the connections of each process are numbered from 1, they are given
+  // dense numbers after those of the processes seen before
+  struct { uint64_t pid; uint64_t started; uint64_t max_conn; uint64_t base; } *procs = NULL;
+  size_t nprocs = 0;
+  size_t proc = 0;
+  uint64_t pid;
+  uint64_t started;
+  uint64_t now = 0;
+  uint64_t type;
+  uint64_t zigzag;
+  bool in_block = false;
+  size_t i;
+  size_t j;
+
+  if (buf == NULL) {
+    return -1;
+  }
+  if (len < magic_len || memcmp(buf, AESD_TRACE_MAGIC, magic_len) != 0) {
+    ERROR_LOG("%s is not a trace", path);
+    goto handle_errors;
+  }
+  for (p = buf + magic_len; p < end; ) {
+    type = *p++;
+    if (type == TRACE_BLOCK_START) {
+      if (get_varint(&p, end, &pid) == -1 || get_varint(&p, end, &started) == -1 ||
+          get_varint(&p, end, &now) == -1) {
+        goto truncated;
+      }
+      for (proc = 0; proc < nprocs && (procs[proc].pid != pid ||
+                                       procs[proc].started != started); proc++);
+      if (proc == nprocs) {
+        void *grown = realloc(procs, (nprocs + 1) * sizeof(*procs));
+        if (grown == NULL) {
+          goto no_memory;
+        }
+        procs = grown;
+        procs[nprocs].pid = pid;
+        procs[nprocs].started = started;
+        procs[nprocs++].max_conn = 0;
+      }
+      in_block = true;
+      continue;
+    }
+    if (!in_block || type >= AESD_TRACE_NUM_TYPES) {
+      ERROR_LOG("%s: bad event type %lu at %zu", path, (unsigned long) type,
+                (size_t) (p - 1 - buf));
+      goto handle_errors;
+    }
+    if (nraw == raw_size) {
+      raw_size = raw_size ? 2 * raw_size : 4096;
+      void *grown = realloc(raw, raw_size * sizeof(*raw));
+      if (grown == NULL) {
+        goto no_memory;
+      }
+      raw = grown;
+    }
+    raw[nraw].event.type = (enum aesd_trace_type) type;
+    if (get_varint(&p, end, &raw[nraw].event.conn) == -1 ||
+        get_varint(&p, end, &zigzag) == -1 ||
+        get_varint(&p, end, &raw[nraw].event.value) == -1) {
+      goto truncated;
+    }
+    if (raw[nraw].event.conn == 0) {
+      ERROR_LOG("%s: bad connection at %zu", path, (size_t) (p - buf));
+      goto handle_errors;
+    }
+    now += (zigzag >> 1) ^ -(zigzag & 1);
+    raw[nraw].event.time_us = now;
+    raw[nraw].proc = proc;
+    raw[nraw].seq = nraw;
+    if (raw[nraw].event.conn > procs[proc].max_conn) {
+      procs[proc].max_conn = raw[nraw].event.conn;
+    }
+    nraw++;
+  }
+
+  *nconns = 0;
+  for (j = 0; j < nprocs; j++) {
+    procs[j].base = *nconns;
+    *nconns += procs[j].max_conn;
+  }
+  qsort(raw, nraw, sizeof(*raw), compare_raw);
+  *events = malloc((nraw ? nraw : 1) * sizeof(struct aesd_trace_event));
+  if (*events == NULL) {
+    goto no_memory;
+  }
+  for (i = 0; i < nraw; i++) {
+    (*events)[i] = raw[i].event;
+    (*events)[i].time_us -= raw[0].event.time_us;
+    (*events)[i].conn = procs[raw[i].proc].base + raw[i].event.conn - 1;
+  }
+  *nevents = nraw;
+  free(procs);
+  free(raw);
+  free(buf);
+  return 0;
+
+truncated:
+  ERROR_LOG("%s is truncated", path);
+  goto handle_errors;
+no_memory:
+  ERROR_LOG("malloc: %s", strerror(errno));
+handle_errors:
+  free(procs);
+  free(raw);
+  free(buf);
+  return -1;
+}
@@ -0,0 +1,98 @@
+/* ----------------------------------------------------------------------------
+ * @file aesd-trace.h
+ * @brief A compact binary trace of the traffic of aesdsocket, for replay
+ *
+ * The trace holds the shape of the workload and nothing of its content:
+ * when each connection opened, negotiated framing and closed, and the size
+ * and arrival time of each packet and reply.  Connections are numbered in
+ * the order they opened, neither addresses nor packet bytes are recorded,
+ * so a trace can be shared without anonymizing it first.
+ *
+ * The file is AESD_TRACE_MAGIC followed by blocks.  A block starts with the
+ * pid of the writing process, the time of its first block, which tells it
+ * from an earlier process given the same pid, and an absolute
+ * CLOCK_MONOTONIC time.  Each of its events is then a type byte and varints:
+ * the connection, the time in us from the previous event as a zigzag delta,
+ * and the event's value.  A typical event takes 4 to 6 bytes.  Each process
+ * buffers its own block and appends it whole, so the worker processes of -P
+ * share one file.
+ *
+ * Events may be recorded from any thread.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESD_TRACE_H
+#define AESD_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AESD_TRACE_MAGIC "AESDTRC2"
+
+enum aesd_trace_type {
+  AESD_TRACE_OPEN = 1,  // accepted, value unused
+  AESD_TRACE_HELLO,     // framing negotiated, value AESD_TRACE_FRAMED_*
+  AESD_TRACE_PACKET,    // a packet arrived, value its size with the newline
+  AESD_TRACE_REPLY,     // a reply was sent, value the log bytes it held
+  AESD_TRACE_CLOSE,     // closed, value unused
+  AESD_TRACE_NUM_TYPES
+};
+
+#define AESD_TRACE_FRAMED_LZ4 (1)  // HELLO value for compressed replies
+
+struct aesd_trace;
+
+struct aesd_trace_event {
+  uint64_t time_us;     // from the first event of the trace
+  uint64_t conn;        // from 0, dense across the processes which wrote
+  enum aesd_trace_type type;
+  uint64_t value;
+};
+
+/**
+* Create or truncate the trace file @param path and write its header.  A
+* process forked later records into it as well, with a block of its own.
+* @return the trace, or NULL on error
+*/
+struct aesd_trace *aesd_trace_open(const char *path);
+
+/**
+* @return the current time in us, for aesd_trace_record()
+*/
+uint64_t aesd_trace_now(void);
+
+/**
+* @return a number for a new connection of @param trace, 0 if trace is NULL
+*/
+uint64_t aesd_trace_connection(struct aesd_trace *trace);
+
+/**
+* Record an event of @param type with @param value for connection
+* @param conn at @param time_us, from aesd_trace_now().  Does nothing if
+* @param trace is NULL.
+*/
+void aesd_trace_record(struct aesd_trace *trace, enum aesd_trace_type type,
+                       uint64_t conn, uint64_t time_us, uint64_t value);
+
+/**
+* Append the events @param trace buffers to its file.
+* @return 0 on success, -1 on error
+*/
+int aesd_trace_flush(struct aesd_trace *trace);
+
+/**
+* Flush and close @param trace, which may be NULL.
+*/
+void aesd_trace_close(struct aesd_trace *trace);
+
+/**
+* Read the trace file @param path into @param events, sorted by time, to be
+* freed by the caller.  @param nevents is set to their number and
+* @param nconns to the number of connections.
+* @return 0 on success, -1 on error
+*/
+int aesd_trace_load(const char *path, struct aesd_trace_event **events,
+                    size_t *nevents, size_t *nconns);
+
+#endif /* AESD_TRACE_H */
@@ -0,0 +1,173 @@
+/* ----------------------------------------------------------------------------
+ * @file aesdsocket-config.c
+ * @brief aesdsocket tunables read from a configuration file
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "aesdsocket-config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <syslog.h>
+
+// reloads happen in the background, so errors go to the log like the rest of aesdsocket
+#define ERROR_LOG(msg,...) syslog(LOG_ERR, "config: " msg, ##__VA_ARGS__)
+
+static const char *log_level_names[] = {
+  [LOG_EMERG] = "emerg", [LOG_ALERT] = "alert", [LOG_CRIT] = "crit",
+  [LOG_ERR] = "err", [LOG_WARNING] = "warning", [LOG_NOTICE] = "notice",
+  [LOG_INFO] = "info", [LOG_DEBUG] = "debug",
+};
+
+/*
+ * @brief  parses an unsigned number within [min, max]
+ * @return 0 on success, -1 on error
+ */
+static int parse_uint(const char *str, unsigned int min, unsigned int max,
+                      unsigned int *val)
+{
+  unsigned long v;
+  char *end;
+
+  errno = 0;
+  v = strtoul(str, &end, 0);
+  if (errno != 0 || end == str || *end != '\0' || v < min || v > max)
+    return -1;
+  *val = (unsigned int) v;
+  return 0;
+}
+
+static int parse_log_level(const char *str, int *level)
+{
+  int i;
+
+  for (i = 0; i <= LOG_DEBUG; i++) {
+    if (strcmp(str, log_level_names[i]) == 0) {
+      *level = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/*
+ * @brief  strips leading and trailing whitespace in place
+ * @return the stripped string
+ */
+static char *strip(char *str)
+{
+  char *end;
+
+  while (isspace((unsigned char) *str))
+    str++;
+  end = str + strlen(str);
+  while (end > str && isspace((unsigned char) end[-1]))
+    end--;
+  *end = '\0';
+  return str;
+}
+
+const char *config_log_level_name(int level)
+{
+  if (level < 0 || level > LOG_DEBUG)
+    return "unknown";
+  return log_level_names[level];
+}
+
+int config_load(const char *path, struct aesdsocket_config *config)
+{
+  struct aesdsocket_config new_config = *config;
+  char line[256];
+  char *key;
+  char *value;
+  char *eq;
+  unsigned int lineno = 0;
+  int rc = -1;
+  FILE *f;
+
+  f = fopen(path, "r");
+  if (f == NULL) {
+    ERROR_LOG("%s: %s", path, strerror(errno));
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    lineno++;
+    // fgets splits a longer line, whose rest would be read as the next one
+    if (strchr(line, '\n') == NULL && !feof(f)) {
+      ERROR_LOG("%s:%u: line longer than %zu bytes", path, lineno, sizeof(line) - 2);
+      goto handle_errors;
+    }
+    key = strip(line);
+    if (*key == '\0' || *key == '#')
+      continue;
+    eq = strchr(key, '=');
+    if (eq == NULL) {
+      ERROR_LOG("%s:%u: expected key = value", path, lineno);
+      goto handle_errors;
+    }
+    *eq = '\0';
+    key = strip(key);
+    value = strip(eq + 1);
+
+    if (strcmp(key, "workers") == 0) {
+      if (parse_uint(value, 0, CONFIG_MAX_WORKERS, &new_config.workers) == -1) {
+        ERROR_LOG("%s:%u: workers must be 0 to %d", path, lineno, CONFIG_MAX_WORKERS);
+        goto handle_errors;
+      }
+    } else if (strcmp(key, "log_level") == 0) {
+      if (parse_log_level(value, &new_config.log_level) == -1) {
+        ERROR_LOG("%s:%u: unknown log_level %s", path, lineno, value);
+        goto handle_errors;
+      }
+    } else if (strcmp(key, "send_chunk") == 0) {
+      if (parse_uint(value, CONFIG_MIN_SEND_CHUNK, CONFIG_MAX_SEND_CHUNK,
+                     &new_config.send_chunk) == -1) {
+        ERROR_LOG("%s:%u: send_chunk must be %d to %d", path, lineno,
+                  CONFIG_MIN_SEND_CHUNK, CONFIG_MAX_SEND_CHUNK);
+        goto handle_errors;
+      }
+    } else if (strcmp(key, "shed_target_ms") == 0) {
+      if (parse_uint(value, 0, CONFIG_MAX_SHED_TARGET_MS,
+                     &new_config.shed_target_ms) == -1) {
+        ERROR_LOG("%s:%u: shed_target_ms must be 0 to %d", path, lineno,
+                  CONFIG_MAX_SHED_TARGET_MS);
+        goto handle_errors;
+      }
+    } else if (strcmp(key, "shed_interval_ms") == 0) {
+      if (parse_uint(value, CONFIG_MIN_SHED_INTERVAL_MS, CONFIG_MAX_SHED_INTERVAL_MS,
+                     &new_config.shed_interval_ms) == -1) {
+        ERROR_LOG("%s:%u: shed_interval_ms must be %d to %d", path, lineno,
+                  CONFIG_MIN_SHED_INTERVAL_MS, CONFIG_MAX_SHED_INTERVAL_MS);
+        goto handle_errors;
+      }
+    } else if (strcmp(key, "shutdown_grace_ms") == 0) {
+      if (parse_uint(value, 0, CONFIG_MAX_SHUTDOWN_GRACE_MS,
+                     &new_config.shutdown_grace_ms) == -1) {
+        ERROR_LOG("%s:%u: shutdown_grace_ms must be 0 to %d", path, lineno,
+                  CONFIG_MAX_SHUTDOWN_GRACE_MS);
+        goto handle_errors;
+      }
+    } else if (strcmp(key, "hugepages") == 0) {
+      if (aesd_huge_mode_from_name(value, &new_config.hugepages) == -1) {
+        ERROR_LOG("%s:%u: hugepages must be off, madvise or hugetlb", path, lineno);
+        goto handle_errors;
+      }
+    } else {
+      ERROR_LOG("%s:%u: unknown key %s", path, lineno, key);
+      goto handle_errors;
+    }
+  }
+  if (ferror(f)) {
+    ERROR_LOG("%s: read error", path);
+    goto handle_errors;
+  }
+  *config = new_config;
+  rc = 0;
+
+handle_errors:
+  fclose(f);
+  return rc;
+}
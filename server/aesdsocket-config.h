@@ -0,0 +1,49 @@
+/* ----------------------------------------------------------------------------
+ * @file aesdsocket-config.h
+ * @brief aesdsocket tunables read from a configuration file
+ *
+ * The file holds one "key = value" per line; blank lines and lines starting
+ * with # are ignored.  Keys left out keep their current value, so the file
+ * only needs the tunables it changes.  aesdsocket reads it at startup and
+ * again on SIGHUP, applying the new values to the running server.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESDSOCKET_CONFIG_H
+#define AESDSOCKET_CONFIG_H
+
+#include "aesd-huge.h"
+
+#define CONFIG_MAX_WORKERS (1024)
+#define CONFIG_MIN_SEND_CHUNK (64)
+#define CONFIG_MAX_SEND_CHUNK (64 * 1024)
+#define CONFIG_MAX_SHED_TARGET_MS (10 * 1000)
+#define CONFIG_MIN_SHED_INTERVAL_MS (10)
+#define CONFIG_MAX_SHED_INTERVAL_MS (60 * 1000)
+#define CONFIG_MAX_SHUTDOWN_GRACE_MS (10 * 60 * 1000)
+
+struct aesdsocket_config {
+  unsigned int workers;     // connection worker pool size, 0 for a thread per connection
+  int log_level;            // syslog priority, less important messages are dropped
+  unsigned int send_chunk;  // largest chunk of a framed reply
+  unsigned int shed_target_ms;    // queueing delay above which work is shed, 0 never
+  unsigned int shed_interval_ms;  // for how long it must stay above it
+  unsigned int shutdown_grace_ms; // replies in progress may finish this long on shutdown
+  enum aesd_huge_mode hugepages;  // for the shared log of -P, read at startup only
+};
+
+/**
+* Read @param path over the values already in @param config.  Lines longer
+* than 254 bytes are an error.  Every line is checked before any value is
+* stored, so on error config is left unchanged.
+* @return 0 on success, -1 on error, with the reason logged
+*/
+int config_load(const char *path, struct aesdsocket_config *config);
+
+/**
+* @return the name of syslog priority @param level, e.g. "info"
+*/
+const char *config_log_level_name(int level);
+
+#endif /* AESDSOCKET_CONFIG_H */
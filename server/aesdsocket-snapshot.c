@@ -0,0 +1,144 @@
+/* ----------------------------------------------------------------------------
+ * @file aesdsocket-snapshot.c
+ * @brief Compressed snapshots of the aesdsocket log, shared by connections
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "aesdsocket-snapshot.h"
+#include "aesd-lz.h"
+#include "aesdsocket-stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// room for "<clen> <rawlen>\n" in front of the compressed bytes
+#define WIRE_HDR_MAX (24)
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct snapshot_block **blocks = NULL; // full blocks by index, or NULL
+static size_t nblocks = 0;
+static struct snapshot_block *tail = NULL;    // the latest partial block
+
+struct snapshot_block *snapshot_compress(const char *raw, size_t len)
+{
+  struct snapshot_block *block;
+  size_t cap = aesd_lz_bound(len);
+  size_t clen;
+  char *data;
+  int hdr_len;
+  char hdr[WIRE_HDR_MAX + 1];
+
+  block = malloc(sizeof(*block) + WIRE_HDR_MAX + cap);
+  if (block == NULL) {
+    return NULL;
+  }
+  data = block->buf + WIRE_HDR_MAX;
+  clen = aesd_lz_compress(raw, len, data, cap);
+  // sent as is when compressing does not pay
+  if (clen == 0 || clen >= len) {
+    memcpy(data, raw, len);
+    clen = len;
+  }
+  hdr_len = snprintf(hdr, sizeof(hdr), "%zu %zu\n", clen, len);
+  block->wire = data - hdr_len;
+  memcpy(block->wire, hdr, hdr_len);
+  block->wire_len = hdr_len + clen;
+  block->rawlen = len;
+  block->offset = 0;
+  atomic_init(&block->refs, 1);
+  atomic_fetch_add(&stats->lz_blocks, 1);
+  return block;
+}
+
+void snapshot_put(struct snapshot_block *block)
+{
+  if (block != NULL && atomic_fetch_sub(&block->refs, 1) == 1) {
+    free(block);
+  }
+}
+
+// takes a reference on a cached block, called with cache_lock held
+static struct snapshot_block *cache_find(size_t offset, size_t rawlen)
+{
+  struct snapshot_block *block = NULL;
+  size_t index = offset / SNAPSHOT_BLOCK;
+
+  if (rawlen == SNAPSHOT_BLOCK && index < nblocks) {
+    block = blocks[index];
+  } else if (tail != NULL && tail->offset == offset && tail->rawlen == rawlen) {
+    block = tail;
+  }
+  if (block != NULL) {
+    atomic_fetch_add(&block->refs, 1);
+  }
+  return block;
+}
+
+// the cache keeps a reference of its own, called with cache_lock held
+static void cache_insert(struct snapshot_block *block)
+{
+  size_t index = block->offset / SNAPSHOT_BLOCK;
+  struct snapshot_block **grown;
+  size_t n;
+
+  if (block->rawlen < SNAPSHOT_BLOCK) {
+    // only a longer tail replaces the one cached, readers keep theirs
+    if (tail != NULL && tail->offset == block->offset && tail->rawlen > block->rawlen) {
+      return;
+    }
+    snapshot_put(tail);
+    atomic_fetch_add(&block->refs, 1);
+    tail = block;
+    return;
+  }
+  if (index >= nblocks) {
+    for (n = nblocks ? nblocks : 16; n <= index; n *= 2);
+    grown = realloc(blocks, n * sizeof(*blocks));
+    if (grown == NULL) {
+      return; // compressed again next time
+    }
+    memset(grown + nblocks, 0, (n - nblocks) * sizeof(*blocks));
+    blocks = grown;
+    nblocks = n;
+  }
+  if (blocks[index] == NULL) {
+    atomic_fetch_add(&block->refs, 1);
+    blocks[index] = block;
+  }
+}
+
+struct snapshot_block *snapshot_get(size_t offset, size_t log_size,
+                                    snapshot_read_fn read_fn, void *ctx)
+{
+  size_t rawlen = log_size - offset;
+  struct snapshot_block *block;
+  char *scratch = NULL;
+  const char *raw;
+
+  if (rawlen > SNAPSHOT_BLOCK) {
+    rawlen = SNAPSHOT_BLOCK;
+  }
+  pthread_mutex_lock(&cache_lock);
+  block = cache_find(offset, rawlen);
+  pthread_mutex_unlock(&cache_lock);
+  if (block != NULL) {
+    atomic_fetch_add(&stats->lz_cache_hits, 1);
+    return block;
+  }
+
+  // compressed without the lock, two connections racing for a block both
+  // compress it and the first one in is kept
+  scratch = malloc(rawlen);
+  raw = (scratch != NULL) ? read_fn(ctx, scratch, rawlen, offset) : NULL;
+  block = (raw != NULL) ? snapshot_compress(raw, rawlen) : NULL;
+  free(scratch);
+  if (block == NULL) {
+    return NULL;
+  }
+  block->offset = offset;
+  pthread_mutex_lock(&cache_lock);
+  cache_insert(block);
+  pthread_mutex_unlock(&cache_lock);
+  return block;
+}
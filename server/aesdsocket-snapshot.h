@@ -0,0 +1,65 @@
+/* ----------------------------------------------------------------------------
+ * @file aesdsocket-snapshot.h
+ * @brief Compressed snapshots of the aesdsocket log, shared by connections
+ *
+ * A compressed reply is the log cut into blocks of SNAPSHOT_BLOCK bytes,
+ * each compressed on its own (lib/aesd-lz.h) and sent as a framed chunk
+ * "<clen> <rawlen>\n" (lib/aesd-proto.h).  The log only grows, so a full
+ * block never changes: it is compressed once, by whichever connection needs
+ * it first, and kept for every later reply of every connection.  Only the
+ * partial block at the end is compressed per append, and the latest one is
+ * shared too, so compression costs do not grow with the readers or the log.
+ *
+ * The blocks stay in memory for the life of the process, about a sixth of
+ * the log for typical text.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESDSOCKET_SNAPSHOT_H
+#define AESDSOCKET_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define SNAPSHOT_BLOCK (32 * 1024)
+
+struct snapshot_block {
+  atomic_int refs;
+  size_t offset;            // in the log
+  size_t rawlen;            // log bytes it holds
+  size_t wire_len;
+  char *wire;               // chunk header and compressed bytes, ready to send
+  char buf[];
+};
+
+/**
+* Reads @param len bytes of the log at @param offset, into @param scratch
+* unless they can be pointed at in place.
+* @return the bytes, NULL on error
+*/
+typedef const char *(*snapshot_read_fn)(void *ctx, char *scratch, size_t len,
+                                        size_t offset);
+
+/**
+* Get the block of the log starting at @param offset, a multiple of
+* SNAPSHOT_BLOCK, for a log of @param log_size bytes, compressing it with
+* bytes read by @param read_fn if no connection did yet.
+* @return the block, to release with snapshot_put(), NULL on error
+*/
+struct snapshot_block *snapshot_get(size_t offset, size_t log_size,
+                                    snapshot_read_fn read_fn, void *ctx);
+
+/**
+* Compress @param len bytes at @param raw, at most SNAPSHOT_BLOCK, into a
+* block which is not shared, for a log which does not only grow.
+* @return the block, to release with snapshot_put(), NULL on error
+*/
+struct snapshot_block *snapshot_compress(const char *raw, size_t len);
+
+/**
+* Release a block from snapshot_get() or snapshot_compress().
+*/
+void snapshot_put(struct snapshot_block *block);
+
+#endif /* AESDSOCKET_SNAPSHOT_H */
@@ -0,0 +1,312 @@
+/* ----------------------------------------------------------------------------
+ * @file aesdsocket-stats.c
+ * @brief aesdsocket counters, served on a unix socket
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#include "aesdsocket-stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static struct aesdsocket_stats local_stats;
+struct aesdsocket_stats *stats = &local_stats;
+
+static int stats_fd = -1;
+static bool stats_threaded = false;
+static char stats_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+static pthread_t stats_thread;
+static int stats_stop_fd = -1;   // eventfd, readable once stats_stop() is called
+static struct timespec start_time;
+
+enum {
+  COUNTER_DTLB_LOAD_MISSES,
+  COUNTER_PAGE_FAULTS,
+  NUM_COUNTERS
+};
+static int counter_fds[NUM_COUNTERS] = { -1, -1 };
+
+/*
+ * @brief  opens a perf event counter for this process and its future
+ *         threads and children, in the kernel too when permitted
+ * @return the counter, -1 on error
+ */
+static int counter_open(unsigned int type, unsigned long long config)
+{
+  struct perf_event_attr attr;
+  int fd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.inherit = 1;
+  // replies copy the log to sockets in the kernel, count there if we may
+  fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  if (fd == -1 && errno == EACCES) {
+    attr.exclude_kernel = 1;
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  }
+  return fd;
+}
+
+/*
+ * @brief  reads a counter, summed over the tasks it was inherited by
+ * @return the count, -1 if it is not open
+ */
+static long counter_read(int counter)
+{
+  unsigned long long count;
+
+  if (counter_fds[counter] == -1 ||
+      read(counter_fds[counter], &count, sizeof(count)) != sizeof(count)) {
+    return -1;
+  }
+  return (long) count;
+}
+
+void stats_counters_open(void)
+{
+  counter_fds[COUNTER_DTLB_LOAD_MISSES] =
+    counter_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+  if (counter_fds[COUNTER_DTLB_LOAD_MISSES] == -1) {
+    syslog(LOG_INFO, "stats: no dTLB miss counter: %s", strerror(errno));
+  }
+  counter_fds[COUNTER_PAGE_FAULTS] =
+    counter_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+}
+
+/*
+ * @brief  formats the heaviest clients of topk as name lines into buf
+ * @return the length of the lines
+ */
+static int stats_format_top(char *buf, size_t size, const char *name,
+                            struct aesd_topk *topk)
+{
+  struct aesd_topk_entry top[STATS_TOP_CLIENTS];
+  char addr[INET6_ADDRSTRLEN];
+  size_t n = aesd_topk_get(topk, top, STATS_TOP_CLIENTS);
+  size_t i;
+  int len = 0;
+
+  for (i = 0; i < n && (size_t) len < size; i++) {
+    len += snprintf(buf + len, size - len, "%s %s %llu\n", name,
+                    aesd_topk_key_name(&top[i].key, addr, sizeof(addr)),
+                    (unsigned long long) top[i].count);
+  }
+  return len;
+}
+
+/*
+ * @brief  formats a snapshot of the counters into buf
+ * @return the length of the snapshot
+ */
+static int stats_format(char *buf, size_t size)
+{
+  struct timespec now;
+  int len;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  len = snprintf(buf, size,
+                 "uptime_s %ld\n"
+                 "config_generation %lu\n"
+                 "workers %u\n"
+                 "connections %lu\n"
+                 "active %ld\n"
+                 "packets %lu\n"
+                 "bytes_in %lu\n"
+                 "bytes_out %lu\n"
+                 "reply_writes %lu\n"
+                 "procs %u\n"
+                 "respawns %lu\n"
+                 "lz_bytes_raw %lu\n"
+                 "lz_bytes_wire %lu\n"
+                 "lz_blocks %lu\n"
+                 "lz_cache_hits %lu\n"
+                 "lock_delay_us %lu\n"
+                 "queue_delay_us %lu\n"
+                 "overloaded %u\n"
+                 "shed_connections %lu\n"
+                 "shed_packets %lu\n"
+                 "hugepages %s\n"
+                 "dtlb_load_misses %ld\n"
+                 "page_faults %ld\n",
+                 (long) (now.tv_sec - start_time.tv_sec),
+                 atomic_load(&stats->config_generation),
+                 atomic_load(&stats->workers),
+                 atomic_load(&stats->connections),
+                 atomic_load(&stats->active),
+                 atomic_load(&stats->packets),
+                 atomic_load(&stats->bytes_in),
+                 atomic_load(&stats->bytes_out),
+                 atomic_load(&stats->reply_writes),
+                 atomic_load(&stats->procs),
+                 atomic_load(&stats->respawns),
+                 atomic_load(&stats->lz_bytes_raw),
+                 atomic_load(&stats->lz_bytes_wire),
+                 atomic_load(&stats->lz_blocks),
+                 atomic_load(&stats->lz_cache_hits),
+                 atomic_load(&stats->lock_delay_us),
+                 atomic_load(&stats->queue_delay_us),
+                 atomic_load(&stats->overloaded),
+                 atomic_load(&stats->shed_connections),
+                 atomic_load(&stats->shed_packets),
+                 aesd_huge_mode_name(atomic_load(&stats->hugepages)),
+                 counter_read(COUNTER_DTLB_LOAD_MISSES),
+                 counter_read(COUNTER_PAGE_FAULTS));
+  if ((size_t) len < size)
+    len += stats_format_top(buf + len, size - len, "top_packets", &stats->top_packets);
+  if ((size_t) len < size)
+    len += stats_format_top(buf + len, size - len, "top_bytes_in", &stats->top_bytes_in);
+  if ((size_t) len < size)
+    len += stats_format_top(buf + len, size - len, "top_bytes_out", &stats->top_bytes_out);
+  return ((size_t) len < size) ? len : (int) size - 1;
+}
+
+void stats_serve_one(void)
+{
+  char buf[4096];
+  int len;
+  int fd;
+
+  fd = accept(stats_fd, NULL, NULL);
+  if (fd == -1)
+    return;
+  len = stats_format(buf, sizeof(buf));
+  // one short snapshot, a client which does not read it just loses it
+  if (send(fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT) != len)
+    syslog(LOG_WARNING, "stats: snapshot not sent");
+  close(fd);
+}
+
+static void* stats_serve(void *param)
+{
+  struct pollfd pfd[2] = { { .fd = stats_fd, .events = POLLIN },
+                           { .fd = stats_stop_fd, .events = POLLIN } };
+
+  // stats_stop() wakes us right away through stats_stop_fd
+  while (!(pfd[1].revents & POLLIN)) {
+    if (poll(pfd, 2, -1) <= 0)
+      continue;
+    if (pfd[0].revents & POLLIN)
+      stats_serve_one();
+  }
+  return NULL;
+}
+
+int stats_share(void)
+{
+  struct aesdsocket_stats *shared;
+
+  shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    syslog(LOG_ERR, "stats: mmap: %s", strerror(errno));
+    return -1;
+  }
+  // no other thread runs yet, a plain copy carries the counters over
+  memcpy(shared, stats, sizeof(*shared));
+  stats = shared;
+  return 0;
+}
+
+int stats_listen(const char *path)
+{
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    syslog(LOG_ERR, "stats: socket path too long: %s", path);
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  stats_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (stats_fd == -1) {
+    syslog(LOG_ERR, "stats: socket: %s", strerror(errno));
+    return -1;
+  }
+  unlink(path);
+  if (bind(stats_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+      listen(stats_fd, 16) == -1) {
+    syslog(LOG_ERR, "stats: %s: %s", path, strerror(errno));
+    goto handle_errors;
+  }
+  strcpy(stats_path, path);
+  return stats_fd;
+
+handle_errors:
+  close(stats_fd);
+  stats_fd = -1;
+  return -1;
+}
+
+int stats_start(const char *path)
+{
+  if (stats_listen(path) == -1)
+    return -1;
+  stats_stop_fd = eventfd(0, EFD_CLOEXEC);
+  if (stats_stop_fd == -1 ||
+      pthread_create(&stats_thread, NULL, stats_serve, NULL) != 0) {
+    syslog(LOG_ERR, "stats: could not create thread");
+    if (stats_stop_fd != -1)
+      close(stats_stop_fd);
+    stats_stop_fd = -1;
+    unlink(stats_path);
+    close(stats_fd);
+    stats_fd = -1;
+    return -1;
+  }
+  stats_threaded = true;
+  return 0;
+}
+
+void stats_stop(void)
+{
+  if (stats_fd == -1)
+    return;
+  if (stats_threaded) {
+    eventfd_write(stats_stop_fd, 1);
+    pthread_join(stats_thread, NULL);
+    close(stats_stop_fd);
+    stats_stop_fd = -1;
+    stats_threaded = false;
+  }
+  close(stats_fd);
+  stats_fd = -1;
+  unlink(stats_path);
+}
+
+void stats_close(void)
+{
+  int i;
+
+  // the child counts on in the parent's counters without them
+  for (i = 0; i < NUM_COUNTERS; i++) {
+    if (counter_fds[i] != -1)
+      close(counter_fds[i]);
+    counter_fds[i] = -1;
+  }
+  if (stats_fd == -1)
+    return;
+  close(stats_fd);
+  stats_fd = -1;
+}
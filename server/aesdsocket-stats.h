@@ -0,0 +1,107 @@
+/* ----------------------------------------------------------------------------
+ * @file aesdsocket-stats.h
+ * @brief aesdsocket counters, served on a unix socket
+ *
+ * Each connection to the stats socket receives one snapshot of the counters
+ * as "name value" lines and is then closed, e.g.
+ *   socat - UNIX-CONNECT:/run/aesdsocket.stats
+ *
+ * With prefork (-P) the counters live in shared memory so they add up over
+ * the worker processes, and the master serves them from its own loop.
+ *
+ * The heaviest clients of each top-K follow as "name address value" lines,
+ * largest first, e.g. "top_packets 192.0.2.7 1200".  Their values are
+ * Count-Min estimates (lib/aesd-topk.h), never below the true totals.
+ *
+ * dtlb_load_misses and page_faults come from the kernel's perf events for
+ * the whole server, its threads and worker processes included, and read -1
+ * where the CPU or the kernel does not count them, e.g. in most VMs for the
+ * former.
+ *
+ * @author Jake Michael, jami1063@colorado.edu
+ *---------------------------------------------------------------------------*/
+
+#ifndef AESDSOCKET_STATS_H
+#define AESDSOCKET_STATS_H
+
+#include <stdatomic.h>
+#include "aesd-huge.h"
+#include "aesd-topk.h"
+
+// heaviest clients listed per top-K, of AESD_TOPK_SLOTS tracked
+#define STATS_TOP_CLIENTS (10)
+
+struct aesdsocket_stats {
+  atomic_ulong config_generation; // configurations applied, 1 for the startup one
+  atomic_uint workers;            // connection worker pool size, 0 for thread per connection
+  atomic_ulong connections;       // accepted since startup
+  atomic_long active;             // being served now
+  atomic_ulong packets;           // newline terminated packets stored
+  atomic_ulong bytes_in;          // received from clients
+  atomic_ulong bytes_out;         // sent to clients
+  atomic_ulong reply_writes;      // writes the log bytes of replies took
+  atomic_uint procs;              // worker processes running with -P
+  atomic_ulong respawns;          // worker processes replaced after dying
+  atomic_ulong lz_bytes_raw;      // log bytes sent in compressed replies
+  atomic_ulong lz_bytes_wire;     // the bytes they took on the wire
+  atomic_ulong lz_blocks;         // blocks compressed
+  atomic_ulong lz_cache_hits;     // blocks sent as compressed by another reply
+  atomic_ulong lock_delay_us;     // lowest wait for the log over the last interval
+  atomic_ulong queue_delay_us;    // same for connections queued for a worker, -w
+  atomic_uint overloaded;         // 1 while new work is being shed
+  atomic_ulong shed_connections;  // rejected on accept
+  atomic_ulong shed_packets;      // rejected instead of waiting for the log
+  atomic_uint hugepages;          // enum aesd_huge_mode of the shared log of -P
+  struct aesd_topk top_packets;   // per client address: packets stored,
+  struct aesd_topk top_bytes_in;  // bytes of them appended to the log,
+  struct aesd_topk top_bytes_out; // and log bytes replayed to it
+};
+
+extern struct aesdsocket_stats *stats;
+
+/**
+* Move the counters to memory shared with the processes forked from now on.
+* @return 0 on success, -1 on error
+*/
+int stats_share(void);
+
+/**
+* Serve snapshots of stats on a unix socket bound at @param path, from a
+* thread of their own.  A stale socket file at path is replaced.
+* @return 0 on success, -1 on error
+*/
+int stats_start(const char *path);
+
+/**
+* Bind the stats socket at @param path without starting a thread, for a
+* caller which polls it and calls stats_serve_one() when it is readable.
+* @return the listening socket, -1 on error
+*/
+int stats_listen(const char *path);
+
+/**
+* Start the perf event counters of the snapshots, counting this process and
+* the threads and processes it creates from now on.  Counters which cannot
+* be opened read -1.
+*/
+void stats_counters_open(void);
+
+/**
+* Accept one connection on the stats socket and send it a snapshot.
+*/
+void stats_serve_one(void);
+
+/**
+* Stop serving snapshots and remove the socket file.  Safe to call when
+* neither stats_start() nor stats_listen() was called.
+*/
+void stats_stop(void);
+
+/**
+* Close the stats socket in a child process, leaving the socket file to the
+* parent which still serves it.  The child's events still count towards the
+* parent's perf event counters.
+*/
+void stats_close(void);
+
+#endif /* AESDSOCKET_STATS_H */
@@ -8,6 +8,33 @@
  * to client upon packet reciept. Cleans up and exits on SIGINT or SIGTERM 
  * signals. 
  * 
+ * Signals are read from a signalfd in the accept loop, no handler runs.  On
+ * SIGINT or SIGTERM every thread waiting is woken at once: the timestamp
+ * thread through an eventfd, connections waiting for packets by shutting
+ * down their read side.  Replies in progress get shutdown_grace_ms to
+ * finish before their sockets are shut down entirely.
+ * 
+ * When started with listening sockets passed by a supervisor (LISTEN_FDS, see
+ * aesdsocket.socket) those are used instead of binding port 9000, so the port
+ * stays open across restarts.  Readiness is reported on NOTIFY_SOCKET.
+ * Tunables given with -c are reloaded on SIGHUP and applied to the running
+ * server, counters are served on the -S unix socket.
+ * With -L, connections run as coroutines on small stacks over per-core epoll
+ * loops (lib/aesd-coro.h) instead of a thread each, with the same code.
+ * With -P, a master process owns the listening sockets and forks worker
+ * processes which accept on them, replacing any worker which dies.  The log
+ * then lives in shared memory (lib/aesd-shmlog.h) instead of TEMPFILE.
+ * Clients may negotiate framed replies, which lets them pipeline packets,
+ * and compressed ones, from blocks shared by every connection
+ * (lib/aesd-proto.h, aesdsocket-snapshot.h).
+ * When waiting for the log stays above shed_target_ms for an interval, new
+ * connections and packets are turned away with AESD_PROTO_BUSY instead of
+ * queueing behind it (lib/aesd-codel.h).
+ * The stats list the heaviest clients by packets, bytes appended and bytes
+ * replayed, in fixed memory whatever the number of clients (lib/aesd-topk.h).
+ * The shared log of -P is mapped in huge pages as set by hugepages
+ * (lib/aesd-huge.h), so replays walking it miss the TLB less.
+ * 
  * @author Jake Michael, jami1063@colorado.edu
  * @resources 
  * (+)  various code is leveraged from Beej's Guide to Network Programming:
@@ -26,13 +53,31 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <poll.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/socket.h>    
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include "queue.h"
+#include "aesd-lock.h"
+#include "aesd-sched.h"
+#include "aesd-listen.h"
+#include "aesd-coro.h"
+#include "aesd-shmlog.h"
+#include "aesd-proto.h"
+#include "aesd-codel.h"
+#include "aesd-trace.h"
+#include "aesdsocket-config.h"
+#include "aesdsocket-stats.h"
+#include "aesdsocket-snapshot.h"
 
 // by default logs should go to syslog, but can be optionally redirected 
 // to printf for debug purposes by setting macro below to 1
@@ -44,9 +89,34 @@
 #endif
 
 #define PORT "9000"
-#define USE_AESD_CHAR_DEVICE (1)
+// most listening sockets accepted from a supervisor, e.g. IPv4 and IPv6
+#define MAX_LISTEN_FDS (8)
+// most worker processes with -P
+#define MAX_PROCS (64)
+// address space reserved for the shared log with -P, pages are used as written
+#define SHMLOG_CAPACITY (256UL * 1024 * 1024)
+// a worker dying sooner than this after its start is respawned this much later
+#define RESPAWN_DELAY_S (1)
+// log bytes gathered into one write of a reply, in whole chunks when framed
+#define REPLY_SPAN (64 * 1024)
+// most iovecs per write of a framed reply, a header and a chunk each
+#define REPLY_IOV (64)
+// unsent bytes a connection may queue in the kernel before a write waits
+#define REPLY_NOTSENT_LOWAT (128 * 1024)
+
+// lock implementation guarding TEMPFILE, may be overridden with -l at run time
+#ifndef FILE_LOCK_DEFAULT
+  #define FILE_LOCK_DEFAULT "mutex"
+#endif
+#ifndef USE_AESD_CHAR_DEVICE
+  #define USE_AESD_CHAR_DEVICE (1)
+#endif
+// the device node, -DAESD_CHAR_DEVICE_PATH=\"/dev/<name>\" for aesdchar-cuse -n <name>
+#ifndef AESD_CHAR_DEVICE_PATH
+  #define AESD_CHAR_DEVICE_PATH "/dev/aesdchar"
+#endif
 #if (USE_AESD_CHAR_DEVICE == 1)
-  #define TEMPFILE "/dev/aesdchar"
+  #define TEMPFILE AESD_CHAR_DEVICE_PATH
 #else
   #define TEMPFILE "/var/tmp/aesdsocketdata"
 #endif
@@ -55,15 +125,54 @@
 /* ============================================================================
  *    GLOBALS
  * ===========================================================================*/
-static int sockfd = -1; // socket file descriptor
+static int sockfd = -1; // socket file descriptor, when we opened it ourselves
+static int listenfds[MAX_LISTEN_FDS]; // every socket accepted from
+static int nlistenfds = 0;
 static int tempfd = -1; // TEMPFILE file descriptor
-static volatile bool global_abort = false;
+static atomic_bool global_abort = false; // set on SIGINT or SIGTERM
+static bool reload_flag = false;        // set on SIGHUP, by the main loop
+static int signal_fd = -1;              // the signals watched, see signal_watch()
+static int abort_fd = -1;               // eventfd, readable once global_abort is set
+static bool is_worker = false;          // a process forked by the -P master
+static char config_path[PATH_MAX];      // set with -c, empty for none
+static struct aesdsocket_config config = {
+  .workers = 0,
+  .log_level = LOG_DEBUG,
+  .send_chunk = 256,
+  .shed_target_ms = 50,
+  .shed_interval_ms = 1000,
+  .shutdown_grace_ms = 5000,
+  .hugepages = AESD_HUGE_MADVISE,
+};
 typedef TAILQ_HEAD(head_s, node) head_t;
 
 /* ============================================================================
  *    THREAD VARIABLES AND SYNCHRONIZATION
  * ===========================================================================*/
-pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+struct aesd_lock file_lock;
+static struct aesd_sched *conn_sched = NULL; // set with -w, else thread per connection
+static struct aesd_coro_sched *coro_sched = NULL; // set with -L, takes precedence over -w
+static struct aesd_coro_mutex coro_file_lock; // replaces file_lock with -L
+static bool use_coro_file_lock = false;
+// with -P, the log and the lock shared by every worker process, taken after
+// file_lock so a process has one waiter at most
+static struct aesd_shmlog *shm_log = NULL;
+// queueing delays, waiting for the file lock and, with -w, for a worker.
+// With -P each worker process measures its own
+static struct aesd_codel lock_codel;
+static struct aesd_codel queue_codel;
+// set with -T, the traffic of every connection is recorded there
+static struct aesd_trace *trace = NULL;
+
+// connections being served by this process, shut down on SIGINT or SIGTERM
+typedef struct conn_entry {
+  int peerfd;
+  TAILQ_ENTRY(conn_entry) entries;
+} conn_entry_t;
+static TAILQ_HEAD(conn_head_s, conn_entry) conn_list = TAILQ_HEAD_INITIALIZER(conn_list);
+static pthread_mutex_t conn_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t conn_list_empty = PTHREAD_COND_INITIALIZER;
+static bool conn_draining = false;
 
 typedef enum thread_status {
   RUNNING   = 0,
@@ -75,6 +184,21 @@ typedef struct thread_params {
   thread_status_t *status;
 } thread_params_t;
 
+typedef struct queued_conn {
+  int peerfd;
+  uint64_t queued_at;        // aesd_codel_now() when submitted
+} queued_conn_t;
+
+typedef struct retire_params {
+  struct aesd_sched *sched;
+  thread_status_t *status;
+} retire_params_t;
+
+typedef struct worker_proc {
+  pid_t pid;                 // -1 while waiting to be respawned
+  struct timespec started;   // or when to respawn, while pid is -1
+} worker_proc_t;
+
 typedef struct node {
   pthread_t thread;
   thread_status_t status; 
@@ -85,26 +209,124 @@ typedef struct node {
  *    FUNCTION HEADERS
  * ===========================================================================*/
 
-/* @brief  registers signal handlers
+/* @brief  prints command line usage
+ * @param  progname, the name the program was invoked with
+ * @return none
+ */
+static void print_usage(const char *progname);
+
+/* @brief  routes SIGINT and SIGTERM to signal_fd, creates abort_fd and
+ *         ignores SIGPIPE
  * @param  none
  * @return 0 upon success, -1 on error
  */
 static int register_signal_handlers();
 
 /*
- * @brief   SIGINT and SIGTERM handler
+ * @brief   blocks a signal in this thread and those it creates from now on,
+ *          to be read from signal_fd instead
  * @param   signo is the signal identifier
+ * @return  0 upon success, -1 on error
+ */
+static int signal_watch(int signo);
+
+/*
+ * @brief   reads the signals pending on signal_fd.  SIGINT and SIGTERM set
+ *          global_abort and wake abort_fd, SIGHUP requests a configuration
+ *          reload, SIGCHLD only wakes the -P master to reap
+ * @param   none
  * @return  none
  */
-static void signal_handler(int signo);
+static void handle_signals(void);
+
+/*
+ * @brief   sleeps until a deadline or until shutdown starts
+ * @param   deadline, CLOCK_MONOTONIC
+ * @return  true if shutdown started
+ */
+static bool wait_abort(const struct timespec *deadline);
+
+/*
+ * @brief   converts a deadline to a poll() timeout
+ * @param   deadline, CLOCK_MONOTONIC
+ * @return  the milliseconds left, rounded up, 0 once it passed
+ */
+static int ms_until(const struct timespec *deadline);
+
+
+/* @brief  adds a connection to conn_list, shutting its read side down
+ *         right away if the server is already draining
+ * @param  entry, the list entry, owned by the caller until conn_unregister()
+ * @param  peerfd, the connection
+ * @return none
+ */
+static void conn_register(conn_entry_t *entry, int peerfd);
+
+
+/* @brief  removes a connection from conn_list, before its socket is closed
+ * @param  entry, the entry given to conn_register()
+ * @return none
+ */
+static void conn_unregister(conn_entry_t *entry);
+
+
+/* @brief  wakes the connections waiting for packets by shutting down their
+ *         read side, then waits up to grace_ms for the others to finish
+ *         their replies before shutting their sockets down entirely
+ * @param  grace_ms, the grace period
+ * @return none
+ */
+static void conn_drain(unsigned int grace_ms);
+
+
+/* @brief  applies a configuration to the running server: resizes the
+ *         connection worker pool, sets the log level, send chunk size, load
+ *         shedding thresholds and shutdown grace period
+ * @param  new_config, the configuration to apply
+ * @param  head, the thread list a replaced worker pool is retired on
+ * @return none
+ */
+static void apply_config(const struct aesdsocket_config *new_config, head_t *head);
+
+
+/* @brief  waits for a replaced worker pool's connections, then frees it
+ * @param  void* param, ptr to retire_params_t
+ * @return void*, param
+ */
+static void* retire_sched_thread(void *param);
+
+
+/* @brief  with -P, forks the worker processes and supervises them until
+ *         SIGINT or SIGTERM, respawning those which die.  Serves the stats
+ *         socket and writes the timestamps meanwhile
+ * @param  nprocs, the number of worker processes
+ * @param  stats_path, the stats socket path, or NULL
+ * @return 0 in a worker process, which goes on serving connections, 1 in
+ *         the master once the workers have exited, -1 on error
+ */
+static int prefork_master(unsigned int nprocs, const char *stats_path);
 
 
-/* @brief  gets human readable ip address string (assuming IPv4)
- * @param  sa, ptr to sockaddr_in to convert
- * @param  dst, ptr to destination buffer with minsize IPNET_ADDRSTRLEN
+/* @brief  forks one worker process for prefork_master()
+ * @param  proc, the worker slot to fill
+ * @return 0 in the worker, 1 in the master, -1 on error
+ */
+static int fork_worker(worker_proc_t *proc);
+
+
+/* @brief  gets human readable ip address string (IPv4 or IPv6)
+ * @param  sa, ptr to sockaddr to convert
+ * @param  dst, ptr to destination buffer with minsize INET6_ADDRSTRLEN
  * @return dst or NULL if error
  */
-static char *get_ip_str(const struct sockaddr_in *sa, char *dst);
+static char *get_ip_str(const struct sockaddr *sa, char *dst);
+
+
+/* @brief  opens, binds and listens on the server socket on PORT
+ * @param  none
+ * @return the socket file descriptor, -1 on error
+ */
+static int open_listen_socket();
 
 
 /* @brief  a writing wrapper utility which writes all bytes to fd
@@ -122,6 +344,139 @@ static int write_wrapper(int fd, char* writestr, int len);
 static int daemonize_proc();
 
 
+/* @brief  services a socket connection until the peer closes it, then
+ *         closes peerfd
+ * @param  peerfd, the accepted connection
+ * @return none
+ */
+static void handle_connection(int peerfd);
+
+
+/* @brief  finds the packets to store next in received bytes
+ * @param  buf, the received bytes
+ * @param  nbytes, the number of received bytes
+ * @param  all, true to take every complete packet, framed replies answer
+ *         them together, false to take only the first
+ * @param  records, set to the number of packets taken
+ * @return the number of bytes they span, 0 until a packet is complete
+ */
+static int packet_span(const char *buf, int nbytes, bool all, int *records);
+
+
+/* @brief  records the packets about to be stored in the trace of -T
+ * @param  conn, the connection's number in the trace
+ * @param  arrived_us, when the last of them was received
+ * @param  buf, the received bytes
+ * @param  span, the number of bytes the packets span
+ * @return none
+ */
+static void trace_packets(uint64_t conn, uint64_t arrived_us, const char *buf,
+                          int span);
+
+
+/* @brief  drops stored packets from the front of received bytes
+ * @param  buf, the received bytes
+ * @param  nbytes, the number of received bytes, updated
+ * @param  span, the number of bytes dropped
+ * @return none
+ */
+static void consume_packets(char *buf, int *nbytes, int span);
+
+
+/* @brief  writes all of an iovec array, as few writev() calls as the
+ *         socket allows
+ * @param  fd, the connection
+ * @param  iov, the array, advanced past what was written on a partial write
+ * @param  iovcnt, the number of iovecs
+ * @return 0 on success, -1 on error
+ */
+static int writev_all(int fd, struct iovec *iov, int iovcnt);
+
+
+/* @brief  sends a span of the log as part of a reply, the chunks of a
+ *         framed reply gathered REPLY_IOV / 2 at a time into one write
+ * @param  peerfd, the connection
+ * @param  data, the span
+ * @param  len, the length of the span
+ * @param  chunk_size, the largest chunk when framed
+ * @param  framed, whether the connection negotiated framed replies
+ * @return 0 on success, -1 on error
+ */
+static int reply_span(int peerfd, const char *data, size_t len, int chunk_size,
+                      bool framed);
+
+
+/* @brief  corks or uncorks a connection, a corked one only sends full
+ *         segments so a reply made of several writes leaves in as few
+ *         segments as possible
+ * @param  peerfd, the connection
+ * @param  on, true to cork, false to send what is held back
+ * @return none
+ */
+static void reply_cork(int peerfd, bool on);
+
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+/* @brief  reads the shared log of -P for reply_snapshot(), in place
+ * @param  ctx, unused
+ * @param  scratch, unused
+ * @param  len, the number of bytes
+ * @param  offset, where they start
+ * @return the bytes
+ */
+static const char *shm_log_read(void *ctx, char *scratch, size_t len, size_t offset);
+
+
+/* @brief  reads TEMPFILE for reply_snapshot()
+ * @param  ctx, ptr to the TEMPFILE descriptor
+ * @param  scratch, the buffer to read into
+ * @param  len, the number of bytes
+ * @param  offset, where they start
+ * @return scratch, NULL on error
+ */
+static const char *tempfile_read(void *ctx, char *scratch, size_t len, size_t offset);
+
+
+/* @brief  sends the log as a compressed reply, without its end, from the
+ *         blocks shared by every connection
+ * @param  peerfd, the connection
+ * @param  log_size, the size of the log to send
+ * @param  read_fn, reads the log to compress the blocks not cached yet
+ * @param  ctx, passed to read_fn
+ * @return 0 on success, -1 on error
+ */
+static int reply_snapshot(int peerfd, size_t log_size, snapshot_read_fn read_fn,
+                          void *ctx);
+#else
+
+
+/* @brief  reads the rest of the device into a malloc'ed buffer
+ * @param  fd, the device, read to its end
+ * @param  len, set to the bytes read
+ * @return the buffer, NULL on error
+ */
+static char *read_device(int fd, size_t *len);
+
+
+/* @brief  sends a copy of the log as a compressed reply, without its end,
+ *         for a log which does not only grow and cannot be cached
+ * @param  peerfd, the connection
+ * @param  data, the log
+ * @param  len, its length
+ * @return 0 on success, -1 on error
+ */
+static int reply_stream_lz(int peerfd, const char *data, size_t len);
+#endif
+
+
+/* @brief  ends a framed reply
+ * @param  peerfd, the connection
+ * @param  records, the number of packets the reply answers
+ * @return 0 on success, -1 on error
+ */
+static int reply_end(int peerfd, int records);
+
+
 /* @brief  handles a socket connection
  * @param  void* param, ptr to data to pass into thread
  * @return void*, a return pointer
@@ -129,6 +484,69 @@ static int daemonize_proc();
 void* connection_thread(void *param);
 
 
+/* @brief  handles a socket connection as a scheduler task
+ * @param  void* param, the peer file descriptor cast to a pointer
+ * @return none
+ */
+static void connection_task(void *param);
+
+
+/* @brief  handles a socket connection queued for a worker, reporting how
+ *         long it waited to queue_codel
+ * @param  void* param, ptr to a queued_conn_t, freed
+ * @return none
+ */
+static void queued_connection_task(void *param);
+
+
+/* @brief  decides whether new work is taken on, from the queueing delays
+ *         measured for the file lock and, for a connection with -w, for a
+ *         worker.  Updates the delay stats
+ * @param  connection, true for a new connection, false for packets
+ * @return true to serve it, false to shed it
+ */
+static bool admit_work(bool connection);
+
+
+/* @brief  turns an accepted connection away with AESD_PROTO_BUSY, closing it
+ * @param  peerfd, the connection
+ * @return none
+ */
+static void reject_connection(int peerfd);
+
+
+/* @brief  acquires the lock guarding TEMPFILE: file_lock, or with -L a lock
+ *         which parks a waiting coroutine instead of blocking its loop.
+ *         With -P, then the lock shared with the other worker processes
+ * @param  none
+ * @return none
+ */
+static void file_lock_acquire(void);
+
+
+/* @brief  acquires the file lock for a client's packets, reporting how long
+ *         it waited to lock_codel
+ * @param  none
+ * @return none
+ */
+static void request_lock_acquire(void);
+
+
+/* @brief  releases the lock taken with file_lock_acquire()
+ * @param  none
+ * @return none
+ */
+static void file_lock_release(void);
+
+
+/* @brief  formats the current time as a timestamp log line
+ * @param  timestr, the destination buffer
+ * @param  size, the size of timestr
+ * @return 0 on success, -1 on error
+ */
+static int timestamp_format(char *timestr, size_t size);
+
+
 /* @brief  handles printing timestamp
  * @param  void* param, ptr to data to pass into thread
  * @return void*, a return pointer
@@ -150,8 +568,15 @@ void* timestamp_thread(void *param);
 int main(int argc, char* argv[])
 { 
   int rc; 
+  int opt;
   int daemonize_flag = 0;
-  struct addrinfo* server_addr = NULL;
+  unsigned int nloops = 0;
+  unsigned int nprocs = 0;
+  const char *lock_name = FILE_LOCK_DEFAULT;
+  const char *stats_path = NULL;
+  const char *trace_path = NULL;
+  struct aesdsocket_config new_config;
+  enum aesd_lock_type lock_type;
   
 #if (USE_AESD_CHAR_DEVICE == 0)
   // if we can access the tempfile, it is stale
@@ -160,20 +585,89 @@ int main(int argc, char* argv[])
   }
 #endif
 
-  // handle daemonize flag from args
-  if (argc >= 2) {
-    if (!strcmp(argv[1], "-d")) {
-      daemonize_flag = 1;
-    } else {
-      printf("Invalid option: %s\n", argv[1]);
-      printf("Usage: %s [options]\n", argv[0]);
-      printf("Options: \n\t -d \t Run application as a daemon\n");
-      return -1;
+  // handle options from args
+  while ((opt = getopt(argc, argv, "dl:w:c:S:L:P:T:")) != -1) {
+    switch (opt) {
+      case 'd':
+        daemonize_flag = 1;
+        break;
+      case 'l':
+        lock_name = optarg;
+        break;
+      case 'w':
+        config.workers = (unsigned int) strtoul(optarg, NULL, 0);
+        break;
+      case 'c':
+        // absolute, daemonizing changes the working directory
+        if (realpath(optarg, config_path) == NULL) {
+          printf("Invalid config file: %s: %s\n", optarg, strerror(errno));
+          return -1;
+        }
+        break;
+      case 'S':
+        stats_path = optarg;
+        break;
+      case 'L':
+        nloops = (unsigned int) strtoul(optarg, NULL, 0);
+        break;
+      case 'P':
+        nprocs = (unsigned int) strtoul(optarg, NULL, 0);
+        if (nprocs > MAX_PROCS) {
+          printf("Invalid process count: %u, at most %d\n", nprocs, MAX_PROCS);
+          return -1;
+        }
+        break;
+      case 'T':
+        trace_path = optarg;
+        break;
+      default:
+        print_usage(argv[0]);
+        return -1;
     }
   }
+  if (optind < argc) {
+    printf("Invalid option: %s\n", argv[optind]);
+    print_usage(argv[0]);
+    return -1;
+  }
   if (daemonize_flag)
     LOG(LOG_INFO, "set to daemonize");
 
+  // the file overrides the command line, at startup as on reload
+  if (config_path[0] != '\0' && config_load(config_path, &config) == -1) {
+    printf("Invalid config file: %s, see the log\n", config_path);
+    return -1;
+  }
+  setlogmask(LOG_UPTO(config.log_level));
+
+  // set up the lock guarding TEMPFILE before any thread can use it
+  if (aesd_lock_type_from_name(lock_name, &lock_type) == -1 ||
+      aesd_lock_init(&file_lock, lock_type) == -1) {
+    printf("Invalid file lock: %s\n", lock_name);
+    print_usage(argv[0]);
+    return -1;
+  }
+  aesd_codel_init(&lock_codel, config.shed_target_ms, config.shed_interval_ms);
+  aesd_codel_init(&queue_codel, config.shed_target_ms, config.shed_interval_ms);
+  if (nloops > 0) {
+    aesd_coro_mutex_init(&coro_file_lock);
+    use_coro_file_lock = true;
+    LOG(LOG_INFO, "using coroutine file lock");
+  } else {
+    LOG(LOG_INFO, "using %s file lock", aesd_lock_type_name(lock_type));
+  }
+
+  // opened before daemonizing changes the working directory, workers forked
+  // with -P inherit it and record into it as well
+  if (trace_path != NULL) {
+    trace = aesd_trace_open(trace_path);
+    if (trace == NULL) {
+      printf("Invalid trace file: %s\n", trace_path);
+      return -1;
+    }
+    LOG(LOG_INFO, "recording traffic to %s", trace_path);
+  }
+
   // register signal handlers
   rc = register_signal_handlers();
   if (rc == -1) {
@@ -181,62 +675,75 @@ int main(int argc, char* argv[])
     exit(EXIT_FAILURE);
   } 
 
-  // initialize hints struct
-  struct addrinfo hints;
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_flags    = AI_PASSIVE;   // fills in IP address automatically
-  hints.ai_family   = AF_INET;      // IPV4 or IPV6 
-  hints.ai_socktype = SOCK_STREAM;  // TCP stream
-
-  // get addrinfo
-  rc = getaddrinfo( NULL,           // ip to connect to (NULL for loopback) 
-                    PORT,         // port per A5 requirements
-                    &hints,         // hints, populated above
-                    &server_addr    // return address for linked list
-                    );
-  if (rc != 0) {
-    LOG(LOG_ERR, "getaddrinfo returned !=0"); perror("getaddrinfo()");
+  // take the listening sockets from a supervisor which holds the port across
+  // restarts, else open our own
+  nlistenfds = aesd_listen_fds(listenfds, MAX_LISTEN_FDS);
+  if (nlistenfds == -1) {
+    LOG(LOG_ERR, "invalid inherited listening sockets");
     return -1;
   }
+  if (nlistenfds > 0) {
+    LOG(LOG_INFO, "using %d inherited listening socket(s)", nlistenfds);
+  } else {
+    sockfd = open_listen_socket();
+    if (sockfd == -1) {
+      return -1;
+    }
+    listenfds[nlistenfds++] = sockfd;
+  }
 
-  // open socket associated with getaddrinfo
-  sockfd = socket(server_addr->ai_family, server_addr->ai_socktype, 
-                  server_addr->ai_protocol);
-  if (sockfd == -1) {
-    LOG(LOG_ERR, "socket returned -1"); perror("socket()");
-    freeaddrinfo(server_addr); 
-    return -1;
+  // connections queue on the socket from here on, so the parent only exits
+  // once the port is accepting and there is no window where it is refused
+  if (daemonize_flag) {
+    if ( (rc = daemonize_proc()) == -1) {
+      LOG(LOG_ERR, "process cannot be daemonized");
+      return -1;
+    }
   }
 
-  // set socket options
-  if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &(int){1},	sizeof(int)) < 0 ) {
-    perror("setsockopt()");
-    freeaddrinfo(server_addr); 
+  // daemonize_proc() ignored SIGHUP across the fork, from here it reloads
+  if (signal(SIGHUP, SIG_DFL) == SIG_ERR || signal_watch(SIGHUP) == -1) {
+    LOG(LOG_ERR, "cannot watch SIGHUP");
     return -1;
-  } 
+  }
 
-  // bind socket to the server_addr returned from getaddrinfo
-  rc = bind(sockfd, server_addr->ai_addr, server_addr->ai_addrlen );
-  if (rc == -1) {
-    LOG(LOG_ERR, "bind returned -1"); perror("bind()");
-    freeaddrinfo(server_addr); 
-    return -1;
+  // after daemonizing, counters follow the threads and workers created later
+  stats_counters_open();
+
+  // with -P this process becomes the master and does not return here until
+  // shutdown, the workers it forks return and serve like a single process
+  if (nprocs > 0) {
+    rc = prefork_master(nprocs, stats_path);
+    if (rc != 0) {
+      return (rc == 1) ? 0 : -1;
+    }
+    stats_path = NULL; // served by the master
   }
-  freeaddrinfo(server_addr); // no longer needed as we have sockfd 
 
-  if (daemonize_flag) {
-    if ( (rc = daemonize_proc()) == -1) {
-      LOG(LOG_ERR, "process cannot be daemonized");
+  // start connection workers after daemonizing, threads do not survive fork()
+  if (nloops > 0) {
+    coro_sched = aesd_coro_create(nloops, 0);
+    if (coro_sched == NULL) {
+      LOG(LOG_ERR, "could not start %u coroutine loops", nloops);
+      return -1;
+    }
+    LOG(LOG_INFO, "serving connections as coroutines on %u loops", nloops);
+  } else if (config.workers > 0) {
+    conn_sched = aesd_sched_create(config.workers);
+    if (conn_sched == NULL) {
+      LOG(LOG_ERR, "could not start %u connection workers", config.workers);
       return -1;
     }
+    LOG(LOG_INFO, "serving connections with %u workers", config.workers);
   }
-
-  // listen on the socket
-  rc = listen(sockfd, 10); // listen, allow connections to queue
-  if (rc == -1)  {
-    LOG(LOG_ERR, "listen returned -1"); perror("listen()");
+  atomic_store(&stats->workers, config.workers);
+  if (!is_worker) { // the master counts the generations of its workers
+    atomic_store(&stats->config_generation, 1);
+  }
+  if (stats_path != NULL && stats_start(stats_path) == -1) {
+    LOG(LOG_ERR, "could not serve stats on %s", stats_path);
     return -1;
-  } 
+  }
 
   // open tempfile with descriptor tempfd
   /*
@@ -248,11 +755,14 @@ int main(int argc, char* argv[])
   */
 
 #if (USE_AESD_CHAR_DEVICE == 0)
+  // with -P the master writes the timestamps to the shared log
   pthread_t tsthread;
-  rc = pthread_create(&tsthread, NULL, timestamp_thread, NULL);
-  if (rc != 0) {
-    LOG(LOG_ERR, "timestamp thread could not be created, returned %d", rc);
-    return -1;
+  if (!is_worker) {
+    rc = pthread_create(&tsthread, NULL, timestamp_thread, NULL);
+    if (rc != 0) {
+      LOG(LOG_ERR, "timestamp thread could not be created, returned %d", rc);
+      return -1;
+    }
   }
 #endif
 
@@ -260,34 +770,124 @@ int main(int argc, char* argv[])
   head_t head;
   TAILQ_INIT(&head);
 
-  // initialize polling structure
-  struct pollfd pfd[1];
-  pfd[0].fd = sockfd;
-  pfd[0].events = POLLIN;
-  int timeout = 500;
+  // initialize polling structure, the listening sockets and signal_fd
+  struct pollfd pfd[MAX_LISTEN_FDS + 1];
+  int i;
+  for (i = 0; i < nlistenfds; i++) {
+    pfd[i].fd = listenfds[i];
+    pfd[i].events = POLLIN;
+  }
+  pfd[nlistenfds].fd = signal_fd;
+  pfd[nlistenfds].events = POLLIN;
+  int nlistening = nlistenfds; // not dropped for an error
   int peerfd_temp = -1;
 
+  // everything is set up, tell a supervisor waiting on us (Type=notify)
+  if (!is_worker) {
+    aesd_listen_notify("READY=1");
+  }
+  LOG(LOG_INFO, "ready");
+
   while(!global_abort) 
   {
     int thread_count = 0;
     int rc = -1;
-    struct sockaddr_in peer_addr;
+    struct sockaddr_storage peer_addr;
     socklen_t peer_addr_size = sizeof(peer_addr);
 
-    poll(pfd, 1, timeout);
-    if (pfd[0].revents != POLLIN) {
+    // set by handle_signals() on the last pass
+    if (reload_flag) {
+      reload_flag = false;
+      new_config = config;
+      if (config_path[0] == '\0') {
+        LOG(LOG_WARNING, "SIGHUP without a config file (-c), nothing to reload");
+      } else if (config_load(config_path, &new_config) == -1) {
+        LOG(LOG_ERR, "config reload failed, keeping generation %lu",
+            atomic_load(&stats->config_generation));
+      } else {
+        apply_config(&new_config, &head);
+      }
+    }
+
+    // no timeout, signals wake us through signal_fd
+    if (poll(pfd, nlistenfds + 1, -1) <= 0) {
+      continue;
+    }
+    if (pfd[nlistenfds].revents & POLLIN) {
+      handle_signals();
+      continue;
+    }
+    // a listener in error would wake every poll() at once from now on, it
+    // is no longer polled.  Without any left there is nothing to serve
+    for (i = 0; i < nlistenfds; i++) {
+      if (pfd[i].fd != -1 && (pfd[i].revents & (POLLERR | POLLHUP | POLLNVAL))) {
+        LOG(LOG_ERR, "listening socket %d failed (revents 0x%x), dropping it",
+            pfd[i].fd, pfd[i].revents);
+        pfd[i].fd = -1;
+        pfd[i].revents = 0;
+        if (--nlistening == 0) {
+          LOG(LOG_ERR, "no listening socket left, shutting down");
+          global_abort = true;
+          eventfd_write(abort_fd, 1);
+        }
+      }
+    }
+    for (i = 0; i < nlistenfds && !(pfd[i].revents & POLLIN); i++);
+    if (i == nlistenfds) {
       continue;
     }
     // store file descriptor of accepted connection 
     peerfd_temp = -1;
-    peerfd_temp = accept(sockfd, (struct sockaddr *) &peer_addr, &peer_addr_size);
-    if (peerfd_temp == -1) {
+    peerfd_temp = accept(pfd[i].fd, (struct sockaddr *) &peer_addr, &peer_addr_size);
+    // coroutines need non-blocking sockets to park instead of blocking their loop
+    if (peerfd_temp != -1 && coro_sched != NULL) {
+      fcntl(peerfd_temp, F_SETFL, O_NONBLOCK);
+    }
+    if (peerfd_temp == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      continue; // with -P, another worker took the connection
+    } else if (peerfd_temp == -1) {
       LOG(LOG_ERR, "accept returned -1"); perror("accept");
       continue;
     } else {
+      atomic_fetch_add(&stats->connections, 1);
+      if (!admit_work(true)) {
+        LOG(LOG_INFO, "Overloaded, rejecting connection");
+        atomic_fetch_add(&stats->shed_connections, 1);
+        reject_connection(peerfd_temp);
+        continue;
+      }
       // print human-readable IP address
-      char peer_addr_str[INET_ADDRSTRLEN];
-      get_ip_str(&peer_addr, peer_addr_str);
+      char peer_addr_str[INET6_ADDRSTRLEN];
+      get_ip_str((struct sockaddr *) &peer_addr, peer_addr_str);
+
+      if (coro_sched != NULL) {
+        LOG(LOG_INFO, "Accepted connection from %s, spawning coroutine", peer_addr_str);
+        rc = aesd_coro_spawn(coro_sched, connection_task, (void*) (intptr_t) peerfd_temp);
+        if (rc != 0) {
+          LOG(LOG_ERR, "aesd_coro_spawn fail");
+          shutdown(peerfd_temp, SHUT_RDWR);
+          close(peerfd_temp);
+        }
+        continue;
+      }
+      if (conn_sched != NULL) {
+        LOG(LOG_INFO, "Accepted connection from %s, queueing task", peer_addr_str);
+        queued_conn_t *queued = malloc(sizeof(queued_conn_t));
+        if (queued == NULL) {
+          LOG(LOG_ERR, "malloc fail"); perror("malloc");
+          exit(EXIT_FAILURE); // we cannot recover from this
+        }
+        queued->peerfd = peerfd_temp;
+        queued->queued_at = aesd_codel_now();
+        rc = aesd_sched_submit(conn_sched, NULL, queued_connection_task, queued);
+        if (rc != 0) {
+          LOG(LOG_ERR, "aesd_sched_submit fail");
+          shutdown(peerfd_temp, SHUT_RDWR);
+          close(peerfd_temp);
+          free(queued);
+        }
+        continue;
+      }
       LOG(LOG_INFO, "Accepted connection from %s, spawning new thread", peer_addr_str);
 
       // malloc all the things
@@ -336,12 +936,22 @@ int main(int argc, char* argv[])
 
   } // end while()
 
-  if ( shutdown(sockfd, SHUT_RDWR) == -1)
+  if (!is_worker) {
+    aesd_listen_notify("STOPPING=1");
+  }
+  // an inherited socket stays open in the supervisor for the next instance,
+  // shutting it down would stop it listening there too, so only close it.
+  // The same goes for a worker and the socket of its master
+  if (sockfd != -1 && !is_worker && shutdown(sockfd, SHUT_RDWR) == -1)
   {
     LOG(LOG_ERR, "shutdown fail"); perror("shutdown");
   }
-  close(sockfd);
-  close(tempfd);
+  for (i = 0; i < nlistenfds; i++) {
+    close(listenfds[i]);
+  }
+
+  // connections waiting for packets close now, replies get the grace period
+  conn_drain(config.shutdown_grace_ms);
 
   // join and cleanup all the socket threads
   LOG(LOG_INFO, "Joining all threads");
@@ -356,11 +966,19 @@ int main(int argc, char* argv[])
     free(retval);
     anode = NULL;
   }
+  // waits for every queued connection task, waits on sockets are canceled
+  aesd_sched_destroy(conn_sched);
+  aesd_coro_destroy(coro_sched);
+  stats_stop();
+  aesd_trace_close(trace);
 
   // join timestamp thread
 #if (USE_AESD_CHAR_DEVICE == 0)
-  pthread_join(tsthread, NULL);
+  if (!is_worker) {
+    pthread_join(tsthread, NULL);
+  }
 #endif
+  close(tempfd);
 
 
 #if (USE_AESD_CHAR_DEVICE == 0)
@@ -376,70 +994,605 @@ int main(int argc, char* argv[])
 
 void* connection_thread(void* tparams) 
 {
-  int peerfd = 0; 
-  int size_step = 128;
-  int recv_buf_size = size_step;
-  char* recv_buf = calloc(size_step, sizeof(char));
-  int recv_buf_nbytes = 0;
   thread_params_t* params = (thread_params_t*) tparams;
-  peerfd = params->peerfd;
-  thread_status_t* status = params->status;
-  
-  while(!global_abort) // continuously read/write 
-  {
-    recv_buf_nbytes = 0;
 
-    while(!global_abort) // read from socket until '\n' 
-    {
-      int recv_temp_size = 32;
-      char recv_temp[recv_temp_size];
-      memset(recv_temp, 0, recv_temp_size);
-      int ret = recv(peerfd, &recv_temp[0], recv_temp_size-1, 0);
-      if (ret == -1 && errno != EINTR) {
-        LOG(LOG_ERR, "recv returned -1"); perror("recv()");
-        goto handle_errors;
-      } else if (ret == 0) { // end of file (peer socket shutdown)
-        LOG(LOG_INFO, "Peer socket shutdown");
-        goto handle_errors;
-      } else if (ret > 0) {
-        /*recv_buf = realloc(recv_buf, recv_buf_size + ret);
-        memcpy(recv_buf + recv_buf_size, recv_temp, ret);
-        recv_buf_size += ret;
-        char* packet_delimiter = strchr(recv_temp, '\n');
-        if (packet_delimiter != NULL) {  // delimeter found
-          break;
-        }*/
-        // recv_buf not big enough, need to realloc
-        if (recv_buf_nbytes + ret > recv_buf_size) {
-          recv_buf = realloc(recv_buf, recv_buf_size + size_step);
-          recv_buf_size += size_step;
-        } 
-        memcpy(&recv_buf[recv_buf_nbytes], &recv_temp[0], ret);
-        recv_buf_nbytes += ret;
-       
-        char* delimiter = NULL;
-        if ( (delimiter = strchr(recv_temp, '\n')) != NULL ) {  // delimeter found
-          break;
-        }
-      }
-    } // end while()
+  handle_connection(params->peerfd);
+  *(params->status) = COMPLETED;
+  pthread_exit(params);
+}
 
-    if (global_abort) goto handle_errors;
 
-    // write to file
-    // wait for the lock
-    pthread_mutex_lock(&file_lock);
-    tempfd = open(TEMPFILE, O_RDWR | O_CREAT | O_APPEND, 0644);
-    if (tempfd == -1) {
-      LOG(LOG_ERR, "open() returned -1"); perror("open()");
-      goto handle_errors;
-    }
-    if (-1 == write_wrapper(tempfd, recv_buf, recv_buf_nbytes)) {
+static void connection_task(void *param)
+{
+  handle_connection((int) (intptr_t) param);
+}
+
+
+static void queued_connection_task(void *param)
+{
+  queued_conn_t *queued = (queued_conn_t*) param;
+  int peerfd = queued->peerfd;
+
+  aesd_codel_sample(&queue_codel, aesd_codel_now() - queued->queued_at);
+  free(queued);
+  handle_connection(peerfd);
+}
+
+
+static bool admit_work(bool connection)
+{
+  // both are asked so both notice the end of their interval
+  bool admit = aesd_codel_admit(&lock_codel);
+
+  if (connection && conn_sched != NULL) {
+    admit = aesd_codel_admit(&queue_codel) && admit;
+  }
+  atomic_store(&stats->lock_delay_us, aesd_codel_delay_us(&lock_codel));
+  atomic_store(&stats->queue_delay_us, aesd_codel_delay_us(&queue_codel));
+  atomic_store(&stats->overloaded, !admit);
+  return admit;
+}
+
+
+static void reject_connection(int peerfd)
+{
+  // a courtesy, a client which does not read it just sees the close
+  send(peerfd, AESD_PROTO_BUSY "\n", strlen(AESD_PROTO_BUSY "\n"),
+       MSG_NOSIGNAL | MSG_DONTWAIT);
+  shutdown(peerfd, SHUT_RDWR);
+  close(peerfd);
+  // its packets were never read, but the churn is part of the traffic
+  if (trace != NULL) {
+    uint64_t now = aesd_trace_now();
+    uint64_t conn = aesd_trace_connection(trace);
+    aesd_trace_record(trace, AESD_TRACE_OPEN, conn, now, 0);
+    aesd_trace_record(trace, AESD_TRACE_CLOSE, conn, now, 0);
+  }
+}
+
+
+static void request_lock_acquire(void)
+{
+  uint64_t start = aesd_codel_now();
+
+  file_lock_acquire();
+  aesd_codel_sample(&lock_codel, aesd_codel_now() - start);
+}
+
+
+static void file_lock_acquire(void)
+{
+  if (use_coro_file_lock)
+    aesd_coro_mutex_lock(&coro_file_lock);
+  else
+    aesd_lock_acquire(&file_lock);
+  if (shm_log != NULL && aesd_shmlog_lock(shm_log) == 1) {
+    LOG(LOG_WARNING, "a worker died holding the shared log lock, recovered");
+  }
+}
+
+
+static void file_lock_release(void)
+{
+  if (shm_log != NULL)
+    aesd_shmlog_unlock(shm_log);
+  if (use_coro_file_lock)
+    aesd_coro_mutex_unlock(&coro_file_lock);
+  else
+    aesd_lock_release(&file_lock);
+}
+
+
+static void* retire_sched_thread(void *param)
+{
+  retire_params_t *params = (retire_params_t*) param;
+
+  // returns once the connections queued on the old pool have been served
+  aesd_sched_destroy(params->sched);
+  LOG(LOG_INFO, "retired previous connection worker pool");
+  *(params->status) = COMPLETED;
+  pthread_exit(params);
+}
+
+
+static void apply_config(const struct aesdsocket_config *new_config, head_t *head)
+{
+  struct aesd_sched *new_sched = NULL;
+  unsigned long generation;
+  int rc;
+
+  if (coro_sched != NULL && new_config->workers != config.workers) {
+    LOG(LOG_WARNING, "workers has no effect with coroutine loops (-L)");
+  } else if (new_config->workers != config.workers) {
+    // new connections go to a new pool right away, the old one keeps serving
+    // its connections and is freed by a thread once they are done
+    if (new_config->workers > 0) {
+      new_sched = aesd_sched_create(new_config->workers);
+      if (new_sched == NULL) {
+        LOG(LOG_ERR, "could not start %u connection workers, config not applied",
+            new_config->workers);
+        return;
+      }
+    }
+    if (conn_sched != NULL) {
+      struct node* new_node = malloc(sizeof(struct node));
+      retire_params_t* params = malloc(sizeof(retire_params_t));
+      if ( !new_node || !params ) {
+        LOG(LOG_ERR, "malloc fail"); perror("malloc");
+        exit(EXIT_FAILURE); // we cannot recover from this
+      }
+      new_node->status = RUNNING;
+      params->sched = conn_sched;
+      params->status = &(new_node->status);
+      rc = pthread_create(&(new_node->thread), NULL, retire_sched_thread, (void*) params);
+      if (rc != 0) {
+        LOG(LOG_ERR, "pthread_create returned %d, config not applied", rc);
+        aesd_sched_destroy(new_sched);
+        free(params); free(new_node);
+        return;
+      }
+      TAILQ_INSERT_TAIL(head, new_node, nodes);
+    }
+    conn_sched = new_sched;
+    atomic_store(&stats->workers, new_config->workers);
+  }
+
+  setlogmask(LOG_UPTO(new_config->log_level));
+  __atomic_store_n(&config.send_chunk, new_config->send_chunk, __ATOMIC_RELAXED);
+  config.workers = new_config->workers;
+  config.log_level = new_config->log_level;
+  aesd_codel_set(&lock_codel, new_config->shed_target_ms, new_config->shed_interval_ms);
+  aesd_codel_set(&queue_codel, new_config->shed_target_ms, new_config->shed_interval_ms);
+  config.shed_target_ms = new_config->shed_target_ms;
+  config.shed_interval_ms = new_config->shed_interval_ms;
+  config.shutdown_grace_ms = new_config->shutdown_grace_ms;
+  if (new_config->hugepages != config.hugepages) {
+    LOG(LOG_WARNING, "hugepages %s takes effect on restart",
+        aesd_huge_mode_name(new_config->hugepages));
+  }
+
+  // the -P master counts the generation before forwarding SIGHUP, a worker
+  // applies the one it counted
+  if (is_worker) {
+    generation = atomic_load(&stats->config_generation);
+  } else {
+    generation = atomic_fetch_add(&stats->config_generation, 1) + 1;
+  }
+  LOG(LOG_NOTICE, "config generation %lu applied: workers %u, log_level %s, send_chunk %u, "
+      "shed_target_ms %u, shed_interval_ms %u, shutdown_grace_ms %u",
+      generation, config.workers, config_log_level_name(config.log_level),
+      config.send_chunk, config.shed_target_ms, config.shed_interval_ms,
+      config.shutdown_grace_ms);
+}
+
+
+static int fork_worker(worker_proc_t *proc)
+{
+  pid_t master = getpid();
+  pid_t pid = fork();
+
+  if (pid == -1) {
+    LOG(LOG_ERR, "fork returned -1"); perror("fork()");
+    return -1;
+  }
+  if (pid == 0) {
+    // signal_fd carries over and reads the worker's own signals
+    is_worker = true;
+    stats_close();
+    // a worker outliving its master would go on accepting unsupervised
+    if (prctl(PR_SET_PDEATHSIG, SIGTERM) == -1 || getppid() != master) {
+      _exit(EXIT_FAILURE);
+    }
+    return 0;
+  }
+  proc->pid = pid;
+  clock_gettime(CLOCK_MONOTONIC, &proc->started);
+  atomic_fetch_add(&stats->procs, 1);
+  LOG(LOG_INFO, "started worker process %d", pid);
+  return 1;
+}
+
+
+static int prefork_master(unsigned int nprocs, const char *stats_path)
+{
+  static worker_proc_t procs[MAX_PROCS];
+  // the stats socket and signal_fd
+  struct pollfd pfd[2] = { { .fd = -1, .events = POLLIN },
+                           { .fd = signal_fd, .events = POLLIN } };
+  struct aesdsocket_config new_config;
+  struct timespec now;
+#if (USE_AESD_CHAR_DEVICE == 0)
+  struct timespec next_timestamp;
+  char timestr[128];
+#endif
+  unsigned int i;
+  int status;
+  int timeout;
+  pid_t pid;
+  int rc;
+
+  // mapped before fork() so every worker shares the same pages, the device
+  // keeps the log itself and only the lock is shared then
+  enum aesd_huge_mode huge_mode = USE_AESD_CHAR_DEVICE ? AESD_HUGE_OFF : config.hugepages;
+  shm_log = aesd_shmlog_create(USE_AESD_CHAR_DEVICE ? 0 : SHMLOG_CAPACITY, &huge_mode);
+  if (shm_log == NULL || stats_share() == -1) {
+    LOG(LOG_ERR, "could not set up shared memory for the workers");
+    return -1;
+  }
+  atomic_store(&stats->hugepages, huge_mode);
+  if (!USE_AESD_CHAR_DEVICE && huge_mode != config.hugepages) {
+    LOG(LOG_WARNING, "shared log in %s pages, %s not available",
+        aesd_huge_mode_name(huge_mode), aesd_huge_mode_name(config.hugepages));
+  }
+  atomic_store(&stats->config_generation, 1);
+  // the master serves stats, a thread here would be forked mid-call
+  if (stats_path != NULL && (pfd[0].fd = stats_listen(stats_path)) == -1) {
+    LOG(LOG_ERR, "could not serve stats on %s", stats_path);
+    return -1;
+  }
+  // every worker is woken for a connection and one wins, the others must
+  // find the queue empty instead of blocking in accept()
+  for (i = 0; i < nlistenfds; i++) {
+    fcntl(listenfds[i], F_SETFL, fcntl(listenfds[i], F_GETFL) | O_NONBLOCK);
+  }
+  // daemonize_proc() ignored SIGCHLD, the master waits for its workers
+  if (signal(SIGCHLD, SIG_DFL) == SIG_ERR || signal_watch(SIGCHLD) == -1) {
+    LOG(LOG_ERR, "cannot watch SIGCHLD");
+    return -1;
+  }
+
+  for (i = 0; i < nprocs; i++) {
+    rc = fork_worker(&procs[i]);
+    if (rc != 1) {
+      return rc; // the worker serves, or the master gives up
+    }
+  }
+  aesd_listen_notify("READY=1");
+  LOG(LOG_INFO, "master ready with %u worker processes", nprocs);
+#if (USE_AESD_CHAR_DEVICE == 0)
+  clock_gettime(CLOCK_MONOTONIC, &next_timestamp);
+#endif
+
+  while (!global_abort)
+  {
+    // SIGCHLD on signal_fd woke us when a worker died
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+      for (i = 0; i < nprocs && procs[i].pid != pid; i++);
+      if (i == nprocs) {
+        continue;
+      }
+      if (WIFSIGNALED(status)) {
+        LOG(LOG_ERR, "worker process %d killed by signal %d", pid, WTERMSIG(status));
+      } else {
+        LOG(LOG_ERR, "worker process %d exited with status %d", pid, WEXITSTATUS(status));
+      }
+      atomic_fetch_sub(&stats->procs, 1);
+      atomic_fetch_add(&stats->respawns, 1);
+      // one failing at startup is respawned with a delay, not in a tight loop
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      procs[i].pid = -1;
+      if (now.tv_sec - procs[i].started.tv_sec < RESPAWN_DELAY_S) {
+        now.tv_sec += RESPAWN_DELAY_S;
+      }
+      procs[i].started = now;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (i = 0; i < nprocs; i++) {
+      if (procs[i].pid != -1 || now.tv_sec < procs[i].started.tv_sec) {
+        continue;
+      }
+      rc = fork_worker(&procs[i]);
+      if (rc == 0) {
+        return 0;
+      } else if (rc == -1) {
+        procs[i].started.tv_sec = now.tv_sec + RESPAWN_DELAY_S;
+      }
+    }
+
+    // validated here once, the workers load the same file when forwarded
+    if (reload_flag) {
+      reload_flag = false;
+      new_config = config;
+      if (config_path[0] == '\0') {
+        LOG(LOG_WARNING, "SIGHUP without a config file (-c), nothing to reload");
+      } else if (config_load(config_path, &new_config) == -1) {
+        LOG(LOG_ERR, "config reload failed, keeping generation %lu",
+            atomic_load(&stats->config_generation));
+      } else {
+        setlogmask(LOG_UPTO(new_config.log_level));
+        config = new_config; // respawned workers start with it
+        atomic_fetch_add(&stats->config_generation, 1);
+        for (i = 0; i < nprocs; i++) {
+          if (procs[i].pid != -1) {
+            kill(procs[i].pid, SIGHUP);
+          }
+        }
+      }
+    }
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+    if (now.tv_sec >= next_timestamp.tv_sec) {
+      if (timestamp_format(timestr, sizeof(timestr)) == 0) {
+        file_lock_acquire();
+        rc = aesd_shmlog_append(shm_log, timestr, strlen(timestr));
+        file_lock_release();
+        if (rc == -1) {
+          LOG(LOG_ERR, "shared log full, timestamp dropped");
+        }
+      }
+      next_timestamp.tv_sec += 10;
+    }
+#endif
+
+    // sleep until the next timestamp or respawn, signals wake us earlier
+    timeout = -1;
+#if (USE_AESD_CHAR_DEVICE == 0)
+    timeout = ms_until(&next_timestamp);
+#endif
+    for (i = 0; i < nprocs; i++) {
+      if (procs[i].pid == -1 && (timeout == -1 || ms_until(&procs[i].started) < timeout)) {
+        timeout = ms_until(&procs[i].started);
+      }
+    }
+    if (poll(pfd, 2, timeout) <= 0) {
+      continue;
+    }
+    if (pfd[1].revents & POLLIN) {
+      handle_signals();
+    }
+    if (pfd[0].revents & POLLIN) {
+      stats_serve_one();
+    }
+  } // end while()
+
+  aesd_listen_notify("STOPPING=1");
+  for (i = 0; i < nprocs; i++) {
+    if (procs[i].pid != -1) {
+      kill(procs[i].pid, SIGTERM);
+    }
+  }
+  for (i = 0; i < nprocs; i++) {
+    if (procs[i].pid == -1) {
+      continue;
+    }
+    while (waitpid(procs[i].pid, &status, 0) == -1 && errno == EINTR);
+    atomic_fetch_sub(&stats->procs, 1);
+  }
+  LOG(LOG_INFO, "all worker processes exited");
+
+  if (sockfd != -1 && shutdown(sockfd, SHUT_RDWR) == -1) {
+    LOG(LOG_ERR, "shutdown fail"); perror("shutdown");
+  }
+  for (i = 0; i < nlistenfds; i++) {
+    close(listenfds[i]);
+  }
+  stats_stop();
+  aesd_shmlog_destroy(shm_log);
+  shm_log = NULL;
+  return 1;
+}
+
+
+static void handle_connection(int peerfd) 
+{
+  int size_step = 1024;
+  int recv_buf_size = size_step;
+  char* recv_buf = calloc(size_step, sizeof(char));
+  int recv_buf_nbytes = 0;
+  bool holding_lock = false;
+  char* span_buf = NULL;
+  // this connection's own descriptor, it is closed on errors without the lock
+  int tempfd = -1;
+  // negotiated with AESD_PROTO_HELLO, see aesd-proto.h
+  bool framed = false;
+  bool lz = false;  // compressed replies, framed as well
+  bool first_packet = true;
+  bool corked = false; // while a reply is being sent
+  int span = 0;     // bytes of recv_buf taken by the packets stored next
+  int records = 0;  // packets in those bytes
+  size_t replayed = 0; // log bytes of the reply being sent
+  uint64_t trace_conn = aesd_trace_connection(trace); // 0 without -T
+  uint64_t arrived_us = 0; // when the last bytes were received, with -T
+  conn_entry_t entry;
+  struct aesd_topk_key client;
+  struct sockaddr_storage peer_addr;
+  socklen_t peer_addr_size = sizeof(peer_addr);
+
+  atomic_fetch_add(&stats->active, 1);
+  conn_register(&entry, peerfd);
+  if (trace != NULL) {
+    aesd_trace_record(trace, AESD_TRACE_OPEN, trace_conn, aesd_trace_now(), 0);
+  }
+  // the top-K count the client's address, whatever its port
+  if (getpeername(peerfd, (struct sockaddr *) &peer_addr, &peer_addr_size) == -1 ||
+      aesd_topk_key_from_addr((struct sockaddr *) &peer_addr, &client) == -1) {
+    memset(&client, 0, sizeof(client));
+  }
+  // a large reply waits in its write instead of queueing all of it unsent
+  setsockopt(peerfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+             &(int){REPLY_NOTSENT_LOWAT}, sizeof(int));
+  if (recv_buf == NULL) {
+    LOG(LOG_ERR, "calloc fail"); perror("calloc");
+    goto handle_errors;
+  }
+  
+  // until shutdown, a reply in progress then finishes before the loop ends
+  while(!global_abort) // continuously read/write 
+  {
+    // the last reply is complete, send its partial last segment
+    if (corked) {
+      reply_cork(peerfd, false);
+      corked = false;
+      aesd_topk_add(&stats->top_bytes_out, &client, replayed);
+      if (trace != NULL) {
+        aesd_trace_record(trace, AESD_TRACE_REPLY, trace_conn, aesd_trace_now(),
+                          replayed);
+      }
+      replayed = 0;
+    }
+
+    // a pipelining client may have sent the next packets with the last ones.
+    // On shutdown the read side is shut down and recv() returns 0 at once
+    while((span = packet_span(recv_buf, recv_buf_nbytes, framed, &records)) == 0)
+    {
+      // recv_buf not big enough for another read, need to realloc
+      if (recv_buf_size - recv_buf_nbytes < size_step) {
+        char *grown = realloc(recv_buf, recv_buf_size + size_step);
+        if (grown == NULL) {
+          LOG(LOG_ERR, "realloc fail"); perror("realloc");
+          goto handle_errors;
+        }
+        recv_buf = grown;
+        recv_buf_size += size_step;
+      }
+      int ret = aesd_coro_recv(peerfd, &recv_buf[recv_buf_nbytes],
+                               recv_buf_size - recv_buf_nbytes, 0);
+      if (ret == -1 && errno == ECANCELED) { // coroutine loops are stopping
+        LOG(LOG_INFO, "Server stopping, closing connection");
+        goto handle_errors;
+      } else if (ret == -1 && errno != EINTR) {
+        LOG(LOG_ERR, "recv returned -1"); perror("recv()");
+        goto handle_errors;
+      } else if (ret == 0) { // end of file (peer socket shutdown)
+        LOG(LOG_INFO, "Peer socket shutdown");
+        goto handle_errors;
+      } else if (ret > 0) {
+        recv_buf_nbytes += ret;
+        atomic_fetch_add(&stats->bytes_in, ret);
+        if (trace != NULL) {
+          arrived_us = aesd_trace_now();
+        }
+      }
+    } // end while()
+
+    if (first_packet &&
+        ((span == strlen(AESD_PROTO_HELLO) &&
+          memcmp(recv_buf, AESD_PROTO_HELLO, span) == 0) ||
+         (span == strlen(AESD_PROTO_HELLO_LZ4) &&
+          memcmp(recv_buf, AESD_PROTO_HELLO_LZ4, span) == 0))) {
+      lz = (span == strlen(AESD_PROTO_HELLO_LZ4));
+      LOG(LOG_INFO, "Framed replies negotiated%s", lz ? ", compressed" : "");
+      framed = true;
+      first_packet = false;
+      aesd_trace_record(trace, AESD_TRACE_HELLO, trace_conn, arrived_us,
+                        lz ? AESD_TRACE_FRAMED_LZ4 : 0);
+      // a framed reply ends with a marker the client waits for, do not hold
+      // its tail back until the previous segments are acked
+      setsockopt(peerfd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+      consume_packets(recv_buf, &recv_buf_nbytes, span);
+      const char *ack = lz ? AESD_PROTO_ACK_LZ4 : AESD_PROTO_ACK;
+      if (-1 == write_wrapper(peerfd, (char*) ack, strlen(ack))) {
+        goto handle_errors;
+      }
+      continue;
+    }
+    first_packet = false;
+    if (trace != NULL) {
+      trace_packets(trace_conn, arrived_us, recv_buf, span);
+    }
+
+    // shed the packets rather than queue them behind a standing queue
+    if (!admit_work(false)) {
+      LOG(LOG_INFO, "Overloaded, rejecting %d packet(s)", records);
+      atomic_fetch_add(&stats->shed_packets, records);
+      consume_packets(recv_buf, &recv_buf_nbytes, span);
+      if (!framed) {
+        // a plain reply has no room for an error, the close tells the client
+        write_wrapper(peerfd, AESD_PROTO_BUSY "\n", strlen(AESD_PROTO_BUSY "\n"));
+        goto handle_errors;
+      }
+      char busy[sizeof(AESD_PROTO_BUSY) + 16];
+      int len = snprintf(busy, sizeof(busy), AESD_PROTO_BUSY " %d\n", records);
+      if (-1 == write_wrapper(peerfd, busy, len)) {
+        goto handle_errors;
+      }
+      continue;
+    }
+
+    // a reply takes several writes, its spans and end share segments
+    reply_cork(peerfd, true);
+    corked = true;
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+    if (shm_log != NULL) {
+      // committed bytes never change, so only the append takes the lock and
+      // the log up to and including these packets is sent without it
+      size_t log_size;
+      size_t sent = 0;
+      int rc;
+      request_lock_acquire();
+      rc = aesd_shmlog_append(shm_log, recv_buf, span);
+      log_size = aesd_shmlog_size(shm_log);
+      file_lock_release();
+      if (rc == -1) {
+        LOG(LOG_ERR, "shared log full, %lu bytes", SHMLOG_CAPACITY);
+        goto handle_errors;
+      }
+      atomic_fetch_add(&stats->packets, records);
+      aesd_topk_add(&stats->top_packets, &client, records);
+      aesd_topk_add(&stats->top_bytes_in, &client, span);
+      consume_packets(recv_buf, &recv_buf_nbytes, span);
+      if (lz) {
+        if (-1 == reply_snapshot(peerfd, log_size, shm_log_read, NULL) ||
+            -1 == reply_end(peerfd, records)) {
+          goto handle_errors;
+        }
+        replayed = log_size;
+        continue;
+      }
+      int chunk_size = __atomic_load_n(&config.send_chunk, __ATOMIC_RELAXED);
+      // gathered straight from the shared log, nothing is copied
+      while (sent < log_size) {
+        size_t nsend = (log_size - sent < REPLY_SPAN) ? log_size - sent : REPLY_SPAN;
+        if (-1 == reply_span(peerfd, aesd_shmlog_data(shm_log) + sent, nsend,
+                             chunk_size, framed)) {
+          goto handle_errors;
+        }
+        sent += nsend;
+      }
+      if (framed && -1 == reply_end(peerfd, records)) {
+        goto handle_errors;
+      }
+      replayed = log_size;
+      continue;
+    }
+#endif
+
+    // write to file
+    // wait for the lock
+    request_lock_acquire();
+    holding_lock = true;
+    tempfd = open(TEMPFILE, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (tempfd == -1) {
+      LOG(LOG_ERR, "open() returned -1"); perror("open()");
+      goto handle_errors;
+    }
+    if (-1 == write_wrapper(tempfd, recv_buf, span)) {
       goto handle_errors;
     } 
+    atomic_fetch_add(&stats->packets, records);
+    aesd_topk_add(&stats->top_packets, &client, records);
+    aesd_topk_add(&stats->top_bytes_in, &client, span);
+    consume_packets(recv_buf, &recv_buf_nbytes, span);
 
     // echo entire file contents to socket
 #if (USE_AESD_CHAR_DEVICE == 0)
+    // the file only grows, its blocks are compressed once for everyone
+    if (lz) {
+      off_t log_size = lseek(tempfd, 0, SEEK_END);
+      if (log_size == -1 ||
+          -1 == reply_snapshot(peerfd, log_size, tempfile_read, &tempfd) ||
+          -1 == reply_end(peerfd, records)) {
+        goto handle_errors;
+      }
+      replayed = log_size;
+      close(tempfd);
+      tempfd = -1;
+      file_lock_release();
+      holding_lock = false;
+      continue;
+    }
     lseek(tempfd, 0, SEEK_SET);
 #else 
     // close and re-open tempfd to get file position of 0
@@ -449,96 +1602,410 @@ void* connection_thread(void* tparams)
       LOG(LOG_ERR, "open() returned -1"); perror("open()");
       goto handle_errors;
     }
+    // the device holds a few writes at most, it is copied out under the
+    // lock and sent without it.  The lock of -P is a process-shared mutex,
+    // a coroutine of -L yielding in a write while holding it would block
+    // its thread on the next coroutine to take it
+    size_t log_size;
+    span_buf = read_device(tempfd, &log_size);
+    if (span_buf == NULL) {
+      goto handle_errors;
+    }
+    close(tempfd);
+    tempfd = -1;
+    file_lock_release();
+    holding_lock = false;
+    // the device drops its oldest writes, so nothing is cached
+    if (lz) {
+      if (-1 == reply_stream_lz(peerfd, span_buf, log_size) ||
+          -1 == reply_end(peerfd, records)) {
+        goto handle_errors;
+      }
+    } else {
+      // spans of whole chunks, only the last chunk of a framed reply is short
+      int chunk_size = __atomic_load_n(&config.send_chunk, __ATOMIC_RELAXED);
+      size_t span_size = (REPLY_SPAN > chunk_size) ? REPLY_SPAN / chunk_size * chunk_size
+                                                   : chunk_size;
+      size_t sent = 0;
+      while (sent < log_size) {
+        size_t nsend = (log_size - sent < span_size) ? log_size - sent : span_size;
+        if (-1 == reply_span(peerfd, span_buf + sent, nsend, chunk_size, framed)) {
+          goto handle_errors;
+        }
+        sent += nsend;
+      }
+      if (framed && -1 == reply_end(peerfd, records)) {
+        goto handle_errors;
+      }
+    }
+    replayed = log_size;
+    free(span_buf);
+    span_buf = NULL;
+    continue;
 #endif 
-    int chunk_size = 256;
-    char chunk[chunk_size];
+    // may change with a reload, a send in progress keeps the size it started
+    // with.  On the heap, coroutine stacks are smaller than a span.  A span
+    // holds whole chunks so only the last chunk of a framed reply is short
+    int chunk_size = __atomic_load_n(&config.send_chunk, __ATOMIC_RELAXED);
+    int span_size = (REPLY_SPAN > chunk_size) ? REPLY_SPAN / chunk_size * chunk_size
+                                              : chunk_size;
     int nread = -1;
+    int len;
+    span_buf = malloc(span_size);
+    if (span_buf == NULL) {
+      LOG(LOG_ERR, "malloc fail"); perror("malloc");
+      goto handle_errors;
+    }
 
-    while (!global_abort) 
-    {
-      nread = read(tempfd, chunk, chunk_size);
-      if (nread == -1 && errno != EINTR) {
+    do {
+      // fill the span
+      for (len = 0; len < span_size; len += nread) {
+        nread = read(tempfd, span_buf + len, span_size - len);
+        if (nread == -1 && errno == EINTR) {
+          nread = 0;
+          continue;
+        } else if (nread <= 0) {
+          break;
+        }
+      }
+      if (nread == -1) {
         LOG(LOG_ERR, "read() returned -1"); perror("read()");
         LOG(LOG_ERR, "fd %d", tempfd);
         goto handle_errors;
-      } else if (nread == 0) {
-        LOG(LOG_INFO, "EOF detected, socket send complete");
-        break;
       }
-      if (-1 == write_wrapper(peerfd, chunk, nread)) {
+      if (len > 0 && -1 == reply_span(peerfd, span_buf, len, chunk_size, framed)) {
         goto handle_errors;
       }
-    } // end while()
+      replayed += len;
+    } while (nread > 0);
+    LOG(LOG_INFO, "EOF detected, socket send complete");
+    if (framed && -1 == reply_end(peerfd, records)) {
+      goto handle_errors;
+    }
 
+    free(span_buf);
+    span_buf = NULL;
     close(tempfd);
-    pthread_mutex_unlock(&file_lock);
+    tempfd = -1;
+    file_lock_release();
+    holding_lock = false;
 
   } // end while()
 
-  *status = COMPLETED;
+  free(recv_buf);
+  if (trace != NULL)
+    aesd_trace_record(trace, AESD_TRACE_CLOSE, trace_conn, aesd_trace_now(), 0);
+  conn_unregister(&entry);
   shutdown(peerfd, SHUT_RDWR);
   close(peerfd);
-  pthread_exit(params);
+  atomic_fetch_sub(&stats->active, 1);
+  return;
 
 handle_errors:
   if (recv_buf != NULL)
     free(recv_buf);
-  pthread_mutex_unlock(&file_lock);
+  // only release what we hold, the spinning locks cannot tolerate a stray release
+  free(span_buf);
+  if (holding_lock)
+    file_lock_release();
+  if (trace != NULL)
+    aesd_trace_record(trace, AESD_TRACE_CLOSE, trace_conn, aesd_trace_now(), 0);
+  conn_unregister(&entry);
   shutdown(peerfd, SHUT_RDWR);
   close(peerfd);
-  close(tempfd);
-  *status = COMPLETED;
-  pthread_exit(params);
+  if (tempfd != -1)
+    close(tempfd);
+  atomic_fetch_sub(&stats->active, 1);
 
-} // end connection_thread
+} // end handle_connection
 
-void* timestamp_thread(void *param) 
+static int timestamp_format(char *timestr, size_t size)
 {
-  char timestr[128];
   struct tm *timestamp;
   time_t t;
-  struct timespec start_time = { 0, 0 };
+
+  memset(timestr, 0, size);
+  t = time(NULL);
+  timestamp = localtime(&t);
+  if (timestamp == NULL) {
+    LOG(LOG_ERR, "localtime returned NULL");
+    return -1;
+  }
+  if(strftime(timestr, size, 
+     "timestamp:%a, %d %b %Y %T %z\n", timestamp) == 0) {
+    LOG(LOG_ERR, "strftime returned 0");
+    return -1;
+  }
+  return 0;
+}
+
+static int packet_span(const char *buf, int nbytes, bool all, int *records)
+{
+  const char *p = buf;
+  int span = 0;
+
+  *records = 0;
+  while ((p = memchr(p, '\n', buf + nbytes - p)) != NULL) {
+    span = ++p - buf;
+    (*records)++;
+    if (!all) {
+      break;
+    }
+  }
+  return span;
+}
+
+
+static void trace_packets(uint64_t conn, uint64_t arrived_us, const char *buf,
+                          int span)
+{
+  const char *start = buf;
+  const char *end;
+
+  // each packet ends with a newline, a client pipelining them sent them by
+  // the time of the receive which completed the last
+  while ((end = memchr(start, '\n', buf + span - start)) != NULL) {
+    aesd_trace_record(trace, AESD_TRACE_PACKET, conn, arrived_us, end + 1 - start);
+    start = end + 1;
+  }
+}
+
+
+static void consume_packets(char *buf, int *nbytes, int span)
+{
+  *nbytes -= span;
+  memmove(buf, buf + span, *nbytes);
+}
+
+
+static int writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+  ssize_t written;
+
+  while (iovcnt > 0) {
+    written = aesd_coro_writev(fd, iov, iovcnt);
+    if (written == -1 && errno == EINTR) {
+      continue;
+    } else if (written == -1) {
+      LOG(LOG_ERR, "writev() returned -1"); perror("writev()");
+      LOG(LOG_ERR, "fd %d", fd);
+      return -1;
+    }
+    atomic_fetch_add(&stats->reply_writes, 1);
+    // drop the iovecs written whole, a partial one keeps its tail
+    while (iovcnt > 0 && (size_t) written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char*) iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return 0;
+}
+
+
+static int reply_span(int peerfd, const char *data, size_t len, int chunk_size,
+                      bool framed)
+{
+  struct iovec iov[REPLY_IOV];
+  char hdr[REPLY_IOV / 2][AESD_PROTO_CHUNK_HDR_MAX + 1];
+  size_t sent = 0;
+  size_t nsend;
+  int n;
+
+  if (!framed) {
+    iov[0].iov_base = (char*) data;
+    iov[0].iov_len = len;
+    if (-1 == writev_all(peerfd, iov, 1)) {
+      return -1;
+    }
+    sent = len;
+  }
+  while (sent < len) {
+    // each chunk behind its header, straight from data
+    for (n = 0; n < REPLY_IOV && sent < len; n += 2) {
+      nsend = (len - sent < (size_t) chunk_size) ? len - sent : (size_t) chunk_size;
+      iov[n].iov_base = hdr[n / 2];
+      iov[n].iov_len = snprintf(hdr[n / 2], sizeof(hdr[0]), "%zu\n", nsend);
+      iov[n + 1].iov_base = (char*) data + sent;
+      iov[n + 1].iov_len = nsend;
+      sent += nsend;
+    }
+    if (-1 == writev_all(peerfd, iov, n)) {
+      return -1;
+    }
+  }
+  atomic_fetch_add(&stats->bytes_out, len);
+  return 0;
+}
+
+
+static void reply_cork(int peerfd, bool on)
+{
+  // best effort, an uncorked reply is only sent in more segments
+  setsockopt(peerfd, IPPROTO_TCP, TCP_CORK, &(int){on}, sizeof(int));
+}
+
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+static const char *shm_log_read(void *ctx, char *scratch, size_t len, size_t offset)
+{
+  return aesd_shmlog_data(shm_log) + offset;
+}
+
+
+static const char *tempfile_read(void *ctx, char *scratch, size_t len, size_t offset)
+{
+  int fd = *(int*) ctx;
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < len) {
+    n = pread(fd, scratch + done, len - done, offset + done);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      LOG(LOG_ERR, "pread() returned %zd", n); perror("pread()");
+      return NULL;
+    }
+    done += n;
+  }
+  return scratch;
+}
+
+
+static int reply_snapshot(int peerfd, size_t log_size, snapshot_read_fn read_fn,
+                          void *ctx)
+{
+  struct snapshot_block *block;
+  size_t offset;
   int rc;
 
+  for (offset = 0; offset < log_size; offset += SNAPSHOT_BLOCK) {
+    block = snapshot_get(offset, log_size, read_fn, ctx);
+    if (block == NULL) {
+      LOG(LOG_ERR, "could not compress the log at %zu", offset);
+      return -1;
+    }
+    rc = writev_all(peerfd, &(struct iovec){ block->wire, block->wire_len }, 1);
+    atomic_fetch_add(&stats->bytes_out, block->wire_len);
+    atomic_fetch_add(&stats->lz_bytes_raw, block->rawlen);
+    atomic_fetch_add(&stats->lz_bytes_wire, block->wire_len);
+    snapshot_put(block);
+    if (rc == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+#else
+
+
+static char *read_device(int fd, size_t *len)
+{
+  size_t size = REPLY_SPAN;
+  char *buf = malloc(size);
+  ssize_t n = 1;
+
+  *len = 0;
+  while (buf != NULL) {
+    if (*len == size) {
+      char *grown = realloc(buf, 2 * size);
+      if (grown == NULL) {
+        free(buf);
+        buf = NULL;
+        break;
+      }
+      buf = grown;
+      size *= 2;
+    }
+    // a read returns one device entry at most
+    n = read(fd, buf + *len, size - *len);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1) {
+      LOG(LOG_ERR, "read() returned -1"); perror("read()");
+      free(buf);
+      return NULL;
+    } else if (n == 0) {
+      return buf;
+    }
+    *len += n;
+  }
+  LOG(LOG_ERR, "malloc fail"); perror("malloc");
+  return NULL;
+}
+
+
+static int reply_stream_lz(int peerfd, const char *data, size_t len)
+{
+  struct snapshot_block *block;
+  size_t offset;
+  size_t n;
+  int rc = 0;
+
+  for (offset = 0; offset < len && rc == 0; offset += n) {
+    n = (len - offset < SNAPSHOT_BLOCK) ? len - offset : SNAPSHOT_BLOCK;
+    block = snapshot_compress(data + offset, n);
+    if (block == NULL) {
+      return -1;
+    }
+    rc = writev_all(peerfd, &(struct iovec){ block->wire, block->wire_len }, 1);
+    atomic_fetch_add(&stats->bytes_out, block->wire_len);
+    atomic_fetch_add(&stats->lz_bytes_raw, block->rawlen);
+    atomic_fetch_add(&stats->lz_bytes_wire, block->wire_len);
+    snapshot_put(block);
+  }
+  return rc;
+}
+#endif
+
+
+static int reply_end(int peerfd, int records)
+{
+  char end[32];
+  int len = snprintf(end, sizeof(end), "0 %d\n", records);
+
+  return write_wrapper(peerfd, end, len);
+}
+
+
+void* timestamp_thread(void *param) 
+{
+  char timestr[128];
+  struct timespec start_time = { 0, 0 };
+
   while(!global_abort) 
   {
       if (-1 == clock_gettime(CLOCK_MONOTONIC, &start_time)) {
         LOG(LOG_ERR, "clock gettime returned -1"); perror("clock_gettime");
       }
-      memset(timestr, 0, 128);
-      t = time(NULL);
-      timestamp = localtime(&t);
-      if (timestamp == NULL) {
-        LOG(LOG_ERR, "localtime returned NULL");
+      if (timestamp_format(timestr, sizeof(timestr)) == -1) {
         pthread_exit(NULL);
       }
-      if(strftime(timestr, sizeof(timestr), 
-         "timestamp:%a, %d %b %Y %T %z\n", timestamp) == 0) {
-        LOG(LOG_ERR, "strftime returned 0");
-        pthread_exit(NULL);
-      }
-      pthread_mutex_lock(&file_lock);
+      file_lock_acquire();
       tempfd = open(TEMPFILE, O_RDWR | O_CREAT | O_APPEND, 0644);
       if (tempfd == -1) {
         LOG(LOG_ERR, "open() returned -1"); perror("open()");
-        pthread_mutex_unlock(&file_lock);
+        file_lock_release();
         break;
       }
       if (-1 == write_wrapper(tempfd, timestr, strlen(timestr))) {
         LOG(LOG_ERR, "timestamp_thread write_wrapper fail");
-        pthread_mutex_unlock(&file_lock);
+        file_lock_release();
         break;
       }
       close(tempfd);
-      pthread_mutex_unlock(&file_lock);
+      // a stale number would be closed again by main, by then maybe a socket
+      tempfd = -1;
+      file_lock_release();
       start_time.tv_sec += 10;
-      if ( (rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &start_time, NULL)) != 0) {
-        if (errno == EINTR) { // signal handler interrupt
-          break;
-        }
-        else {
-          LOG(LOG_ERR, "clock_nanosleep error %d", rc);
-        }
+      // woken through abort_fd as soon as shutdown starts
+      if (wait_abort(&start_time)) {
+        break;
       }
   } // end while()
 
@@ -546,6 +2013,34 @@ void* timestamp_thread(void *param)
 }
 
 
+static void print_usage(const char *progname)
+{
+  printf("Usage: %s [options]\n", progname);
+  printf("Options: \n");
+  printf("\t -d \t\t Run application as a daemon\n");
+  printf("\t -l <lock> \t File lock implementation: mutex, ticket, mcs or adaptive"
+         " (default %s)\n", FILE_LOCK_DEFAULT);
+  printf("\t -w <workers> \t Serve connections from a pool of <workers> threads\n"
+         "\t\t\t instead of a thread per connection. At most <workers>\n"
+         "\t\t\t connections are serviced at once, the rest wait in queue\n");
+  printf("\t -c <file> \t Read tunables from <file> (workers, log_level,\n"
+         "\t\t\t send_chunk, shed_target_ms, shed_interval_ms,\n"
+         "\t\t\t shutdown_grace_ms, hugepages), overriding the options\n"
+         "\t\t\t above. Reloaded on SIGHUP without interrupting\n"
+         "\t\t\t connections. send_chunk is the largest chunk of a\n"
+         "\t\t\t framed reply, plain replies are sent in 64K spans\n");
+  printf("\t -S <path> \t Serve counters on unix socket <path>\n");
+  printf("\t -L <loops> \t Serve connections as coroutines on <loops> epoll\n"
+         "\t\t\t threads, one per core, instead of -w or threads\n");
+  printf("\t -P <procs> \t Serve connections from <procs> worker processes,\n"
+         "\t\t\t respawned when they die, each as set by the options\n"
+         "\t\t\t above. The log is kept in shared memory\n");
+  printf("\t -T <file> \t Record the traffic to <file>, connections and the\n"
+         "\t\t\t sizes and times of packets but not their content,\n"
+         "\t\t\t for aesdtrace-replay\n");
+}
+
+
 static int daemonize_proc() 
 {
   // ignore signals
@@ -582,8 +2077,11 @@ static int write_wrapper(int fd, char* writestr, int len)
 {
   int written = 0;
   while(len) {
-    written = write(fd, writestr, len);
-    if (written == -1 && errno != EINTR) {
+    // parks a coroutine while the socket is full, a plain write() otherwise
+    written = aesd_coro_write(fd, writestr, len);
+    if (written == -1 && errno == EINTR) {
+      continue;
+    } else if (written == -1) {
       LOG(LOG_ERR, "write() returned -1"); perror("write()");
       LOG(LOG_ERR, "fd %d", fd); 
       return -1;
@@ -595,34 +2093,242 @@ static int write_wrapper(int fd, char* writestr, int len)
   return 0; 
 }
 
-static char *get_ip_str(const struct sockaddr_in *sa, char *dst) 
+static char *get_ip_str(const struct sockaddr *sa, char *dst) 
 {
   if (dst == NULL)
     return NULL;
 
-  inet_ntop(AF_INET, &(sa->sin_addr), dst, INET_ADDRSTRLEN);
+  if (sa->sa_family == AF_INET6) {
+    inet_ntop(AF_INET6, &((const struct sockaddr_in6 *) sa)->sin6_addr, dst,
+              INET6_ADDRSTRLEN);
+  } else {
+    inet_ntop(AF_INET, &((const struct sockaddr_in *) sa)->sin_addr, dst,
+              INET6_ADDRSTRLEN);
+  }
   return dst;
 }
 
 
+static int open_listen_socket()
+{
+  int rc;
+  int fd;
+  struct addrinfo* server_addr = NULL;
+
+  // initialize hints struct
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_flags    = AI_PASSIVE;   // fills in IP address automatically
+  hints.ai_family   = AF_INET;      // IPV4 or IPV6 
+  hints.ai_socktype = SOCK_STREAM;  // TCP stream
+
+  // get addrinfo
+  rc = getaddrinfo( NULL,           // ip to connect to (NULL for loopback) 
+                    PORT,         // port per A5 requirements
+                    &hints,         // hints, populated above
+                    &server_addr    // return address for linked list
+                    );
+  if (rc != 0) {
+    LOG(LOG_ERR, "getaddrinfo returned !=0"); perror("getaddrinfo()");
+    return -1;
+  }
+
+  // open socket associated with getaddrinfo
+  fd = socket(server_addr->ai_family, server_addr->ai_socktype | SOCK_CLOEXEC,
+              server_addr->ai_protocol);
+  if (fd == -1) {
+    LOG(LOG_ERR, "socket returned -1"); perror("socket()");
+    goto handle_errors;
+  }
+
+  // set socket options
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) < 0 ) {
+    perror("setsockopt()");
+    goto handle_errors;
+  } 
+
+  // bind socket to the server_addr returned from getaddrinfo
+  rc = bind(fd, server_addr->ai_addr, server_addr->ai_addrlen );
+  if (rc == -1) {
+    LOG(LOG_ERR, "bind returned -1"); perror("bind()");
+    goto handle_errors;
+  }
+  freeaddrinfo(server_addr); // no longer needed as we have fd 
+
+  // listen on the socket, a full backlog absorbs connection bursts
+  rc = listen(fd, SOMAXCONN);
+  if (rc == -1)  {
+    LOG(LOG_ERR, "listen returned -1"); perror("listen()");
+    close(fd);
+    return -1;
+  } 
+  return fd;
+
+handle_errors:
+  if (fd != -1)
+    close(fd);
+  freeaddrinfo(server_addr);
+  return -1;
+}
+
+
 static int register_signal_handlers() 
 {
-  // register signal handlers
-  if (signal(SIGINT, signal_handler) == SIG_ERR) {
-    LOG(LOG_ERR, "cannot register SIGINT"); 
+  // the other threads are created later and inherit the blocked signals,
+  // so they arrive on signal_fd only
+  abort_fd = eventfd(0, EFD_CLOEXEC);
+  if (abort_fd == -1) {
+    LOG(LOG_ERR, "eventfd fail"); perror("eventfd");
+    return -1;
+  }
+  if (signal_watch(SIGINT) == -1) {
+    LOG(LOG_ERR, "cannot watch SIGINT"); 
+    return -1;
+  }
+  if (signal_watch(SIGTERM) == -1) {
+    LOG(LOG_ERR, "cannot watch SIGTERM"); 
+    return -1;
+  }
+  // a client which gives up, e.g. on a loaded server, fails our write with
+  // EPIPE instead of killing the process
+  if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+    LOG(LOG_ERR, "cannot ignore SIGPIPE");
+    return -1;
+  }
+  return 0;
+}
+
+
+static int signal_watch(int signo)
+{
+  static sigset_t watched;
+  sigset_t one;
+  int fd;
+
+  if (signal_fd == -1) {
+    sigemptyset(&watched);
+  }
+  sigemptyset(&one);
+  sigaddset(&one, signo);
+  sigaddset(&watched, signo);
+  if (pthread_sigmask(SIG_BLOCK, &one, NULL) != 0) {
     return -1;
   }
-  if (signal(SIGTERM, signal_handler) == SIG_ERR) {
-    LOG(LOG_ERR, "cannot register SIGTERM"); 
+  // an existing signal_fd is updated in place, pollers keep their fd
+  fd = signalfd(signal_fd, &watched, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd == -1) {
     return -1;
   }
+  signal_fd = fd;
   return 0;
 }
 
 
-static void signal_handler(int signo)
+static void handle_signals(void)
+{
+  struct signalfd_siginfo info;
+
+  while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+    if (info.ssi_signo == SIGCHLD) { // only wakes the -P master to reap
+      continue;
+    }
+    if (info.ssi_signo == SIGHUP) {
+      reload_flag = true;
+      continue;
+    }
+    // a signal handler could not log, we can
+    LOG(LOG_WARNING, "Caught signal %d, setting abort flag", info.ssi_signo);
+    global_abort = true;
+    eventfd_write(abort_fd, 1);
+  }
+}
+
+
+static int ms_until(const struct timespec *deadline)
+{
+  struct timespec now;
+  long long ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ns = (deadline->tv_sec - now.tv_sec) * 1000000000LL + (deadline->tv_nsec - now.tv_nsec);
+  if (ns <= 0) {
+    return 0;
+  }
+  return (ns + 999999) / 1000000;
+}
+
+
+static bool wait_abort(const struct timespec *deadline)
+{
+  struct pollfd pfd = { .fd = abort_fd, .events = POLLIN };
+  int rc;
+
+  // abort_fd is never read, it stays readable for every waiter
+  while ((rc = poll(&pfd, 1, ms_until(deadline))) != 0) {
+    if (rc > 0) {
+      return true;
+    }
+  }
+  return global_abort;
+}
+
+
+static void conn_register(conn_entry_t *entry, int peerfd)
+{
+  entry->peerfd = peerfd;
+  pthread_mutex_lock(&conn_list_lock);
+  TAILQ_INSERT_TAIL(&conn_list, entry, entries);
+  // queued for a worker and picked up after conn_drain() went over the list
+  if (conn_draining) {
+    shutdown(peerfd, SHUT_RD);
+  }
+  pthread_mutex_unlock(&conn_list_lock);
+}
+
+
+static void conn_unregister(conn_entry_t *entry)
+{
+  pthread_mutex_lock(&conn_list_lock);
+  TAILQ_REMOVE(&conn_list, entry, entries);
+  if (TAILQ_EMPTY(&conn_list)) {
+    pthread_cond_signal(&conn_list_empty);
+  }
+  pthread_mutex_unlock(&conn_list_lock);
+}
+
+
+static void conn_drain(unsigned int grace_ms)
 {
-  LOG(LOG_WARNING, "Caught signal, setting abort flag");
-  global_abort = true;
-} // end signal_handler
+  struct timespec deadline;
+  conn_entry_t *entry;
+  int rc = 0;
+  int cut = 0;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += grace_ms / 1000;
+  deadline.tv_nsec += (grace_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
 
+  pthread_mutex_lock(&conn_list_lock);
+  conn_draining = true;
+  // the listed fds stay open while we hold the lock, their owners
+  // unregister before closing them
+  TAILQ_FOREACH(entry, &conn_list, entries) {
+    shutdown(entry->peerfd, SHUT_RD);
+  }
+  while (!TAILQ_EMPTY(&conn_list) && rc != ETIMEDOUT) {
+    rc = pthread_cond_timedwait(&conn_list_empty, &conn_list_lock, &deadline);
+  }
+  TAILQ_FOREACH(entry, &conn_list, entries) {
+    shutdown(entry->peerfd, SHUT_RDWR);
+    cut++;
+  }
+  pthread_mutex_unlock(&conn_list_lock);
+  if (cut > 0) {
+    LOG(LOG_WARNING, "%d repl%s cut short after the %u ms grace period",
+        cut, cut == 1 ? "y" : "ies", grace_ms);
+  }
+}
@@ -0,0 +1,79 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../examples/systemcalls/systemcalls-batch.h"
+
+#define NCOMMANDS (32)
+
+static char * const true_cmd[] = { "/bin/true", NULL };
+static char * const false_cmd[] = { "/bin/false", NULL };
+static char * const echo_cmd[] = { "/bin/echo", "batch", NULL };
+// not a full path, execv fails in the child
+static char * const relative_cmd[] = { "echo", "batch", NULL };
+
+void test_exec_batch_all_succeed()
+{
+    char * const *commands[NCOMMANDS];
+    bool results[NCOMMANDS];
+    int i;
+
+    for (i = 0; i < NCOMMANDS; i++) {
+        commands[i] = (i % 2) ? echo_cmd : true_cmd;
+        results[i] = false;
+    }
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_batch(commands, NCOMMANDS, results, 4),
+                             "a batch of succeeding commands failed");
+    for (i = 0; i < NCOMMANDS; i++) {
+        TEST_ASSERT_TRUE_MESSAGE(results[i], "a succeeding command reported failure");
+    }
+    // one worker per CPU, and no results wanted
+    TEST_ASSERT_TRUE(do_exec_batch(commands, NCOMMANDS, NULL, 0));
+}
+
+void test_exec_batch_reports_each_failure()
+{
+    char * const *commands[NCOMMANDS];
+    bool results[NCOMMANDS];
+    int i;
+
+    for (i = 0; i < NCOMMANDS; i++) {
+        if (i % 8 == 3) {
+            commands[i] = false_cmd;
+        } else if (i % 8 == 5) {
+            commands[i] = relative_cmd;
+        } else {
+            commands[i] = true_cmd;
+        }
+    }
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_batch(commands, NCOMMANDS, results, 3),
+                              "a batch with failing commands succeeded");
+    for (i = 0; i < NCOMMANDS; i++) {
+        TEST_ASSERT_EQUAL_INT_MESSAGE(!(i % 8 == 3 || i % 8 == 5), results[i],
+                                      "a result is not the one of its command");
+    }
+}
+
+void test_exec_batch_runs_concurrently()
+{
+    char * const sleep_cmd[] = { "/bin/sleep", "0.5", NULL };
+    char * const *commands[4] = { sleep_cmd, sleep_cmd, sleep_cmd, sleep_cmd };
+    struct timespec start;
+    struct timespec end;
+    double elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_TRUE(do_exec_batch(commands, 4, NULL, 4));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    // one after the other they would take 2 s
+    TEST_ASSERT_TRUE_MESSAGE(elapsed < 1.5, "the commands of a batch did not overlap");
+}
+
+void test_exec_batch_empty()
+{
+    TEST_ASSERT_TRUE(do_exec_batch(NULL, 0, NULL, 0));
+}
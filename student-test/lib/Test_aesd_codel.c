@@ -0,0 +1,96 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "../../lib/aesd-codel.h"
+
+#define TARGET_MS (5)
+#define INTERVAL_MS (20)
+#define NS_PER_MS (1000000ULL)
+
+static struct aesd_codel codel;
+
+/*
+ * @brief  reports a delay of delay_ms every ms for ms milliseconds
+ * @return true if every request was admitted meanwhile
+ */
+static bool load(unsigned int delay_ms, unsigned int ms)
+{
+    uint64_t end = aesd_codel_now() + ms * NS_PER_MS;
+    bool admitted = true;
+
+    while (aesd_codel_now() < end) {
+        admitted = aesd_codel_admit(&codel) && admitted;
+        aesd_codel_sample(&codel, delay_ms * NS_PER_MS);
+        usleep(1000);
+    }
+    return admitted;
+}
+
+/*
+ * @brief  lets the current interval end without any delay reported
+ */
+static void idle(void)
+{
+    usleep((INTERVAL_MS + 5) * 1000);
+}
+
+void test_codel_below_target()
+{
+    aesd_codel_init(&codel, TARGET_MS, INTERVAL_MS);
+    // a queue with waits below target over several intervals
+    TEST_ASSERT_TRUE_MESSAGE(load(TARGET_MS - 1, 4 * INTERVAL_MS),
+                             "shed while the delay stayed below target");
+    // some waits above target, but not a whole interval of them
+    TEST_ASSERT_TRUE(load(TARGET_MS * 4, INTERVAL_MS / 4));
+    TEST_ASSERT_TRUE(load(TARGET_MS - 1, INTERVAL_MS / 2));
+    TEST_ASSERT_TRUE(load(TARGET_MS * 4, INTERVAL_MS / 4));
+    TEST_ASSERT_TRUE(load(TARGET_MS - 1, 2 * INTERVAL_MS));
+}
+
+void test_codel_sheds_above_target()
+{
+    aesd_codel_init(&codel, TARGET_MS, INTERVAL_MS);
+    // a standing queue, whole intervals of waits above target
+    load(TARGET_MS * 2, 2 * INTERVAL_MS + 5);
+    TEST_ASSERT_FALSE_MESSAGE(aesd_codel_admit(&codel),
+                              "admitted after a whole interval above target");
+    TEST_ASSERT_EQUAL_UINT64(TARGET_MS * 2 * 1000, aesd_codel_delay_us(&codel));
+    TEST_ASSERT_FALSE(load(TARGET_MS * 2, INTERVAL_MS));
+}
+
+void test_codel_recovers()
+{
+    aesd_codel_init(&codel, TARGET_MS, INTERVAL_MS);
+    load(TARGET_MS * 2, 2 * INTERVAL_MS + 5);
+    TEST_ASSERT_FALSE(aesd_codel_admit(&codel));
+
+    // the queue drained: the interval in progress still holds its last
+    // waits, the next one has none
+    idle();
+    aesd_codel_admit(&codel);
+    idle();
+    TEST_ASSERT_TRUE_MESSAGE(aesd_codel_admit(&codel), "still shedding after the queue drained");
+    TEST_ASSERT_EQUAL_UINT64(0, aesd_codel_delay_us(&codel));
+
+    // overloaded again, then one short wait in an interval is enough
+    load(TARGET_MS * 2, 2 * INTERVAL_MS + 5);
+    TEST_ASSERT_FALSE(aesd_codel_admit(&codel));
+    aesd_codel_sample(&codel, NS_PER_MS);
+    idle();
+    TEST_ASSERT_TRUE_MESSAGE(aesd_codel_admit(&codel), "still shedding after a short wait");
+}
+
+void test_codel_disabled()
+{
+    aesd_codel_init(&codel, 0, INTERVAL_MS);
+    TEST_ASSERT_TRUE_MESSAGE(load(1000, 3 * INTERVAL_MS), "shed with a target of 0");
+    TEST_ASSERT_TRUE(aesd_codel_admit(&codel));
+
+    // disabling an overloaded controller admits at once
+    aesd_codel_set(&codel, TARGET_MS, INTERVAL_MS);
+    load(TARGET_MS * 2, 2 * INTERVAL_MS + 5);
+    TEST_ASSERT_FALSE(aesd_codel_admit(&codel));
+    aesd_codel_set(&codel, 0, INTERVAL_MS);
+    TEST_ASSERT_TRUE(aesd_codel_admit(&codel));
+}
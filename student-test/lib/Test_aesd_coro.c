@@ -0,0 +1,232 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "../../lib/aesd-coro.h"
+
+#define NWAITERS (3)
+#define ROUNDS (3)
+
+// one loop, so the coroutines below run one at a time in a known order
+static struct aesd_coro_sched *sched;
+static char order[64];
+static size_t norder;
+
+static struct aesd_coro_mutex mutex;
+static int pipe_fds[2];
+static atomic_int parked;
+static atomic_int woken;
+static atomic_int others_ran;
+static int wait_rc[NWAITERS];
+static int wait_errno[NWAITERS];
+
+static void record(char c)
+{
+    if (norder < sizeof(order) - 1) {
+        order[norder++] = c;
+    }
+}
+
+/*
+ * @brief  waits up to 2 s for *counter to reach value
+ * @return true if it did
+ */
+static bool wait_for(atomic_int *counter, int value)
+{
+    int i;
+
+    for (i = 0; i < 2000 && atomic_load(counter) < value; i++) {
+        usleep(1000);
+    }
+    return atomic_load(counter) >= value;
+}
+
+/*
+ * @brief  waits up to 2 s for every coroutine of sched to return
+ * @return true if they did
+ */
+static bool wait_idle(void)
+{
+    int i;
+
+    for (i = 0; i < 2000 && aesd_coro_count(sched) > 0; i++) {
+        usleep(1000);
+    }
+    return aesd_coro_count(sched) == 0;
+}
+
+static void yielder(void *arg)
+{
+    int round;
+
+    for (round = 0; round < ROUNDS; round++) {
+        record(*(const char *) arg);
+        aesd_coro_yield();
+    }
+}
+
+static void spawner(void *arg)
+{
+    static const char names[] = "abc";
+    int i;
+
+    (void) arg;
+    // spawned from the loop itself, they are queued in this order
+    for (i = 0; i < 3; i++) {
+        aesd_coro_spawn(sched, yielder, (void *) &names[i]);
+    }
+}
+
+void test_coro_spawn_yield_order()
+{
+    sched = aesd_coro_create(1, 0);
+    TEST_ASSERT_NOT_NULL(sched);
+    norder = 0;
+    memset(order, 0, sizeof(order));
+    TEST_ASSERT_EQUAL_INT(0, aesd_coro_spawn(sched, spawner, NULL));
+    // a stopping scheduler spawns nothing more, so only destroy once idle
+    TEST_ASSERT_TRUE(wait_idle());
+    aesd_coro_destroy(sched);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("abcabcabc", order,
+                                     "yielding coroutines did not take turns");
+    TEST_ASSERT_FALSE(aesd_coro_running());
+}
+
+static void pipe_reader(void *arg)
+{
+    char c = 0;
+
+    (void) arg;
+    // no asserts on a coroutine stack, the main thread checks the counters
+    if (!aesd_coro_running()) {
+        return;
+    }
+    atomic_fetch_add(&parked, 1);
+    if (aesd_coro_wait_fd(pipe_fds[0], EPOLLIN) == 0 && read(pipe_fds[0], &c, 1) == 1 &&
+        c == 'x') {
+        atomic_fetch_add(&woken, 1);
+    }
+}
+
+static void other(void *arg)
+{
+    (void) arg;
+    aesd_coro_yield();
+    atomic_fetch_add(&others_ran, 1);
+}
+
+void test_coro_wait_fd_pipe()
+{
+    TEST_ASSERT_EQUAL_INT(0, pipe(pipe_fds));
+    atomic_store(&parked, 0);
+    atomic_store(&woken, 0);
+    atomic_store(&others_ran, 0);
+    sched = aesd_coro_create(1, 0);
+    TEST_ASSERT_NOT_NULL(sched);
+    TEST_ASSERT_EQUAL_INT(0, aesd_coro_spawn(sched, pipe_reader, NULL));
+    TEST_ASSERT_TRUE(wait_for(&parked, 1));
+
+    // the loop runs other coroutines while the reader is parked
+    TEST_ASSERT_EQUAL_INT(0, aesd_coro_spawn(sched, other, NULL));
+    TEST_ASSERT_TRUE_MESSAGE(wait_for(&others_ran, 1), "a parked coroutine blocked its loop");
+    usleep(20000);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, atomic_load(&woken), "woken before the pipe was readable");
+
+    TEST_ASSERT_EQUAL_INT(1, (int) write(pipe_fds[1], "x", 1));
+    TEST_ASSERT_TRUE_MESSAGE(wait_for(&woken, 1), "not woken when the pipe became readable");
+    aesd_coro_destroy(sched);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+}
+
+static void lock_waiter(void *arg)
+{
+    int round;
+
+    for (round = 0; round < 2; round++) {
+        aesd_coro_mutex_lock(&mutex);
+        record(*(const char *) arg);
+        // held across a yield, no other waiter may get in meanwhile
+        aesd_coro_yield();
+        aesd_coro_mutex_unlock(&mutex);
+    }
+}
+
+static void lock_holder(void *arg)
+{
+    static const char names[] = "123";
+    int i;
+
+    (void) arg;
+    aesd_coro_mutex_lock(&mutex);
+    for (i = 0; i < NWAITERS; i++) {
+        aesd_coro_spawn(sched, lock_waiter, (void *) &names[i]);
+    }
+    // the waiters run and queue on the mutex in order
+    aesd_coro_yield();
+    aesd_coro_mutex_unlock(&mutex);
+}
+
+void test_coro_mutex_fifo()
+{
+    aesd_coro_mutex_init(&mutex);
+    sched = aesd_coro_create(1, 0);
+    TEST_ASSERT_NOT_NULL(sched);
+    norder = 0;
+    memset(order, 0, sizeof(order));
+    TEST_ASSERT_EQUAL_INT(0, aesd_coro_spawn(sched, lock_holder, NULL));
+    TEST_ASSERT_TRUE(wait_idle());
+    aesd_coro_destroy(sched);
+    // a waiter relocking at once goes behind the others
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("123123", order,
+                                     "the mutex was not handed over in FIFO order");
+
+    // and it still works as a plain mutex outside coroutines
+    aesd_coro_mutex_lock(&mutex);
+    aesd_coro_mutex_unlock(&mutex);
+}
+
+static void canceled_waiter(void *arg)
+{
+    int i = (int) (long) arg;
+
+    atomic_fetch_add(&parked, 1);
+    wait_rc[i] = aesd_coro_wait_fd(pipe_fds[0], EPOLLIN);
+    wait_errno[i] = errno;
+    // the scheduler is stopping, a new wait fails at once
+    if (aesd_coro_wait_fd(pipe_fds[0], EPOLLIN) == -1 && errno == ECANCELED) {
+        atomic_fetch_add(&woken, 1);
+    }
+}
+
+void test_coro_destroy_cancels_waiters()
+{
+    long i;
+
+    TEST_ASSERT_EQUAL_INT(0, pipe(pipe_fds));
+    atomic_store(&parked, 0);
+    atomic_store(&woken, 0);
+    // on two loops, parked on a pipe never written
+    sched = aesd_coro_create(2, 0);
+    TEST_ASSERT_NOT_NULL(sched);
+    for (i = 0; i < NWAITERS; i++) {
+        wait_rc[i] = 0;
+        wait_errno[i] = 0;
+        TEST_ASSERT_EQUAL_INT(0, aesd_coro_spawn(sched, canceled_waiter, (void *) i));
+    }
+    TEST_ASSERT_TRUE(wait_for(&parked, NWAITERS));
+    usleep(20000);
+    TEST_ASSERT_EQUAL_INT(NWAITERS, (int) aesd_coro_count(sched));
+
+    aesd_coro_destroy(sched);
+    for (i = 0; i < NWAITERS; i++) {
+        TEST_ASSERT_EQUAL_INT_MESSAGE(-1, wait_rc[i], "a parked waiter was not woken by destroy");
+        TEST_ASSERT_EQUAL_INT(ECANCELED, wait_errno[i]);
+    }
+    TEST_ASSERT_EQUAL_INT(NWAITERS, atomic_load(&woken));
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+}
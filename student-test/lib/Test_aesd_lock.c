@@ -0,0 +1,127 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "../../lib/aesd-lock.h"
+
+#define NTHREADS (4)
+#define ROUNDS (20000)
+
+static struct aesd_lock nested[AESD_LOCK_MCS_MAX_NESTING + 1];
+static long shared_count;
+
+/*
+ * @brief  takes the first depth locks of nested in order, every other one
+ *         with tryacquire, then releases them in reverse
+ * @return true if each was taken
+ */
+static bool nest(int depth)
+{
+    bool taken = true;
+    int i;
+
+    for (i = 0; i < depth; i++) {
+        if (i % 2) {
+            taken = aesd_lock_tryacquire(&nested[i]) && taken;
+        } else {
+            aesd_lock_acquire(&nested[i]);
+        }
+    }
+    shared_count++;
+    for (i = depth - 1; i >= 0; i--) {
+        aesd_lock_release(&nested[i]);
+    }
+    return taken;
+}
+
+static void *nest_thread(void *arg)
+{
+    int round;
+
+    for (round = 0; round < ROUNDS; round++) {
+        aesd_lock_acquire(&nested[0]);
+        aesd_lock_acquire(&nested[1]);
+        aesd_lock_acquire(&nested[2]);
+        aesd_lock_acquire(&nested[3]);
+        shared_count++;
+        aesd_lock_release(&nested[3]);
+        aesd_lock_release(&nested[2]);
+        aesd_lock_release(&nested[1]);
+        aesd_lock_release(&nested[0]);
+    }
+    return NULL;
+}
+
+static void init_nested(void)
+{
+    int i;
+
+    for (i = 0; i < AESD_LOCK_MCS_MAX_NESTING + 1; i++) {
+        TEST_ASSERT_EQUAL_INT(0, aesd_lock_init(&nested[i], AESD_LOCK_MCS));
+    }
+}
+
+static void destroy_nested(void)
+{
+    int i;
+
+    for (i = 0; i < AESD_LOCK_MCS_MAX_NESTING + 1; i++) {
+        aesd_lock_destroy(&nested[i]);
+    }
+}
+
+void test_lock_mcs_nesting_up_to_limit()
+{
+    int depth;
+
+    init_nested();
+    shared_count = 0;
+    // the nodes are given back, the limit holds at every depth again and again
+    for (depth = 1; depth <= AESD_LOCK_MCS_MAX_NESTING; depth++) {
+        TEST_ASSERT_TRUE_MESSAGE(nest(depth), "a free nested lock could not be taken");
+        TEST_ASSERT_TRUE(nest(depth));
+    }
+    TEST_ASSERT_EQUAL_INT(2 * AESD_LOCK_MCS_MAX_NESTING, (int) shared_count);
+    destroy_nested();
+}
+
+void test_lock_mcs_nested_contended()
+{
+    pthread_t threads[NTHREADS];
+    int i;
+
+    TEST_ASSERT_TRUE(AESD_LOCK_MCS_MAX_NESTING >= 4);
+    init_nested();
+    shared_count = 0;
+    for (i = 0; i < NTHREADS; i++) {
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, nest_thread, NULL));
+    }
+    for (i = 0; i < NTHREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    TEST_ASSERT_EQUAL_INT_MESSAGE(NTHREADS * ROUNDS, (int) shared_count,
+                                  "updates under the nested locks were lost");
+    destroy_nested();
+}
+
+void test_lock_mcs_past_limit_aborts()
+{
+    pid_t pid;
+    int status;
+
+    init_nested();
+    // in a child, whose abort the test expects
+    pid = fork();
+    TEST_ASSERT_TRUE(pid != -1);
+    if (pid == 0) {
+        nest(AESD_LOCK_MCS_MAX_NESTING + 1);
+        _exit(0);
+    }
+    TEST_ASSERT_TRUE(waitpid(pid, &status, 0) == pid);
+    TEST_ASSERT_TRUE_MESSAGE(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT,
+                             "one MCS lock past the limit did not abort");
+    destroy_nested();
+}
@@ -0,0 +1,203 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../lib/aesd-lz.h"
+
+/**
+* Blocks are compressed into and decompressed from buffers of exactly the
+* size they need, so under -fsanitize=address a read or write past either
+* end is reported.
+*/
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t xorshift64(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/*
+ * @brief  compresses len bytes of src, checks the block fits the bound and
+ *         decompresses back to src
+ * @return the compressed size
+ */
+static size_t round_trip(const char *src, size_t len)
+{
+    size_t bound = aesd_lz_bound(len);
+    char *block = malloc(bound);
+    char *out = malloc(len ? len : 1);
+    size_t clen;
+    ssize_t dlen;
+
+    TEST_ASSERT_NOT_NULL(block);
+    TEST_ASSERT_NOT_NULL(out);
+    clen = aesd_lz_compress(src, len, block, bound);
+    TEST_ASSERT_TRUE_MESSAGE(clen > 0, "a block within the bound did not fit");
+    TEST_ASSERT_TRUE_MESSAGE(clen <= bound, "a block is larger than its bound");
+    dlen = aesd_lz_decompress(block, clen, out, len);
+    TEST_ASSERT_EQUAL_INT_MESSAGE((int) len, (int) dlen, "decompressed to another size");
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(src, out, len, "decompressed to other bytes");
+    free(block);
+    free(out);
+    return clen;
+}
+
+void test_lz_empty()
+{
+    char src[1] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(1, (int) round_trip(src, 0));
+}
+
+void test_lz_short_inputs()
+{
+    const char *text = "timestamp:Sun, 18 Oct 2026 20:05:27 +0000\n";
+    size_t len;
+
+    // every length around the minimum match and the last literals
+    for (len = 1; len <= strlen(text); len++) {
+        round_trip(text, len);
+    }
+}
+
+void test_lz_incompressible()
+{
+    char *src = malloc(AESD_LZ_MAX_INPUT);
+    size_t i;
+
+    TEST_ASSERT_NOT_NULL(src);
+    for (i = 0; i < AESD_LZ_MAX_INPUT; i++) {
+        src[i] = (char) xorshift64();
+    }
+    TEST_ASSERT_TRUE(round_trip(src, AESD_LZ_MAX_INPUT) >= AESD_LZ_MAX_INPUT);
+    free(src);
+}
+
+void test_lz_long_matches()
+{
+    char *src = malloc(AESD_LZ_MAX_INPUT);
+    size_t len = 0;
+    unsigned long i;
+
+    TEST_ASSERT_NOT_NULL(src);
+    // a run, one match overlapping itself at offset 1
+    memset(src, 'a', AESD_LZ_MAX_INPUT);
+    TEST_ASSERT_TRUE(round_trip(src, AESD_LZ_MAX_INPUT) < 512);
+
+    // the log, repeated lines a few bytes apart
+    for (i = 0; len + 64 < AESD_LZ_MAX_INPUT; i++) {
+        len += snprintf(src + len, 64, (i % 8) ? "packet %lu\n"
+                        : "timestamp:Sun, 18 Oct 2026 20:05:27 +0000\n", i);
+    }
+    TEST_ASSERT_TRUE(round_trip(src, len) < len / 2);
+    free(src);
+}
+
+void test_lz_overlapping_copy()
+{
+    // "ab" then a match of 10 at offset 2, it copies bytes it produces
+    const char block[] = { 0x26, 'a', 'b', 2, 0 };
+    char out[12];
+
+    TEST_ASSERT_EQUAL_INT(12, (int) aesd_lz_decompress(block, sizeof(block), out, sizeof(out)));
+    TEST_ASSERT_EQUAL_MEMORY("abababababab", out, 12);
+}
+
+void test_lz_limits()
+{
+    char *src = calloc(1, AESD_LZ_MAX_INPUT + 1);
+    size_t bound = aesd_lz_bound(AESD_LZ_MAX_INPUT + 1);
+    char *block = malloc(bound);
+
+    TEST_ASSERT_NOT_NULL(src);
+    TEST_ASSERT_NOT_NULL(block);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, (int) aesd_lz_compress(src, AESD_LZ_MAX_INPUT + 1,
+                                                            block, bound),
+                                  "compressed a block larger than the window");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, (int) aesd_lz_compress(src, 1024, block, 4),
+                                  "compressed into too small a buffer");
+    free(src);
+    free(block);
+}
+
+void test_lz_corrupt_blocks()
+{
+    char out[64];
+    // a match before the start of the output
+    const char far[] = { 0x10, 'a', 2, 0 };
+    // a match at offset 0
+    const char zero[] = { 0x10, 'a', 0, 0 };
+    // more literals than the block holds
+    const char literals[] = { 0x50, 'a', 'b' };
+    // a length continuing past the end
+    const char length[] = { 0xf0, 255 };
+    // an offset cut short
+    const char offset[] = { 0x10, 'a', 1 };
+
+    TEST_ASSERT_EQUAL_INT(-1, (int) aesd_lz_decompress(far, sizeof(far), out, sizeof(out)));
+    TEST_ASSERT_EQUAL_INT(-1, (int) aesd_lz_decompress(zero, sizeof(zero), out, sizeof(out)));
+    TEST_ASSERT_EQUAL_INT(-1, (int) aesd_lz_decompress(literals, sizeof(literals), out,
+                                                       sizeof(out)));
+    TEST_ASSERT_EQUAL_INT(-1, (int) aesd_lz_decompress(length, sizeof(length), out,
+                                                       sizeof(out)));
+    TEST_ASSERT_EQUAL_INT(-1, (int) aesd_lz_decompress(offset, sizeof(offset), out,
+                                                       sizeof(out)));
+}
+
+void test_lz_truncated_and_damaged()
+{
+    char src[4096];
+    size_t bound = aesd_lz_bound(sizeof(src));
+    char *block = malloc(bound);
+    char *out = malloc(sizeof(src));
+    size_t len = 0;
+    size_t clen;
+    size_t cut;
+    char *part;
+    ssize_t dlen;
+    int i;
+
+    TEST_ASSERT_NOT_NULL(block);
+    TEST_ASSERT_NOT_NULL(out);
+    for (i = 0; len + 64 < sizeof(src); i++) {
+        len += snprintf(src + len, 64, "record %d of the log\n", i % 37);
+    }
+    clen = aesd_lz_compress(src, len, block, bound);
+    TEST_ASSERT_TRUE(clen > 0);
+
+    // a cut block decodes to a prefix at most, ending at a whole sequence
+    for (cut = 0; cut < clen; cut++) {
+        part = malloc(cut ? cut : 1);
+        TEST_ASSERT_NOT_NULL(part);
+        memcpy(part, block, cut);
+        dlen = aesd_lz_decompress(part, cut, out, len);
+        TEST_ASSERT_TRUE_MESSAGE(dlen == -1 || (size_t) dlen < len,
+                                 "a truncated block decoded whole");
+        if (dlen > 0) {
+            TEST_ASSERT_EQUAL_MEMORY_MESSAGE(src, out, dlen, "a truncated block decoded wrong");
+        }
+        free(part);
+    }
+
+    // a smaller output buffer than the block needs
+    TEST_ASSERT_EQUAL_INT(-1, (int) aesd_lz_decompress(block, clen, out, len - 1));
+
+    // damaged bytes may decode to anything, but within the output buffer
+    for (i = 0; i < 20000; i++) {
+        part = malloc(clen);
+        TEST_ASSERT_NOT_NULL(part);
+        memcpy(part, block, clen);
+        part[xorshift64() % clen] ^= (char) (1 + xorshift64() % 255);
+        dlen = aesd_lz_decompress(part, clen, out, len);
+        TEST_ASSERT_TRUE(dlen >= -1 && dlen <= (ssize_t) len);
+        free(part);
+    }
+    free(block);
+    free(out);
+}
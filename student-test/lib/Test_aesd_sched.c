@@ -0,0 +1,125 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "../../lib/aesd-sched.h"
+
+/**
+* Task groups live on the stack of the thread waiting on them, so once
+* aesd_task_group_wait() returns nothing may touch the group again.  Each
+* wait below is followed by poisoning the group and checking the poison
+* stays, a late write by the last task to complete shows up as a changed
+* byte.  Under -fsanitize=address with
+* ASAN_OPTIONS=detect_stack_use_after_return=1 the late access is reported
+* directly.
+*/
+
+#define STRESS_ROUNDS (20000)
+#define POISON (0x5a)
+
+static struct aesd_sched *sched;
+static atomic_long tasks_run;
+
+static void count_task(void *arg)
+{
+    atomic_fetch_add(&tasks_run, 1);
+}
+
+/*
+ * @brief  waits on a group of ntasks on this frame, then checks nothing
+ *         writes to it after the wait returned
+ * @return true if the group was left alone
+ */
+static bool wait_stack_group(int ntasks)
+{
+    struct aesd_task_group group;
+    unsigned char *bytes = (unsigned char *) &group;
+    bool intact = true;
+    size_t i;
+    int spin;
+
+    aesd_task_group_init(&group);
+    for (i = 0; i < (size_t) ntasks; i++) {
+        if (aesd_sched_submit(sched, &group, count_task, NULL) != 0) {
+            return false;
+        }
+    }
+    aesd_task_group_wait(sched, &group);
+    memset(&group, POISON, sizeof(group));
+    for (spin = 0; spin < 64 && intact; spin++) {
+        for (i = 0; i < sizeof(group); i++) {
+            intact = intact && ((volatile unsigned char *) bytes)[i] == POISON;
+        }
+    }
+    return intact;
+}
+
+static atomic_long tree_damaged;
+
+// the worker side, a task waiting on its subtasks spins instead of sleeping
+static void tree_task(void *arg)
+{
+    long depth = (long) (intptr_t) arg;
+    struct aesd_task_group group;
+    unsigned char *bytes = (unsigned char *) &group;
+    size_t i;
+
+    atomic_fetch_add(&tasks_run, 1);
+    if (depth <= 0) {
+        return;
+    }
+    aesd_task_group_init(&group);
+    aesd_sched_submit(sched, &group, tree_task, (void *) (intptr_t) (depth - 1));
+    aesd_sched_submit(sched, &group, tree_task, (void *) (intptr_t) (depth - 1));
+    aesd_task_group_wait(sched, &group);
+    memset(&group, POISON, sizeof(group));
+    for (i = 0; i < sizeof(group); i++) {
+        if (((volatile unsigned char *) bytes)[i] != POISON) {
+            atomic_fetch_add(&tree_damaged, 1);
+            break;
+        }
+    }
+}
+
+void test_sched_stack_group_waits()
+{
+    long expected = 0;
+    int round;
+    bool intact = true;
+
+    sched = aesd_sched_create(4);
+    TEST_ASSERT_NOT_NULL_MESSAGE(sched, "could not start the scheduler");
+    atomic_store(&tasks_run, 0);
+    for (round = 0; round < STRESS_ROUNDS && intact; round++) {
+        intact = wait_stack_group(1 + round % 3);
+        expected += 1 + round % 3;
+        TEST_ASSERT_EQUAL_INT_MESSAGE(expected, atomic_load(&tasks_run),
+                                      "a wait returned before its tasks ran");
+    }
+    aesd_sched_destroy(sched);
+    TEST_ASSERT_TRUE_MESSAGE(intact, "a task group was written after its wait returned");
+}
+
+void test_sched_stack_group_waits_in_tasks()
+{
+    struct aesd_task_group group;
+    long depth = 12;
+    int round;
+
+    sched = aesd_sched_create(4);
+    TEST_ASSERT_NOT_NULL_MESSAGE(sched, "could not start the scheduler");
+    atomic_store(&tree_damaged, 0);
+    for (round = 0; round < 8; round++) {
+        atomic_store(&tasks_run, 0);
+        aesd_task_group_init(&group);
+        aesd_sched_submit(sched, &group, tree_task, (void *) (intptr_t) depth);
+        aesd_task_group_wait(sched, &group);
+        TEST_ASSERT_EQUAL_INT_MESSAGE((2L << depth) - 1, atomic_load(&tasks_run),
+                                      "a wait returned before its subtasks ran");
+    }
+    aesd_sched_destroy(sched);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, atomic_load(&tree_damaged),
+                                  "a task group was written after its wait returned");
+}
@@ -0,0 +1,154 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include "../../lib/aesd-topk.h"
+
+#define NHEAVY (5)
+#define NLIGHT (5000)
+
+// too large for the stack, zeroed so it starts empty
+static struct aesd_topk topk;
+
+static const uint64_t heavy_totals[NHEAVY] = { 100000, 50000, 20000, 10000, 5000 };
+
+static struct aesd_topk_key key_v4(uint32_t addr)
+{
+    struct sockaddr_in sin;
+    struct aesd_topk_key key;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(40000 + addr % 1000);
+    sin.sin_addr.s_addr = htonl(addr);
+    TEST_ASSERT_EQUAL_INT(0, aesd_topk_key_from_addr((struct sockaddr *) &sin, &key));
+    return key;
+}
+
+/*
+ * @return the true total of the client at addr in test_topk_heavy_hitters()
+ */
+static uint64_t true_total(uint32_t addr)
+{
+    if (addr >= 0xc0a80001 && addr < 0xc0a80001 + NHEAVY) {
+        return heavy_totals[addr - 0xc0a80001];
+    }
+    return 1 + addr % 3;
+}
+
+void test_topk_heavy_hitters()
+{
+    struct aesd_topk_entry entries[AESD_TOPK_SLOTS];
+    struct aesd_topk_key key;
+    uint64_t grand_total = 0;
+    uint64_t sent[NHEAVY] = { 0 };
+    uint32_t addr;
+    size_t n;
+    int round;
+    int i;
+
+    memset(&topk, 0, sizeof(topk));
+    // the heavy clients 192.168.0.1 to .5 arrive in steps among the light
+    // ones 10.0.0.0 onwards, so the slots see them all along
+    for (round = 0; round < 100; round++) {
+        for (addr = 0x0a000000 + round * (NLIGHT / 100);
+             addr < 0x0a000000 + (round + 1) * (NLIGHT / 100); addr++) {
+            key = key_v4(addr);
+            aesd_topk_add(&topk, &key, true_total(addr));
+            grand_total += true_total(addr);
+        }
+        for (i = 0; i < NHEAVY; i++) {
+            key = key_v4(0xc0a80001 + i);
+            aesd_topk_add(&topk, &key, heavy_totals[i] / 100);
+            sent[i] += heavy_totals[i] / 100;
+            grand_total += heavy_totals[i] / 100;
+        }
+    }
+    for (i = 0; i < NHEAVY; i++) {
+        TEST_ASSERT_EQUAL_UINT64(heavy_totals[i], sent[i]);
+    }
+
+    n = aesd_topk_get(&topk, entries, AESD_TOPK_SLOTS);
+    TEST_ASSERT_TRUE_MESSAGE(n >= NHEAVY, "fewer clients than the heavy ones");
+    for (i = 0; i < NHEAVY; i++) {
+        key = key_v4(0xc0a80001 + i);
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(&key, &entries[i].key, sizeof(key),
+                                         "the heavy clients are not first, largest first");
+    }
+    for (i = 0; i < (int) n; i++) {
+        if (i > 0) {
+            TEST_ASSERT_TRUE_MESSAGE(entries[i - 1].count >= entries[i].count,
+                                     "entries are not largest first");
+        }
+        // the IPv4 address ends the mapped one
+        memcpy(&addr, (const uint8_t *) entries[i].key.w + 12, sizeof(addr));
+        addr = ntohl(addr);
+        TEST_ASSERT_TRUE_MESSAGE(entries[i].count >= true_total(addr),
+                                 "an estimate is below the true total");
+    }
+    // the error bound of the sketch, e / width of the grand total
+    for (i = 0; i < NHEAVY; i++) {
+        TEST_ASSERT_TRUE_MESSAGE(entries[i].count <=
+                                 heavy_totals[i] + 3 * grand_total / AESD_TOPK_WIDTH,
+                                 "an estimate is far above the true total");
+    }
+}
+
+void test_topk_get_limits()
+{
+    struct aesd_topk_entry entries[2];
+    struct aesd_topk_key key;
+
+    memset(&topk, 0, sizeof(topk));
+    TEST_ASSERT_EQUAL_INT(0, (int) aesd_topk_get(&topk, entries, 2));
+    key = key_v4(0x7f000001);
+    aesd_topk_add(&topk, &key, 7);
+    key = key_v4(0x7f000002);
+    aesd_topk_add(&topk, &key, 9);
+    key = key_v4(0x7f000003);
+    aesd_topk_add(&topk, &key, 3);
+    TEST_ASSERT_EQUAL_INT(2, (int) aesd_topk_get(&topk, entries, 2));
+    TEST_ASSERT_EQUAL_UINT64(9, entries[0].count);
+    TEST_ASSERT_EQUAL_UINT64(7, entries[1].count);
+}
+
+void test_topk_keys()
+{
+    struct sockaddr_in sin;
+    struct sockaddr_in6 sin6;
+    struct sockaddr_un sun;
+    struct aesd_topk_key v4;
+    struct aesd_topk_key v4_other_port;
+    struct aesd_topk_key v6;
+    char name[INET6_ADDRSTRLEN];
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(1234);
+    inet_pton(AF_INET, "10.1.2.3", &sin.sin_addr);
+    TEST_ASSERT_EQUAL_INT(0, aesd_topk_key_from_addr((struct sockaddr *) &sin, &v4));
+    TEST_ASSERT_EQUAL_STRING("10.1.2.3", aesd_topk_key_name(&v4, name, sizeof(name)));
+    sin.sin_port = htons(4321);
+    TEST_ASSERT_EQUAL_INT(0, aesd_topk_key_from_addr((struct sockaddr *) &sin,
+                                                     &v4_other_port));
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE(&v4, &v4_other_port, sizeof(v4),
+                                     "the port is part of the key");
+
+    // the same client over IPv6, mapped
+    memset(&sin6, 0, sizeof(sin6));
+    sin6.sin6_family = AF_INET6;
+    inet_pton(AF_INET6, "::ffff:10.1.2.3", &sin6.sin6_addr);
+    TEST_ASSERT_EQUAL_INT(0, aesd_topk_key_from_addr((struct sockaddr *) &sin6, &v6));
+    TEST_ASSERT_EQUAL_MEMORY(&v4, &v6, sizeof(v4));
+    inet_pton(AF_INET6, "2001:db8::1", &sin6.sin6_addr);
+    TEST_ASSERT_EQUAL_INT(0, aesd_topk_key_from_addr((struct sockaddr *) &sin6, &v6));
+    TEST_ASSERT_EQUAL_STRING("2001:db8::1", aesd_topk_key_name(&v6, name, sizeof(name)));
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    TEST_ASSERT_EQUAL_INT(-1, aesd_topk_key_from_addr((struct sockaddr *) &sun, &v6));
+}
@@ -0,0 +1,219 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../../lib/aesd-trace.h"
+
+#define NCHILDREN (3)
+
+static char path[] = "/tmp/aesd-trace-testXXXXXX";
+
+static void make_path(void)
+{
+    int fd;
+
+    strcpy(path, "/tmp/aesd-trace-testXXXXXX");
+    fd = mkstemp(path);
+    TEST_ASSERT_TRUE_MESSAGE(fd != -1, "could not create a temporary file");
+    close(fd);
+}
+
+/*
+ * @brief  writes len bytes of data as the trace file
+ */
+static void write_trace(const uint8_t *data, size_t len)
+{
+    int fd = open(path, O_WRONLY | O_TRUNC);
+
+    TEST_ASSERT_TRUE(fd != -1);
+    TEST_ASSERT_TRUE(write(fd, AESD_TRACE_MAGIC, strlen(AESD_TRACE_MAGIC)) ==
+                     (ssize_t) strlen(AESD_TRACE_MAGIC));
+    TEST_ASSERT_TRUE(write(fd, data, len) == (ssize_t) len);
+    close(fd);
+}
+
+void test_trace_round_trip()
+{
+    struct aesd_trace *trace;
+    struct aesd_trace_event *events = NULL;
+    size_t nevents = 0;
+    size_t nconns = 0;
+    uint64_t a;
+    uint64_t b;
+
+    make_path();
+    trace = aesd_trace_open(path);
+    TEST_ASSERT_NOT_NULL(trace);
+    a = aesd_trace_connection(trace);
+    b = aesd_trace_connection(trace);
+    TEST_ASSERT_TRUE(a != b);
+    aesd_trace_record(trace, AESD_TRACE_OPEN, a, 1000, 0);
+    aesd_trace_record(trace, AESD_TRACE_OPEN, b, 1500, 0);
+    aesd_trace_record(trace, AESD_TRACE_HELLO, a, 1600, AESD_TRACE_FRAMED_LZ4);
+    aesd_trace_record(trace, AESD_TRACE_PACKET, a, 2000, 300);
+    // taken before the mutex, a time may step back a little
+    aesd_trace_record(trace, AESD_TRACE_PACKET, b, 1900, 70000);
+    aesd_trace_record(trace, AESD_TRACE_REPLY, a, 5000000, 1ULL << 40);
+    aesd_trace_record(trace, AESD_TRACE_CLOSE, b, 5000001, 0);
+    aesd_trace_record(trace, AESD_TRACE_CLOSE, a, 5000001, 0);
+    aesd_trace_record(NULL, AESD_TRACE_CLOSE, a, 5000001, 0);
+    aesd_trace_close(trace);
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_trace_load(path, &events, &nevents, &nconns));
+    TEST_ASSERT_EQUAL_INT(8, (int) nevents);
+    TEST_ASSERT_EQUAL_INT(2, (int) nconns);
+    // sorted by time from the first event, equal times in recorded order
+    TEST_ASSERT_EQUAL_UINT64(0, events[0].time_us);
+    TEST_ASSERT_EQUAL_INT(AESD_TRACE_OPEN, events[0].type);
+    TEST_ASSERT_EQUAL_UINT64(a - 1, events[0].conn);
+    TEST_ASSERT_EQUAL_UINT64(500, events[1].time_us);
+    TEST_ASSERT_EQUAL_UINT64(b - 1, events[1].conn);
+    TEST_ASSERT_EQUAL_INT(AESD_TRACE_HELLO, events[2].type);
+    TEST_ASSERT_EQUAL_UINT64(AESD_TRACE_FRAMED_LZ4, events[2].value);
+    TEST_ASSERT_EQUAL_UINT64(900, events[3].time_us);
+    TEST_ASSERT_EQUAL_UINT64(70000, events[3].value);
+    TEST_ASSERT_EQUAL_UINT64(1000, events[4].time_us);
+    TEST_ASSERT_EQUAL_UINT64(300, events[4].value);
+    TEST_ASSERT_EQUAL_INT(AESD_TRACE_REPLY, events[5].type);
+    TEST_ASSERT_EQUAL_UINT64(1ULL << 40, events[5].value);
+    TEST_ASSERT_EQUAL_UINT64(b - 1, events[6].conn);
+    TEST_ASSERT_EQUAL_UINT64(a - 1, events[7].conn);
+    TEST_ASSERT_EQUAL_UINT64(4999001, events[7].time_us);
+    free(events);
+    unlink(path);
+}
+
+void test_trace_forked_processes()
+{
+    struct aesd_trace *trace;
+    struct aesd_trace_event *events = NULL;
+    size_t nevents = 0;
+    size_t nconns = 0;
+    bool seen[1 + NCHILDREN] = { false };
+    pid_t pid;
+    int status;
+    int i;
+
+    make_path();
+    trace = aesd_trace_open(path);
+    TEST_ASSERT_NOT_NULL(trace);
+    // each process numbers its connections from 1, like the workers of -P
+    for (i = 0; i < NCHILDREN; i++) {
+        pid = fork();
+        TEST_ASSERT_TRUE(pid != -1);
+        if (pid == 0) {
+            uint64_t conn = aesd_trace_connection(trace);
+            aesd_trace_record(trace, AESD_TRACE_OPEN, conn, 100 + i, 0);
+            aesd_trace_record(trace, AESD_TRACE_PACKET, conn, 200 + i, 10 + i);
+            aesd_trace_record(trace, AESD_TRACE_CLOSE, conn, 300 + i, 0);
+            aesd_trace_close(trace);
+            _exit(0);
+        }
+        TEST_ASSERT_TRUE(waitpid(pid, &status, 0) == pid);
+        TEST_ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    aesd_trace_record(trace, AESD_TRACE_OPEN, aesd_trace_connection(trace), 50, 0);
+    aesd_trace_close(trace);
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_trace_load(path, &events, &nevents, &nconns));
+    TEST_ASSERT_EQUAL_INT(1 + 3 * NCHILDREN, (int) nevents);
+    TEST_ASSERT_EQUAL_INT(1 + NCHILDREN, (int) nconns);
+    for (i = 0; i < (int) nevents; i++) {
+        TEST_ASSERT_TRUE(events[i].conn < nconns);
+        seen[events[i].conn] = true;
+    }
+    for (i = 0; i < 1 + NCHILDREN; i++) {
+        TEST_ASSERT_TRUE_MESSAGE(seen[i], "the connections of the processes are not dense");
+    }
+    free(events);
+    unlink(path);
+}
+
+void test_trace_reused_pid()
+{
+    // three blocks of pid 100: started at 5, at 9 after a respawn, and the
+    // first process again.  Each opens its connection 1
+    const uint8_t blocks[] = {
+        0, 100, 5, 5,  AESD_TRACE_OPEN, 1, 0, 0,
+        0, 100, 9, 9,  AESD_TRACE_OPEN, 1, 0, 0,
+        0, 100, 5, 20, AESD_TRACE_CLOSE, 1, 0, 0,
+    };
+    struct aesd_trace_event *events = NULL;
+    size_t nevents = 0;
+    size_t nconns = 0;
+
+    make_path();
+    write_trace(blocks, sizeof(blocks));
+    TEST_ASSERT_EQUAL_INT(0, aesd_trace_load(path, &events, &nevents, &nconns));
+    TEST_ASSERT_EQUAL_INT(3, (int) nevents);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(2, (int) nconns, "a reused pid merged two processes");
+    TEST_ASSERT_EQUAL_UINT64(events[0].conn, events[2].conn);
+    TEST_ASSERT_TRUE(events[0].conn != events[1].conn);
+    TEST_ASSERT_EQUAL_UINT64(15, events[2].time_us);
+    free(events);
+    unlink(path);
+}
+
+void test_trace_truncated()
+{
+    struct aesd_trace *trace;
+    struct aesd_trace_event *events = NULL;
+    size_t nevents = 0;
+    size_t nconns = 0;
+    struct stat st;
+    uint64_t conn;
+    int i;
+
+    make_path();
+    trace = aesd_trace_open(path);
+    TEST_ASSERT_NOT_NULL(trace);
+    conn = aesd_trace_connection(trace);
+    // enough for a full block and part of the next
+    for (i = 0; i < 20000; i++) {
+        aesd_trace_record(trace, AESD_TRACE_PACKET, conn, 1000 + i * 1000, 1 + i);
+    }
+    aesd_trace_close(trace);
+    TEST_ASSERT_EQUAL_INT(0, aesd_trace_load(path, &events, &nevents, &nconns));
+    TEST_ASSERT_EQUAL_INT(20000, (int) nevents);
+    TEST_ASSERT_EQUAL_UINT64(20000, events[19999].value);
+    free(events);
+
+    // cut within the last event of the last block
+    TEST_ASSERT_EQUAL_INT(0, stat(path, &st));
+    TEST_ASSERT_EQUAL_INT(0, truncate(path, st.st_size - 1));
+    events = NULL;
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, aesd_trace_load(path, &events, &nevents, &nconns),
+                                  "a truncated trace loaded");
+    TEST_ASSERT_TRUE(events == NULL);
+
+    // cut within the magic
+    TEST_ASSERT_EQUAL_INT(0, truncate(path, 3));
+    TEST_ASSERT_EQUAL_INT(-1, aesd_trace_load(path, &events, &nevents, &nconns));
+    unlink(path);
+    TEST_ASSERT_EQUAL_INT(-1, aesd_trace_load(path, &events, &nevents, &nconns));
+}
+
+void test_trace_corrupt()
+{
+    // an event before any block, then one of an unknown type
+    const uint8_t no_block[] = { AESD_TRACE_OPEN, 1, 0, 0 };
+    const uint8_t bad_type[] = { 0, 100, 5, 5, AESD_TRACE_NUM_TYPES, 1, 0, 0 };
+    const uint8_t bad_conn[] = { 0, 100, 5, 5, AESD_TRACE_OPEN, 0, 0, 0 };
+    struct aesd_trace_event *events = NULL;
+    size_t nevents = 0;
+    size_t nconns = 0;
+
+    make_path();
+    write_trace(no_block, sizeof(no_block));
+    TEST_ASSERT_EQUAL_INT(-1, aesd_trace_load(path, &events, &nevents, &nconns));
+    write_trace(bad_type, sizeof(bad_type));
+    TEST_ASSERT_EQUAL_INT(-1, aesd_trace_load(path, &events, &nevents, &nconns));
+    write_trace(bad_conn, sizeof(bad_conn));
+    TEST_ASSERT_EQUAL_INT(-1, aesd_trace_load(path, &events, &nevents, &nconns));
+    unlink(path);
+}